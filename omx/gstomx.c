@@ -55,9 +55,12 @@
 #include "gstomx_filereadersrc.h"
 #include "gstomx_volume.h"
 #include "gstomx_camera.h"
+#include "gstomx_mccamera.h"
 #include "swcsc.h"
 #include "gstperf.h"
 #include "gstomx_scaler.h"
+#include "gstomx_mcscaler.h"
+#include "gstomx_mosaicsink.h"
 #include "gstomx_deiscaler.h"
 #include "gstomx_noisefilter.h"
 #include "gstomx_base_ctrl.h"
@@ -119,18 +122,21 @@ static TableItem element_table[] =
 //    { "omx_jpegdec",        "libOMX_Core.so",           "OMX.TI.DUCATI1.IMAGE.JPEGD",   NULL,                   GST_RANK_NONE,   gst_omx_jpegdec_get_type },
 //    { "omx_audiosink",      "libomxil-bellagio.so.0",   "OMX.st.alsa.alsasink",         NULL,                   GST_RANK_NONE,      gst_omx_audiosink_get_type },
     { "omx_videosink",      "libOMX_Core.so",   "OMX.TI.VPSSM3.VFDC",             NULL,              GST_RANK_NONE,      gst_omx_videosink_get_type },
+    { "omx_mosaicsink",     "libOMX_Core.so",   "OMX.TI.VPSSM3.VFDC",             NULL,              GST_RANK_NONE,      gst_omx_mosaicsink_get_type },
 //    { "omx_filereadersrc",  "libomxil-bellagio.so.0",   "OMX.st.audio_filereader",      NULL,                   GST_RANK_NONE,      gst_omx_filereadersrc_get_type },
 //    { "omx_volume",         "libomxil-bellagio.so.0",   "OMX.st.volume.component",      NULL,                   GST_RANK_NONE,      gst_omx_volume_get_type },
     { "swcsc",         "libOMX_Core.so",   NULL,      NULL,                   GST_RANK_NONE,      gst_swcsc_get_type },
     { "gstperf",         "libOMX_Core.so",   NULL,      NULL,                   GST_RANK_PRIMARY,      gst_perf_get_type },
     { "omxbufferalloc",         "libOMX_Core.so",   NULL,      NULL,                   GST_RANK_PRIMARY,      gst_omx_buffer_alloc_get_type },
     { "omx_scaler",         "libOMX_Core.so",   "OMX.TI.VPSSM3.VFPC.INDTXSCWB",     NULL,                   GST_RANK_PRIMARY,      gst_omx_scaler_get_type },
+    { "omx_mcscaler",       "libOMX_Core.so",   "OMX.TI.VPSSM3.VFPC.INDTXSCWB",     NULL,                   GST_RANK_PRIMARY,      gst_omx_mcscaler_get_type },
     { "omx_mdeiscaler",         "libOMX_Core.so",   "OMX.TI.VPSSM3.VFPC.DEIMDUALOUT",     NULL,                   GST_RANK_PRIMARY,      gst_omx_mdeiscaler_get_type },
     { "omx_hdeiscaler",         "libOMX_Core.so",   "OMX.TI.VPSSM3.VFPC.DEIHDUALOUT",     NULL,                   GST_RANK_PRIMARY,      gst_omx_hdeiscaler_get_type },
     { "omx_noisefilter",         "libOMX_Core.so",   "OMX.TI.VPSSM3.VFPC.NF",     "",                   GST_RANK_PRIMARY,      gst_omx_noisefilter_get_type },
     { "omx_ctrl",         "libOMX_Core.so",   "OMX.TI.VPSSM3.CTRL.DC",     "",                   GST_RANK_NONE,      gst_omx_base_ctrl_get_type },
     { "omx_tvp",          "libOMX_Core.so",   "OMX.TI.VPSSM3.CTRL.TVP",     "",                  GST_RANK_PRIMARY,      gst_omx_tvp_get_type },
     { "omx_camera",         "libOMX_Core.so",           "OMX.TI.VPSSM3.VFCC",  NULL,                   GST_RANK_PRIMARY,   gst_omx_camera_get_type },
+    { "omx_mccamera",       "libOMX_Core.so",           "OMX.TI.VPSSM3.VFCC",  NULL,                   GST_RANK_PRIMARY,   gst_omx_mccamera_get_type },
     { "priority", NULL, NULL,  NULL, GST_RANK_PRIMARY, gst_tipriority_get_type },
     { "rr_h264parser", NULL, NULL,  NULL, GST_RANK_PRIMARY, gst_rrparser_get_type },
     { "omx_videomixer", 		"libOMX_Core.so",	"OMX.TI.VPSSM3.VFPC.INDTXSCWB", 	"", 				  GST_RANK_PRIMARY, 	 gst_omx_video_mixer_get_type },
@@ -22,7 +22,7 @@
 #include "gstomx_aacdec.h"
 #include "gstomx.h"
 
-#include <string.h> /* for memset */
+#include <string.h> /* for memset, strcmp */
 #ifdef USE_OMXTIAUDIODEC
 #  include <audio_decode/TIDspOmx.h>
 #endif
@@ -31,12 +31,44 @@ enum
 {
 	ARG_0,
 	ARG_FRAMEMODE,
+	ARG_NUM_INPUT_BUFFERS,
+	ARG_NUM_OUTPUT_BUFFERS,
+	ARG_INPUT_BUFFER_SIZE,
+	ARG_OUTPUT_BUFFER_SIZE,
+	ARG_FRAMES_PER_BUFFER,
+	ARG_BYTES_SKIPPED,
 };
 
 #define FRAMEMODE_DEFAULT FALSE
 
+/* Several frames in flight on each port instead of one round trip each */
+#define DEFAULT_NUM_BUFFERS 4
+/* Frames per input buffer when the component delimits them itself */
+#define DEFAULT_FRAMES_PER_BUFFER 4
+#define MAX_FRAMES_PER_BUFFER 16
+
+/* A raw AAC frame is at most 6144 bits per channel, ADTS adds up to 9 bytes */
+#define AAC_MAX_FRAME_SIZE(channels) (768 * (channels) + 9)
+#define AAC_FRAME_SAMPLES 1024
+
 GSTOMX_BOILERPLATE (GstOmxAacDec, gst_omx_aacdec, GstOmxBaseAudioDec, GST_OMX_BASE_AUDIODEC_TYPE);
 
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+static gboolean pad_event (GstPad *pad, GstEvent *event);
+
+typedef enum
+{
+	AAC_FRAMING_NONE,
+	AAC_FRAMING_ADTS,
+	AAC_FRAMING_LOAS,
+} AacFraming;
+
+/* Enough to read either header */
+#define AAC_HEADER_SIZE 9
+
+static const gint aac_rates[] = { 96000, 88200, 64000, 48000, 44100, 32000,
+	24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
 typedef enum
 {
 	AAC_PROFILE_LC = 2,
@@ -155,6 +187,21 @@ set_property (GObject *obj,
 		case ARG_FRAMEMODE:
 			self->framemode = g_value_get_boolean  (value);
 			break;
+		case ARG_NUM_INPUT_BUFFERS:
+			self->num_input_buffers = g_value_get_uint (value);
+			break;
+		case ARG_NUM_OUTPUT_BUFFERS:
+			self->num_output_buffers = g_value_get_uint (value);
+			break;
+		case ARG_INPUT_BUFFER_SIZE:
+			self->input_buffer_size = g_value_get_uint (value);
+			break;
+		case ARG_OUTPUT_BUFFER_SIZE:
+			self->output_buffer_size = g_value_get_uint (value);
+			break;
+		case ARG_FRAMES_PER_BUFFER:
+			self->frames_per_buffer = g_value_get_uint (value);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
 			break;
@@ -176,19 +223,57 @@ get_property (GObject *obj,
 		case ARG_FRAMEMODE:
 			g_value_set_boolean (value, self->framemode);
 			break;
+		case ARG_NUM_INPUT_BUFFERS:
+			g_value_set_uint (value, self->num_input_buffers ?
+					self->num_input_buffers : DEFAULT_NUM_BUFFERS);
+			break;
+		case ARG_NUM_OUTPUT_BUFFERS:
+			g_value_set_uint (value, self->num_output_buffers ?
+					self->num_output_buffers : DEFAULT_NUM_BUFFERS);
+			break;
+		case ARG_INPUT_BUFFER_SIZE:
+			g_value_set_uint (value, self->input_buffer_size);
+			break;
+		case ARG_OUTPUT_BUFFER_SIZE:
+			g_value_set_uint (value, self->output_buffer_size);
+			break;
+		case ARG_FRAMES_PER_BUFFER:
+			g_value_set_uint (value, self->frames_per_buffer);
+			break;
+		case ARG_BYTES_SKIPPED:
+			g_value_set_uint (value, self->bytes_skipped);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
 			break;
 	}
 }
 
+	static void
+finalize (GObject *obj)
+{
+	GstOmxAacDec *self;
+
+	self = GST_OMX_AACDEC (obj);
+
+	g_object_unref (self->adapter);
+
+	G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
 	static void
 type_class_init (gpointer g_class,
 		gpointer class_data)
 {
 	GObjectClass *gobject_class;
+	GstOmxBaseFilterClass *bclass;
 
 	gobject_class = G_OBJECT_CLASS (g_class);
+	bclass = GST_OMX_BASE_FILTER_CLASS (g_class);
+
+	gobject_class->finalize = finalize;
+	bclass->pad_chain = pad_chain;
+	bclass->pad_event = pad_event;
 
 	/* Properties stuff */
 	{
@@ -198,6 +283,30 @@ type_class_init (gpointer g_class,
 		g_object_class_install_property (gobject_class, ARG_FRAMEMODE,
 				g_param_spec_boolean ("framemode", "Frame Mode",
 					"Frame Mode", FRAMEMODE_DEFAULT, G_PARAM_READWRITE));
+
+		/* set up in omx_setup() rather than on the component right away */
+		g_object_class_override_property (gobject_class, ARG_NUM_INPUT_BUFFERS,
+				"input-buffers");
+		g_object_class_override_property (gobject_class, ARG_NUM_OUTPUT_BUFFERS,
+				"output-buffers");
+
+		g_object_class_install_property (gobject_class, ARG_INPUT_BUFFER_SIZE,
+				g_param_spec_uint ("input-buffer-size", "Input buffer size",
+					"Size of the OMX input buffers, 0 to fit frames-per-buffer frames",
+					0, G_MAXUINT, 0, G_PARAM_READWRITE));
+		g_object_class_install_property (gobject_class, ARG_OUTPUT_BUFFER_SIZE,
+				g_param_spec_uint ("output-buffer-size", "Output buffer size",
+					"Size of the OMX output buffers, 0 to fit the PCM of one input buffer",
+					0, G_MAXUINT, 0, G_PARAM_READWRITE));
+		g_object_class_install_property (gobject_class, ARG_FRAMES_PER_BUFFER,
+				g_param_spec_uint ("frames-per-buffer", "Frames per buffer",
+					"AAC frames packed in one input buffer when the stream is "
+					"self-delimiting (ADTS, not frame mode), 0 for the default",
+					0, MAX_FRAMES_PER_BUFFER, 0, G_PARAM_READWRITE));
+		g_object_class_install_property (gobject_class, ARG_BYTES_SKIPPED,
+				g_param_spec_uint ("bytes-skipped", "Bytes skipped",
+					"Bytes of unframed input skipped while resyncing",
+					0, G_MAXUINT, 0, G_PARAM_READABLE));
 	}
 }
 
@@ -227,13 +336,32 @@ sink_setcaps (GstPad *pad,
 	gst_structure_get_int (structure, "channels", &base_audiodec->channels);
 
 	self->aacversion = 2;
-	gst_structure_get_int (structure, "object_type", &self->aacversion);
+	self->caps_object_type = gst_structure_get_int (structure, "object_type",
+			&self->aacversion);
 
 	self->framed = gst_structure_has_field (structure, "framed");
+	{
+		const gchar *stream_format;
+
+		stream_format = gst_structure_get_string (structure, "stream-format");
+		if (stream_format && !strcmp (stream_format, "raw"))
+			self->framed = TRUE;
+	}
 
 	omx_base->in_port->caps = gst_caps_copy (caps);
 
+	/* without framing we find the frames ourselves, and the component
+	 * gets whole ones only */
+	self->parse = !self->framed;
 
+	/* frames are gathered into input buffers, see omx_setup() */
+	{
+		gboolean parsed = FALSE;
+
+		gst_structure_get_boolean (structure, "parsed", &parsed);
+		omx_base->pack_input = TRUE;
+		omx_base->input_aligned = self->framed || self->parse || parsed;
+	}
 
 	return gst_pad_set_caps (pad, caps);
 }
@@ -314,6 +442,43 @@ sink_getcaps (GstPad *pad)
 	return caps;
 }
 
+/* Raw frames carry no length, so the component can only take several per
+ * buffer from a self-delimiting stream it parses itself.
+ */
+	static guint
+get_frames_per_buffer (GstOmxAacDec *self)
+{
+	if (self->framed || self->framemode)
+	{
+		if (self->frames_per_buffer > 1)
+			GST_WARNING_OBJECT (self, "raw AAC frames go one per buffer");
+		return 1;
+	}
+
+	return self->frames_per_buffer ? self->frames_per_buffer :
+		DEFAULT_FRAMES_PER_BUFFER;
+}
+
+	static guint
+get_output_buffer_size (GstOmxAacDec *self, guint frames)
+{
+	GstOmxBaseAudioDec *base_audiodec = GST_OMX_BASE_AUDIODEC (self);
+	guint samples = AAC_FRAME_SAMPLES;
+	guint channels = base_audiodec->channels;
+
+	if (self->output_buffer_size)
+		return self->output_buffer_size;
+
+	/* SBR doubles the output rate, PS makes stereo out of mono */
+	if (self->aacversion == AAC_PROFILE_LC_SBR ||
+			self->aacversion == AAC_PROFILE_LC_SBR_PS)
+		samples *= 2;
+	if (self->aacversion == AAC_PROFILE_LC_SBR_PS)
+		channels = MAX (channels, 2);
+
+	return GST_ROUND_UP_32 (frames * samples * channels * 2);
+}
+
 	static void
 omx_setup (GstOmxBaseFilter *omx_base)
 {
@@ -328,11 +493,16 @@ omx_setup (GstOmxBaseFilter *omx_base)
 
 	OMX_U32 streamFormat;
 	gint profile;
+	guint frames;
 
 	gomx = (GOmxCore *) omx_base->gomx;
 
 	GST_DEBUG_OBJECT (omx_base, "Begin Set-Up");
 
+	frames = get_frames_per_buffer (self);
+	omx_base->in_port->pack_units = frames;
+	GST_INFO_OBJECT (omx_base, "%u frame(s) per input buffer", frames);
+
 	switch (self->aacversion)
 	{
 		case AAC_PROFILE_LC_SBR_PS:
@@ -353,6 +523,16 @@ omx_setup (GstOmxBaseFilter *omx_base)
 		streamFormat = OMX_AUDIO_AACStreamFormatRAW;
 		GST_DEBUG_OBJECT (omx_base, "Format: Raw");
 	}
+	else if (self->framing == AAC_FRAMING_ADTS)
+	{
+		streamFormat = OMX_AUDIO_AACStreamFormatMP4ADTS;
+		GST_DEBUG_OBJECT (omx_base, "Format: ADTS");
+	}
+	else if (self->framing == AAC_FRAMING_LOAS)
+	{
+		streamFormat = OMX_AUDIO_AACStreamFormatMP4LOAS;
+		GST_DEBUG_OBJECT (omx_base, "Format: LOAS");
+	}
 	else
 	{
 		streamFormat = OMX_AUDIO_AACStreamFormatMax;
@@ -371,7 +551,9 @@ omx_setup (GstOmxBaseFilter *omx_base)
 		OMX_AUDIO_PARAM_PCMMODETYPE param;
 		G_OMX_PORT_GET_PARAM (omx_base->out_port, OMX_IndexParamAudioPcm, &param);
 		param.nSamplingRate = base_audiodec->rate;
-		GST_DEBUG_OBJECT (omx_base, "PCM Sample Rate: %ld", param.nSamplingRate);
+		param.nChannels = base_audiodec->channels;
+		GST_DEBUG_OBJECT (omx_base, "PCM Sample Rate: %ld, channels: %ld",
+				param.nSamplingRate, param.nChannels);
 		G_OMX_PORT_SET_PARAM (omx_base->out_port, OMX_IndexParamAudioPcm, &param);
 	}
 	/*set port definition*/
@@ -384,9 +566,11 @@ omx_setup (GstOmxBaseFilter *omx_base)
 	_G_OMX_INIT_PARAM(&pInPortDef);
 	pInPortDef.nPortIndex = 0;//OMX_AUDDEC_INPUT_PORT;
 	pInPortDef.eDir = OMX_DirInput;
-	pInPortDef.nBufferCountActual = 1;
+	pInPortDef.nBufferCountActual = self->num_input_buffers ?
+		self->num_input_buffers : DEFAULT_NUM_BUFFERS;
 	pInPortDef.nBufferCountMin = 1;
-	pInPortDef.nBufferSize = 4096; //width * height;
+	pInPortDef.nBufferSize = self->input_buffer_size ? self->input_buffer_size :
+		GST_ROUND_UP_32 (frames * AAC_MAX_FRAME_SIZE (base_audiodec->channels));
 
 	pInPortDef.bEnabled = OMX_TRUE;
 	pInPortDef.bPopulated = OMX_FALSE;
@@ -404,12 +588,10 @@ omx_setup (GstOmxBaseFilter *omx_base)
 	_G_OMX_INIT_PARAM(&pOutPortDef);
 	pOutPortDef.nPortIndex = 1;
 	pOutPortDef.eDir = OMX_DirOutput;
-	pOutPortDef.nBufferCountActual = 1;
+	pOutPortDef.nBufferCountActual = self->num_output_buffers ?
+		self->num_output_buffers : DEFAULT_NUM_BUFFERS;
 	pOutPortDef.nBufferCountMin = 1;
-
-	/* for referance purpose, in PT mode, stride and height would be used by FQ
-	   It is padded inside components */
-	pOutPortDef.nBufferSize = 4608;        
+	pOutPortDef.nBufferSize = get_output_buffer_size (self, frames);
 	pOutPortDef.bEnabled = OMX_TRUE;
 	pOutPortDef.bPopulated = OMX_FALSE;
 	pOutPortDef.eDomain = OMX_PortDomainAudio;
@@ -469,6 +651,270 @@ omx_setup (GstOmxBaseFilter *omx_base)
 #endif
 }
 
+/*
+ * Framing of unframed input.
+ */
+
+/* Length of the ADTS frame at data, 0 if there is no valid header there */
+	static guint
+adts_frame_length (const guint8 *data)
+{
+	guint length;
+
+	if (data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+		return 0;
+
+	if (((data[2] >> 2) & 0x0f) >= G_N_ELEMENTS (aac_rates))
+		return 0;
+
+	length = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+	if (length < ((data[1] & 0x01) ? 7 : 9))
+		return 0;
+
+	return length;
+}
+
+/* Length of the LOAS AudioSyncStream frame at data, 0 if there is none */
+	static guint
+loas_frame_length (const guint8 *data)
+{
+	if (data[0] != 0x56 || (data[1] & 0xe0) != 0xe0)
+		return 0;
+
+	return 3 + (((data[1] & 0x1f) << 8) | data[2]);
+}
+
+	static guint
+frame_length (GstOmxAacDec *self, const guint8 *data, AacFraming *framing)
+{
+	guint length;
+
+	if (*framing != AAC_FRAMING_LOAS)
+	{
+		length = adts_frame_length (data);
+
+		/* once synced, the fixed header can't change */
+		if (length && self->synced &&
+				(((data[2] >> 2) & 0x0f) != self->sync_rate_index ||
+				 (((data[2] & 0x01) << 2) | (data[3] >> 6)) != self->sync_channels))
+			length = 0;
+
+		if (length)
+		{
+			*framing = AAC_FRAMING_ADTS;
+			return length;
+		}
+	}
+
+	if (*framing != AAC_FRAMING_ADTS)
+	{
+		length = loas_frame_length (data);
+		if (length)
+		{
+			*framing = AAC_FRAMING_LOAS;
+			return length;
+		}
+	}
+
+	return 0;
+}
+
+/* Finds the next whole frame in the adapter, dropping anything in front
+ * of it.  Out of sync, a header only counts if another one follows it,
+ * unless draining at EOS.
+ *
+ * Returns its length, or 0 if more data is needed.
+ */
+	static guint
+sync_frame (GstOmxAacDec *self, gboolean draining)
+{
+	const guint8 *data;
+	guint avail, skip, length = 0;
+	AacFraming framing = self->framing;
+
+	avail = gst_adapter_available (self->adapter);
+	if (avail < AAC_HEADER_SIZE)
+		return 0;
+
+	data = gst_adapter_peek (self->adapter, avail);
+
+	if (self->synced && !frame_length (self, data, &framing))
+	{
+		GST_WARNING_OBJECT (self, "lost sync");
+		self->synced = FALSE;
+	}
+
+	for (skip = 0; skip + AAC_HEADER_SIZE <= avail; skip++)
+	{
+		AacFraming next;
+
+		length = frame_length (self, data + skip, &framing);
+		if (!length)
+			continue;
+
+		if (self->synced || draining)
+			break;
+
+		/* wait until the next header is in */
+		if (skip + length + AAC_HEADER_SIZE > avail)
+		{
+			length = 0;
+			break;
+		}
+
+		next = framing;
+		if (frame_length (self, data + skip + length, &next))
+			break;
+
+		framing = self->framing;
+		length = 0;
+	}
+
+	if (skip)
+	{
+		GST_DEBUG_OBJECT (self, "skipping %u bytes", skip);
+		self->bytes_skipped += skip;
+		gst_adapter_flush (self->adapter, skip);
+		avail -= skip;
+		data += skip;
+	}
+
+	if (!length)
+		return 0;
+
+	if (!self->synced)
+	{
+		GST_INFO_OBJECT (self, "synced on %s frames of %u bytes",
+				framing == AAC_FRAMING_ADTS ? "ADTS" : "LOAS", length);
+		self->synced = TRUE;
+		self->framing = framing;
+
+		if (framing == AAC_FRAMING_ADTS)
+		{
+			self->sync_rate_index = (data[2] >> 2) & 0x0f;
+			self->sync_channels = ((data[2] & 0x01) << 2) | (data[3] >> 6);
+		}
+	}
+
+	if (length > avail)
+		return 0;
+
+	return length;
+}
+
+/* The ADTS header carries what the PCM port needs, so the component is
+ * set up right for the first frame instead of after a settings change.
+ */
+	static void
+configure_from_header (GstOmxAacDec *self, const guint8 *data)
+{
+	GstOmxBaseAudioDec *base_audiodec = GST_OMX_BASE_AUDIODEC (self);
+	gint channels;
+
+	if (self->framing != AAC_FRAMING_ADTS)
+		return;
+
+	base_audiodec->rate = aac_rates[self->sync_rate_index];
+
+	channels = self->sync_channels == 7 ? 8 : self->sync_channels;
+	if (channels)
+		base_audiodec->channels = channels;
+
+	/* ADTS profile is the object type minus one; it says LC for implicitly
+	 * signalled SBR, so the caps know better */
+	if (!self->caps_object_type)
+		self->aacversion = (data[2] >> 6) + 1;
+
+	GST_INFO_OBJECT (self, "ADTS: rate %d, channels %d, object type %d",
+			base_audiodec->rate, base_audiodec->channels, self->aacversion);
+}
+
+	static GstFlowReturn
+push_frames (GstOmxAacDec *self, gboolean draining)
+{
+	GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+	GstOmxBaseAudioDec *base_audiodec = GST_OMX_BASE_AUDIODEC (self);
+	GstFlowReturn ret = GST_FLOW_OK;
+	guint length;
+
+	while (ret == GST_FLOW_OK && (length = sync_frame (self, draining)))
+	{
+		GstBuffer *frame;
+
+		if (G_UNLIKELY (omx_base->gomx->omx_state == OMX_StateLoaded))
+			configure_from_header (self, gst_adapter_peek (self->adapter, length));
+
+		frame = gst_adapter_take_buffer (self->adapter, length);
+
+		/* one frame is 1024 samples of the core rate */
+		GST_BUFFER_TIMESTAMP (frame) = self->next_timestamp;
+		GST_BUFFER_DURATION (frame) = gst_util_uint64_scale_int (AAC_FRAME_SAMPLES,
+				GST_SECOND, base_audiodec->rate);
+		if (GST_CLOCK_TIME_IS_VALID (self->next_timestamp))
+			self->next_timestamp += GST_BUFFER_DURATION (frame);
+
+		ret = GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_chain (omx_base->sinkpad, frame);
+	}
+
+	return ret;
+}
+
+	static void
+parse_reset (GstOmxAacDec *self)
+{
+	gst_adapter_clear (self->adapter);
+	self->synced = FALSE;
+	self->next_timestamp = GST_CLOCK_TIME_NONE;
+}
+
+	static GstFlowReturn
+pad_chain (GstPad *pad, GstBuffer *buf)
+{
+	GstOmxAacDec *self;
+
+	self = GST_OMX_AACDEC (GST_OBJECT_PARENT (pad));
+
+	if (!self->parse)
+		return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_chain (pad, buf);
+
+	/* upstream time applies from the next frame boundary on */
+	if (GST_BUFFER_TIMESTAMP_IS_VALID (buf) &&
+			(gst_adapter_available (self->adapter) == 0 ||
+			 !GST_CLOCK_TIME_IS_VALID (self->next_timestamp)))
+		self->next_timestamp = GST_BUFFER_TIMESTAMP (buf);
+
+	gst_adapter_push (self->adapter, buf);
+
+	return push_frames (self, FALSE);
+}
+
+	static gboolean
+pad_event (GstPad *pad, GstEvent *event)
+{
+	GstOmxAacDec *self;
+
+	self = GST_OMX_AACDEC (GST_OBJECT_PARENT (pad));
+
+	if (self->parse)
+	{
+		switch (GST_EVENT_TYPE (event))
+		{
+			case GST_EVENT_EOS:
+				/* the last frame has no header after it */
+				push_frames (self, TRUE);
+				parse_reset (self);
+				break;
+			case GST_EVENT_FLUSH_STOP:
+				parse_reset (self);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_event (pad, event);
+}
+
 	static void
 type_instance_init (GTypeInstance *instance,
 		gpointer g_class)
@@ -480,6 +926,9 @@ type_instance_init (GTypeInstance *instance,
 	omx_base = GST_OMX_BASE_FILTER (instance);
 	//GST_DEBUG_OBJECT (omx_base, "start");
 	omx_base->omx_setup = omx_setup;
+	self->adapter = gst_adapter_new ();
+	self->framing = AAC_FRAMING_NONE;
+	self->next_timestamp = GST_CLOCK_TIME_NONE;
 	//omx_base->in_port->always_copy  = FALSE;
 	omx_base->out_port->always_copy = TRUE;
 
@@ -23,6 +23,7 @@
 #define GSTOMX_AACDEC_H
 
 #include <gst/gst.h>
+#include <gst/base/gstadapter.h>
 
 G_BEGIN_DECLS
 
@@ -38,8 +39,26 @@ struct GstOmxAacDec
 {
     GstOmxBaseAudioDec omx_base;
     gint aacversion;
+    gboolean caps_object_type;  /**< aacversion came with the caps */
     gboolean framed;
     gboolean framemode;
+
+    /** port setup, 0 to derive from the stream in omx_setup() */
+    guint num_input_buffers;
+    guint num_output_buffers;
+    guint input_buffer_size;
+    guint output_buffer_size;
+    guint frames_per_buffer;    /**< AAC frames packed in one input buffer */
+
+    /** unframed input is split into ADTS or LOAS frames, see pad_chain() */
+    gboolean parse;
+    GstAdapter *adapter;
+    gint framing;               /**< AacFraming of the stream */
+    gboolean synced;
+    gint sync_rate_index;       /**< ADTS fixed header of the stream */
+    gint sync_channels;
+    GstClockTime next_timestamp;
+    guint bytes_skipped;
 };
 
 struct GstOmxAacDecClass
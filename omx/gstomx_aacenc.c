@@ -31,6 +31,7 @@ enum
     ARG_BITRATE,
     ARG_PROFILE,
     ARG_OUTPUT_FORMAT,
+    ARG_FRAMES_PER_BUFFER,
 };
 
 #define DEFAULT_BITRATE 128000 /* Guarantee that all the 3 formats will work using this default. */
@@ -39,7 +40,8 @@ enum
 #define DEFAULT_OUTPUT_FORMAT OMX_AUDIO_AACStreamFormatRAW
 #define DEFAULT_RATE 44100
 #define DEFAULT_CHANNELS 2
-#define IN_BUFFER_SIZE 1024*8			/* 1024*8 Recommended buffer size */
+#define DEFAULT_FRAMES_PER_BUFFER 2		/* 1024*8 bytes of 16-bit stereo LC */
+#define MAX_FRAMES_PER_BUFFER 16
 #define OUT_BUFFER_SIZE 1024*8		 	/* 1024*8 Recommended buffer size */
 #define OMX_AUDENC_INPUT_PORT 0
 #define OMX_AUDENC_OUTPUT_PORT 1
@@ -50,6 +52,10 @@ enum
 
 GSTOMX_BOILERPLATE (GstOmxAacEnc, gst_omx_aacenc, GstOmxBaseFilter, GST_OMX_BASE_FILTER_TYPE);
 
+static GstFlowReturn push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf);
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+static gboolean pad_event (GstPad *pad, GstEvent *event);
+
 #define GST_TYPE_OMX_AACENC_PROFILE (gst_omx_aacenc_profile_get_type ())
 
 gint rateIdx[] = {96000,88200,64000,48000,44100,32000,24000,22050,16000,12000,
@@ -270,6 +276,9 @@ set_property (GObject *obj,
         case ARG_OUTPUT_FORMAT:
             self->output_format = g_value_get_enum (value);
             break;
+        case ARG_FRAMES_PER_BUFFER:
+            self->frames_per_buffer = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -298,6 +307,9 @@ get_property (GObject *obj,
         case ARG_OUTPUT_FORMAT:
             g_value_set_enum (value, self->output_format);
             break;
+        case ARG_FRAMES_PER_BUFFER:
+            g_value_set_uint (value, self->frames_per_buffer);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -309,8 +321,14 @@ type_class_init (gpointer g_class,
                  gpointer class_data)
 {
     GObjectClass *gobject_class;
+    GstOmxBaseFilterClass *bclass;
 
     gobject_class = G_OBJECT_CLASS (g_class);
+    bclass = GST_OMX_BASE_FILTER_CLASS (g_class);
+
+    bclass->push_buffer = push_buffer;
+    bclass->pad_chain = pad_chain;
+    bclass->pad_event = pad_event;
 
     /* Properties stuff */
     {
@@ -334,9 +352,26 @@ type_class_init (gpointer g_class,
                                                             GST_TYPE_OMX_AACENC_OUTPUT_FORMAT,
                                                             DEFAULT_OUTPUT_FORMAT,
                                                            G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAMES_PER_BUFFER,
+                                         g_param_spec_uint ("frames-per-buffer", "Frames per buffer",
+                                                            "Whole AAC frames of PCM in each OMX input buffer (ADTS output only)",
+                                                            1, MAX_FRAMES_PER_BUFFER, DEFAULT_FRAMES_PER_BUFFER,
+                                                            G_PARAM_READWRITE));
     }
 }
 
+/* PCM samples per channel in one AAC frame */
+static guint
+frame_samples (GstOmxAacEnc *self)
+{
+    if (self->profile == OMX_AUDIO_AACObjectHE ||
+        self->profile == OMX_AUDIO_AACObjectHE_PS)
+        return 2048;
+
+    return 1024;
+}
+
 static gboolean
 sink_setcaps (GstPad *pad,
               GstCaps *caps)
@@ -373,6 +408,14 @@ sink_setcaps (GstPad *pad,
     }
     self->inport_configured = TRUE;
 
+    /* PCM goes straight into the OMX input buffers, which go to the
+     * component only once they hold whole frames; see omx_setup() */
+    omx_base->pack_input = TRUE;
+    omx_base->input_aligned = FALSE;
+    omx_base->in_port->pack_continuous = TRUE;
+    omx_base->duration = gst_util_uint64_scale_int (frame_samples (self),
+            GST_SECOND, self->rate);
+
 
     {
         GstCaps *sink_caps;
@@ -588,6 +631,23 @@ src_getcaps (GstPad *pad)
      
 }
 
+/* Raw frames carry no length, so only ADTS output can have several in a
+ * buffer and still be split downstream.
+ */
+static guint
+get_frames_per_buffer (GstOmxAacEnc *self)
+{
+    if (self->output_format != OMX_AUDIO_AACStreamFormatMP2ADTS &&
+        self->output_format != OMX_AUDIO_AACStreamFormatMP4ADTS)
+    {
+        if (self->frames_per_buffer > 1)
+            GST_INFO_OBJECT (self, "only ADTS AAC frames go several per buffer");
+        return 1;
+    }
+
+    return self->frames_per_buffer;
+}
+
 static void
 omx_setup (GstOmxBaseFilter *omx_base)
 {
@@ -595,6 +655,7 @@ omx_setup (GstOmxBaseFilter *omx_base)
     GstOmxAacEnc *self;
     GOmxCore *gomx;
     GOmxPort *port;
+    guint frames;
     
     OMX_PORT_PARAM_TYPE portInit;
     OMX_PARAM_PORTDEFINITIONTYPE pInPortDef, pOutPortDef;
@@ -607,6 +668,14 @@ omx_setup (GstOmxBaseFilter *omx_base)
     
     GST_INFO_OBJECT (omx_base, "begin");
 
+    frames = get_frames_per_buffer (self);
+    omx_base->in_port->pack_size = frames *
+            frame_samples (self) * self->channels * 2;
+    /* frames_in counts AAC frames, like push_buffer() does frames_out */
+    omx_base->in_port->pack_units = frames;
+    GST_INFO_OBJECT (omx_base, "%u frame(s), %u bytes per input buffer",
+            frames, omx_base->in_port->pack_size);
+
     _G_OMX_INIT_PARAM(&portInit);
     portInit.nPorts = NUM_OF_PORTS;
     portInit.nStartPortNumber = START_PORT_NUM;
@@ -616,6 +685,7 @@ omx_setup (GstOmxBaseFilter *omx_base)
     pInPortDef.nPortIndex = OMX_AUDENC_INPUT_PORT;
     G_OMX_PORT_GET_DEFINITION (omx_base->in_port, &pInPortDef);
     pInPortDef.nBufferCountActual = NUM_OF_IN_BUFFERS;
+    pInPortDef.nBufferSize = omx_base->in_port->pack_size;
     pInPortDef.format.audio.eEncoding = OMX_AUDIO_CodingPCM;
     G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &pInPortDef);
 
@@ -697,6 +767,144 @@ omx_setup (GstOmxBaseFilter *omx_base)
     GST_INFO_OBJECT (omx_base, "end");
 }
 
+/* Anchors the input sample count on upstream time, at the start and
+ * again after a discontinuity.
+ */
+static GstFlowReturn
+pad_chain (GstPad *pad,
+           GstBuffer *buf)
+{
+    GstOmxAacEnc *self;
+
+    self = GST_OMX_AACENC (GST_OBJECT_PARENT (pad));
+
+    /* first buffer of the stream */
+    if (G_UNLIKELY (self->omx_base.gomx->omx_state == OMX_StateLoaded))
+    {
+        self->base_timestamp = GST_CLOCK_TIME_NONE;
+        self->samples_in = self->samples_out = 0;
+    }
+
+    if (GST_BUFFER_TIMESTAMP_IS_VALID (buf) &&
+        (!GST_CLOCK_TIME_IS_VALID (self->base_timestamp) ||
+         GST_BUFFER_IS_DISCONT (buf)))
+    {
+        GstClockTime offset;
+
+        offset = gst_util_uint64_scale_int (self->samples_in, GST_SECOND, self->rate);
+        self->base_timestamp = GST_BUFFER_TIMESTAMP (buf) > offset ?
+                GST_BUFFER_TIMESTAMP (buf) - offset : 0;
+    }
+
+    self->samples_in += GST_BUFFER_SIZE (buf) / (self->channels * 2);
+
+    return parent_class->pad_chain (pad, buf);
+}
+
+static gboolean
+pad_event (GstPad *pad,
+           GstEvent *event)
+{
+    GstOmxAacEnc *self;
+    GstOmxBaseFilter *omx_base;
+    OMX_BUFFERHEADERTYPE *pack_buffer;
+
+    self = GST_OMX_AACENC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+    pack_buffer = omx_base->in_port->pack_buffer;
+
+    /* the base filter counts the last, partial, input buffer as one
+     * frame; it holds as many as its samples start */
+    if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && pack_buffer)
+    {
+        guint frame_size = frame_samples (self) * self->channels * 2;
+        guint frames = (pack_buffer->nFilledLen + frame_size - 1) / frame_size;
+
+        if (frames > 1)
+        {
+            g_mutex_lock (omx_base->num_buffers_mutex);
+            omx_base->frames_in += frames - 1;
+            g_mutex_unlock (omx_base->num_buffers_mutex);
+        }
+    }
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+    {
+        self->base_timestamp = GST_CLOCK_TIME_NONE;
+        self->samples_in = self->samples_out = 0;
+    }
+
+    return parent_class->pad_event (pad, event);
+}
+
+/* AAC frames in an output buffer: counted from the ADTS headers, or else
+ * just one, see get_frames_per_buffer().
+ */
+static guint
+output_frames (GstOmxAacEnc *self, GstBuffer *buf)
+{
+    const guint8 *data = GST_BUFFER_DATA (buf);
+    guint size = GST_BUFFER_SIZE (buf);
+    guint frames = 0;
+
+    if (self->output_format != OMX_AUDIO_AACStreamFormatMP2ADTS &&
+        self->output_format != OMX_AUDIO_AACStreamFormatMP4ADTS)
+        return 1;
+
+    while (size >= 7 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0)
+    {
+        guint len = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+
+        if (len < 7 || len > size)
+            break;
+
+        /* number_of_raw_data_blocks_in_frame, minus one */
+        frames += (data[6] & 0x03) + 1;
+        data += len;
+        size -= len;
+    }
+
+    return MAX (frames, 1);
+}
+
+/* The time of an output buffer follows from the samples encoded before
+ * it rather than from the component.
+ */
+static GstFlowReturn
+push_buffer (GstOmxBaseFilter *omx_base,
+             GstBuffer *buf)
+{
+    GstOmxAacEnc *self;
+    guint frames;
+
+    self = GST_OMX_AACENC (omx_base);
+
+    frames = output_frames (self, buf);
+
+    /* the output task counted the buffer as one frame */
+    if (frames > 1)
+    {
+        g_mutex_lock (omx_base->num_buffers_mutex);
+        omx_base->frames_out += frames - 1;
+        g_cond_broadcast (omx_base->num_buffers_cond);
+        g_mutex_unlock (omx_base->num_buffers_mutex);
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (self->base_timestamp))
+        GST_BUFFER_TIMESTAMP (buf) = self->base_timestamp +
+                gst_util_uint64_scale_int (self->samples_out, GST_SECOND, self->rate);
+    else
+        GST_BUFFER_TIMESTAMP (buf) = GST_CLOCK_TIME_NONE;
+
+    GST_BUFFER_OFFSET (buf) = self->samples_out;
+    self->samples_out += (guint64) frames * frame_samples (self);
+    GST_BUFFER_OFFSET_END (buf) = self->samples_out;
+    GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (
+            GST_BUFFER_OFFSET_END (buf) - GST_BUFFER_OFFSET (buf), GST_SECOND, self->rate);
+
+    return parent_class->push_buffer (omx_base, buf);
+}
+
 static void
 type_instance_init (GTypeInstance *instance,
                     gpointer g_class)
@@ -721,5 +929,7 @@ type_instance_init (GTypeInstance *instance,
     self->output_format = DEFAULT_OUTPUT_FORMAT;
     self->rate = DEFAULT_RATE;
     self->channels = DEFAULT_CHANNELS;
+    self->frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
+    self->base_timestamp = GST_CLOCK_TIME_NONE;
 
 }
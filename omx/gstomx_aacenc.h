@@ -43,6 +43,14 @@ struct GstOmxAacEnc
     gint rate;
     gint channels;
     gboolean inport_configured;
+
+    /** input buffers hold this many whole frames of PCM */
+    guint frames_per_buffer;
+
+    /** output timing from the sample count, see push_buffer() */
+    GstClockTime base_timestamp;
+    guint64 samples_in;
+    guint64 samples_out;
 };
 
 struct GstOmxAacEncClass
@@ -26,8 +26,8 @@
 #include "gstomx.h"
 #include "gstomx_interface.h"
 #include "gstomx_buffertransport.h"
-#include "OMX_TI_Common.h"
-#include "OMX_TI_Index.h"
+#include "OMX_TI_Common.h"
+#include "OMX_TI_Index.h"
 
 enum
 {
@@ -40,9 +40,14 @@ enum
     ARG_NUM_OUTPUT_BUFFERS,
 	ARG_NUM_FRAME_RATE,
 	ARG_GEN_TIMESTAMPS,
-	ARG_NUM_BUFFERS
+	ARG_NUM_BUFFERS,
+    ARG_DRAIN_TIMEOUT,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
 };
 
+#define DEFAULT_DRAIN_TIMEOUT 1000
+#define DRAIN_IDLE_MS 200
+
 static void init_interfaces (GType type);
 GSTOMX_BOILERPLATE_FULL (GstOmxBaseFilter, gst_omx_base_filter, GstElement, GST_TYPE_ELEMENT, init_interfaces);
 
@@ -113,6 +118,26 @@ setup_input_buffer (GstOmxBaseFilter *self, GstBuffer *buf)
 			/* configure input buffer size to match with upstream buffer */
 			G_OMX_PORT_GET_DEFINITION (self->in_port, &param);
 			param.nBufferSize =  GST_BUFFER_SIZE (buf);
+
+			if (self->input_fields_separately && GST_GET_OMXBUFFER (buf))
+			{
+				/* each upstream frame is submitted as two fields, so every
+				 * upstream buffer is registered twice with the component.
+				 */
+				param.nBufferCountActual = port->num_buffers * 2;
+				G_OMX_PORT_SET_DEFINITION (self->in_port, &param);
+
+				self->second_field_offset = g_omx_port_get_second_field_offset (
+						self->in_port, GST_GET_OMXBUFFER (buf));
+				GST_INFO_OBJECT (self, "submitting fields separately, second field at %d",
+						self->second_field_offset);
+
+				g_omx_port_share_fields (self->in_port, port, self->second_field_offset);
+
+				return;
+			}
+
+			self->input_fields_separately = FALSE;
 			param.nBufferCountActual = port->num_buffers;
 			G_OMX_PORT_SET_DEFINITION (self->in_port, &param);
 
@@ -136,6 +161,7 @@ setup_input_buffer (GstOmxBaseFilter *self, GstBuffer *buf)
 	/* ask openmax to allocate input buffer */
 	self->in_port->omx_allocate = TRUE;
 	self->in_port->always_copy = TRUE;
+	self->input_fields_separately = FALSE;
 }
 
 static GstStateChangeReturn
@@ -275,45 +301,49 @@ set_property (GObject *obj,
                         self->in_port : self->out_port;
                 G_OMX_PORT_GET_DEFINITION (port, &param);
 
-				//g_return_if_fail(nBufferCountActual >= param.nBufferCountMin);				
+				//g_return_if_fail(nBufferCountActual >= param.nBufferCountMin);				
 
 				param.nBufferCountActual = nBufferCountActual;
                 G_OMX_PORT_SET_DEFINITION (port, &param);
             }
             break;
-		case ARG_NUM_FRAME_RATE:
-			{
-				OMX_PARAM_PORTDEFINITIONTYPE param;
-				OMX_PARAM_COMPPORT_NOTIFYTYPE pNotifyType;
-				OMX_ERRORTYPE error_val = OMX_ErrorNone;
-
-                OMX_U32 nFramerate = g_value_get_uint (value);
-                
-
-                G_OMX_PORT_GET_DEFINITION (self->out_port, &param);
-
-				param.format.video.xFramerate = (nFramerate) << 16;
-                
-                G_OMX_PORT_SET_DEFINITION (self->out_port, &param);
-
-				/* Setting Notify type for both input and ouput ports*/
-				_G_OMX_INIT_PARAM (&pNotifyType);
-				pNotifyType.eNotifyType = OMX_NOTIFY_TYPE_NONE;
-				pNotifyType.nPortIndex =  0;				
-				G_OMX_PORT_SET_NOTIFY_DEFINITION(self->in_port, &pNotifyType);
-
-				pNotifyType.eNotifyType = OMX_NOTIFY_TYPE_NONE;
-				pNotifyType.nPortIndex =  1;													
-				G_OMX_PORT_SET_NOTIFY_DEFINITION(self->out_port, &pNotifyType);
-			}
+		case ARG_NUM_FRAME_RATE:
+			{
+				OMX_PARAM_PORTDEFINITIONTYPE param;
+				OMX_PARAM_COMPPORT_NOTIFYTYPE pNotifyType;
+				OMX_ERRORTYPE error_val = OMX_ErrorNone;
+
+                OMX_U32 nFramerate = g_value_get_uint (value);
+                
+
+                G_OMX_PORT_GET_DEFINITION (self->out_port, &param);
+
+				param.format.video.xFramerate = (nFramerate) << 16;
+                
+                G_OMX_PORT_SET_DEFINITION (self->out_port, &param);
+
+				/* Setting Notify type for both input and ouput ports*/
+				_G_OMX_INIT_PARAM (&pNotifyType);
+				pNotifyType.eNotifyType = OMX_NOTIFY_TYPE_NONE;
+				pNotifyType.nPortIndex =  0;				
+				G_OMX_PORT_SET_NOTIFY_DEFINITION(self->in_port, &pNotifyType);
+
+				pNotifyType.eNotifyType = OMX_NOTIFY_TYPE_NONE;
+				pNotifyType.nPortIndex =  1;													
+				G_OMX_PORT_SET_NOTIFY_DEFINITION(self->out_port, &pNotifyType);
+			}
 			break;
 		case ARG_NUM_BUFFERS:
 			{
                 self->num_buffers = g_value_get_int (value);
 			}
 			break;
+        case ARG_DRAIN_TIMEOUT:
+            self->drain_timeout = g_value_get_uint (value);
+            break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -357,20 +387,24 @@ get_property (GObject *obj,
                 g_value_set_uint (value, param.nBufferCountActual);
             }
             break;
-		case ARG_NUM_FRAME_RATE:
-			{
-				OMX_PARAM_PORTDEFINITIONTYPE param;                
-                G_OMX_PORT_GET_DEFINITION (self->in_port, &param);
-                g_value_set_uint (value, param.format.video.xFramerate >> 16);
-			}
+		case ARG_NUM_FRAME_RATE:
+			{
+				OMX_PARAM_PORTDEFINITIONTYPE param;                
+                G_OMX_PORT_GET_DEFINITION (self->in_port, &param);
+                g_value_set_uint (value, param.format.video.xFramerate >> 16);
+			}
 			break;
-		case ARG_NUM_BUFFERS:
-			{
-				g_value_set_int (value, self->num_buffers);
-			}
+		case ARG_NUM_BUFFERS:
+			{
+				g_value_set_int (value, self->num_buffers);
+			}
 			break;
+        case ARG_DRAIN_TIMEOUT:
+            g_value_set_uint (value, self->drain_timeout);
+            break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -439,15 +473,21 @@ type_class_init (gpointer g_class,
         g_object_class_install_property (gobject_class, ARG_NUM_OUTPUT_BUFFERS,
                                          g_param_spec_uint ("output-buffers", "Output buffers",
                                                             "The number of OMX output buffers",
-                                                            1, 16, 10, G_PARAM_READWRITE));
-		g_object_class_install_property (gobject_class, ARG_NUM_FRAME_RATE,
-                                         g_param_spec_uint ("framerate", "Frame rate",
-                                                            "The number of OMX output buffers",
+                                                            1, 16, 10, G_PARAM_READWRITE));
+		g_object_class_install_property (gobject_class, ARG_NUM_FRAME_RATE,
+                                         g_param_spec_uint ("framerate", "Frame rate",
+                                                            "The number of OMX output buffers",
                                                             1, 60, 30, G_PARAM_READWRITE));
-		g_object_class_install_property (gobject_class, ARG_NUM_BUFFERS,
-                                         g_param_spec_int ("num-buffers", "Number of buffers",
-                                                            "The number of Buffers to be processed",
+		g_object_class_install_property (gobject_class, ARG_NUM_BUFFERS,
+                                         g_param_spec_int ("num-buffers", "Number of buffers",
+                                                            "The number of Buffers to be processed",
                                                             0, G_MAXINT, 0, G_PARAM_READWRITE));
+        g_object_class_install_property (gobject_class, ARG_DRAIN_TIMEOUT,
+                                         g_param_spec_uint ("drain-timeout", "Drain timeout",
+                                                            "Milliseconds to wait at EOS for the frames still inside the component",
+                                                            0, G_MAXUINT, DEFAULT_DRAIN_TIMEOUT, G_PARAM_READWRITE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
     }
 }
 
@@ -478,11 +518,13 @@ push_buffer (GstOmxBaseFilter *self,
     GST_LOG_OBJECT (self, "end");
 
     if(self->num_buffers) {
+		 g_mutex_lock (self->num_buffers_mutex);
 		 self->cont++;
 		 if(self->cont >= self->num_buffers) {
-			g_cond_signal(self->num_buffers_cond);
 			self->cont = 0;
+			g_cond_broadcast(self->num_buffers_cond);
 		 }
+		 g_mutex_unlock (self->num_buffers_mutex);
 	}
 
     return ret;
@@ -504,6 +546,8 @@ output_loop (gpointer data)
 
     bclass = GST_OMX_BASE_FILTER_GET_CLASS (self);
 
+    g_omx_threads_enter_task (gomx->threads, pad, "output");
+
     GST_LOG_OBJECT (self, "begin");
 
     if (!self->ready)
@@ -518,6 +562,14 @@ output_loop (gpointer data)
     {
         gpointer obj = g_omx_port_recv (out_port);
 
+        if (G_UNLIKELY (!obj) && self->output_reconfigure &&
+            g_atomic_int_compare_and_exchange (&self->output_reconfigure_pending, TRUE, FALSE))
+        {
+            GST_INFO_OBJECT (self, "reconfiguring output port");
+            self->output_reconfigure (self);
+            goto leave;
+        }
+
         if (G_UNLIKELY (!obj))
         {
             GST_WARNING_OBJECT (self, "null buffer: leaving");
@@ -548,6 +600,13 @@ output_loop (gpointer data)
             else
             {
                 GstBuffer *buf = GST_BUFFER (obj);
+
+                g_mutex_lock (self->num_buffers_mutex);
+                self->frames_out++;
+                g_get_current_time (&self->last_output);
+                g_cond_broadcast (self->num_buffers_cond);
+                g_mutex_unlock (self->num_buffers_mutex);
+
                 ret = bclass->push_buffer (self, buf);
                 GST_DEBUG_OBJECT (self, "ret=%s", gst_flow_get_name (ret));
             }
@@ -679,7 +738,35 @@ pad_chain (GstPad *pad,
                 goto out_flushing;
             }
 
-            sent = g_omx_port_send (in_port, buf);
+            if (self->input_fields_separately)
+            {
+                /* both fields go out of the same buffer in one go */
+                sent = g_omx_port_send_interlaced_fields (in_port, buf,
+                        self->second_field_offset);
+                if (sent >= 0)
+                    sent = GST_BUFFER_SIZE (buf);
+            }
+            else if (self->pack_input && in_port->always_copy && !in_port->vp6_hack &&
+                     !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS))
+            {
+                guint units = 0;
+
+                sent = g_omx_port_pack (in_port, buf, &units);
+                if (sent >= 0 && self->input_aligned && g_omx_port_pack_end_unit (in_port))
+                    units++;
+
+                g_mutex_lock (self->num_buffers_mutex);
+                self->frames_in += units;
+                g_mutex_unlock (self->num_buffers_mutex);
+
+                if (sent >= 0)
+                {
+                    gst_buffer_unref (buf);
+                    break;
+                }
+            }
+            else
+                sent = g_omx_port_send (in_port, buf);
 
             if (G_UNLIKELY (sent < 0))
             {
@@ -695,6 +782,12 @@ pad_chain (GstPad *pad,
             }
             else
             {
+                if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS))
+                {
+                    g_mutex_lock (self->num_buffers_mutex);
+                    self->frames_in++;
+                    g_mutex_unlock (self->num_buffers_mutex);
+                }
                 gst_buffer_unref (buf);
                 break;
             }
@@ -739,6 +832,71 @@ out_flushing:
     }
 }
 
+/* Frames still inside the component are done once every ETB has been
+ * returned and an output has come back for every input frame, or the
+ * output has been quiet for DRAIN_IDLE_MS since then (inputs that produce
+ * no output, such as headers).  A num-buffers batch in progress is waited
+ * for as well.  Everything is bounded by drain-timeout.
+ */
+static void
+drain (GstOmxBaseFilter *self)
+{
+    GTimeVal end_time;
+    gboolean inputs_returned;
+
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, (glong) self->drain_timeout * 1000);
+
+    inputs_returned = g_omx_port_wait_returned (self->in_port, &end_time);
+
+    g_mutex_lock (self->num_buffers_mutex);
+
+    GST_INFO_OBJECT (self, "draining: in=%u out=%u inputs returned=%d",
+                     self->frames_in, self->frames_out, inputs_returned);
+
+    while (self->last_pad_push_return == GST_FLOW_OK &&
+           self->gomx->omx_error == OMX_ErrorNone)
+    {
+        GTimeVal idle_time;
+        gboolean pending;
+
+        pending = (self->frames_out < self->frames_in) ||
+                  (self->num_buffers && self->cont != 0);
+        if (!pending)
+            break;
+
+        /* nothing left to consume, so stop once the output goes quiet */
+        idle_time = self->last_output;
+        g_time_val_add (&idle_time, DRAIN_IDLE_MS * 1000);
+        if (inputs_returned && self->frames_out > 0 &&
+            (idle_time.tv_sec < end_time.tv_sec ||
+             (idle_time.tv_sec == end_time.tv_sec && idle_time.tv_usec < end_time.tv_usec)))
+        {
+            if (!g_cond_timed_wait (self->num_buffers_cond, self->num_buffers_mutex, &idle_time))
+            {
+                GTimeVal now;
+
+                g_get_current_time (&now);
+                if (now.tv_sec > idle_time.tv_sec ||
+                    (now.tv_sec == idle_time.tv_sec && now.tv_usec >= idle_time.tv_usec))
+                    break;
+            }
+            continue;
+        }
+
+        if (!g_cond_timed_wait (self->num_buffers_cond, self->num_buffers_mutex, &end_time))
+        {
+            GST_WARNING_OBJECT (self, "drain timed out: in=%u out=%u",
+                                self->frames_in, self->frames_out);
+            break;
+        }
+    }
+
+    self->frames_in = self->frames_out = 0;
+
+    g_mutex_unlock (self->num_buffers_mutex);
+}
+
 static gboolean
 pad_event (GstPad *pad,
            GstEvent *event)
@@ -774,15 +932,21 @@ pad_event (GstPad *pad,
                 #endif
             }
 
-			/* In some cases the EoS event arrives before we encode the
-			 * desired amount of frames using the num_buffers property we
-             *  can be sure that we will encode this amount of frames (i.e.snapshots)
-             */
-            if(self->num_buffers){
-				g_mutex_lock(self->num_buffers_mutex);
-				g_cond_wait(self->num_buffers_cond,self->num_buffers_mutex);
-				g_mutex_unlock(self->num_buffers_mutex);
-			}
+            /* without the EOS flag round trip, wait for what is still
+             * inside the component before sending EOS downstream */
+            if (self->ready)
+            {
+                if (self->pack_input && g_omx_port_pack_flush (self->in_port))
+                {
+                    g_mutex_lock (self->num_buffers_mutex);
+                    self->frames_in++;
+                    g_mutex_unlock (self->num_buffers_mutex);
+                }
+                drain (self);
+            }
+
+            if (self->drained)
+                self->drained (self);
 
 			/* we tried, but it's up to us here */
             ret = gst_pad_push_event (self->srcpad, event);
@@ -803,8 +967,15 @@ pad_event (GstPad *pad,
             gst_pad_push_event (self->srcpad, event);
             self->last_pad_push_return = GST_FLOW_OK;
 
+            g_omx_port_pack_reset (self->in_port);
             g_omx_core_flush_stop (gomx);
             self->isFlushed = TRUE;
+
+            g_mutex_lock (self->num_buffers_mutex);
+            self->frames_in = self->frames_out = 0;
+            self->cont = 0;
+            g_mutex_unlock (self->num_buffers_mutex);
+
             if (self->ready)
                 gst_pad_start_task (self->srcpad, output_loop, self->srcpad);
 
@@ -970,9 +1141,14 @@ type_instance_init (GTypeInstance *instance,
 
 	self->isFlushed = FALSE;
     self->filterType = FILTER_NONE;
+    self->input_fields_separately = FALSE;
+    self->second_field_offset = 0;
     self->duration = GST_CLOCK_TIME_NONE;
     self->num_buffers = 0;
     self->cont = 0;
+    self->frames_in = 0;
+    self->frames_out = 0;
+    self->drain_timeout = DEFAULT_DRAIN_TIMEOUT;
     self->num_buffers_mutex = g_mutex_new();
 	self->num_buffers_cond  = g_cond_new();
 
@@ -67,14 +67,35 @@ struct GstOmxBaseFilter
 	GCond *num_buffers_cond;
 	GMutex *num_buffers_mutex;
 
+    /** frames sent to and received from the component, for the EOS drain;
+     * protected by num_buffers_mutex */
+    guint frames_in;
+    guint frames_out;
+    GTimeVal last_output;
+    guint drain_timeout;
+
     GstOmxBaseFilterCb omx_setup;
     GstOmxBaseFilterPushCb push_cb;
+    /** run by the output task after a NULL wakeup on the output port queue
+     * while output_reconfigure_pending is set */
+    GstOmxBaseFilterCb output_reconfigure;
+    gint output_reconfigure_pending;
+    /** run on EOS once the component is drained, before EOS goes on */
+    GstOmxBaseFilterCb drained;
     GstFlowReturn last_pad_push_return;
     GstBuffer *codec_data;
     GstClockTime duration;
 	gboolean isFlushed;
 	guint filterType;
 
+    /** submit each interlaced input frame as two separate fields */
+    gboolean input_fields_separately;
+    gint second_field_offset;
+
+    /** coalesce input fragments into one OMX buffer per access unit */
+    gboolean pack_input;
+    gboolean input_aligned;     /**< upstream buffers are whole access units */
+
 };
 
 struct GstOmxBaseFilterClass
@@ -36,7 +36,8 @@ enum
     ARG_USE_TIMESTAMPS,
     ARG_NUM_INPUT_BUFFERS,
     ARG_NUM_OUTPUT_BUFFERS,
-	ARG_GEN_TIMESTAMPS
+	ARG_GEN_TIMESTAMPS,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
 };
 
 static void init_interfaces (GType type);
@@ -317,7 +318,8 @@ set_property (GObject *obj,
             }
             break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -362,7 +364,8 @@ get_property (GObject *obj,
             }
             break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -432,6 +435,8 @@ type_class_init (gpointer g_class,
                                          g_param_spec_uint ("output-buffers", "Output buffers",
                                                             "The number of OMX output buffers",
                                                             1, 10, 4, G_PARAM_READWRITE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
     }
 }
 
@@ -490,6 +495,8 @@ output_loop (gpointer data)
 
     bclass = GST_OMX_BASE_FILTER2_GET_CLASS (self);
 
+    g_omx_threads_enter_task (gomx->threads, pad, GST_PAD_NAME (pad));
+
     GST_LOG_OBJECT (self, "begin");
 
     if (!self->ready)
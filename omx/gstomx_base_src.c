@@ -31,6 +31,7 @@ enum
     ARG_COMPONENT_NAME,
     ARG_LIBRARY_NAME,
     ARG_NUM_OUTPUT_BUFFERS,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
 };
 
 GSTOMX_BOILERPLATE (GstOmxBaseSrc, gst_omx_base_src, GstBaseSrc, GST_TYPE_BASE_SRC);
@@ -117,6 +118,9 @@ gst_omx_base_src_create_from_port (GstOmxBaseSrc *self,
 
     gomx = self->gomx;
 
+    /* runs on the GstBaseSrc streaming task */
+    g_omx_threads_enter_task (gomx->threads, GST_BASE_SRC_PAD (self), "src");
+
     GST_LOG_OBJECT (self, "begin");
 
     if (out_port->enabled)
@@ -266,7 +270,8 @@ set_property (GObject *obj,
             }
             break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -300,7 +305,8 @@ get_property (GObject *obj,
             }
             break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -357,6 +363,8 @@ type_class_init (gpointer g_class,
                                          g_param_spec_uint ("output-buffers", "Output buffers",
                                                             "The number of OMX output buffers",
                                                             1, 10, 4, G_PARAM_READWRITE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
     }
 
     omx_base_class->out_port_index = 0;
@@ -34,6 +34,26 @@
 
 GSTOMX_BOILERPLATE (GstOmxBaseVideoDec, gst_omx_base_videodec, GstOmxBaseFilter, GST_OMX_BASE_FILTER_TYPE);
 
+enum
+{
+    ARG_0,
+    ARG_BITSTREAM_BUFFER_MAX,
+    ARG_INPUT_OVERFLOWS,
+    ARG_QOS,
+    ARG_QOS_SKIP_LATENESS,
+    ARG_QOS_KEYFRAME_LATENESS,
+    ARG_FRAMES_SKIPPED,
+    ARG_FRAMES_DROPPED,
+    ARG_OUTPUT_RECONFIGURES,
+    ARG_PACK_INPUT,
+};
+
+#define DEFAULT_BITSTREAM_BUFFER_MAX 0
+#define DEFAULT_QOS TRUE
+#define DEFAULT_QOS_SKIP_LATENESS 20
+#define DEFAULT_QOS_KEYFRAME_LATENESS 500
+#define DEFAULT_PACK_INPUT TRUE
+
 /* OMX component not handling other color formats properly.. use this workaround
  * until component is fixed or we rebase to get config file support..
  */
@@ -53,6 +73,8 @@ static GstStaticPadTemplate src_template =
         );
 
 static GstFlowReturn push_buffer (GstOmxBaseFilter *self, GstBuffer *buf);
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+static gboolean pad_event (GstPad *pad, GstEvent *event);
 
 static void
 type_base_init (gpointer g_class)
@@ -65,11 +87,545 @@ type_base_init (gpointer g_class)
         gst_static_pad_template_get (&src_template));
 }
 
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxBaseVideoDec *self;
+
+    self = GST_OMX_BASE_VIDEODEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_BITSTREAM_BUFFER_MAX:
+            self->bitstream_buffer_max = g_value_get_uint (value);
+            break;
+        case ARG_QOS:
+            self->qos = g_value_get_boolean (value);
+            break;
+        case ARG_PACK_INPUT:
+            self->pack_input = g_value_get_boolean (value);
+            break;
+        case ARG_QOS_SKIP_LATENESS:
+            self->qos_skip_lateness = g_value_get_uint (value);
+            break;
+        case ARG_QOS_KEYFRAME_LATENESS:
+            self->qos_keyframe_lateness = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxBaseVideoDec *self;
+
+    self = GST_OMX_BASE_VIDEODEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_BITSTREAM_BUFFER_MAX:
+            g_value_set_uint (value, self->bitstream_buffer_max);
+            break;
+        case ARG_INPUT_OVERFLOWS:
+            g_value_set_uint (value, self->input_overflows);
+            break;
+        case ARG_QOS:
+            g_value_set_boolean (value, self->qos);
+            break;
+        case ARG_PACK_INPUT:
+            g_value_set_boolean (value, self->pack_input);
+            break;
+        case ARG_QOS_SKIP_LATENESS:
+            g_value_set_uint (value, self->qos_skip_lateness);
+            break;
+        case ARG_QOS_KEYFRAME_LATENESS:
+            g_value_set_uint (value, self->qos_keyframe_lateness);
+            break;
+        case ARG_FRAMES_SKIPPED:
+            g_value_set_uint (value, self->frames_skipped);
+            break;
+        case ARG_FRAMES_DROPPED:
+            g_value_set_uint (value, self->frames_dropped);
+            break;
+        case ARG_OUTPUT_RECONFIGURES:
+            g_value_set_uint (value, self->output_reconfigures);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
+    GObjectClass *gobject_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+
     GST_OMX_BASE_FILTER_CLASS (g_class)->push_buffer = push_buffer;
+    GST_OMX_BASE_FILTER_CLASS (g_class)->pad_chain = pad_chain;
+    GST_OMX_BASE_FILTER_CLASS (g_class)->pad_event = pad_event;
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_BITSTREAM_BUFFER_MAX,
+                                         g_param_spec_uint ("bitstream-buffer-max", "Bitstream buffer ceiling",
+                                                            "Upper bound in bytes for the input buffer size "
+                                                            "derived from resolution, level and bit-rate (0 = none)",
+                                                            0, G_MAXUINT, DEFAULT_BITSTREAM_BUFFER_MAX, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_INPUT_OVERFLOWS,
+                                         g_param_spec_uint ("input-overflows", "Input overflows",
+                                                            "Number of input frames larger than the input buffers",
+                                                            0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_QOS,
+                                         g_param_spec_boolean ("qos", "QoS",
+                                                               "Skip input frames when downstream reports lateness",
+                                                               DEFAULT_QOS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_QOS_SKIP_LATENESS,
+                                         g_param_spec_uint ("qos-skip-lateness", "QoS skip lateness",
+                                                            "Milliseconds late before non-reference frames are skipped",
+                                                            0, G_MAXUINT, DEFAULT_QOS_SKIP_LATENESS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_QOS_KEYFRAME_LATENESS,
+                                         g_param_spec_uint ("qos-keyframe-lateness", "QoS keyframe lateness",
+                                                            "Milliseconds late before decoding skips to the next keyframe",
+                                                            0, G_MAXUINT, DEFAULT_QOS_KEYFRAME_LATENESS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAMES_SKIPPED,
+                                         g_param_spec_uint ("frames-skipped", "Frames skipped",
+                                                            "Non-reference frames not decoded because of QoS",
+                                                            0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAMES_DROPPED,
+                                         g_param_spec_uint ("frames-dropped", "Frames dropped",
+                                                            "Frames not decoded while skipping to a keyframe because of QoS",
+                                                            0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_OUTPUT_RECONFIGURES,
+                                         g_param_spec_uint ("output-reconfigures", "Output reconfigures",
+                                                            "Times the output buffers were reallocated for new stream settings",
+                                                            0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_PACK_INPUT,
+                                         g_param_spec_boolean ("pack-input", "Pack input",
+                                                               "Fill each input buffer with a whole access unit, "
+                                                               "coalescing fragments that share a timestamp",
+                                                               DEFAULT_PACK_INPUT, G_PARAM_READWRITE));
+    }
+}
+
+/*
+ * Input frames bigger than the bitstream buffers: before the buffers are
+ * allocated the port simply grows to fit; once they are, the frame is split
+ * over several buffers by g_omx_port_send() and the larger size is kept for
+ * the next time the port is configured.
+ */
+static void
+input_overflow (GstOmxBaseVideoDec *self, guint size)
+{
+    GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+    guint new_size = (size + size / 4 + 4095) & ~4095;
+
+    self->input_overflows++;
+    self->input_buffer_size = new_size;
+
+    if (omx_base->gomx->omx_state == OMX_StateLoaded)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE param;
+
+        GST_INFO_OBJECT (self, "%u byte frame, growing input buffers to %u", size, new_size);
+
+        G_OMX_PORT_GET_DEFINITION (omx_base->in_port, &param);
+        param.nBufferSize = new_size;
+        G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &param);
+    }
+    else
+    {
+        GST_WARNING_OBJECT (self, "%u byte frame doesn't fit the input buffers, "
+                "splitting it", size);
+    }
+}
+
+/*
+ * Whether the coded picture in @buf may be referenced by later pictures,
+ * from the first slice/VOP/picture header found. Unknown formats and
+ * headers that can't be found count as references.
+ */
+static gboolean
+is_reference (GstOmxBaseVideoDec *self, GstBuffer *buf)
+{
+    GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+    const guint8 *data = GST_BUFFER_DATA (buf);
+    guint size = GST_BUFFER_SIZE (buf);
+    guint i;
+
+    switch (self->compression_format)
+    {
+        case OMX_VIDEO_CodingAVC:
+        {
+            GstBuffer *codec_data = omx_base->codec_data;
+
+            /* avcC streams carry length prefixed NAL units */
+            if (codec_data && GST_BUFFER_SIZE (codec_data) > 4 &&
+                GST_BUFFER_DATA (codec_data)[0] == 1)
+            {
+                guint nal_length_size = (GST_BUFFER_DATA (codec_data)[4] & 3) + 1;
+
+                i = 0;
+                while (i + nal_length_size < size)
+                {
+                    guint nal_size = 0, j;
+                    guint8 type;
+
+                    for (j = 0; j < nal_length_size; j++)
+                        nal_size = (nal_size << 8) | data[i + j];
+                    i += nal_length_size;
+
+                    type = data[i] & 0x1f;
+                    if (type == 1 || type == 5)
+                        return (data[i] & 0x60) != 0;
+                    i += nal_size;
+                }
+                return TRUE;
+            }
+
+            for (i = 0; i + 3 < size; i++)
+            {
+                guint8 type;
+
+                if (data[i] || data[i + 1] || data[i + 2] != 1)
+                    continue;
+
+                type = data[i + 3] & 0x1f;
+                if (type == 1 || type == 5)
+                    return (data[i + 3] & 0x60) != 0;
+            }
+            return TRUE;
+        }
+        case OMX_VIDEO_CodingMPEG4:
+            /* vop_coding_type 2 is a B-VOP */
+            for (i = 0; i + 4 < size; i++)
+            {
+                if (!data[i] && !data[i + 1] && data[i + 2] == 1 && data[i + 3] == 0xb6)
+                    return (data[i + 4] >> 6) != 2;
+            }
+            return TRUE;
+        case OMX_VIDEO_CodingMPEG2:
+            /* picture_coding_type 3 is a B picture */
+            for (i = 0; i + 5 < size; i++)
+            {
+                if (!data[i] && !data[i + 1] && data[i + 2] == 1 && data[i + 3] == 0x00)
+                    return ((data[i + 5] >> 3) & 7) != 3;
+            }
+            return TRUE;
+        default:
+            return TRUE;
+    }
+}
+
+/*
+ * Decide before ETB whether @buf is worth decoding given the lateness
+ * downstream last reported: non-reference frames go first, and past the
+ * keyframe threshold everything up to the next keyframe.
+ */
+static gboolean
+qos_skip (GstOmxBaseVideoDec *self, GstBuffer *buf)
+{
+    GstClockTime timestamp, earliest_time;
+    GstClockTimeDiff lateness;
+    gboolean delta;
+
+    delta = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    if (self->waiting_keyframe)
+    {
+        if (delta)
+        {
+            self->frames_dropped++;
+            return TRUE;
+        }
+
+        GST_INFO_OBJECT (self, "keyframe, resuming (%u dropped, %u skipped)",
+                self->frames_dropped, self->frames_skipped);
+        self->waiting_keyframe = FALSE;
+        return FALSE;
+    }
+
+    if (!self->qos || GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS))
+        return FALSE;
+
+    GST_OBJECT_LOCK (self);
+    earliest_time = self->earliest_time;
+    GST_OBJECT_UNLOCK (self);
+
+    if (!GST_CLOCK_TIME_IS_VALID (earliest_time))
+        return FALSE;
+
+    timestamp = gst_segment_to_running_time (&self->segment, GST_FORMAT_TIME,
+            GST_BUFFER_TIMESTAMP (buf));
+    if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+        return FALSE;
+
+    lateness = GST_CLOCK_DIFF (timestamp, earliest_time);
+    if (lateness <= (GstClockTimeDiff) self->qos_skip_lateness * GST_MSECOND)
+        return FALSE;
+
+    if (delta && lateness > (GstClockTimeDiff) self->qos_keyframe_lateness * GST_MSECOND)
+    {
+        GST_INFO_OBJECT (self, "%" GST_TIME_FORMAT " late, skipping to the next keyframe",
+                GST_TIME_ARGS (lateness));
+        self->waiting_keyframe = TRUE;
+        self->frames_dropped++;
+        return TRUE;
+    }
+
+    if (!is_reference (self, buf))
+    {
+        GST_DEBUG_OBJECT (self, "%" GST_TIME_FORMAT " late, skipping non-reference frame",
+                GST_TIME_ARGS (lateness));
+        self->frames_skipped++;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static GstFlowReturn
+pad_chain (GstPad *pad, GstBuffer *buf)
+{
+    GstOmxBaseVideoDec *self;
+    GstOmxBaseFilter *omx_base;
+
+    self = GST_OMX_BASE_VIDEODEC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    /* keyframe-only trick mode never sends delta units */
+    if (self->trick_mode && GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+        GST_LOG_OBJECT (self, "trick mode, discarding delta unit");
+        gst_buffer_unref (buf);
+        return GST_FLOW_OK;
+    }
+
+    /* nothing to skip before the component runs */
+    if (omx_base->ready && qos_skip (self, buf))
+    {
+        gst_buffer_unref (buf);
+        return GST_FLOW_OK;
+    }
+
+    /* shared input buffers already come with the right size */
+    if (G_UNLIKELY (GST_BUFFER_SIZE (buf) > self->input_buffer_size) &&
+        self->input_buffer_size && !GST_IS_OMXBUFFERTRANSPORT (buf))
+    {
+        input_overflow (self, GST_BUFFER_SIZE (buf));
+    }
+
+    return parent_class->pad_chain (pad, buf);
+}
+
+static void
+qos_reset (GstOmxBaseVideoDec *self)
+{
+    GST_OBJECT_LOCK (self);
+    self->earliest_time = GST_CLOCK_TIME_NONE;
+    GST_OBJECT_UNLOCK (self);
+    self->waiting_keyframe = FALSE;
+}
+
+static gboolean
+pad_event (GstPad *pad, GstEvent *event)
+{
+    GstOmxBaseVideoDec *self;
+
+    self = GST_OMX_BASE_VIDEODEC (GST_OBJECT_PARENT (pad));
+
+    switch (GST_EVENT_TYPE (event))
+    {
+        case GST_EVENT_NEWSEGMENT:
+        {
+            gboolean update;
+            gdouble rate, applied_rate;
+            GstFormat format;
+            gint64 start, stop, position;
+
+            gst_event_parse_new_segment_full (event, &update, &rate, &applied_rate,
+                    &format, &start, &stop, &position);
+
+            if (format == GST_FORMAT_TIME)
+                gst_segment_set_newsegment_full (&self->segment, update, rate,
+                        applied_rate, format, start, stop, position);
+
+            /* keyframes only reach downstream at the playback rate, so
+             * the rate is applied here and the segment sent on runs at 1.0 */
+            if (self->trick_mode && format == GST_FORMAT_TIME && rate != 1.0 &&
+                (rate > 0.0 || GST_CLOCK_TIME_IS_VALID (stop)))
+            {
+                GstSegment *segment = &self->segment;
+                gint64 out_stop = -1;
+
+                if (GST_CLOCK_TIME_IS_VALID (stop) && GST_CLOCK_TIME_IS_VALID (start))
+                    out_stop = (stop - start) / ABS (rate);
+
+                GST_OBJECT_LOCK (self);
+                self->trick_segment = *segment;
+                self->trick_segment_active = TRUE;
+                GST_OBJECT_UNLOCK (self);
+
+                GST_INFO_OBJECT (self, "trick mode at rate %g", rate);
+
+                gst_event_unref (event);
+                event = gst_event_new_new_segment_full (update, 1.0,
+                        rate * applied_rate, GST_FORMAT_TIME, 0, out_stop,
+                        gst_segment_to_stream_time (segment, GST_FORMAT_TIME,
+                                rate > 0.0 ? segment->start : segment->stop));
+            }
+            else
+            {
+                GST_OBJECT_LOCK (self);
+                self->trick_segment_active = FALSE;
+                GST_OBJECT_UNLOCK (self);
+            }
+            break;
+        }
+        case GST_EVENT_FLUSH_STOP:
+            gst_segment_init (&self->segment, GST_FORMAT_TIME);
+            qos_reset (self);
+            break;
+        default:
+            break;
+    }
+
+    return parent_class->pad_event (pad, event);
+}
+
+static gboolean
+src_event (GstPad *pad, GstEvent *event)
+{
+    GstOmxBaseVideoDec *self;
+    GstOmxBaseFilter *omx_base;
+
+    self = GST_OMX_BASE_VIDEODEC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK)
+    {
+        GstSeekFlags flags;
+        gboolean trick_mode, ret;
+
+        gst_event_parse_seek (event, NULL, NULL, &flags, NULL, NULL, NULL, NULL);
+
+        /* a flushing seek streams the new segment before the push returns,
+         * so the mode is in place already and only kept if the seek worked */
+        trick_mode = self->trick_mode;
+        self->trick_mode = (flags & GST_SEEK_FLAG_SKIP) != 0;
+
+        ret = gst_pad_push_event (omx_base->sinkpad, event);
+        if (!ret)
+            self->trick_mode = trick_mode;
+
+        GST_DEBUG_OBJECT (self, "seek %s, trick mode %s", ret ? "done" : "failed",
+                self->trick_mode ? "on" : "off");
+
+        return ret;
+    }
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_QOS)
+    {
+        gdouble proportion;
+        GstClockTimeDiff diff;
+        GstClockTime timestamp;
+
+        gst_event_parse_qos (event, &proportion, &diff, &timestamp);
+
+        GST_OBJECT_LOCK (self);
+        if (diff > 0)
+            self->earliest_time = timestamp + diff;
+        else
+            self->earliest_time = GST_CLOCK_TIME_NONE;
+        GST_OBJECT_UNLOCK (self);
+
+        GST_LOG_OBJECT (self, "QoS: proportion %g, diff %" G_GINT64_FORMAT
+                ", timestamp %" GST_TIME_FORMAT, proportion, diff,
+                GST_TIME_ARGS (timestamp));
+    }
+
+    return gst_pad_push_event (omx_base->sinkpad, event);
+}
+
+/* level_idc of the stream, from the caps or the avcC codec-data; 0 if unknown */
+static gint
+get_level (GstStructure *structure)
+{
+    const gchar *level;
+    const GValue *codec_data;
+
+    level = gst_structure_get_string (structure, "level");
+    if (level)
+    {
+        if (!strcmp (level, "1b"))
+            return 9;
+        return (gint) (g_ascii_strtod (level, NULL) * 10 + 0.5);
+    }
+
+    codec_data = gst_structure_get_value (structure, "codec_data");
+    if (codec_data && gst_structure_has_name (structure, "video/x-h264"))
+    {
+        GstBuffer *buffer = gst_value_get_buffer (codec_data);
+
+        if (GST_BUFFER_SIZE (buffer) > 3 && GST_BUFFER_DATA (buffer)[0] == 1)
+            return GST_BUFFER_DATA (buffer)[3];
+    }
+
+    return 0;
+}
+
+/*
+ * In trick mode the segment sent downstream runs at 1.0 from 0, so
+ * output timestamps become running time in the upstream segment and
+ * durations shrink by the rate.
+ */
+static void
+trick_mode_retime (GstOmxBaseVideoDec *self, GstBuffer *buf)
+{
+    GstSegment *segment = &self->trick_segment;
+    GstClockTime timestamp;
+
+    GST_OBJECT_LOCK (self);
+
+    if (!self->trick_segment_active)
+        goto out;
+
+    timestamp = GST_BUFFER_TIMESTAMP (buf);
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+    {
+        timestamp = gst_segment_to_running_time (segment, GST_FORMAT_TIME, timestamp);
+        if (GST_CLOCK_TIME_IS_VALID (timestamp))
+            timestamp -= segment->accum;
+        GST_BUFFER_TIMESTAMP (buf) = timestamp;
+    }
+
+    if (GST_BUFFER_DURATION_IS_VALID (buf))
+        GST_BUFFER_DURATION (buf) = GST_BUFFER_DURATION (buf) / ABS (segment->rate);
+
+out:
+    GST_OBJECT_UNLOCK (self);
 }
 
 static GstFlowReturn
@@ -77,6 +633,8 @@ push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf)
 {
     GstOmxBaseVideoDec *self = GST_OMX_BASE_VIDEODEC (omx_base);
     guint n_offset = omx_base->out_port->n_offset;
+
+    trick_mode_retime (self, buf);
     if (n_offset)
     {
 		if (self->prev_rowstride != self->rowstride ||
@@ -93,20 +651,25 @@ push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf)
     return parent_class->push_buffer (omx_base, buf);
 }
 
+/* renegotiate the src caps from the current output port definition */
 static void
-settings_changed_cb (GOmxCore *core)
+update_src_caps (GstOmxBaseVideoDec *self)
 {
-    GstOmxBaseFilter *omx_base;
-    GstOmxBaseVideoDec *self;
-    GstCaps *new_caps;
-
-    omx_base = core->object;
-    self = GST_OMX_BASE_VIDEODEC (omx_base);
+    GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+    GstCaps *caps, *peer_caps, *new_caps;
 
-    GST_DEBUG_OBJECT (omx_base, "settings changed");
+    self->caps_update = TRUE;
 
-    new_caps = gst_caps_intersect (gst_pad_get_caps (omx_base->srcpad),
-           gst_pad_peer_get_caps (omx_base->srcpad));
+    caps = gst_pad_get_caps (omx_base->srcpad);
+    peer_caps = gst_pad_peer_get_caps (omx_base->srcpad);
+    if (peer_caps)
+    {
+        new_caps = gst_caps_intersect (caps, peer_caps);
+        gst_caps_unref (peer_caps);
+        gst_caps_unref (caps);
+    }
+    else
+        new_caps = caps;
 
     if (!gst_caps_is_fixed (new_caps))
     {
@@ -119,6 +682,81 @@ settings_changed_cb (GOmxCore *core)
     GST_INFO_OBJECT (omx_base, "old caps are: %" GST_PTR_FORMAT, GST_PAD_CAPS (omx_base->srcpad));
 
     gst_pad_set_caps (omx_base->srcpad, new_caps);
+    gst_caps_unref (new_caps);
+
+    self->caps_update = FALSE;
+}
+
+/*
+ * New output settings in the middle of the stream. While the current
+ * buffers are big and plentiful enough only the caps change; otherwise the
+ * port has to be cycled, which can't be done from this (OMX callback)
+ * thread: the output task is woken up with a NULL buffer and runs
+ * output_reconfigure() once the frames decoded so far are pushed.
+ */
+static void
+settings_changed_cb (GOmxCore *core)
+{
+    GstOmxBaseFilter *omx_base;
+    GstOmxBaseVideoDec *self;
+    GOmxPort *out_port;
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+
+    omx_base = core->object;
+    self = GST_OMX_BASE_VIDEODEC (omx_base);
+    out_port = omx_base->out_port;
+
+    GST_DEBUG_OBJECT (omx_base, "settings changed");
+
+    G_OMX_PORT_GET_DEFINITION (out_port, &param);
+
+    if (out_port->buffers && out_port->enabled &&
+        (param.nBufferSize > out_port->buffers[0]->nAllocLen ||
+         param.nBufferCountActual > out_port->num_buffers))
+    {
+        GST_INFO_OBJECT (self, "%ldx%ld needs %lu x %lu byte buffers, have %u x %lu",
+                param.format.video.nFrameWidth, param.format.video.nFrameHeight,
+                param.nBufferCountActual, param.nBufferSize,
+                out_port->num_buffers, out_port->buffers[0]->nAllocLen);
+
+        /* frames still to come out of these buffers are pushed as copies,
+         * so downstream doesn't keep the disable below waiting */
+        out_port->lend_copies = TRUE;
+        g_atomic_int_set (&omx_base->output_reconfigure_pending, TRUE);
+        async_queue_push (out_port->queue, NULL);
+        return;
+    }
+
+    update_src_caps (self);
+}
+
+/*
+ * Runs in the output task, so nothing else takes buffers off the output
+ * port. The input port is left alone: whatever the component still holds
+ * there is decoded into the new buffers.
+ */
+static void
+output_reconfigure (GstOmxBaseFilter *omx_base)
+{
+    GstOmxBaseVideoDec *self = GST_OMX_BASE_VIDEODEC (omx_base);
+    GOmxPort *out_port = omx_base->out_port;
+
+    /* headers still held downstream are freed as they come back; the
+     * disable completes once the last one is */
+    g_omx_port_disable (out_port);
+    /* headers returned by the disable are gone with the buffers */
+    async_queue_flush (out_port->queue);
+
+    update_src_caps (self);
+
+    g_omx_port_enable (out_port);
+    out_port->lend_copies = FALSE;
+
+    self->output_reconfigures++;
+
+    GST_INFO_OBJECT (self, "output port reconfigured, %u x %lu bytes",
+            out_port->num_buffers,
+            out_port->buffers ? out_port->buffers[0]->nAllocLen : 0);
 }
 
 static gboolean
@@ -182,6 +820,24 @@ sink_setcaps (GstPad *pad,
 	if (!gst_structure_get_boolean (structure, "interlaced", &self->interlaced))
 		self->interlaced = FALSE;
 
+    /* size the bitstream buffers for one coded picture of this stream */
+    {
+        gint bitrate = 0;
+        guint size;
+
+        gst_structure_get_int (structure, "bitrate", &bitrate);
+
+        size = g_omx_bitstream_buffer_size (self->compression_format, width, height,
+                get_level (structure), MAX (bitrate, 0),
+                self->framerate_num, self->framerate_denom,
+                self->bitstream_buffer_max);
+
+        /* never go below what an earlier overflow asked for */
+        self->input_buffer_size = MAX (size, self->input_buffer_size);
+
+        GST_INFO_OBJECT (self, "input buffer size: %u", self->input_buffer_size);
+    }
+
     {
         const GValue *codec_data;
         GstBuffer *buffer;
@@ -195,6 +851,31 @@ sink_setcaps (GstPad *pad,
         }
     }
 
+    /* The WMV and MPEG-4 paths of g_omx_port_send() put the codec data in
+     * front of every buffer, so those are never packed.  Upstream that
+     * frames whole access units gets each one submitted right away. */
+    {
+        const gchar *alignment;
+        gboolean parsed = FALSE, framed = FALSE;
+
+        omx_base->pack_input = self->pack_input &&
+                self->compression_format != OMX_VIDEO_CodingWMV &&
+                self->compression_format != OMX_VIDEO_CodingMPEG4;
+
+        alignment = gst_structure_get_string (structure, "alignment");
+        gst_structure_get_boolean (structure, "parsed", &parsed);
+        gst_structure_get_boolean (structure, "framed", &framed);
+
+        if (alignment)
+            omx_base->input_aligned = !strcmp (alignment, "au");
+        else
+            omx_base->input_aligned = parsed || framed;
+
+        GST_INFO_OBJECT (self, "input packing %s, %s",
+                omx_base->pack_input ? "on" : "off",
+                omx_base->input_aligned ? "access units" : "fragments");
+    }
+
     /* REVISIT: to use OMX package from EZSDK you need to configure ports  */
     #ifdef USE_OMXTICORE
     {
@@ -214,7 +895,7 @@ sink_setcaps (GstPad *pad,
 
         param.format.video.nFrameWidth = width;
         param.format.video.nFrameHeight = height;
-        param.nBufferSize = width * height;
+        param.nBufferSize = self->input_buffer_size;
 
         G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &param);
         GST_DEBUG_OBJECT (self, "G_OMX_PORT_SET_DEFINITION");
@@ -235,10 +916,10 @@ src_getcaps (GstPad *pad)
     GstOmxBaseVideoDec *self   = GST_OMX_BASE_VIDEODEC (GST_PAD_PARENT (pad));
     GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
 
-    if (omx_base->gomx->omx_state > OMX_StateLoaded)
+    if (omx_base->gomx->omx_state > OMX_StateLoaded && !self->caps_update)
     {
-        /* currently, we cannot change caps once out of loaded..  later this
-         * could possibly be supported by enabling/disabling the port..
+        /* outside of Loaded caps only change with new output settings from
+         * the component, see settings_changed_cb()
          */
         GST_DEBUG_OBJECT (self, "cannot getcaps in %d state", omx_base->gomx->omx_state);
         return GST_PAD_CAPS (pad);
@@ -510,6 +1191,7 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base->omx_setup = omx_setup;
     omx_base->push_cb = push_cb;
+    omx_base->output_reconfigure = output_reconfigure;
 
     omx_base->gomx->settings_changed_cb = settings_changed_cb;
 
@@ -527,10 +1209,31 @@ type_instance_init (GTypeInstance *instance,
             GST_DEBUG_FUNCPTR (src_getcaps));
     gst_pad_set_setcaps_function (omx_base->srcpad,
             GST_DEBUG_FUNCPTR (src_setcaps));
+    gst_pad_set_event_function (omx_base->srcpad,
+            GST_DEBUG_FUNCPTR (src_event));
 //    gst_pad_set_query_function (omx_base->srcpad,
 //            GST_DEBUG_FUNCPTR (src_query));
 
 	self->prev_rowstride = 0;
 	self->prev_n_stride = 0;
+
+    self->bitstream_buffer_max = DEFAULT_BITSTREAM_BUFFER_MAX;
+    self->input_buffer_size = 0;
+    self->input_overflows = 0;
+    self->caps_update = FALSE;
+    self->output_reconfigures = 0;
+    self->pack_input = DEFAULT_PACK_INPUT;
+
+    self->qos = DEFAULT_QOS;
+    self->qos_skip_lateness = DEFAULT_QOS_SKIP_LATENESS;
+    self->qos_keyframe_lateness = DEFAULT_QOS_KEYFRAME_LATENESS;
+    self->frames_skipped = 0;
+    self->frames_dropped = 0;
+    gst_segment_init (&self->segment, GST_FORMAT_TIME);
+    qos_reset (self);
+
+    self->trick_mode = FALSE;
+    self->trick_segment_active = FALSE;
+    gst_segment_init (&self->trick_segment, GST_FORMAT_TIME);
 }
 
@@ -63,6 +63,32 @@ struct GstOmxBaseVideoDec
 
 	/* For sending crop event */
 	guint prev_n_stride, prev_rowstride;
+
+    /* input bitstream buffer sizing */
+    guint bitstream_buffer_max;     /**< ceiling for the computed size, 0 for none */
+    guint input_buffer_size;        /**< size in use, grown after an overflow */
+    guint input_overflows;
+
+    /* mid-stream output settings changes */
+    gboolean caps_update;           /**< src caps follow the output port definition */
+    guint output_reconfigures;      /**< output port reallocations */
+
+    gboolean pack_input;            /**< see GstOmxBaseFilter::pack_input */
+
+    /* QoS: input frames are skipped before ETB when downstream runs late */
+    gboolean qos;
+    guint qos_skip_lateness;        /**< ms late before non-reference frames are skipped */
+    guint qos_keyframe_lateness;    /**< ms late before skipping to the next keyframe */
+    GstSegment segment;
+    GstClockTime earliest_time;     /**< from the last QoS event, running time */
+    gboolean waiting_keyframe;
+    guint frames_skipped;           /**< non-reference frames never sent */
+    guint frames_dropped;           /**< frames dropped waiting for a keyframe */
+
+    /* keyframe-only trick mode, from a seek with GST_SEEK_FLAG_SKIP */
+    gboolean trick_mode;
+    gboolean trick_segment_active;  /**< output is retimed to trick_segment */
+    GstSegment trick_segment;       /**< protected by the object lock */
 };
 
 struct GstOmxBaseVideoDecClass
@@ -21,6 +21,7 @@
 
 #include "gstomx_base_videoenc.h"
 #include "gstomx.h"
+#include "gstomx_buffertransport.h"
 #include <OMX_TI_Index.h>
 #include <gst/video/video.h>
 
@@ -30,9 +31,14 @@ enum
 {
     ARG_0,
     ARG_BITRATE,
+    ARG_FRAME_STATS,
+    ARG_STATS,
+    ARG_BITSTREAM_BUFFER_MAX,
 };
 
 #define DEFAULT_BITRATE 500000
+#define DEFAULT_FRAME_STATS FALSE
+#define DEFAULT_BITSTREAM_BUFFER_MAX 0
 
 GSTOMX_BOILERPLATE (GstOmxBaseVideoEnc, gst_omx_base_videoenc, GstOmxBaseFilter, GST_OMX_BASE_FILTER_TYPE);
 
@@ -46,6 +52,21 @@ static GstStaticPadTemplate sink_template =
         );
 
 static gboolean pad_event (GstPad *pad, GstEvent *event);
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+static GstFlowReturn push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf);
+
+const gchar *
+gst_omx_videoenc_frame_type_to_str (GstOmxVideoEncFrameType type)
+{
+    switch (type)
+    {
+        case GST_OMX_VIDEOENC_FRAME_IDR: return "IDR";
+        case GST_OMX_VIDEOENC_FRAME_I:   return "I";
+        case GST_OMX_VIDEOENC_FRAME_P:   return "P";
+        case GST_OMX_VIDEOENC_FRAME_B:   return "B";
+        default:                         return "unknown";
+    }
+}
 
 static void
 type_base_init (gpointer g_class)
@@ -74,6 +95,12 @@ set_property (GObject *obj,
         case ARG_BITRATE:
             self->bitrate = g_value_get_uint (value);
             break;
+        case ARG_FRAME_STATS:
+            self->frame_stats = g_value_get_boolean (value);
+            break;
+        case ARG_BITSTREAM_BUFFER_MAX:
+            self->bitstream_buffer_max = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -96,19 +123,68 @@ get_property (GObject *obj,
             /** @todo propagate this to OpenMAX when processing. */
             g_value_set_uint (value, self->bitrate);
             break;
+        case ARG_FRAME_STATS:
+            g_value_set_boolean (value, self->frame_stats);
+            break;
+        case ARG_BITSTREAM_BUFFER_MAX:
+            g_value_set_uint (value, self->bitstream_buffer_max);
+            break;
+        case ARG_STATS:
+            {
+                GstStructure *s;
+                GstOmxVideoEncStats stats;
+
+                g_mutex_lock (self->stats_lock);
+                stats = self->stats;
+                g_mutex_unlock (self->stats_lock);
+
+                s = gst_structure_new ("omx-videoenc-stats",
+                        "frames", G_TYPE_UINT64, stats.frames,
+                        "bytes", G_TYPE_UINT64, stats.bytes,
+                        "idr-frames", G_TYPE_UINT64, stats.idr_frames,
+                        "i-frames", G_TYPE_UINT64, stats.i_frames,
+                        "p-frames", G_TYPE_UINT64, stats.p_frames,
+                        "b-frames", G_TYPE_UINT64, stats.b_frames,
+                        "avg-encode-time", G_TYPE_UINT64, stats.frames ?
+                                stats.total_encode_time / stats.frames : 0,
+                        "max-encode-time", G_TYPE_UINT64, stats.max_encode_time,
+                        "last-encode-time", G_TYPE_UINT64, stats.last_encode_time,
+                        NULL);
+                g_value_take_boxed (value, s);
+            }
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
 
+static void
+finalize (GObject *obj)
+{
+    GstOmxBaseVideoEnc *self;
+
+    self = GST_OMX_BASE_VIDEOENC (obj);
+
+    g_mutex_free (self->stats_lock);
+    gst_buffer_replace (&self->fragment, NULL);
+
+    G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
     GObjectClass *gobject_class;
+    GstOmxBaseFilterClass *bfilter_class;
 
     gobject_class = G_OBJECT_CLASS (g_class);
+    bfilter_class = GST_OMX_BASE_FILTER_CLASS (g_class);
+
+    gobject_class->finalize = finalize;
+    bfilter_class->pad_chain = pad_chain;
+    bfilter_class->push_buffer = push_buffer;
 
     /* Properties stuff */
     {
@@ -119,6 +195,22 @@ type_class_init (gpointer g_class,
                                          g_param_spec_uint ("bitrate", "Bit-rate",
                                                             "Encoding bit-rate",
                                                             0, G_MAXUINT, DEFAULT_BITRATE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAME_STATS,
+                                         g_param_spec_boolean ("frame-stats", "Frame statistics",
+                                                               "Post an 'omx-videoenc-frame' element message for every encoded frame",
+                                                               DEFAULT_FRAME_STATS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_STATS,
+                                         g_param_spec_boxed ("stats", "Statistics",
+                                                             "Aggregated encoder statistics",
+                                                             GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_BITSTREAM_BUFFER_MAX,
+                                         g_param_spec_uint ("bitstream-buffer-max", "Bitstream buffer ceiling",
+                                                            "Upper bound in bytes for the output buffer size "
+                                                            "derived from resolution, level and bit-rate (0 = none)",
+                                                            0, G_MAXUINT, DEFAULT_BITSTREAM_BUFFER_MAX, G_PARAM_READWRITE));
     }
 }
 
@@ -155,6 +247,11 @@ sink_setcaps (GstPad *pad,
 
     gst_structure_get_boolean (gst_caps_get_structure (caps, 0), "interlaced", &self->interlaced);
 
+    /* interlaced input is encoded field by field; when upstream shares its
+     * buffers both fields are submitted straight from the same frame.
+     */
+    omx_base->input_fields_separately = self->interlaced;
+
     if (gst_video_format_parse_caps_strided (caps,
             &format, &width, &height, &rowstride))
     {
@@ -248,8 +345,17 @@ omx_setup (GstOmxBaseFilter *omx_base)
             {
                 G_OMX_PORT_GET_DEFINITION (omx_base->out_port, &param);
 
-                /* this is against the standard; nBufferSize is read-only. */
-                param.nBufferSize = width * height;
+                /* this is against the standard; nBufferSize is read-only.
+                 * Size it for one coded picture rather than a raw one; a
+                 * frame that was ever split raises the floor.
+                 */
+                param.nBufferSize = g_omx_bitstream_buffer_size (self->compression_format,
+                        width, height, self->level, self->bitrate,
+                        self->framerate_num, self->framerate_denom,
+                        self->bitstream_buffer_max);
+                param.nBufferSize = MAX (param.nBufferSize, self->bitstream_buffer_size);
+                self->bitstream_buffer_size = param.nBufferSize;
+                GST_INFO_OBJECT (omx_base, "output buffer size: %lu", param.nBufferSize);
 
                 param.format.video.nFrameWidth = width;
                 param.format.video.nFrameHeight = height;
@@ -284,6 +390,397 @@ omx_setup (GstOmxBaseFilter *omx_base)
     GST_INFO_OBJECT (omx_base, "end");
 }
 
+/*
+ * Per-frame statistics
+ */
+
+typedef struct
+{
+    const guint8 *data;
+    guint size;
+    guint pos;      /**< position in bits */
+} BitReader;
+
+static guint
+bit_reader_get_bit (BitReader *br)
+{
+    guint bit;
+
+    if (br->pos >= br->size * 8)
+        return 0;
+
+    bit = (br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+    br->pos++;
+
+    return bit;
+}
+
+static guint
+bit_reader_get_ue (BitReader *br)
+{
+    guint zeros = 0;
+    guint value = 0;
+    guint i;
+
+    while (!bit_reader_get_bit (br) && zeros < 31)
+        zeros++;
+
+    for (i = 0; i < zeros; i++)
+        value = (value << 1) | bit_reader_get_bit (br);
+
+    return (1u << zeros) - 1 + value;
+}
+
+/**
+ * Find the type of an H.264 access unit by looking at the first slice NAL
+ * unit. Only the first two exp-golomb fields of the slice header are read,
+ * so emulation prevention bytes never come into play.
+ */
+static GstOmxVideoEncFrameType
+h264_frame_type (const guint8 *data, guint size)
+{
+    guint i;
+
+    for (i = 0; i + 4 < size; i++)
+    {
+        guint nal_type;
+
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+            continue;
+
+        nal_type = data[i + 3] & 0x1f;
+
+        if (nal_type == 5)
+            return GST_OMX_VIDEOENC_FRAME_IDR;
+
+        if (nal_type == 1)
+        {
+            BitReader br = { data + i + 4, size - i - 4, 0 };
+
+            bit_reader_get_ue (&br);  /* first_mb_in_slice */
+
+            switch (bit_reader_get_ue (&br) % 5)  /* slice_type */
+            {
+                case 0: case 3: return GST_OMX_VIDEOENC_FRAME_P;
+                case 1:         return GST_OMX_VIDEOENC_FRAME_B;
+                default:        return GST_OMX_VIDEOENC_FRAME_I;
+            }
+        }
+
+        i += 3;
+    }
+
+    return GST_OMX_VIDEOENC_FRAME_UNKNOWN;
+}
+
+static GstOmxVideoEncFrameType
+frame_type (GstOmxBaseVideoEnc *self, GstBuffer *buf)
+{
+    GstOmxVideoEncFrameType type = GST_OMX_VIDEOENC_FRAME_UNKNOWN;
+
+    if (self->compression_format == OMX_VIDEO_CodingAVC)
+        type = h264_frame_type (GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
+
+    if (type == GST_OMX_VIDEOENC_FRAME_UNKNOWN && GST_IS_OMXBUFFERTRANSPORT (buf))
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer = GST_GET_OMXBUFFER (buf);
+
+        if (omx_buffer)
+            type = (omx_buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME) ?
+                    GST_OMX_VIDEOENC_FRAME_I : GST_OMX_VIDEOENC_FRAME_P;
+    }
+    else if (type == GST_OMX_VIDEOENC_FRAME_UNKNOWN)
+    {
+        /* joined from several buffers, flagged after the first one */
+        type = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) ?
+                GST_OMX_VIDEOENC_FRAME_P : GST_OMX_VIDEOENC_FRAME_I;
+    }
+
+    return type;
+}
+
+/* a full output buffer without the end of frame flag continues in the next */
+static gboolean
+is_fragment (GstBuffer *buf)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+
+    if (!GST_IS_OMXBUFFERTRANSPORT (buf))
+        return FALSE;
+
+    omx_buffer = GST_GET_OMXBUFFER (buf);
+
+    return omx_buffer && !(omx_buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) &&
+           omx_buffer->nOffset + omx_buffer->nFilledLen >= omx_buffer->nAllocLen;
+}
+
+/**
+ * Joins a frame the component split over several output buffers: returns
+ * NULL while @buf is only a piece of it, then the whole frame, with the
+ * timestamp of its first piece.  The output buffers are grown before the
+ * next frame so it fits in one of them.  Any other buffer is returned as
+ * is; output frames are counted once, whatever the number of pieces.
+ */
+GstBuffer *
+gst_omx_base_videoenc_join_fragments (GstOmxBaseVideoEnc *self, GstBuffer *buf)
+{
+    GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+    GstBuffer *whole;
+    guint size;
+
+    if (G_LIKELY (!self->fragment && !is_fragment (buf)))
+        return buf;
+
+    if (!self->fragment)
+    {
+        GstOmxVideoEncFrameType type = frame_type (self, buf);
+
+        whole = gst_buffer_copy (buf);
+        if (type == GST_OMX_VIDEOENC_FRAME_IDR || type == GST_OMX_VIDEOENC_FRAME_I)
+            GST_BUFFER_FLAG_UNSET (whole, GST_BUFFER_FLAG_DELTA_UNIT);
+        else if (type != GST_OMX_VIDEOENC_FRAME_UNKNOWN)
+            GST_BUFFER_FLAG_SET (whole, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    else
+    {
+        whole = gst_buffer_merge (self->fragment, buf);
+        GST_BUFFER_TIMESTAMP (whole) = GST_BUFFER_TIMESTAMP (self->fragment);
+        GST_MINI_OBJECT_FLAGS (whole) = GST_MINI_OBJECT_FLAGS (self->fragment);
+        gst_buffer_unref (self->fragment);
+    }
+
+    if (is_fragment (buf))
+    {
+        GST_LOG_OBJECT (self, "holding %u bytes of a frame", GST_BUFFER_SIZE (whole));
+
+        self->fragment = whole;
+        gst_buffer_unref (buf);
+
+        /* the output task counted this piece as a frame */
+        g_mutex_lock (omx_base->num_buffers_mutex);
+        omx_base->frames_out--;
+        g_mutex_unlock (omx_base->num_buffers_mutex);
+
+        return NULL;
+    }
+
+    gst_buffer_set_caps (whole, GST_BUFFER_CAPS (buf));
+    gst_buffer_unref (buf);
+    self->fragment = NULL;
+
+    size = GST_BUFFER_SIZE (whole);
+    size = (size + size / 2 + 4095) & ~4095;
+    if (self->bitstream_buffer_max)
+        size = MIN (size, self->bitstream_buffer_max);
+
+    if (size > self->bitstream_buffer_size)
+    {
+        GST_WARNING_OBJECT (self, "%u byte frame was split, growing the output "
+                "buffers to %u bytes", GST_BUFFER_SIZE (whole), size);
+        self->bitstream_buffer_size = size;
+        g_atomic_int_set (&self->output_resize_pending, TRUE);
+    }
+
+    return whole;
+}
+
+/*
+ * Runs in the streaming thread, before the next frame goes in: once every
+ * frame sent so far has come out, the output task reallocates the output
+ * buffers (see output_reconfigure()) while no input is sent.
+ */
+static void
+grow_output (GstOmxBaseVideoEnc *self)
+{
+    GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+    GTimeVal end_time;
+    gboolean drained;
+    guint resizes;
+
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, (glong) omx_base->drain_timeout * 1000);
+
+    g_mutex_lock (omx_base->num_buffers_mutex);
+
+    while (omx_base->frames_out < omx_base->frames_in &&
+           omx_base->last_pad_push_return == GST_FLOW_OK)
+    {
+        if (!g_cond_timed_wait (omx_base->num_buffers_cond, omx_base->num_buffers_mutex, &end_time))
+            break;
+    }
+
+    drained = omx_base->frames_out >= omx_base->frames_in;
+    resizes = self->output_resizes;
+
+    g_mutex_unlock (omx_base->num_buffers_mutex);
+
+    if (!drained)
+    {
+        GST_DEBUG_OBJECT (self, "frames still encoding, growing the output later");
+        g_atomic_int_set (&self->output_resize_pending, TRUE);
+        return;
+    }
+
+    g_atomic_int_set (&omx_base->output_reconfigure_pending, TRUE);
+    async_queue_push (omx_base->out_port->queue, NULL);
+
+    g_mutex_lock (omx_base->num_buffers_mutex);
+
+    while (self->output_resizes == resizes &&
+           omx_base->last_pad_push_return == GST_FLOW_OK)
+    {
+        if (!g_cond_timed_wait (omx_base->num_buffers_cond, omx_base->num_buffers_mutex, &end_time))
+        {
+            GST_WARNING_OBJECT (self, "output buffers not regrown in time");
+            break;
+        }
+    }
+
+    g_mutex_unlock (omx_base->num_buffers_mutex);
+}
+
+static void
+output_reconfigure (GstOmxBaseFilter *omx_base)
+{
+    GstOmxBaseVideoEnc *self = GST_OMX_BASE_VIDEOENC (omx_base);
+
+    g_omx_port_resize_buffers (omx_base->out_port, self->bitstream_buffer_size);
+
+    g_mutex_lock (omx_base->num_buffers_mutex);
+    self->output_resizes++;
+    g_cond_broadcast (omx_base->num_buffers_cond);
+    g_mutex_unlock (omx_base->num_buffers_mutex);
+
+    GST_INFO_OBJECT (self, "output buffers grown to %u bytes", self->bitstream_buffer_size);
+}
+
+/**
+ * Look up (and consume) the submission time of the input frame that
+ * produced an output buffer with @timestamp.
+ */
+static GstClockTime
+take_submit_time (GstOmxBaseVideoEnc *self, GstClockTime timestamp)
+{
+    guint i;
+
+    if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+        return GST_CLOCK_TIME_NONE;
+
+    for (i = 0; i < GST_OMX_VIDEOENC_STATS_HISTORY; i++)
+    {
+        GstOmxVideoEncPending *pending;
+
+        pending = &self->pending[(self->pending_head - 1 - i) % GST_OMX_VIDEOENC_STATS_HISTORY];
+
+        if (pending->timestamp == timestamp)
+        {
+            pending->timestamp = GST_CLOCK_TIME_NONE;
+            return pending->submitted;
+        }
+    }
+
+    return GST_CLOCK_TIME_NONE;
+}
+
+static void
+reset_pending (GstOmxBaseVideoEnc *self)
+{
+    guint i;
+
+    g_mutex_lock (self->stats_lock);
+    for (i = 0; i < GST_OMX_VIDEOENC_STATS_HISTORY; i++)
+        self->pending[i].timestamp = GST_CLOCK_TIME_NONE;
+    self->pending_head = 0;
+    g_mutex_unlock (self->stats_lock);
+}
+
+static GstFlowReturn
+pad_chain (GstPad *pad, GstBuffer *buf)
+{
+    GstOmxBaseVideoEnc *self;
+    GstOmxVideoEncPending *pending;
+
+    self = GST_OMX_BASE_VIDEOENC (GST_OBJECT_PARENT (pad));
+
+    if (G_UNLIKELY (g_atomic_int_compare_and_exchange (&self->output_resize_pending, TRUE, FALSE)))
+        grow_output (self);
+
+    g_mutex_lock (self->stats_lock);
+    pending = &self->pending[self->pending_head++ % GST_OMX_VIDEOENC_STATS_HISTORY];
+    pending->timestamp = GST_BUFFER_TIMESTAMP (buf);
+    pending->submitted = gst_util_get_timestamp ();
+    g_mutex_unlock (self->stats_lock);
+
+    return parent_class->pad_chain (pad, buf);
+}
+
+static GstFlowReturn
+push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf)
+{
+    GstOmxBaseVideoEnc *self;
+    GstOmxVideoEncFrameType type;
+    GstClockTime submitted;
+    GstClockTime encode_time = GST_CLOCK_TIME_NONE;
+    guint size;
+
+    self = GST_OMX_BASE_VIDEOENC (omx_base);
+
+    buf = gst_omx_base_videoenc_join_fragments (self, buf);
+    if (!buf)
+        return GST_FLOW_OK;
+
+    type = frame_type (self, buf);
+    size = GST_BUFFER_SIZE (buf);
+
+    if (type == GST_OMX_VIDEOENC_FRAME_IDR || type == GST_OMX_VIDEOENC_FRAME_I)
+        GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    else if (type != GST_OMX_VIDEOENC_FRAME_UNKNOWN)
+        GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    g_mutex_lock (self->stats_lock);
+
+    submitted = take_submit_time (self, GST_BUFFER_TIMESTAMP (buf));
+    if (GST_CLOCK_TIME_IS_VALID (submitted))
+    {
+        encode_time = gst_util_get_timestamp () - submitted;
+        self->stats.total_encode_time += encode_time;
+        self->stats.max_encode_time = MAX (self->stats.max_encode_time, encode_time);
+        self->stats.last_encode_time = encode_time;
+    }
+
+    self->stats.frames++;
+    self->stats.bytes += size;
+    switch (type)
+    {
+        case GST_OMX_VIDEOENC_FRAME_IDR: self->stats.idr_frames++; break;
+        case GST_OMX_VIDEOENC_FRAME_I:   self->stats.i_frames++;   break;
+        case GST_OMX_VIDEOENC_FRAME_P:   self->stats.p_frames++;   break;
+        case GST_OMX_VIDEOENC_FRAME_B:   self->stats.b_frames++;   break;
+        default: break;
+    }
+
+    g_mutex_unlock (self->stats_lock);
+
+    GST_LOG_OBJECT (self, "frame: type=%s, size=%u, encode-time=%" GST_TIME_FORMAT,
+            gst_omx_videoenc_frame_type_to_str (type), size, GST_TIME_ARGS (encode_time));
+
+    if (self->frame_stats)
+    {
+        /* the EZSDK encoder does not report per-frame QP, so it is left at -1 */
+        gst_element_post_message (GST_ELEMENT (self),
+                gst_message_new_element (GST_OBJECT (self),
+                        gst_structure_new ("omx-videoenc-frame",
+                                "timestamp", G_TYPE_UINT64, GST_BUFFER_TIMESTAMP (buf),
+                                "frame-type", G_TYPE_STRING, gst_omx_videoenc_frame_type_to_str (type),
+                                "size", G_TYPE_UINT, size,
+                                "qp", G_TYPE_INT, -1,
+                                "encode-time", G_TYPE_UINT64, encode_time,
+                                NULL)));
+    }
+
+    return parent_class->push_buffer (omx_base, buf);
+}
+
 static gboolean
 pad_event (GstPad *pad, GstEvent *event)
 {
@@ -306,6 +803,12 @@ pad_event (GstPad *pad, GstEvent *event)
 
             return TRUE;
         }
+        case GST_EVENT_FLUSH_STOP:
+        {
+            reset_pending (self);
+            gst_buffer_replace (&self->fragment, NULL);
+            return parent_class->pad_event (pad, event);
+        }
         default:
         {
             return parent_class->pad_event (pad, event);
@@ -324,6 +827,7 @@ type_instance_init (GTypeInstance *instance,
     self = GST_OMX_BASE_VIDEOENC (instance);
 
     omx_base->omx_setup = omx_setup;
+    omx_base->output_reconfigure = output_reconfigure;
 
     omx_base->in_port->omx_allocate = TRUE;
     omx_base->out_port->omx_allocate = TRUE;
@@ -336,4 +840,14 @@ type_instance_init (GTypeInstance *instance,
 
     self->bitrate = DEFAULT_BITRATE;
     self->interlaced = FALSE;
+
+    self->frame_stats = DEFAULT_FRAME_STATS;
+    self->bitstream_buffer_max = DEFAULT_BITSTREAM_BUFFER_MAX;
+    self->bitstream_buffer_size = 0;
+    self->fragment = NULL;
+    self->output_resize_pending = FALSE;
+    self->output_resizes = 0;
+    self->level = 0;
+    self->stats_lock = g_mutex_new ();
+    reset_pending (self);
 }
@@ -34,6 +34,37 @@ typedef struct GstOmxBaseVideoEncClass GstOmxBaseVideoEncClass;
 
 #include "gstomx_base_filter.h"
 
+#define GST_OMX_VIDEOENC_STATS_HISTORY 32
+
+typedef enum
+{
+    GST_OMX_VIDEOENC_FRAME_UNKNOWN,
+    GST_OMX_VIDEOENC_FRAME_IDR,
+    GST_OMX_VIDEOENC_FRAME_I,
+    GST_OMX_VIDEOENC_FRAME_P,
+    GST_OMX_VIDEOENC_FRAME_B
+} GstOmxVideoEncFrameType;
+
+/** submission time of an input frame, matched by timestamp on output */
+typedef struct
+{
+    GstClockTime timestamp;
+    GstClockTime submitted;
+} GstOmxVideoEncPending;
+
+typedef struct
+{
+    guint64 frames;
+    guint64 bytes;
+    guint64 idr_frames;
+    guint64 i_frames;
+    guint64 p_frames;
+    guint64 b_frames;
+    GstClockTime total_encode_time;
+    GstClockTime max_encode_time;
+    GstClockTime last_encode_time;
+} GstOmxVideoEncStats;
+
 struct GstOmxBaseVideoEnc
 {
     GstOmxBaseFilter omx_base;
@@ -46,6 +77,21 @@ struct GstOmxBaseVideoEnc
 
     gint rowstride;     /**< rowstride of input buffer */
     gboolean interlaced;
+
+    /* output buffer sizing */
+    gint level;                     /**< level_idc set by the subclass, 0 if unknown */
+    guint bitstream_buffer_max;     /**< ceiling for the computed size, 0 for none */
+    guint bitstream_buffer_size;    /**< size in use, grown after an overflow */
+    GstBuffer *fragment;            /**< start of a frame bigger than the buffers */
+    gint output_resize_pending;     /**< grow the buffers before the next frame */
+    guint output_resizes;           /**< protected by num_buffers_mutex */
+
+    /* per-frame statistics */
+    gboolean frame_stats;   /**< post a message on the bus for every frame */
+    GstOmxVideoEncPending pending[GST_OMX_VIDEOENC_STATS_HISTORY];
+    guint pending_head;
+    GstOmxVideoEncStats stats;
+    GMutex *stats_lock;
 };
 
 struct GstOmxBaseVideoEncClass
@@ -54,6 +100,8 @@ struct GstOmxBaseVideoEncClass
 };
 
 GType gst_omx_base_videoenc_get_type (void);
+const gchar *gst_omx_videoenc_frame_type_to_str (GstOmxVideoEncFrameType type);
+GstBuffer *gst_omx_base_videoenc_join_fragments (GstOmxBaseVideoEnc *self, GstBuffer *buf);
 
 G_END_DECLS
 
@@ -59,6 +59,9 @@ static void gst_omxbuffertransport_init(GstOmxBufferTransport *self)
 
     self->omxbuffer = NULL;
     self->portptr = NULL;
+    self->numAdditionalHeaders = 0;
+    self->next = NULL;
+    self->lent_index = -1;
 
     GST_LOG("end\n");
 }
@@ -82,67 +85,212 @@ static void gst_omxbuffertransport_class_init(
 static void
 release_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
 {
+    /* a port being disabled gets its buffers back, not resubmitted */
+    if (!port->enabled)
+        return;
+
     switch (port->type)
     {
         case GOMX_PORT_INPUT:
             GST_LOG ("ETB: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
                     omx_buffer, omx_buffer ? omx_buffer->pAppPrivate : 0, omx_buffer ? omx_buffer->pBuffer : 0);
-            OMX_EmptyThisBuffer (port->core->omx_handle, omx_buffer);
+            g_omx_port_submit (port, omx_buffer);
             break;
         case GOMX_PORT_OUTPUT:
             GST_LOG ("FTB: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
                     omx_buffer, omx_buffer ? omx_buffer->pAppPrivate : 0, omx_buffer ? omx_buffer->pBuffer : 0);
-            OMX_FillThisBuffer (port->core->omx_handle, omx_buffer);
+            g_omx_port_submit (port, omx_buffer);
             break;
         default:
             break;
     }
 }
-#include <sys/time.h>
+
+/*
+ * Free list of idle wrappers, per port. Any thread may push; a pop takes
+ * the whole list and gives back what it doesn't use, which keeps it safe
+ * against a wrapper being popped and pushed again meanwhile.
+ */
+
+static void
+idle_push (GstOmxPortPtr *portptr, GstOmxBufferTransport *first,
+           GstOmxBufferTransport *last)
+{
+    gpointer head;
+
+    do {
+        head = g_atomic_pointer_get (&portptr->free_list);
+        last->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange (&portptr->free_list,
+                head, first));
+}
+
+static GstOmxBufferTransport *
+idle_take_all (GstOmxPortPtr *portptr)
+{
+    GstOmxBufferTransport *head;
+
+    do {
+        head = g_atomic_pointer_get (&portptr->free_list);
+        if (!head)
+            return NULL;
+    } while (!g_atomic_pointer_compare_and_exchange (&portptr->free_list,
+                head, NULL));
+
+    return head;
+}
+
+static GstOmxBufferTransport *
+idle_pop (GstOmxPortPtr *portptr)
+{
+    GstOmxBufferTransport *head, *last;
+
+    head = idle_take_all (portptr);
+    if (!head)
+        return NULL;
+
+    if (head->next)
+    {
+        for (last = head->next; last->next; last = last->next);
+        idle_push (portptr, head->next, last);
+    }
+
+    head->next = NULL;
+
+    return head;
+}
+
+/* a wrapper for the port, recycled when possible */
+static GstOmxBufferTransport *
+transport_get (GOmxPort *port)
+{
+    GstOmxBufferTransport *tdt_buf;
+
+    tdt_buf = idle_pop (port->portptr);
+    if (G_UNLIKELY (!tdt_buf))
+    {
+        tdt_buf = (GstOmxBufferTransport*)
+                  gst_mini_object_new(GST_TYPE_OMXBUFFERTRANSPORT);
+        g_atomic_int_inc (&port->portptr->num_wrappers);
+    }
+
+    return tdt_buf;
+}
+
+/* Creates wrappers until the port has count of them. Idle wrappers hold
+ * no reference on the port pointer, they are freed with it.
+ */
+void gst_omxbuffertransport_prealloc (GstOmxPortPtr *portptr, guint count)
+{
+    while (g_atomic_int_get (&portptr->num_wrappers) < (gint) count)
+    {
+        GstOmxBufferTransport *tdt_buf;
+
+        tdt_buf = (GstOmxBufferTransport*)
+                  gst_mini_object_new(GST_TYPE_OMXBUFFERTRANSPORT);
+        g_atomic_int_inc (&portptr->num_wrappers);
+        idle_push (portptr, tdt_buf, tdt_buf);
+    }
+}
+
+void gst_omxbuffertransport_free_idle (GstOmxPortPtr *portptr)
+{
+    GstOmxBufferTransport *tdt_buf, *next;
+
+    for (tdt_buf = idle_take_all (portptr); tdt_buf; tdt_buf = next)
+    {
+        next = tdt_buf->next;
+        tdt_buf->next = NULL;
+        /* without a port pointer finalize really frees it */
+        gst_buffer_unref (GST_BUFFER (tdt_buf));
+    }
+}
+
+/* Called once the port pointer is invalidated, for each header the port is
+ * about to free: TRUE if it is still held downstream, and then left to the
+ * buffer holding it, which frees it on finalize.
+ */
+gboolean gst_omxbuffertransport_orphan (GstOmxPortPtr *portptr, guint index)
+{
+    return index < portptr->num_lent &&
+           g_atomic_int_compare_and_exchange (&portptr->lent[index],
+                   GST_OMXPORTPTR_LENT, GST_OMXPORTPTR_ORPHANED);
+}
 
 static void gst_omxbuffertransport_finalize(GstBuffer *gstbuffer)
 {
     GstOmxBufferTransport *self = GST_OMXBUFFERTRANSPORT(gstbuffer);
-    int ii;
-    GST_LOG("begin\n"); 
-	static guint64 beftime = 0;
-
-	gst_omxportptr_mutex_lock(self->portptr);
+    GstOmxPortPtr *portptr = self->portptr;
+    GOmxPort *port = NULL;
+    guint ii;
 
-	if (self->portptr->port) {
-		if (self->omxbuffer)
-			release_buffer (self->portptr->port, self->omxbuffer);
+    GST_LOG("begin\n");
 
-		for(ii = 0; ii < self->numAdditionalHeaders; ii++) {
-			//printf("finalize buffer:%p\n",self->addHeader[ii]);
-			if(self->addHeader[ii])
-				release_buffer(self->portptr->port,self->addHeader[ii]);
-		}
-	}
-	gst_omxportptr_mutex_unlock(self->portptr);
+    if (portptr && self->lent_index >= 0) {
+        gint *lent = &portptr->lent[self->lent_index];
+
+        /* failing, the port freed its buffers while this one was out */
+        if (!g_atomic_int_compare_and_exchange (lent,
+                    GST_OMXPORTPTR_LENT, GST_OMXPORTPTR_HOME)) {
+            GST_DEBUG ("freeing orphaned header %p", self->omxbuffer);
+            OMX_FreeBuffer (portptr->omx_handle, portptr->port_index,
+                    self->omxbuffer);
+            self->omxbuffer = NULL;
+            g_atomic_int_set (lent, GST_OMXPORTPTR_HOME);
+        }
+        self->lent_index = -1;
+    }
 
-    if(self->addHeader) {
-      free(self->addHeader);
-	  //printf("free\n");
+    if (portptr) {
+        port = gst_omxportptr_enter(portptr);
+        if (port) {
+            if (self->omxbuffer)
+                release_buffer (port, self->omxbuffer);
+
+            for(ii = 0; ii < self->numAdditionalHeaders; ii++) {
+                if(self->addHeader[ii])
+                    release_buffer(port,self->addHeader[ii]);
+            }
+        }
+        gst_omxportptr_leave(portptr);
     }
-	if(self->parent)
-		gst_buffer_unref(self->parent);
-
-	if(self->bufSem) {
-		struct timeval tv;
-		guint64 afttime;
-	    gettimeofday(&tv, NULL);
-		afttime = (tv.tv_sec * 1000000 + tv.tv_usec);
-		//printf("sem up:%lld\n",(afttime-beftime) );
-		beftime = afttime;
-		g_sem_up(self->bufSem);
-	}
-	
-	self->addHeader = NULL;
+
+    if(self->parent)
+        gst_buffer_unref(self->parent);
+
+    if(self->bufSem)
+        g_sem_up(self->bufSem);
+
+    self->numAdditionalHeaders = 0;
     self->omxbuffer = NULL;
-	gst_omxportptr_unref(self->portptr);
     self->portptr = NULL;
     self->parent = NULL;
+    self->bufSem = NULL;
+
+    if (port) {
+        /* back on the port's free list instead of freed: drop what the
+         * GstBuffer finalize would and keep the wrapper alive */
+        gst_caps_replace (&GST_BUFFER_CAPS (gstbuffer), NULL);
+        GST_MINI_OBJECT_FLAGS (gstbuffer) = 0;
+        GST_BUFFER_TIMESTAMP (gstbuffer) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DURATION (gstbuffer) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_OFFSET (gstbuffer) = GST_BUFFER_OFFSET_NONE;
+        GST_BUFFER_OFFSET_END (gstbuffer) = GST_BUFFER_OFFSET_NONE;
+        GST_BUFFER_DATA (gstbuffer) = NULL;
+        GST_BUFFER_SIZE (gstbuffer) = 0;
+
+        gst_buffer_ref (gstbuffer);
+        idle_push (portptr, self, self);
+
+        /* may be the last reference, freeing the list with this wrapper
+         * on it; don't touch self after this */
+        gst_omxportptr_unref (portptr);
+        return;
+    }
+
+    if (portptr)
+        gst_omxportptr_unref(portptr);
+
     /* Call GstBuffer's finalize routine, so our base class can do it's cleanup
      * as well.  If we don't do this, we'll have a memory leak that is very
      * difficult to track down.
@@ -156,9 +304,13 @@ static void gst_omxbuffertransport_finalize(GstBuffer *gstbuffer)
 GstBuffer* gst_omxbuffertransport_new (GOmxPort *port, OMX_BUFFERHEADERTYPE *buffer)
 {
     GstOmxBufferTransport *tdt_buf;
+    GstOmxPortPtr *portptr = port->portptr;
+    gint i;
+
+    if (buffer->pBuffer == NULL)
+        return NULL;
 
-    tdt_buf = (GstOmxBufferTransport*)
-              gst_mini_object_new(GST_TYPE_OMXBUFFERTRANSPORT);
+    tdt_buf = transport_get (port);
 
     g_return_val_if_fail(tdt_buf != NULL, NULL);
 
@@ -166,19 +318,21 @@ GstBuffer* gst_omxbuffertransport_new (GOmxPort *port, OMX_BUFFERHEADERTYPE *buf
     GST_BUFFER_DATA(tdt_buf) = buffer->pBuffer;
     gst_buffer_set_caps(GST_BUFFER (tdt_buf), port->caps);
 
-    if (GST_BUFFER_DATA(tdt_buf) == NULL) {
-        gst_mini_object_unref(GST_MINI_OBJECT(tdt_buf));
-        return NULL;
-    }
-
     tdt_buf->omxbuffer  = buffer;
     tdt_buf->portptr    = gst_omxportptr_ref(port->portptr);
 
 	tdt_buf->numAdditionalHeaders = 0;
-	tdt_buf->addHeader = NULL;
 	tdt_buf->parent = NULL;
 	tdt_buf->bufSem   = NULL;
 
+    /* remembered until finalized, see gst_omxbuffertransport_orphan() */
+    i = G_OMX_PORT_BUFFER_INDEX (port, buffer);
+    if (i >= 0 && (guint) i < portptr->num_lent)
+    {
+        g_atomic_int_set (&portptr->lent[i], GST_OMXPORTPTR_LENT);
+        tdt_buf->lent_index = i;
+    }
+
     GST_LOG("end new\n");
 
     return GST_BUFFER(tdt_buf);
@@ -187,26 +341,23 @@ GstBuffer* gst_omxbuffertransport_new (GOmxPort *port, OMX_BUFFERHEADERTYPE *buf
 GstBuffer* gst_omxbuffertransport_clone (GstBuffer *parent, GOmxPort *port)
 {
     GstOmxBufferTransport *tdt_buf;
-    tdt_buf = (GstOmxBufferTransport*)
-              gst_mini_object_new(GST_TYPE_OMXBUFFERTRANSPORT);
+
+    if (GST_BUFFER_DATA(parent) == NULL)
+        return NULL;
+
+    tdt_buf = transport_get (port);
 
     g_return_val_if_fail(tdt_buf != NULL, NULL);
 
     GST_BUFFER_SIZE(tdt_buf) = GST_BUFFER_SIZE(parent);
     GST_BUFFER_DATA(tdt_buf) = GST_BUFFER_DATA(parent);
-    GST_BUFFER_CAPS(GST_BUFFER (tdt_buf)) = gst_caps_ref (GST_BUFFER_CAPS(parent));
+    gst_buffer_set_caps(GST_BUFFER (tdt_buf), GST_BUFFER_CAPS(parent));
 	GST_BUFFER_TIMESTAMP(tdt_buf) = GST_BUFFER_TIMESTAMP(parent);
 	GST_BUFFER_DURATION(tdt_buf) = GST_BUFFER_DURATION(parent);
 
-    if (GST_BUFFER_DATA(tdt_buf) == NULL) {
-        gst_mini_object_unref(GST_MINI_OBJECT(tdt_buf));
-        return NULL;
-    }
-
     tdt_buf->omxbuffer  = NULL;
     tdt_buf->portptr    = gst_omxportptr_ref(port->portptr);
 	tdt_buf->numAdditionalHeaders = 0;
-	tdt_buf->addHeader = NULL;
 	tdt_buf->bufSem    = NULL;
 	tdt_buf->parent = parent;
 
@@ -219,18 +370,14 @@ GstBuffer* gst_omxbuffertransport_clone (GstBuffer *parent, GOmxPort *port)
 
 void gst_omxbuffertransport_set_additional_headers (GstOmxBufferTransport *self ,guint numHeaders,OMX_BUFFERHEADERTYPE **buffer)
 {
-    int ii;
+    guint ii;
+
+    g_return_if_fail (numHeaders <= GST_OMXBUFFERTRANSPORT_MAX_HEADERS);
 
 	if(numHeaders == 0)
 		return;
 
-	if(self->addHeader)
-		free(self->addHeader);
-	
-    self->addHeader = malloc(numHeaders*sizeof(OMX_BUFFERHEADERTYPE *));
-
 	for(ii = 0; ii < numHeaders; ii++) {
-		//printf("additional header:%p\n", buffer[ii]);
 		self->addHeader[ii] = buffer[ii];
 	}
 	self->numAdditionalHeaders = numHeaders;
@@ -55,15 +55,23 @@ typedef struct _GstOmxBufferTransportClass GstOmxBufferTransportClass;
     ((obj) ? GST_OMXBUFFERTRANSPORT(obj)->portptr->port : NULL)
 
 
+/* Headers released together with the main one, one per additional
+ * videomixer input */
+#define GST_OMXBUFFERTRANSPORT_MAX_HEADERS 16
+
 /* _GstOmxBufferTransport object */
 struct _GstOmxBufferTransport {
     GstBuffer  parent_instance;
     OMX_BUFFERHEADERTYPE *omxbuffer;
     GstOmxPortPtr *portptr;
 	guint numAdditionalHeaders;
-	OMX_BUFFERHEADERTYPE **addHeader;
+	OMX_BUFFERHEADERTYPE *addHeader[GST_OMXBUFFERTRANSPORT_MAX_HEADERS];
 	GstBuffer *parent;
 	GSem *bufSem;
+	/* next idle wrapper on the port's free list */
+	GstOmxBufferTransport *next;
+	/* slot in the port pointer's lent table, -1 if none */
+	gint lent_index;
 };
 
 struct _GstOmxBufferTransportClass {
@@ -74,6 +82,9 @@ struct _GstOmxBufferTransportClass {
 GType      gst_omxbuffertransport_get_type(void);
 GstBuffer* gst_omxbuffertransport_new(GOmxPort *port, OMX_BUFFERHEADERTYPE *buffer);
 void gst_omxbuffertransport_set_additional_headers (GstOmxBufferTransport *self ,guint numHeaders,OMX_BUFFERHEADERTYPE **buffer);
+void gst_omxbuffertransport_prealloc (GstOmxPortPtr *portptr, guint count);
+void gst_omxbuffertransport_free_idle (GstOmxPortPtr *portptr);
+gboolean gst_omxbuffertransport_orphan (GstOmxPortPtr *portptr, guint index);
 
 
 G_END_DECLS 
@@ -92,6 +92,14 @@ char* TYPE_NAMES(int i)
 }
 
 #define MAX_SHIFTS	30
+
+/* a capture time this far off the current mapping restarts it */
+#define SYNC_RESYNC_THRESHOLD GST_SECOND
+
+/* adaptive skipping is evaluated over this many frames, and backs off
+ * after this many windows without trouble */
+#define ADAPT_WINDOW 30
+#define ADAPT_RECOVER_WINDOWS 4
 /**
  * SECTION:element-omx_camera
  *
@@ -115,7 +123,9 @@ enum
   ARG_SCAN_TYPE,
   ARG_SKIP_FRAMES,
   ARG_VIF_MODE,
-  ARG_OVERRIDE_COLORSPACE
+  ARG_OVERRIDE_COLORSPACE,
+  ARG_STATS,
+  ARG_ADAPTIVE_SKIP
 };
 
 GSTOMX_BOILERPLATE (GstOmxCamera, gst_omx_camera, GstOmxBaseSrc,
@@ -152,6 +162,16 @@ src_setcaps (GstPad * pad, GstCaps * caps)
 
   if (gst_video_format_parse_caps_strided (caps,
           &format, &width, &height, &rowstride)) {
+    gint fps_n, fps_d;
+
+    /* capture period, for the overrun accounting */
+    if (gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+            "framerate", &fps_n, &fps_d) && fps_n > 0) {
+      g_mutex_lock (self->stats_lock);
+      self->sync.interval = gst_util_uint64_scale_int (GST_SECOND, fps_d,
+          fps_n);
+      g_mutex_unlock (self->stats_lock);
+    }
 
     /* Output port configuration: */
     OMX_PARAM_PORTDEFINITIONTYPE param;
@@ -287,6 +307,328 @@ start_ports (GstOmxCamera * self)
   g_omx_port_enable (self->port);
 }
 
+/*
+ * Capture timestamps:
+ *
+ * The VFCC stamps every frame with its capture time, on a clock of its own.
+ * The first frame after a (re)start maps that clock to running time on its
+ * arrival.  Afterwards the difference between elapsed running time and
+ * elapsed capture time is tracked through the lower envelope of a sliding
+ * window, which follows the drift between the two clocks while ignoring
+ * frames that reached userspace late, as the RTP jitterbuffer does for
+ * sender clocks.
+ */
+
+void
+gst_omx_camera_sync_reset (GstOmxCameraSync * sync)
+{
+  sync->base_hw = GST_CLOCK_TIME_NONE;
+  sync->base_local = GST_CLOCK_TIME_NONE;
+  sync->last_hw = GST_CLOCK_TIME_NONE;
+  sync->base_time = GST_CLOCK_TIME_NONE;
+  sync->skew = 0;
+  sync->window_pos = 0;
+  sync->window_filled = FALSE;
+  sync->window_min = G_MAXINT64;
+}
+
+static GstClockTime
+sync_timestamp (GstOmxCameraSync * sync, GstClockTime hw_time,
+    GstClockTime base_time, GstClockTime now)
+{
+  gint64 delta = 0, old;
+  gint64 timestamp;
+  guint i;
+
+  if (GST_CLOCK_TIME_IS_VALID (sync->base_hw)) {
+    delta = (gint64) (now - sync->base_local) -
+        (gint64) (hw_time - sync->base_hw);
+
+    /* a paused pipeline, a capture clock that stands still or jumps */
+    if (base_time != sync->base_time || hw_time <= sync->last_hw ||
+        ABS (delta - sync->skew) > SYNC_RESYNC_THRESHOLD) {
+      GST_DEBUG ("resync: capture %" GST_TIME_FORMAT
+          ", delta %" G_GINT64_FORMAT, GST_TIME_ARGS (hw_time), delta);
+      gst_omx_camera_sync_reset (sync);
+      sync->stats.resyncs++;
+    }
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (sync->base_hw)) {
+    sync->base_hw = hw_time;
+    sync->base_local = now;
+    sync->base_time = base_time;
+    delta = 0;
+  }
+
+  if (!sync->window_filled) {
+    sync->window[sync->window_pos++] = delta;
+    sync->window_min = MIN (sync->window_min, delta);
+    sync->skew = sync->window_min;
+
+    if (sync->window_pos == GST_OMX_CAMERA_SYNC_WINDOW) {
+      sync->window_filled = TRUE;
+      sync->window_pos = 0;
+    }
+  } else {
+    old = sync->window[sync->window_pos];
+    sync->window[sync->window_pos] = delta;
+    sync->window_pos = (sync->window_pos + 1) % GST_OMX_CAMERA_SYNC_WINDOW;
+
+    if (delta <= sync->window_min) {
+      sync->window_min = delta;
+    } else if (old == sync->window_min) {
+      sync->window_min = G_MAXINT64;
+      for (i = 0; i < GST_OMX_CAMERA_SYNC_WINDOW; i++)
+        sync->window_min = MIN (sync->window_min, sync->window[i]);
+    }
+
+    /* move slowly, a single early frame must not shift the timeline */
+    sync->skew = (sync->window_min + 124 * sync->skew) / 125;
+  }
+
+  sync->last_hw = hw_time;
+
+  timestamp = (gint64) sync->base_local +
+      (gint64) (hw_time - sync->base_hw) + sync->skew;
+
+  return timestamp > 0 ? (GstClockTime) timestamp : 0;
+}
+
+/**
+ * Returns the running time at which a frame stamped @hw_time by the VFCC
+ * was captured, or GST_CLOCK_TIME_NONE when @element has no clock, and
+ * accounts its capture-to-push delay.
+ */
+GstClockTime
+gst_omx_camera_sync_buffer (GstOmxCameraSync * sync, GstElement * element,
+    GstClockTime hw_time)
+{
+  GstClock *clock;
+  GstClockTime timestamp, base_time, now;
+
+  /* timestamps, LOCK to get clock and base time. */
+  GST_OBJECT_LOCK (element);
+  if ((clock = GST_ELEMENT_CLOCK (element))) {
+    /* we have a clock, get base time and ref clock */
+    base_time = element->base_time;
+    gst_object_ref (clock);
+  } else {
+    /* no clock, can't set timestamps */
+    base_time = GST_CLOCK_TIME_NONE;
+  }
+  GST_OBJECT_UNLOCK (element);
+
+  /* the VFCC skips frames silently when it has no buffer to fill */
+  if (GST_CLOCK_TIME_IS_VALID (hw_time) &&
+      GST_CLOCK_TIME_IS_VALID (sync->last_hw) && hw_time > sync->last_hw &&
+      sync->interval) {
+    guint64 gap = (hw_time - sync->last_hw + sync->interval / 2) /
+        sync->interval;
+
+    if (gap > sync->max_gap) {
+      GST_DEBUG_OBJECT (element, "overrun: %" G_GUINT64_FORMAT
+          " frames lost", gap - sync->max_gap);
+      sync->stats.overruns++;
+      sync->stats.dropped += gap - sync->max_gap;
+    }
+  }
+
+  if (!clock)
+    return GST_CLOCK_TIME_NONE;
+
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+
+  if (now > base_time)
+    now -= base_time;
+  else
+    now = 0;
+
+  /* a frame without a capture time is as old as its arrival */
+  if (GST_CLOCK_TIME_IS_VALID (hw_time))
+    timestamp = sync_timestamp (sync, hw_time, base_time, now);
+  else
+    timestamp = now;
+
+  sync->stats.frames++;
+  sync->stats.last_delay = now > timestamp ? now - timestamp : 0;
+  sync->stats.total_delay += sync->stats.last_delay;
+  sync->stats.max_delay = MAX (sync->stats.max_delay, sync->stats.last_delay);
+  if (sync->interval && sync->stats.last_delay > sync->interval * sync->max_gap)
+    sync->stats.late++;
+  if (GST_CLOCK_TIME_IS_VALID (sync->base_hw) &&
+      sync->last_hw > sync->base_hw)
+    sync->stats.drift_ppm = (gdouble) sync->skew * 1e6 /
+        (sync->last_hw - sync->base_hw);
+
+  GST_LOG_OBJECT (element, "capture %" GST_TIME_FORMAT " -> %"
+      GST_TIME_FORMAT ", delay %" GST_TIME_FORMAT, GST_TIME_ARGS (hw_time),
+      GST_TIME_ARGS (timestamp), GST_TIME_ARGS (sync->stats.last_delay));
+
+  return timestamp;
+}
+
+/**
+ * Tells @sync that frames are captured under @mask, so that the gaps it
+ * leaves in capture time are not taken for overruns.
+ */
+void
+gst_omx_camera_sync_set_skip_mask (GstOmxCameraSync * sync, guint32 mask)
+{
+  guint run = 0, longest = 0, i;
+
+  /* longest run of skipped frames, the mask repeats every 30 frames */
+  for (i = 0; i < 2 * MAX_SHIFTS; i++) {
+    if (mask & (1 << (i % MAX_SHIFTS))) {
+      run++;
+      longest = MAX (longest, run);
+    } else {
+      run = 0;
+    }
+  }
+
+  sync->max_gap = MIN (longest, MAX_SHIFTS) + 1;
+  sync->skip_mask = mask;
+}
+
+/**
+ * Average time between the frames @sync lets through: the capture period
+ * stretched by the frames the skip mask drops, GST_CLOCK_TIME_NONE while
+ * the period is unknown.
+ */
+GstClockTime
+gst_omx_camera_sync_duration (GstOmxCameraSync * sync)
+{
+  guint captured = 0, i;
+
+  if (!sync->interval)
+    return GST_CLOCK_TIME_NONE;
+
+  for (i = 0; i < MAX_SHIFTS; i++) {
+    if (!(sync->skip_mask & (1 << i)))
+      captured++;
+  }
+
+  return gst_util_uint64_scale_int (sync->interval, MAX_SHIFTS,
+      MAX (captured, 1));
+}
+
+GstStructure *
+gst_omx_camera_stats_to_structure (const GstOmxCameraStats * stats)
+{
+  return gst_structure_new ("omx-camera-stats",
+      "frames", G_TYPE_UINT64, stats->frames,
+      "avg-capture-delay", G_TYPE_UINT64, stats->frames ?
+          stats->total_delay / stats->frames : 0,
+      "max-capture-delay", G_TYPE_UINT64, stats->max_delay,
+      "last-capture-delay", G_TYPE_UINT64, stats->last_delay,
+      "drift-ppm", G_TYPE_DOUBLE, stats->drift_ppm,
+      "resyncs", G_TYPE_UINT, stats->resyncs,
+      "overruns", G_TYPE_UINT64, stats->overruns,
+      "dropped-frames", G_TYPE_UINT64, stats->dropped,
+      "late-frames", G_TYPE_UINT64, stats->late,
+      "out-of-buffers", G_TYPE_UINT64, stats->out_of_buffers,
+      NULL);
+}
+
+/**
+ * Returns the OMX_TI_IndexConfigVFCCFrameSkip mask dropping @skip frames
+ * after every captured one.
+ */
+guint32
+gst_omx_camera_skip_mask (guint skip)
+{
+  guint32 shifts = skip, mask = 0, i = 0, count = 0;
+
+  if (shifts) {
+    while (count < MAX_SHIFTS) {
+
+      if ((count + shifts) > MAX_SHIFTS) {
+        shifts = MAX_SHIFTS - count;
+      }
+      for (i = 0; i < shifts; i++) {
+        mask = mask << 1;
+        mask = mask | 1;
+        count++;
+      }
+      if (count < MAX_SHIFTS) {
+        mask = mask << 1;
+        count++;
+      }
+    }
+  }
+
+  return mask;
+}
+
+static void
+apply_skip_frames (GstOmxCamera * self, guint skip)
+{
+  OMX_CONFIG_VFCC_FRAMESKIP_INFO sCapSkipFrames;
+
+  _G_OMX_INIT_PARAM (&sCapSkipFrames);
+  /*OMX_TI_IndexConfigVFCCFrameSkip is for dropping frames in capture,
+     it is a binary 30bit value where 1 means drop a frame and 0
+     process the frame
+   */
+  sCapSkipFrames.frameSkipMask = gst_omx_camera_skip_mask (skip);
+  G_OMX_PORT_SET_CONFIG (self->port,
+      OMX_TI_IndexConfigVFCCFrameSkip, &sCapSkipFrames);
+
+  g_mutex_lock (self->stats_lock);
+  self->cur_skip_frames = skip;
+  gst_omx_camera_sync_set_skip_mask (&self->sync,
+      sCapSkipFrames.frameSkipMask);
+  g_mutex_unlock (self->stats_lock);
+}
+
+/* Once per window: skip one more frame in every group while downstream
+ * leaves the component short of buffers, and one less after a few clean
+ * windows, never below the skip-frames property.  Losing frames to the
+ * mask keeps the capture cadence regular, overruns don't.
+ */
+static void
+adapt_skip_frames (GstOmxCamera * self, const GstOmxCameraStats * stats)
+{
+  guint64 problems;
+  guint skip;
+
+  if (++self->adapt_frames < ADAPT_WINDOW)
+    return;
+
+  problems = stats->overruns + stats->late + stats->out_of_buffers;
+  skip = self->cur_skip_frames;
+
+  if (problems > self->adapt_problems) {
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self),
+            gst_omx_camera_stats_to_structure (stats)));
+
+    self->adapt_clean = 0;
+    if (self->adaptive_skip && skip < MAX_SHIFTS - 1)
+      skip++;
+  } else if (++self->adapt_clean >= ADAPT_RECOVER_WINDOWS) {
+    self->adapt_clean = 0;
+    if (self->adaptive_skip && skip > self->skip_frames)
+      skip--;
+  }
+
+  self->adapt_frames = 0;
+  self->adapt_problems = problems;
+
+  if (skip != self->cur_skip_frames) {
+    GST_INFO_OBJECT (self, "skip-frames %u -> %u", self->cur_skip_frames,
+        skip);
+    apply_skip_frames (self, skip);
+
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self),
+            gst_structure_new ("omx-camera-skip",
+                "skip-frames", G_TYPE_UINT, skip, NULL)));
+  }
+}
+
 /*
  * GstBaseSrc Methods:
  */
@@ -298,12 +640,8 @@ create (GstBaseSrc * gst_base,
   GstOmxCamera *self = GST_OMX_CAMERA (gst_base);
   GstOmxBaseSrc *omx_base = GST_OMX_BASE_SRC (self);
   GstFlowReturn ret = GST_FLOW_NOT_NEGOTIATED;
-  guint n_offset = 0;
-  GstClock *clock;
-  GstClockTime timestamp;
-#if 0
-  GstClockTime abs_time, base_time, duration;
-#endif
+  GstOmxCameraStats stats;
+
   if (omx_base->gomx->omx_state == OMX_StateLoaded) {
     gst_omx_base_src_setup_ports (omx_base);
     g_omx_core_prepare (omx_base->gomx);
@@ -311,51 +649,28 @@ create (GstBaseSrc * gst_base,
 
   if (!self->alreadystarted) {
     self->alreadystarted = 1;
+    gst_omx_camera_sync_reset (&self->sync);
     start_ports (self);
   }
 
   ret = gst_omx_base_src_create_from_port (omx_base, self->port, ret_buf);
 
-  n_offset = self->port->n_offset;
-
   if (ret != GST_FLOW_OK)
     goto fail;
 
-#if 0
-  /* timestamps, LOCK to get clock and base time. */
-  GST_OBJECT_LOCK (self);
-  if ((clock = GST_ELEMENT_CLOCK (self))) {
-    /* we have a clock, get base time and ref clock */
-    base_time = GST_ELEMENT (self)->base_time;
-    abs_time = gst_clock_get_time (clock);
-  } else {
-    /* no clock, can't set timestamps */
-    base_time = GST_CLOCK_TIME_NONE;
-    abs_time = GST_CLOCK_TIME_NONE;
-  }
-  GST_OBJECT_UNLOCK (self);
-
-  timestamp = GST_BUFFER_TIMESTAMP (*ret_buf);
-  //GST_INFO_OBJECT (self, "Original timestamp %" GST_TIME_FORMAT, GST_TIME_ARGS (timestamp));
-  //GST_INFO_OBJECT (self, "Base time %" GST_TIME_FORMAT, GST_TIME_ARGS (base_time));
-  //GST_INFO_OBJECT (self, "Abs time %" GST_TIME_FORMAT, GST_TIME_ARGS (abs_time));
+  g_mutex_lock (self->stats_lock);
+  /* the buffer just received was the last one the component had */
+  if (g_atomic_int_get (&self->port->outstanding) == 0)
+    self->sync.stats.out_of_buffers++;
+  GST_BUFFER_TIMESTAMP (*ret_buf) = gst_omx_camera_sync_buffer (&self->sync,
+      GST_ELEMENT (self), GST_BUFFER_TIMESTAMP (*ret_buf));
+  /* follows the skip mask, adaptive or not */
+  GST_BUFFER_DURATION (*ret_buf) = gst_omx_camera_sync_duration (&self->sync);
+  stats = self->sync.stats;
+  g_mutex_unlock (self->stats_lock);
 
-  if (!self->alreadystarted) {
-    self->running_time = abs_time - base_time;
-    if (!self->running_time)
-      self->running_time = timestamp;
-    self->omx_delay = timestamp - self->running_time;
+  adapt_skip_frames (self, &stats);
 
-    //GST_INFO_OBJECT (self, "OMX delay %" G_GINT64_FORMAT, self->omx_delay);
-    self->alreadystarted = 1;
-  }
-  timestamp = timestamp - self->omx_delay;
-  //GST_INFO_OBJECT (self, "Adjusted timestamp %" GST_TIME_FORMAT, GST_TIME_ARGS (timestamp));
-  GST_BUFFER_TIMESTAMP (*ret_buf) = timestamp;
-#else
-  // Let gstreamer make the job
-  GST_BUFFER_TIMESTAMP (*ret_buf) = GST_CLOCK_TIME_NONE;//timestamp;
-#endif
   return GST_FLOW_OK;
 
 fail:
@@ -446,34 +761,17 @@ set_property (GObject * obj,
     }
     case ARG_SKIP_FRAMES:
     {
-      OMX_CONFIG_VFCC_FRAMESKIP_INFO sCapSkipFrames;
-      _G_OMX_INIT_PARAM (&sCapSkipFrames);
-      guint32 shifts = 0, skip = 0, i = 0, count = 0;
-      shifts = g_value_get_uint (value);
-      if (shifts) {
-        while (count < MAX_SHIFTS) {
-
-          if ((count + shifts) > MAX_SHIFTS) {
-            shifts = MAX_SHIFTS - count;
-          }
-          for (i = 0; i < shifts; i++) {
-            skip = skip << 1;
-            skip = skip | 1;
-            count++;
-          }
-          if (count < MAX_SHIFTS) {
-            skip = skip << 1;
-            count++;
-          }
-        }
-      }
-	  /*OMX_TI_IndexConfigVFCCFrameSkip is for dropping frames in capture,
-	    it is a binary 30bit value where 1 means drop a frame and 0
-		process the frame
-	    */
-      sCapSkipFrames.frameSkipMask = skip;
-      G_OMX_PORT_SET_CONFIG (self->port,
-          OMX_TI_IndexConfigVFCCFrameSkip, &sCapSkipFrames);
+      self->skip_frames = g_value_get_uint (value);
+      apply_skip_frames (self, self->skip_frames);
+      break;
+    }
+
+    case ARG_ADAPTIVE_SKIP:
+    {
+      self->adaptive_skip = g_value_get_boolean (value);
+      /* back to what the user asked for */
+      if (!self->adaptive_skip && self->cur_skip_frames != self->skip_frames)
+        apply_skip_frames (self, self->skip_frames);
       break;
     }
 
@@ -588,6 +886,26 @@ get_property (GObject * obj, guint prop_id, GValue * value, GParamSpec * pspec)
       break;
     }
 
+    case ARG_ADAPTIVE_SKIP:
+    {
+      g_value_set_boolean (value, self->adaptive_skip);
+      break;
+    }
+
+    case ARG_STATS:
+    {
+      GstStructure *s;
+      GstOmxCameraStats stats;
+
+      g_mutex_lock (self->stats_lock);
+      stats = self->sync.stats;
+      g_mutex_unlock (self->stats_lock);
+
+      s = gst_omx_camera_stats_to_structure (&stats);
+      g_value_take_boxed (value, s);
+      break;
+    }
+
     default:
     {
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -596,6 +914,16 @@ get_property (GObject * obj, guint prop_id, GValue * value, GParamSpec * pspec)
   }
 }
 
+static void
+finalize (GObject * obj)
+{
+  GstOmxCamera *self = GST_OMX_CAMERA (obj);
+
+  g_mutex_free (self->stats_lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
 /*
  * Initialization:
  */
@@ -636,6 +964,7 @@ type_class_init (gpointer g_class, gpointer class_data)
   /* GObject methods: */
   gobject_class->set_property = set_property;
   gobject_class->get_property = get_property;
+  gobject_class->finalize = finalize;
 
   /* install properties: */
   g_object_class_install_property (gobject_class, ARG_INPUT_INTERFACE,
@@ -683,6 +1012,17 @@ type_class_init (gpointer g_class, gpointer class_data)
       g_param_spec_string ("field-merged", "Field merged",
           "Field Merged", "false", G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, ARG_ADAPTIVE_SKIP,
+      g_param_spec_boolean ("adaptive-skip", "Adaptive frame skipping",
+          "Skip more frames while downstream can't keep up, down to "
+          "skip-frames once it does", FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, ARG_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Capture timing and losses: delay from capture to push, drift "
+          "of the capture clock, overruns, late frames and buffer starvation",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
 }
 
 static void
@@ -693,6 +1033,9 @@ type_instance_init (GTypeInstance * instance, gpointer g_class)
   GstBaseSrc *basesrc = GST_BASE_SRC (self);
 
   self->alreadystarted = 0;
+  self->stats_lock = g_mutex_new ();
+  gst_omx_camera_sync_reset (&self->sync);
+  gst_omx_camera_sync_set_skip_mask (&self->sync, 0);
 
   omx_base->setup_ports = setup_ports;
 
@@ -37,6 +37,44 @@ typedef struct GstOmxCameraClass GstOmxCameraClass;
 
 #include "gstomx_base_src.h"
 
+/* capture-time mapping window, in frames */
+#define GST_OMX_CAMERA_SYNC_WINDOW 64
+
+typedef struct
+{
+    guint64 frames;
+    GstClockTime total_delay;
+    GstClockTime max_delay;
+    GstClockTime last_delay;
+    gdouble drift_ppm;      /**< capture clock against the pipeline clock */
+    guint resyncs;
+
+    guint64 overruns;       /**< gaps in capture time beyond the skip mask */
+    guint64 dropped;        /**< frames lost in those gaps */
+    guint64 late;           /**< pushed more than a capture period late */
+    guint64 out_of_buffers; /**< the component was left without a buffer */
+} GstOmxCameraStats;
+
+/* VFCC capture time to running time, one per captured stream */
+typedef struct
+{
+    GstClockTime base_hw;       /**< capture time of the reference frame */
+    GstClockTime base_local;    /**< its running time on arrival */
+    GstClockTime last_hw;
+    GstClockTime base_time;     /**< element base time the mapping is for */
+    gint64 skew;                /**< drift since the reference frame */
+    gint64 window[GST_OMX_CAMERA_SYNC_WINDOW];
+    guint window_pos;
+    gboolean window_filled;
+    gint64 window_min;
+
+    GstClockTime interval;      /**< capture period, before skipping */
+    guint32 skip_mask;          /**< applied to the capture */
+    guint max_gap;              /**< in periods, allowed by the skip mask */
+
+    GstOmxCameraStats stats;
+} GstOmxCameraSync;
+
 struct GstOmxCamera
 {
     GstOmxBaseSrc omx_base;
@@ -45,11 +83,18 @@ struct GstOmxCamera
 
     /*< private >*/
     gint rowstride;     /**< rowstride of preview/video buffer */
-#if 0
-    GstClockTime duration;
-    GstClockTime running_time;
-    GstClockTime omx_delay;
-#endif
+
+    GstOmxCameraSync sync;
+    GMutex *stats_lock;
+
+    /* adaptive frame skipping */
+    gboolean adaptive_skip;
+    guint skip_frames;          /**< set by the user, the adaptive minimum */
+    guint cur_skip_frames;      /**< applied to the component */
+    guint adapt_frames;         /**< into the current evaluation window */
+    guint adapt_clean;          /**< consecutive windows without trouble */
+    guint64 adapt_problems;     /**< problem count at the window start */
+
     GOmxPort *port;
     gint alreadystarted;
 
@@ -69,6 +114,15 @@ struct GstOmxCameraClass
 
 GType gst_omx_camera_get_type (void);
 
+/* helpers shared with the multi-channel capture element */
+void gst_omx_camera_sync_reset (GstOmxCameraSync *sync);
+GstClockTime gst_omx_camera_sync_buffer (GstOmxCameraSync *sync,
+        GstElement *element, GstClockTime hw_time);
+guint32 gst_omx_camera_skip_mask (guint skip);
+void gst_omx_camera_sync_set_skip_mask (GstOmxCameraSync *sync, guint32 mask);
+GstClockTime gst_omx_camera_sync_duration (GstOmxCameraSync *sync);
+GstStructure *gst_omx_camera_stats_to_structure (const GstOmxCameraStats *stats);
+
 /* Default portstartnumber of Camera component */
 #define OMX_CAMERA_DEFAULT_START_PORT_NUM 0
 
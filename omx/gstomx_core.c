@@ -159,6 +159,9 @@ g_omx_core_new (gpointer object, gpointer klass)
     core->gen_timestamps = TRUE;
     core->last_buf_timestamp = GST_CLOCK_TIME_NONE;
 
+    /* before the properties below, they may reach the element's setters */
+    core->threads = g_omx_threads_new (object);
+
     {
         gchar *library_name, *component_name, *component_role;
 
@@ -195,6 +198,8 @@ g_omx_core_free (GOmxCore *core)
 
     g_ptr_array_free (core->ports, TRUE);
 
+    g_omx_threads_free (core->threads);
+
     g_free (core);
 }
 
@@ -277,6 +282,10 @@ g_omx_core_deinit (GOmxCore *core)
     if (!core->imp)
         return;
 
+    GST_INFO_OBJECT (core->object, "%d buffers submitted in %d calls",
+            g_atomic_int_get (&core->submitted),
+            g_atomic_int_get (&core->submit_calls));
+
     core_for_each_port (core, g_omx_port_free);
     g_ptr_array_clear (core->ports);
 
@@ -599,6 +608,8 @@ EventHandler (OMX_HANDLETYPE omx_handle,
 
     core = (GOmxCore *) app_data;
 
+    g_omx_threads_enter (core->threads, G_OMX_THREAD_CALLBACK, NULL);
+
     switch (event)
     {
         case OMX_EventCmdComplete:
@@ -713,9 +724,14 @@ EmptyBufferDone (OMX_HANDLETYPE omx_handle,
     core = (GOmxCore*) app_data;
     port = get_port (core, omx_buffer->nInputPortIndex);
 
+    g_omx_threads_enter (core->threads, G_OMX_THREAD_CALLBACK, NULL);
+
     GST_DEBUG_OBJECT (core->object, "EBD: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
             omx_buffer, omx_buffer->pAppPrivate, omx_buffer->pBuffer);
 
+    if (G_LIKELY (port))
+        g_omx_port_buffer_returned (port);
+
     g_omx_core_got_buffer (core, port, omx_buffer);
 
     return OMX_ErrorNone;
@@ -734,9 +750,14 @@ FillBufferDone (OMX_HANDLETYPE omx_handle,
     core = (GOmxCore *) app_data;
     port = get_port (core, omx_buffer->nOutputPortIndex);
 
+    g_omx_threads_enter (core->threads, G_OMX_THREAD_CALLBACK, NULL);
+
     GST_DEBUG_OBJECT (core->object, "FBD: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
             omx_buffer, omx_buffer->pAppPrivate, omx_buffer->pBuffer);
 
+    if (G_LIKELY (port))
+        g_omx_port_buffer_returned (port);
+
     g_omx_core_got_buffer (core, port, omx_buffer);
 
     return OMX_ErrorNone;
@@ -62,6 +62,12 @@ struct GOmxCore
 
     gboolean gen_timestamps;
 	GstClockTime   last_buf_timestamp;
+
+    /** policy of the element's streaming and callback threads */
+    GOmxThreads *threads;
+
+    gint submit_calls;          /**< EmptyThisBuffer/FillThisBuffer calls */
+    gint submitted;             /**< buffers the component accepted */
 };
 
 /* Utility Macros */
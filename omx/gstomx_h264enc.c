@@ -31,6 +31,8 @@
 
 GSTOMX_BOILERPLATE (GstOmxH264Enc, gst_omx_h264enc, GstOmxBaseVideoEnc, GST_OMX_BASE_VIDEOENC_TYPE);
 
+static gint to_ih264_level (OMX_VIDEO_AVCLEVELTYPE level);
+
 enum
 {
     ARG_0,
@@ -275,6 +277,7 @@ set_property (GObject *obj,
         }
 		#else
 			self->level = g_value_get_enum(value);
+			GST_OMX_BASE_VIDEOENC (self)->level = to_ih264_level (self->level);
 			break;
 		#endif
        case ARG_I_PERIOD:
@@ -534,7 +537,7 @@ type_class_init (gpointer g_class,
                                                                DEFAULT_BYTESTREAM, G_PARAM_READWRITE));
 	g_object_class_install_property (gobject_class, ARG_PROFILE,
 		    g_param_spec_enum ("profile", "H.264 Profile",
-                    "H.264 Profile",
+                    "H.264 Profile (interlaced input needs main or high)",
                     GST_TYPE_OMX_VIDEO_AVCPROFILETYPE,
                     DEFAULT_PROFILE,
                     G_PARAM_READWRITE));
@@ -613,12 +616,70 @@ omx_h264_push_cb (GstOmxBaseFilter *omx_base, GstBuffer *buf)
 	GST_BUFFER_CAPS(buf) = gst_caps_ref(GST_PAD_CAPS(omx_base->srcpad));
 }
 
+/* Field coding is only available in the main and high profiles, so any
+ * other selection is promoted to high (the codec default) for interlaced
+ * input.
+ */
+static OMX_VIDEO_AVCPROFILETYPE
+get_profile (GstOmxH264Enc *self)
+{
+    if (!self->omx_base.interlaced)
+        return self->profile;
+
+    switch (self->profile)
+    {
+        case OMX_VIDEO_AVCProfileMain:
+        case OMX_VIDEO_AVCProfileHigh:
+            return self->profile;
+        default:
+            GST_WARNING_OBJECT (self, "profile %d can't code fields, using high profile",
+                                (gint) self->profile);
+            return OMX_VIDEO_AVCProfileHigh;
+    }
+}
+
+static gint
+to_ih264_profile (OMX_VIDEO_AVCPROFILETYPE profile)
+{
+    switch (profile)
+    {
+        case OMX_VIDEO_AVCProfileBaseline: return IH264_BASELINE_PROFILE;
+        case OMX_VIDEO_AVCProfileMain: return IH264_MAIN_PROFILE;
+        default: return IH264_HIGH_PROFILE;
+    }
+}
+
+static gint
+to_ih264_level (OMX_VIDEO_AVCLEVELTYPE level)
+{
+    switch (level)
+    {
+        case OMX_VIDEO_AVCLevel1: return IH264_LEVEL_10;
+        case OMX_VIDEO_AVCLevel1b: return IH264_LEVEL_1b;
+        case OMX_VIDEO_AVCLevel11: return IH264_LEVEL_11;
+        case OMX_VIDEO_AVCLevel12: return IH264_LEVEL_12;
+        case OMX_VIDEO_AVCLevel13: return IH264_LEVEL_13;
+        case OMX_VIDEO_AVCLevel2: return IH264_LEVEL_20;
+        case OMX_VIDEO_AVCLevel21: return IH264_LEVEL_21;
+        case OMX_VIDEO_AVCLevel22: return IH264_LEVEL_22;
+        case OMX_VIDEO_AVCLevel3: return IH264_LEVEL_30;
+        case OMX_VIDEO_AVCLevel31: return IH264_LEVEL_31;
+        case OMX_VIDEO_AVCLevel32: return IH264_LEVEL_32;
+        case OMX_VIDEO_AVCLevel4: return IH264_LEVEL_40;
+        case OMX_VIDEO_AVCLevel41: return IH264_LEVEL_41;
+        case OMX_VIDEO_AVCLevel5: return IH264_LEVEL_50;
+        case OMX_VIDEO_AVCLevel51: return IH264_LEVEL_51;
+        default: return IH264_LEVEL_42;
+    }
+}
+
 static void
 omx_setup (GstOmxBaseFilter *omx_base)
 {
     GstOmxBaseVideoEnc *self;
     GOmxCore *gomx;
     GstOmxH264Enc *h264enc;
+    OMX_VIDEO_AVCPROFILETYPE profile;
 
     h264enc = GST_OMX_H264ENC (omx_base);
     self = GST_OMX_BASE_VIDEOENC (omx_base);
@@ -626,6 +687,8 @@ omx_setup (GstOmxBaseFilter *omx_base)
 
     GST_INFO_OBJECT (omx_base, "begin");
 
+    profile = get_profile (h264enc);
+
     {
         OMX_INDEXTYPE index;
 
@@ -653,7 +716,7 @@ omx_setup (GstOmxBaseFilter *omx_base)
       OMX_GetParameter(gomx->omx_handle, OMX_IndexParamVideoAvc, &tAVCParams);
 
       tAVCParams.eLevel = h264enc->level;
-      tAVCParams.eProfile = h264enc->profile;
+      tAVCParams.eProfile = profile;
       tAVCParams.nPFrames = h264enc->i_period - 1;
 #ifdef B_FRAMES
       if (tAVCParams.eProfile != OMX_VIDEO_AVCProfileBaseline && (OMX_Video_RC_Storage == h264enc->ratecontrolPreset || OMX_Video_RC_User_Defined == h264enc->ratecontrolPreset))
@@ -804,8 +867,8 @@ omx_setup (GstOmxBaseFilter *omx_base)
 			/* for interlace, base profile can not be used */
 
 			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.encodingPreset = XDM_USER_DEFINED;
-			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.profile = IH264_HIGH_PROFILE;
-			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.level = IH264_LEVEL_42;
+			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.profile = to_ih264_profile (profile);
+			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.level = to_ih264_level (h264enc->level);
 
 			/* setting Interlace mode */
 			tStaticParam.videoStaticParams.h264EncStaticParams.videnc2Params.inputContentType = IVIDEO_INTERLACED;
@@ -896,6 +959,7 @@ type_instance_init (GTypeInstance *instance,
 	self->i_period = 90;
 	self->profile = DEFAULT_PROFILE;
 	self->level = DEFAULT_LEVEL;
+	omx_base->level = to_ih264_level (self->level);
     self->encodingPreset = OMX_Video_Enc_High_Speed_Med_Quality;
     self->ratecontrolPreset = OMX_Video_RC_Low_Delay;
 }
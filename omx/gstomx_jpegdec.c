@@ -36,6 +36,16 @@
 
 GSTOMX_BOILERPLATE (GstOmxJpegDec, gst_omx_jpegdec, GstOmxBaseFilter, GST_OMX_BASE_FILTER_TYPE);
 
+enum
+{
+    ARG_0,
+    ARG_BITSTREAM_BUFFER_MAX,
+};
+
+#define DEFAULT_BITSTREAM_BUFFER_MAX 0
+
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+
 
 static GstStaticPadTemplate src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
@@ -79,8 +89,6 @@ type_base_init (gpointer g_class)
             gst_static_pad_template_get (&sink_template));
 }
 
-/*The properties have not been implemented yet*/
-/***
 static void
 set_property (GObject *obj,
               guint prop_id,
@@ -93,6 +101,9 @@ set_property (GObject *obj,
 
     switch (prop_id)
     {
+        case ARG_BITSTREAM_BUFFER_MAX:
+            self->bitstream_buffer_max = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -111,12 +122,15 @@ get_property (GObject *obj,
 
     switch (prop_id)
     {
+        case ARG_BITSTREAM_BUFFER_MAX:
+            g_value_set_uint (value, self->bitstream_buffer_max);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
-**/
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
@@ -125,13 +139,64 @@ type_class_init (gpointer g_class,
 
     gobject_class = G_OBJECT_CLASS (g_class);
 
+    GST_OMX_BASE_FILTER_CLASS (g_class)->pad_chain = pad_chain;
+
     /* Properties stuff */
-    /*{
+    {
         gobject_class->set_property = set_property;
         gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_BITSTREAM_BUFFER_MAX,
+                                         g_param_spec_uint ("bitstream-buffer-max", "Bitstream buffer ceiling",
+                                                            "Upper bound in bytes for the input buffer size "
+                                                            "derived from the picture size (0 = none)",
+                                                            0, G_MAXUINT, DEFAULT_BITSTREAM_BUFFER_MAX, G_PARAM_READWRITE));
     }
-    */
 }
+
+/*
+ * The component decodes whole pictures from its single input buffer, so a
+ * picture bigger than the buffer raises the size omx_setup() asks for.
+ * Past setup the input port is reallocated at the new size once the
+ * component is done with the previous picture.
+ */
+static GstFlowReturn
+pad_chain (GstPad *pad, GstBuffer *buf)
+{
+    GstOmxJpegDec *self;
+    GstOmxBaseFilter *omx_base;
+    GOmxPort *in_port;
+    guint size = GST_BUFFER_SIZE (buf);
+
+    self = GST_OMX_JPEGDEC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+    in_port = omx_base->in_port;
+
+    if (G_UNLIKELY (size > self->input_buffer_size))
+    {
+        self->input_buffer_size = (size + size / 4 + 4095) & ~4095;
+
+        /* buffers shared with upstream are sized there */
+        if (omx_base->gomx->omx_state != OMX_StateLoaded &&
+            in_port->enabled && in_port->always_copy)
+        {
+            GTimeVal end_time;
+
+            GST_INFO_OBJECT (self, "%u byte picture, growing the input buffer to %u",
+                    size, self->input_buffer_size);
+
+            g_get_current_time (&end_time);
+            g_time_val_add (&end_time, (glong) omx_base->drain_timeout * 1000);
+            if (!g_omx_port_wait_returned (in_port, &end_time))
+                GST_WARNING_OBJECT (self, "input buffer not returned, resizing anyway");
+
+            g_omx_port_resize_buffers (in_port, self->input_buffer_size);
+        }
+    }
+
+    return parent_class->pad_chain (pad, buf);
+}
+
 static GstCaps *
 fixcaps (GstCaps* mycaps, GstCaps* intercaps)
 {
@@ -428,7 +493,11 @@ omx_setup (GstOmxBaseFilter *omx_base)
             param.nBufferCountActual = 1;
 
             /* this is against the standard;nBufferSize is read-only. */
-            param.nBufferSize = width * height;     /*Avoiding to get a biger image that memory allocated*/
+            param.nBufferSize = g_omx_bitstream_buffer_size (OMX_VIDEO_CodingMJPEG,
+                    width, height, 0, 0, self->framerate_num, self->framerate_denom,
+                    self->bitstream_buffer_max);
+            param.nBufferSize = MAX (param.nBufferSize, self->input_buffer_size);
+            self->input_buffer_size = param.nBufferSize;
 
             G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &param);
         }
@@ -574,6 +643,8 @@ type_instance_init (GTypeInstance *instance,
     self->framerate_denom = 1;
     self->progressive = FALSE;
     self->outport_configured = FALSE;
+    self->bitstream_buffer_max = DEFAULT_BITSTREAM_BUFFER_MAX;
+    self->input_buffer_size = 0;
 
 }
 
@@ -71,6 +71,8 @@ struct GstOmxJpegDec
     gint framerate_denom;
     gboolean progressive;
     gboolean outport_configured;
+    guint bitstream_buffer_max;     /**< ceiling for the input buffer size, 0 for none */
+    guint input_buffer_size;        /**< size in use, grown after an overflow */
 
 };
 
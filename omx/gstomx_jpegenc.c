@@ -37,8 +37,28 @@ enum
 {
   ARG_0,
   ARG_QUALITY,
+  ARG_SNAPSHOT_MODE,
+  ARG_TARGET_FRAME_SIZE,
+  ARG_MAX_QUALITY_STEP,
 };
 
+#define DEFAULT_QUALITY 90
+#define DEFAULT_MAX_QUALITY_STEP 5
+#define QUALITY_WINDOW 8
+
+enum
+{
+  SIGNAL_SNAPSHOT,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static GstFlowReturn pad_chain (GstPad * pad, GstBuffer * buf);
+static gboolean pad_event (GstPad * pad, GstEvent * event);
+static GstFlowReturn push_buffer (GstOmxBaseFilter * omx_base,
+    GstBuffer * buf);
+
 static GstCaps *
 generate_src_template (void)
 {
@@ -83,47 +103,28 @@ static void
 set_property (GObject * obj,
     guint prop_id, const GValue * value, GParamSpec * pspec)
 {
-  GstOmxBaseFilter *omx_base;
-  GOmxCore *gomx;
   GstOmxMjpegEnc *self;
 
-  omx_base = GST_OMX_BASE_FILTER (obj);
   self = GST_OMX_MJPEGENC (obj);
-  gomx = (GOmxCore *) omx_base->gomx;
 
   switch (prop_id) {
     case ARG_QUALITY:
-#if 0
-    {
-      OMX_IMAGE_PARAM_QFACTORTYPE tQualityFactor;
-      OMX_ERRORTYPE error_val = OMX_ErrorNone;
-      
-      _G_OMX_INIT_PARAM(&tQualityFactor);
-      tQualityFactor.nPortIndex = omx_base->out_port->port_index;
-      
-      error_val = OMX_GetParameter(gomx->omx_handle, OMX_IndexParamQFactor, &tQualityFactor);
-      
-      GST_INFO_OBJECT (self, "At set property QFactor %d",
-                       (gint)tQualityFactor.nQFactor);
-      
-      g_assert (error_val == OMX_ErrorNone);
-            
-      tQualityFactor.nQFactor = g_value_get_uint (value);
-
-      error_val = OMX_SetParameter(gomx->omx_handle, OMX_IndexParamQFactor,  &tQualityFactor);
-      
-      OMX_GetParameter(gomx->omx_handle, OMX_IndexParamQFactor, &tQualityFactor);
-        
-      GST_INFO_OBJECT (self, "Exit setup QFactor %d",
-                      (gint)tQualityFactor.nQFactor);
-      g_assert (error_val == OMX_ErrorNone);
-
+      /* applied before the next frame, see apply_quality() */
+      g_atomic_int_set (&self->quality, g_value_get_uint (value));
+      g_atomic_int_set (&self->quality_pending, TRUE);
+      break;
+    case ARG_TARGET_FRAME_SIZE:
+      self->target_frame_size = g_value_get_uint (value);
+      self->average_frame_size = 0;
+      self->window_bytes = 0;
+      self->window_frames = 0;
+      break;
+    case ARG_MAX_QUALITY_STEP:
+      self->max_quality_step = g_value_get_uint (value);
+      break;
+    case ARG_SNAPSHOT_MODE:
+      self->snapshot_mode = g_value_get_boolean (value);
       break;
-    }
-#else
-    self->quality = g_value_get_uint (value);
-    break;
-#endif
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -134,50 +135,419 @@ static void
 get_property (GObject * obj, guint prop_id, GValue * value, GParamSpec * pspec)
 {
   GstOmxMjpegEnc *self;
-  GOmxCore *gomx;
-  GstOmxBaseFilter *omx_base;
 
-  omx_base = GST_OMX_BASE_FILTER (obj);
   self = GST_OMX_MJPEGENC (obj);
-  gomx = (GOmxCore *) omx_base->gomx;
 
   switch (prop_id) {
     case ARG_QUALITY:
-#if 0
-    {
-      OMX_IMAGE_PARAM_QFACTORTYPE tQualityFactor;
-      OMX_ERRORTYPE error_val = OMX_ErrorNone;
-      
-      _G_OMX_INIT_PARAM(&tQualityFactor);
-      tQualityFactor.nPortIndex = omx_base->out_port->port_index;
-
-      error_val = OMX_GetParameter(gomx->omx_handle, OMX_IndexParamQFactor, &tQualityFactor);
-      
-      GST_INFO_OBJECT (self, "At get property QFactor %d",
-                       (gint)tQualityFactor.nQFactor);
-      
-      g_assert (error_val == OMX_ErrorNone);
-            
-      g_value_set_uint(value, (gint)tQualityFactor.nQFactor);
-
+      g_value_set_uint (value, g_atomic_int_get (&self->quality));
+      break;
+    case ARG_TARGET_FRAME_SIZE:
+      g_value_set_uint (value, self->target_frame_size);
+      break;
+    case ARG_MAX_QUALITY_STEP:
+      g_value_set_uint (value, self->max_quality_step);
+      break;
+    case ARG_SNAPSHOT_MODE:
+      g_value_set_boolean (value, self->snapshot_mode);
       break;
-    }
-#else
-    g_value_set_uint(value, self->quality);
-    break;
-#endif
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
   }
 }
 
+/*
+ * Quality control.
+ */
+
+/* Hands a changed quality to the component before the next frame */
+static void
+apply_quality (GstOmxMjpegEnc * self)
+{
+  GstOmxBaseFilter *omx_base;
+  GOmxCore *gomx;
+  OMX_IMAGE_PARAM_QFACTORTYPE tQualityFactor;
+  OMX_ERRORTYPE error_val;
+
+  omx_base = GST_OMX_BASE_FILTER (self);
+  gomx = omx_base->gomx;
+
+  if (!g_atomic_int_compare_and_exchange (&self->quality_pending, TRUE, FALSE))
+    return;
+
+  /* omx_setup() sets it on the way up */
+  if (gomx->omx_state == OMX_StateLoaded)
+    return;
+
+  _G_OMX_INIT_PARAM (&tQualityFactor);
+  tQualityFactor.nPortIndex = omx_base->out_port->port_index;
+  tQualityFactor.nQFactor = g_atomic_int_get (&self->quality);
+
+  /* OMX IL only takes parameters in Loaded or on a disabled port, so a
+   * running component gets it as a config; some take it either way */
+  error_val = OMX_SetConfig (gomx->omx_handle, OMX_IndexParamQFactor,
+      &tQualityFactor);
+  if (error_val != OMX_ErrorNone)
+    error_val = OMX_SetParameter (gomx->omx_handle, OMX_IndexParamQFactor,
+        &tQualityFactor);
+
+  if (error_val == OMX_ErrorNone)
+    GST_DEBUG_OBJECT (self, "QFactor %d", (gint) tQualityFactor.nQFactor);
+  else if (!self->quality_warned) {
+    GST_WARNING_OBJECT (self, "could not change QFactor to %d: %s",
+        (gint) tQualityFactor.nQFactor, g_omx_error_to_str (error_val));
+    self->quality_warned = TRUE;
+  } else
+    GST_LOG_OBJECT (self, "could not change QFactor to %d: %s",
+        (gint) tQualityFactor.nQFactor, g_omx_error_to_str (error_val));
+}
+
+/* In target-frame-size mode, steers the quality toward the target once
+ * every QUALITY_WINDOW frames, from their average size.  The frames that
+ * were in flight when the quality changed don't count.
+ */
+static void
+update_quality (GstOmxMjpegEnc * self, guint size)
+{
+  GstOmxBaseFilter *omx_base = GST_OMX_BASE_FILTER (self);
+  guint target = self->target_frame_size;
+  gint step = self->max_quality_step;
+  gint quality, delta;
+
+  if (!target)
+    return;
+
+  if (self->quality_settle) {
+    self->quality_settle--;
+    return;
+  }
+
+  self->window_bytes += size;
+  if (++self->window_frames < QUALITY_WINDOW)
+    return;
+
+  self->average_frame_size = self->window_bytes / self->window_frames;
+  self->window_bytes = 0;
+  self->window_frames = 0;
+
+  /* the size follows the quality about linearly in its useful range, so
+   * every 5% off the target moves the quality by one */
+  delta = ((gint64) target - self->average_frame_size) * 20 / target;
+  delta = CLAMP (delta, -step, step);
+  if (!delta)
+    return;
+
+  quality = CLAMP (g_atomic_int_get (&self->quality) + delta, 1, 100);
+  if (quality == g_atomic_int_get (&self->quality))
+    return;
+
+  GST_LOG_OBJECT (self, "average %u bytes for a %u byte target: quality %d",
+      self->average_frame_size, target, quality);
+
+  g_atomic_int_set (&self->quality, quality);
+  g_atomic_int_set (&self->quality_pending, TRUE);
+
+  /* this output was counted already, the rest are still being encoded */
+  g_mutex_lock (omx_base->num_buffers_mutex);
+  self->quality_settle =
+      MAX ((gint) (omx_base->frames_in - omx_base->frames_out), 0);
+  g_mutex_unlock (omx_base->num_buffers_mutex);
+}
+
+static GstFlowReturn
+encode_frame (GstOmxMjpegEnc * self, GstPad * pad, GstBuffer * buf)
+{
+  apply_quality (self);
+
+  return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_chain (pad, buf);
+}
+
+/*
+ * Snapshot mode.
+ *
+ * The component is started on the first frame, whose JPEG is thrown
+ * away, and then kept in Executing while frames are dropped ahead of the
+ * ETB.  A request only has to wait for one encode.
+ */
+
+static void
+snapshot_request (GstOmxMjpegEnc * self, guint count, GstClockTime timestamp)
+{
+  g_mutex_lock (self->snapshot_lock);
+  if (GST_CLOCK_TIME_IS_VALID (timestamp))
+    self->snapshot_target = timestamp;
+  else
+    self->snapshots_pending += count;
+  g_mutex_unlock (self->snapshot_lock);
+
+  GST_INFO_OBJECT (self, "snapshot of %u frames, at %" GST_TIME_FORMAT,
+      count, GST_TIME_ARGS (timestamp));
+}
+
+static void
+snapshot_action (GstOmxMjpegEnc * self, guint count)
+{
+  snapshot_request (self, count, GST_CLOCK_TIME_NONE);
+}
+
+/* Takes the event if it is a snapshot request */
+static gboolean
+snapshot_event (GstOmxMjpegEnc * self, GstEvent * event)
+{
+  const GstStructure *structure;
+  GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+  guint count = 1;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CUSTOM_UPSTREAM:
+    case GST_EVENT_CUSTOM_DOWNSTREAM:
+    case GST_EVENT_CUSTOM_DOWNSTREAM_OOB:
+    case GST_EVENT_CUSTOM_BOTH:
+    case GST_EVENT_CUSTOM_BOTH_OOB:
+      break;
+    default:
+      return FALSE;
+  }
+
+  structure = gst_event_get_structure (event);
+  if (!structure ||
+      !gst_structure_has_name (structure, GST_OMX_MJPEGENC_SNAPSHOT_EVENT))
+    return FALSE;
+
+  gst_structure_get_uint (structure, "count", &count);
+  gst_structure_get_clock_time (structure, "timestamp", &timestamp);
+
+  snapshot_request (self, count, timestamp);
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+snapshot_flush (GstOmxMjpegEnc * self)
+{
+  self->in_flight_head = self->in_flight_tail = 0;
+  if (self->snapshot_candidate) {
+    gst_buffer_unref (self->snapshot_candidate);
+    self->snapshot_candidate = NULL;
+  }
+}
+
+/* Picks the frame to encode out of buf, NULL to drop it.  Called with the
+ * snapshot lock held; buf is taken either way.
+ */
+static GstBuffer *
+snapshot_select (GstOmxMjpegEnc * self, GstBuffer * buf)
+{
+  GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buf);
+  GstBuffer *candidate = self->snapshot_candidate;
+
+  if (GST_CLOCK_TIME_IS_VALID (self->snapshot_target) &&
+      GST_CLOCK_TIME_IS_VALID (timestamp)) {
+    GstClockTime target = self->snapshot_target;
+
+    /* hold the frame until one at or past the target shows up */
+    if (timestamp < target) {
+      if (candidate)
+        gst_buffer_unref (candidate);
+      self->snapshot_candidate = buf;
+      return NULL;
+    }
+
+    self->snapshot_candidate = NULL;
+    self->snapshot_target = GST_CLOCK_TIME_NONE;
+
+    if (candidate &&
+        target - GST_BUFFER_TIMESTAMP (candidate) <= timestamp - target) {
+      gst_buffer_unref (buf);
+      return candidate;
+    }
+
+    if (candidate)
+      gst_buffer_unref (candidate);
+    return buf;
+  }
+
+  if (self->snapshots_pending) {
+    self->snapshots_pending--;
+    return buf;
+  }
+
+  gst_buffer_unref (buf);
+  return NULL;
+}
+
+static GstFlowReturn
+pad_chain (GstPad * pad, GstBuffer * buf)
+{
+  GstOmxBaseFilter *omx_base;
+  GstOmxMjpegEnc *self;
+  GstOmxMjpegEncInFlight *in_flight;
+  gboolean keep = TRUE;
+
+  self = GST_OMX_MJPEGENC (GST_OBJECT_PARENT (pad));
+  omx_base = GST_OMX_BASE_FILTER (self);
+
+  if (!self->snapshot_mode)
+    return encode_frame (self, pad, buf);
+
+  g_mutex_lock (self->snapshot_lock);
+
+  if (G_UNLIKELY (omx_base->gomx->omx_state == OMX_StateLoaded)) {
+    /* nothing is in flight before the component starts, and the first
+     * frame warms it up unless it is wanted anyway */
+    self->in_flight_head = self->in_flight_tail = 0;
+    if (!self->snapshots_pending &&
+        !GST_CLOCK_TIME_IS_VALID (self->snapshot_target)) {
+      GST_INFO_OBJECT (self, "warming up on the first frame");
+      keep = FALSE;
+    }
+  }
+
+  if (keep)
+    buf = snapshot_select (self, buf);
+
+  /* a JPEG without its entry would take the next frame's, so a frame
+   * that finds the ring full is not encoded */
+  if (buf && self->in_flight_tail - self->in_flight_head >=
+      MJPEGENC_MAX_IN_FLIGHT) {
+    GST_WARNING_OBJECT (self, "too many snapshots in flight, dropping frame");
+    gst_buffer_unref (buf);
+    buf = NULL;
+  }
+
+  if (buf) {
+    in_flight = &self->in_flight[self->in_flight_tail++ %
+        MJPEGENC_MAX_IN_FLIGHT];
+    in_flight->timestamp = GST_BUFFER_TIMESTAMP (buf);
+    in_flight->keep = keep;
+  }
+
+  g_mutex_unlock (self->snapshot_lock);
+
+  if (!buf)
+    return GST_FLOW_OK;
+
+  return encode_frame (self, pad, buf);
+}
+
+static gboolean
+pad_event (GstPad * pad, GstEvent * event)
+{
+  GstOmxMjpegEnc *self;
+
+  self = GST_OMX_MJPEGENC (GST_OBJECT_PARENT (pad));
+
+  if (snapshot_event (self, event))
+    return TRUE;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    g_mutex_lock (self->snapshot_lock);
+    snapshot_flush (self);
+    g_mutex_unlock (self->snapshot_lock);
+  }
+
+  return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_event (pad, event);
+}
+
+static gboolean
+src_event (GstPad * pad, GstEvent * event)
+{
+  GstOmxMjpegEnc *self;
+  gboolean ret;
+
+  self = GST_OMX_MJPEGENC (gst_pad_get_parent (pad));
+
+  if (snapshot_event (self, event))
+    ret = TRUE;
+  else
+    ret = gst_pad_event_default (pad, event);
+
+  gst_object_unref (self);
+
+  return ret;
+}
+
+static gboolean
+send_event (GstElement * element, GstEvent * event)
+{
+  if (snapshot_event (GST_OMX_MJPEGENC (element), event))
+    return TRUE;
+
+  return GST_ELEMENT_CLASS (parent_class)->send_event (element, event);
+}
+
+static GstFlowReturn
+push_buffer (GstOmxBaseFilter * omx_base, GstBuffer * buf)
+{
+  GstOmxMjpegEnc *self;
+  GstOmxMjpegEncInFlight in_flight = { GST_CLOCK_TIME_NONE, TRUE };
+  gboolean found = FALSE;
+
+  self = GST_OMX_MJPEGENC (omx_base);
+
+  /* one ring entry per JPEG, not per output buffer */
+  buf = gst_omx_base_videoenc_join_fragments (GST_OMX_BASE_VIDEOENC (self), buf);
+  if (!buf)
+    return GST_FLOW_OK;
+
+  g_mutex_lock (self->snapshot_lock);
+  if (self->in_flight_head != self->in_flight_tail) {
+    in_flight = self->in_flight[self->in_flight_head++ %
+        MJPEGENC_MAX_IN_FLIGHT];
+    found = TRUE;
+  }
+  g_mutex_unlock (self->snapshot_lock);
+
+  if (found) {
+    if (!in_flight.keep) {
+      GST_DEBUG_OBJECT (self, "dropping the warm-up JPEG");
+      gst_buffer_unref (buf);
+      return GST_FLOW_OK;
+    }
+
+    /* JPEG is one in, one out: this is the frame it was encoded from */
+    GST_BUFFER_TIMESTAMP (buf) = in_flight.timestamp;
+  }
+
+  update_quality (self, GST_BUFFER_SIZE (buf));
+
+  return GST_OMX_BASE_FILTER_CLASS (parent_class)->push_buffer (omx_base, buf);
+}
+
+static void
+finalize (GObject * obj)
+{
+  GstOmxMjpegEnc *self;
+
+  self = GST_OMX_MJPEGENC (obj);
+
+  snapshot_flush (self);
+  g_mutex_free (self->snapshot_lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
 static void
 type_class_init (gpointer g_class, gpointer class_data)
 {
   GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstOmxBaseFilterClass *bclass;
+  GstOmxMjpegEncClass *mjpegenc_class;
 
   gobject_class = G_OBJECT_CLASS (g_class);
+  gstelement_class = GST_ELEMENT_CLASS (g_class);
+  bclass = GST_OMX_BASE_FILTER_CLASS (g_class);
+  mjpegenc_class = GST_OMX_MJPEGENC_CLASS (g_class);
+
+  gobject_class->finalize = finalize;
+  gstelement_class->send_event = send_event;
+  bclass->pad_chain = pad_chain;
+  bclass->pad_event = pad_event;
+  bclass->push_buffer = push_buffer;
+  mjpegenc_class->snapshot = snapshot_action;
 
   /* Properties stuff */
   {
@@ -188,7 +558,32 @@ type_class_init (gpointer g_class, gpointer class_data)
     g_object_class_install_property (gobject_class, ARG_QUALITY,
         g_param_spec_uint ("quality", "MJPEG/JPEG quality",
             "MJPEG/JPEG quality (integer 0:min 100:max)",
-            0, 100, 90, G_PARAM_READWRITE));
+            0, 100, DEFAULT_QUALITY, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, ARG_TARGET_FRAME_SIZE,
+        g_param_spec_uint ("target-frame-size", "Target frame size",
+            "Bytes per JPEG to steer the quality to (0: fixed quality)",
+            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, ARG_MAX_QUALITY_STEP,
+        g_param_spec_uint ("max-quality-step", "Maximum quality step",
+            "Most the quality moves per adjustment in target-frame-size mode",
+            1, 100, DEFAULT_MAX_QUALITY_STEP, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, ARG_SNAPSHOT_MODE,
+        g_param_spec_boolean ("snapshot-mode", "Snapshot mode",
+            "Encode only the frames asked for with the snapshot signal or "
+            "the " GST_OMX_MJPEGENC_SNAPSHOT_EVENT " event",
+            FALSE, G_PARAM_READWRITE));
+  }
+
+  /* Signals stuff */
+  {
+    signals[SIGNAL_SNAPSHOT] =
+        g_signal_new ("snapshot", G_TYPE_FROM_CLASS (g_class),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+        G_STRUCT_OFFSET (GstOmxMjpegEncClass, snapshot), NULL, NULL,
+        g_cclosure_marshal_VOID__UINT, G_TYPE_NONE, 1, G_TYPE_UINT);
   }
 }
 
@@ -225,7 +620,9 @@ omx_setup (GstOmxBaseFilter * omx_base)
         GST_INFO_OBJECT (self, "At setup QFactor %d",
                        (gint)tQualityFactor.nQFactor);
 
-        tQualityFactor.nQFactor = mjpegenc->quality;
+        tQualityFactor.nQFactor = g_atomic_int_get (&mjpegenc->quality);
+        g_atomic_int_set (&mjpegenc->quality_pending, FALSE);
+        mjpegenc->quality_warned = FALSE;
 
         OMX_SetParameter(gomx->omx_handle, OMX_IndexParamQFactor,  &tQualityFactor);
         
@@ -295,6 +692,11 @@ type_instance_init (GTypeInstance * instance, gpointer g_class)
 
   omx_base_filter->gomx->settings_changed_cb = settings_changed_cb;
 
-  self->quality = 90;
-  
+  self->quality = DEFAULT_QUALITY;
+  self->max_quality_step = DEFAULT_MAX_QUALITY_STEP;
+
+  self->snapshot_lock = g_mutex_new ();
+  self->snapshot_target = GST_CLOCK_TIME_NONE;
+
+  gst_pad_set_event_function (omx_base_filter->srcpad, src_event);
 }
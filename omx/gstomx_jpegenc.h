@@ -31,20 +31,62 @@
 G_BEGIN_DECLS
 #define GST_OMX_MJPEGENC(obj) (GstOmxMjpegEnc *) (obj)
 #define GST_OMX_MJPEGENC_TYPE (gst_omx_mjpegenc_get_type ())
+#define GST_OMX_MJPEGENC_CLASS(obj) ((GstOmxMjpegEncClass *) (obj))
 typedef struct GstOmxMjpegEnc GstOmxMjpegEnc;
 typedef struct GstOmxMjpegEncClass GstOmxMjpegEncClass;
 
 #include "gstomx_base_videoenc.h"
 
+/* Custom event requesting snapshots, with a "count" (guint) of frames to
+ * encode or the "timestamp" (GstClockTime) of the frame wanted.  Taken
+ * from either direction and by gst_element_send_event().
+ */
+#define GST_OMX_MJPEGENC_SNAPSHOT_EVENT "omx-jpegenc-snapshot"
+
+/* Snapshots in flight between ETB and the pushed JPEG */
+#define MJPEGENC_MAX_IN_FLIGHT 32
+
+typedef struct GstOmxMjpegEncInFlight GstOmxMjpegEncInFlight;
+
+struct GstOmxMjpegEncInFlight
+{
+  GstClockTime timestamp;       /**< of the source frame */
+  gboolean keep;                /**< FALSE for the warm-up frame */
+};
+
 struct GstOmxMjpegEnc
 {
   GstOmxBaseVideoEnc omx_base;
   gint quality;
+  gint quality_pending;         /**< quality changed, apply before next ETB */
+  gboolean quality_warned;      /**< a failed change was already reported */
+
+  /** target-frame-size mode: quality follows the output sizes */
+  guint target_frame_size;
+  guint max_quality_step;
+  guint average_frame_size;
+  guint64 window_bytes;         /**< output of the current averaging window */
+  guint window_frames;
+  guint quality_settle;         /**< outputs left at the previous quality */
+
+  /** snapshot mode: frames are dropped before ETB until requested */
+  gboolean snapshot_mode;
+
+  /** protects everything below */
+  GMutex *snapshot_lock;
+  guint snapshots_pending;      /**< next frames to encode */
+  GstClockTime snapshot_target; /**< encode the frame closest to this */
+  GstBuffer *snapshot_candidate;        /**< last frame before the target */
+  GstOmxMjpegEncInFlight in_flight[MJPEGENC_MAX_IN_FLIGHT];
+  guint in_flight_head, in_flight_tail;
 };
 
 struct GstOmxMjpegEncClass
 {
   GstOmxBaseVideoEncClass parent_class;
+
+  /* actions */
+  void (*snapshot) (GstOmxMjpegEnc * self, guint count);
 };
 
 GType gst_omx_mjpegenc_get_type (void);
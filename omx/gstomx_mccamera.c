@@ -0,0 +1,1176 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Multi-channel capture: the channels multiplexed on one VIP port are
+ * captured by a single OMX.TI.VPSSM3.VFCC handle, each on its own output
+ * port and src_%02d pad, instead of one omx_camera (and one handle, state
+ * machine and buffer set) per channel.  Every pad has its own caps, frame
+ * skip mask and capture-time mapping.
+ */
+
+#include "gstomx_mccamera.h"
+#include "gstomx.h"
+#include "gstomx_interface.h"
+
+#include <OMX_TI_Common.h>
+#include <OMX_TI_Index.h>
+#include <omx_vfcc.h>
+
+#include <stdlib.h> /* for atoi */
+#include <string.h> /* for strcmp */
+
+enum
+{
+    ARG_0,
+    ARG_COMPONENT_ROLE,
+    ARG_COMPONENT_NAME,
+    ARG_LIBRARY_NAME,
+    ARG_INPUT_INTERFACE,
+    ARG_CAP_MODE,
+    ARG_SCAN_TYPE,
+    ARG_VIF_MODE,
+    ARG_NUM_OUTPUT_BUFFERS,
+    ARG_NUM_BUFFERS,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
+};
+
+enum
+{
+    PAD_ARG_0,
+    PAD_ARG_SKIP_FRAMES,
+    PAD_ARG_STATS,
+};
+
+#define DEFAULT_BUFFERS_PER_CHANNEL 4
+#define MIN_BUFFERS_PER_CHANNEL 3
+
+static void init_interfaces (GType type);
+GSTOMX_BOILERPLATE_FULL (GstOmxMcCamera, gst_omx_mccamera, GstElement, GST_TYPE_ELEMENT, init_interfaces);
+
+G_DEFINE_TYPE (GstOmxMcCameraPad, gst_omx_mccamera_pad, GST_TYPE_PAD);
+
+static GstStaticPadTemplate src_template =
+        GST_STATIC_PAD_TEMPLATE ("src_%02d",
+                GST_PAD_SRC,
+                GST_PAD_REQUEST,
+                GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV_STRIDED (
+                        "{ NV12, YUY2 }", "[ 0, max ]"))
+        );
+
+static void output_loop (gpointer data);
+
+/*
+ * Pads:
+ */
+
+static void
+apply_skip_frames (GstOmxMcCameraPad *pad)
+{
+    OMX_CONFIG_VFCC_FRAMESKIP_INFO sCapSkipFrames;
+
+    _G_OMX_INIT_PARAM (&sCapSkipFrames);
+    sCapSkipFrames.nPortIndex = pad->port->port_index;
+    sCapSkipFrames.frameSkipMask = gst_omx_camera_skip_mask (pad->skip_frames);
+    G_OMX_PORT_SET_CONFIG (pad->port,
+            OMX_TI_IndexConfigVFCCFrameSkip, &sCapSkipFrames);
+
+    gst_omx_camera_sync_set_skip_mask (&pad->sync, sCapSkipFrames.frameSkipMask);
+}
+
+static void
+pad_set_property (GObject *obj,
+                  guint prop_id,
+                  const GValue *value,
+                  GParamSpec *pspec)
+{
+    GstOmxMcCameraPad *pad;
+
+    pad = GST_OMX_MCCAMERA_PAD (obj);
+
+    switch (prop_id)
+    {
+        case PAD_ARG_SKIP_FRAMES:
+            pad->skip_frames = g_value_get_uint (value);
+            /* otherwise applied when the channel is set up */
+            if (pad->port && pad->port->core->omx_state != OMX_StateLoaded &&
+                pad->port->core->omx_state != OMX_StateInvalid)
+                apply_skip_frames (pad);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+pad_get_property (GObject *obj,
+                  guint prop_id,
+                  GValue *value,
+                  GParamSpec *pspec)
+{
+    GstOmxMcCameraPad *pad;
+
+    pad = GST_OMX_MCCAMERA_PAD (obj);
+
+    switch (prop_id)
+    {
+        case PAD_ARG_SKIP_FRAMES:
+            g_value_set_uint (value, pad->skip_frames);
+            break;
+        case PAD_ARG_STATS:
+            {
+                GstOmxMcCamera *self = GST_OMX_MCCAMERA (GST_PAD_PARENT (pad));
+                GstOmxCameraStats stats;
+                GstStructure *s;
+
+                if (self)
+                    g_mutex_lock (self->stats_lock);
+                stats = pad->sync.stats;
+                if (self)
+                    g_mutex_unlock (self->stats_lock);
+
+                s = gst_omx_camera_stats_to_structure (&stats);
+                g_value_take_boxed (value, s);
+            }
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_omx_mccamera_pad_class_init (GstOmxMcCameraPadClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = pad_set_property;
+    gobject_class->get_property = pad_get_property;
+
+    g_object_class_install_property (gobject_class, PAD_ARG_SKIP_FRAMES,
+                                     g_param_spec_uint ("skip-frames", "skip frames",
+                                                        "Skip this amount of frames after a valid frame",
+                                                        0, 30, 0, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PAD_ARG_STATS,
+                                     g_param_spec_boxed ("stats", "Statistics",
+                                                         "Capture timing of this channel, as in omx_camera",
+                                                         GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+}
+
+static void
+gst_omx_mccamera_pad_init (GstOmxMcCameraPad *pad)
+{
+    pad->format = GST_VIDEO_FORMAT_UNKNOWN;
+    gst_omx_camera_sync_reset (&pad->sync);
+    gst_omx_camera_sync_set_skip_mask (&pad->sync, 0);
+}
+
+static gboolean
+src_setcaps (GstPad *gst_pad,
+             GstCaps *caps)
+{
+    GstOmxMcCamera *self;
+    GstOmxMcCameraPad *pad;
+    GstStructure *structure;
+    const GValue *framerate;
+
+    self = GST_OMX_MCCAMERA (GST_PAD_PARENT (gst_pad));
+    pad = GST_OMX_MCCAMERA_PAD (gst_pad);
+
+    GST_INFO_OBJECT (self, "setcaps (src_%02d): %" GST_PTR_FORMAT, pad->index, caps);
+
+    g_return_val_if_fail (caps, FALSE);
+    g_return_val_if_fail (gst_caps_is_fixed (caps), FALSE);
+
+    if (!gst_video_format_parse_caps_strided (caps,
+            &pad->format, &pad->width, &pad->height, &pad->stride))
+    {
+        GST_WARNING_OBJECT (self, "width and/or height is not set in caps");
+        return FALSE;
+    }
+
+    if (!pad->stride)
+    {
+        pad->stride = (pad->format == GST_VIDEO_FORMAT_YUY2) ?
+                pad->width * 2 : pad->width;
+    }
+
+    structure = gst_caps_get_structure (caps, 0);
+    framerate = gst_structure_get_value (structure, "framerate");
+    if (framerate)
+    {
+        pad->fps_n = gst_value_get_fraction_numerator (framerate);
+        pad->fps_d = gst_value_get_fraction_denominator (framerate);
+
+        if (pad->fps_n)
+            pad->sync.interval = gst_util_uint64_scale_int (GST_SECOND,
+                    pad->fps_d, pad->fps_n);
+    }
+
+    /* save the src caps later needed by omx transport buffer */
+    if (pad->port->caps)
+        gst_caps_unref (pad->port->caps);
+
+    pad->port->caps = gst_caps_copy (caps);
+
+    return TRUE;
+}
+
+static void
+src_fixatecaps (GstPad *pad,
+                GstCaps *caps)
+{
+    GstStructure *structure;
+
+    structure = gst_caps_get_structure (caps, 0);
+
+    gst_structure_fixate_field_nearest_int (structure, "width", 720);
+    gst_structure_fixate_field_nearest_int (structure, "height", 480);
+    gst_structure_fixate_field_nearest_fraction (structure, "framerate", 30, 1);
+}
+
+static gboolean
+negotiate (GstOmxMcCamera *self,
+           GstOmxMcCameraPad *pad)
+{
+    GstCaps *thiscaps;
+    GstCaps *peercaps;
+    GstCaps *caps;
+    gboolean result = FALSE;
+
+    thiscaps = gst_pad_get_caps (GST_PAD (pad));
+    peercaps = gst_pad_peer_get_caps (GST_PAD (pad));
+
+    if (peercaps)
+    {
+        caps = gst_caps_intersect (thiscaps, peercaps);
+        gst_caps_unref (peercaps);
+    }
+    else
+    {
+        caps = gst_caps_copy (thiscaps);
+    }
+    gst_caps_unref (thiscaps);
+
+    if (!gst_caps_is_empty (caps))
+    {
+        gst_caps_truncate (caps);
+        gst_pad_fixate_caps (GST_PAD (pad), caps);
+
+        if (gst_caps_is_fixed (caps))
+            result = gst_pad_set_caps (GST_PAD (pad), caps);
+    }
+
+    gst_caps_unref (caps);
+
+    if (!result)
+    {
+        GST_ELEMENT_ERROR (self, CORE, NEGOTIATION, (NULL),
+                ("src_%02d: could not negotiate format", pad->index));
+    }
+
+    return result;
+}
+
+/*
+ * OpenMAX setup:
+ */
+
+static gboolean
+channel_setup (GstOmxMcCamera *self,
+               GstOmxMcCameraPad *pad,
+               guint num_buffers)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+    OMX_PARAM_BUFFER_MEMORYTYPE memTypeCfg;
+    OMX_ERRORTYPE err;
+
+    if (!negotiate (self, pad))
+        return FALSE;
+
+    G_OMX_PORT_GET_DEFINITION (pad->port, &param);
+    param.format.video.nFrameWidth = pad->width;
+    param.format.video.nFrameHeight = pad->height;
+    param.format.video.nStride = pad->stride;
+    param.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    if (pad->format == GST_VIDEO_FORMAT_NV12)
+        param.format.video.eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
+    else
+        param.format.video.eColorFormat = OMX_COLOR_FormatYCbYCr;
+    param.nBufferSize = gst_video_format_get_size_strided (pad->format,
+            pad->width, pad->height, pad->stride);
+    param.nBufferCountActual = num_buffers;
+    err = G_OMX_PORT_SET_DEFINITION (pad->port, &param);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    g_omx_port_setup (pad->port, &param);
+
+    /* Setting Memory type at output port to Raw Memory */
+    _G_OMX_INIT_PARAM (&memTypeCfg);
+    memTypeCfg.nPortIndex = pad->port->port_index;
+    memTypeCfg.eBufMemoryType = OMX_BUFFER_MEMORY_DEFAULT;
+    G_OMX_PORT_SET_PARAM (pad->port, OMX_TI_IndexParamBuffMemType, &memTypeCfg);
+
+    apply_skip_frames (pad);
+
+    return TRUE;
+}
+
+static gboolean
+omx_setup (GstOmxMcCamera *self)
+{
+    GOmxCore *gomx;
+    GOmxPort *port;
+    OMX_PARAM_VFCC_HWPORT_ID sHwPortId;
+    OMX_PARAM_VFCC_HWPORT_PROPERTIES sHwPortParam;
+    guint num_buffers;
+    gint max_width = 0, max_height = 0;
+    guint i;
+
+    gomx = self->gomx;
+
+    GST_INFO_OBJECT (self, "begin: %u channels", self->num_channels);
+
+    if (!self->num_channels)
+    {
+        GST_ELEMENT_ERROR (self, CORE, PAD, (NULL), ("no src pad requested"));
+        return FALSE;
+    }
+
+    /* the component numbers its channels 0..N-1 */
+    for (i = 0; i < self->num_channels; i++)
+    {
+        if (!self->channels[i])
+        {
+            GST_ELEMENT_ERROR (self, CORE, PAD, (NULL),
+                    ("channels must be numbered from src_00 without gaps"));
+            return FALSE;
+        }
+    }
+
+    /* one pool for the whole handle, split evenly between the channels */
+    num_buffers = self->num_output_buffers ?
+            self->num_output_buffers / self->num_channels :
+            DEFAULT_BUFFERS_PER_CHANNEL;
+    num_buffers = MAX (num_buffers, MIN_BUFFERS_PER_CHANNEL);
+
+    for (i = 0; i < self->num_channels; i++)
+    {
+        GstOmxMcCameraPad *pad = self->channels[i];
+
+        if (!channel_setup (self, pad, num_buffers))
+            return FALSE;
+
+        max_width = MAX (max_width, pad->width);
+        max_height = MAX (max_height, pad->height);
+    }
+
+    /* the VIP port properties hold for every channel multiplexed on it */
+    port = self->channels[0]->port;
+
+    _G_OMX_INIT_PARAM (&sHwPortId);
+    sHwPortId.eHwPortId = self->input_interface;
+    G_OMX_PORT_SET_PARAM (port,
+        (OMX_INDEXTYPE) OMX_TI_IndexParamVFCCHwPortID, (OMX_PTR) & sHwPortId);
+
+    _G_OMX_INIT_PARAM (&sHwPortParam);
+    sHwPortParam.eCaptMode = self->cap_mode;
+    sHwPortParam.eVifMode = self->vif_mode;
+    sHwPortParam.eInColorFormat = OMX_COLOR_FormatYCbYCr;
+    sHwPortParam.eScanType = self->scan_type;
+    sHwPortParam.nMaxWidth = max_width;
+    sHwPortParam.nMaxHeight = max_height;
+    sHwPortParam.nMaxChnlsPerHwPort = self->num_channels;
+    G_OMX_PORT_SET_PARAM (port,
+        (OMX_INDEXTYPE) OMX_TI_IndexParamVFCCHwPortProperties,
+        (OMX_PTR) & sHwPortParam);
+
+    for (i = 0; i < self->num_channels; i++)
+    {
+        port = self->channels[i]->port;
+
+        port->enabled = TRUE;
+        g_omx_port_resume (port);
+
+        OMX_SendCommand (gomx->omx_handle, OMX_CommandPortEnable,
+                port->port_index, NULL);
+        g_sem_down (gomx->port_sem);
+    }
+
+    GST_INFO_OBJECT (self, "end: %u buffers per channel", num_buffers);
+
+    return TRUE;
+}
+
+static gboolean
+omx_start (GstOmxMcCamera *self)
+{
+    GOmxCore *gomx = self->gomx;
+    guint i;
+
+    if (!self->ready)
+    {
+        if (!omx_setup (self))
+            return FALSE;
+
+        g_omx_core_prepare (gomx);
+
+        if (gomx->omx_state != OMX_StateIdle)
+            return FALSE;
+
+        self->ready = TRUE;
+    }
+
+    if (gomx->omx_state == OMX_StateIdle)
+        g_omx_core_start (gomx);
+
+    if (gomx->omx_state != OMX_StateExecuting)
+        return FALSE;
+
+    for (i = 0; i < self->num_channels; i++)
+    {
+        GstPad *pad = GST_PAD (self->channels[i]);
+
+        gst_pad_start_task (pad, output_loop, pad);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Streaming:
+ */
+
+static void
+output_loop (gpointer data)
+{
+    GstOmxMcCamera *self;
+    GstOmxMcCameraPad *pad;
+    GstFlowReturn ret = GST_FLOW_OK;
+    GstBuffer *buf;
+    gpointer obj;
+
+    pad = GST_OMX_MCCAMERA_PAD (data);
+    self = GST_OMX_MCCAMERA (gst_pad_get_parent (GST_PAD (pad)));
+
+    g_omx_threads_enter_task (self->gomx->threads, GST_PAD (pad), GST_PAD_NAME (pad));
+
+    obj = g_omx_port_recv (pad->port);
+
+    if (G_UNLIKELY (!obj))
+    {
+        GST_INFO_OBJECT (self, "src_%02d: null buffer: leaving", pad->index);
+        ret = GST_FLOW_WRONG_STATE;
+        goto pause;
+    }
+
+    if (G_UNLIKELY (GST_IS_EVENT (obj)))
+    {
+        GST_DEBUG_OBJECT (self, "src_%02d: got eos", pad->index);
+        gst_pad_push_event (GST_PAD (pad), obj);
+        ret = GST_FLOW_UNEXPECTED;
+        goto pause;
+    }
+
+    buf = GST_BUFFER (obj);
+
+    if (G_UNLIKELY (pad->eos_pending))
+    {
+        gst_buffer_unref (buf);
+        gst_pad_push_event (GST_PAD (pad), gst_event_new_eos ());
+        ret = GST_FLOW_UNEXPECTED;
+        goto pause;
+    }
+
+    /* a live source drops what it captures while paused */
+    if (G_UNLIKELY (!self->playing))
+    {
+        gst_buffer_unref (buf);
+        goto leave;
+    }
+
+    if (G_UNLIKELY (pad->segment_pending))
+    {
+        gst_pad_push_event (GST_PAD (pad),
+                gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_TIME, 0, -1, 0));
+        pad->segment_pending = FALSE;
+    }
+
+    g_mutex_lock (self->stats_lock);
+    /* the buffer just received was the last one the component had */
+    if (g_atomic_int_get (&pad->port->outstanding) == 0)
+        pad->sync.stats.out_of_buffers++;
+    GST_BUFFER_TIMESTAMP (buf) = gst_omx_camera_sync_buffer (&pad->sync,
+            GST_ELEMENT (self), GST_BUFFER_TIMESTAMP (buf));
+    /* the frame rate of the caps, stretched by the skip mask */
+    GST_BUFFER_DURATION (buf) = gst_omx_camera_sync_duration (&pad->sync);
+    g_mutex_unlock (self->stats_lock);
+    GST_BUFFER_OFFSET (buf) = pad->pushed;
+
+    PRINT_BUFFER (self, buf);
+
+    ret = gst_pad_push (GST_PAD (pad), buf);
+    GST_LOG_OBJECT (self, "src_%02d: ret=%s", pad->index, gst_flow_get_name (ret));
+
+    /* an unlinked channel must not stop the others */
+    if (ret == GST_FLOW_NOT_LINKED)
+        ret = GST_FLOW_OK;
+
+    if (ret != GST_FLOW_OK)
+        goto pause;
+
+    pad->pushed++;
+    if (self->num_buffers >= 0 && pad->pushed >= (guint64) self->num_buffers)
+    {
+        gst_pad_push_event (GST_PAD (pad), gst_event_new_eos ());
+        ret = GST_FLOW_UNEXPECTED;
+        goto pause;
+    }
+
+leave:
+    gst_object_unref (self);
+    return;
+
+pause:
+    GST_INFO_OBJECT (self, "src_%02d: pause task, reason: %s",
+                     pad->index, gst_flow_get_name (ret));
+    gst_pad_pause_task (GST_PAD (pad));
+
+    if (ret < GST_FLOW_UNEXPECTED && ret != GST_FLOW_WRONG_STATE)
+    {
+        GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                ("src_%02d: streaming stopped, reason %s", pad->index,
+                 gst_flow_get_name (ret)));
+        gst_pad_push_event (GST_PAD (pad), gst_event_new_eos ());
+    }
+
+    gst_object_unref (self);
+}
+
+static gboolean
+send_event (GstElement *element,
+            GstEvent *event)
+{
+    GstOmxMcCamera *self;
+    guint i;
+
+    self = GST_OMX_MCCAMERA (element);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_EOS)
+    {
+        /* every channel ends after the frame being captured */
+        g_mutex_lock (self->ready_lock);
+        for (i = 0; i < self->num_channels; i++)
+            if (self->channels[i])
+                self->channels[i]->eos_pending = TRUE;
+        g_mutex_unlock (self->ready_lock);
+
+        gst_event_unref (event);
+        return TRUE;
+    }
+
+    return GST_ELEMENT_CLASS (parent_class)->send_event (element, event);
+}
+
+/*
+ * Element:
+ */
+
+static GstPad *
+request_new_pad (GstElement *element,
+                 GstPadTemplate *templ,
+                 const gchar *req_name)
+{
+    GstOmxMcCamera *self;
+    GstOmxMcCameraPad *pad;
+    gchar *name;
+    gint index = -1;
+
+    self = GST_OMX_MCCAMERA (element);
+
+    g_mutex_lock (self->ready_lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "channels can't be added while capturing");
+        return NULL;
+    }
+
+    if (req_name && strlen (req_name) > 4 && g_str_has_prefix (req_name, "src_"))
+    {
+        /* parse serial number from requested padname */
+        index = atoi (&req_name[4]);
+    }
+    else
+    {
+        /* no name given when requesting the pad, use the first free channel */
+        for (index = 0; index < MCCAMERA_MAX_CHANNELS; index++)
+            if (!self->channels[index])
+                break;
+    }
+
+    if (index < 0 || index >= MCCAMERA_MAX_CHANNELS || self->channels[index])
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "no channel available for %s", req_name);
+        return NULL;
+    }
+
+    name = g_strdup_printf ("src_%02d", index);
+    pad = g_object_new (GST_TYPE_OMX_MCCAMERA_PAD, "name", name,
+            "direction", GST_PAD_SRC, "template", templ, NULL);
+    g_free (name);
+
+    pad->index = index;
+    pad->segment_pending = TRUE;
+
+    name = g_strdup_printf ("out_%02d", index);
+    pad->port = g_omx_core_get_port (self->gomx, name,
+            OMX_CAMERA_PORT_VIDEO_START + index);
+    g_free (name);
+
+    /* Configuring port to allocated buffers instead of use shared buffers */
+    pad->port->omx_allocate = TRUE;
+    pad->port->share_buffer = FALSE;
+    pad->port->enabled = TRUE;
+
+    gst_pad_set_setcaps_function (GST_PAD (pad), GST_DEBUG_FUNCPTR (src_setcaps));
+    gst_pad_set_fixatecaps_function (GST_PAD (pad), GST_DEBUG_FUNCPTR (src_fixatecaps));
+
+    self->channels[index] = pad;
+    self->num_channels = MAX (self->num_channels, index + 1);
+
+    g_mutex_unlock (self->ready_lock);
+
+    GST_INFO_OBJECT (self, "added channel %d", index);
+
+    if (GST_STATE (element) > GST_STATE_READY)
+        gst_pad_set_active (GST_PAD (pad), TRUE);
+    gst_element_add_pad (element, GST_PAD (pad));
+
+    return GST_PAD (pad);
+}
+
+static void
+release_pad (GstElement *element,
+             GstPad *gst_pad)
+{
+    GstOmxMcCamera *self;
+    GstOmxMcCameraPad *pad;
+    guint i;
+
+    self = GST_OMX_MCCAMERA (element);
+    pad = GST_OMX_MCCAMERA_PAD (gst_pad);
+
+    g_mutex_lock (self->ready_lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "channels can't be removed while capturing");
+        return;
+    }
+
+    /* the port stays in the core, disabled ones are not prepared */
+    pad->port->enabled = FALSE;
+
+    self->channels[pad->index] = NULL;
+    self->num_channels = 0;
+    for (i = 0; i < MCCAMERA_MAX_CHANNELS; i++)
+        if (self->channels[i])
+            self->num_channels = i + 1;
+
+    g_mutex_unlock (self->ready_lock);
+
+    gst_element_remove_pad (element, gst_pad);
+}
+
+static GstStateChangeReturn
+change_state (GstElement *element,
+              GstStateChange transition)
+{
+    GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+    GstOmxMcCamera *self;
+    GOmxCore *core;
+    guint i;
+
+    self = GST_OMX_MCCAMERA (element);
+    core = self->gomx;
+
+    GST_INFO_OBJECT (self, "begin: changing state %s -> %s",
+                     gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
+                     gst_element_state_get_name (GST_STATE_TRANSITION_NEXT (transition)));
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_NULL_TO_READY:
+            g_omx_core_init (core);
+            if (core->omx_state != OMX_StateLoaded)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+            for (i = 0; i < self->num_channels; i++)
+            {
+                GstOmxMcCameraPad *pad = self->channels[i];
+
+                if (!pad)
+                    continue;
+
+                pad->pushed = 0;
+                pad->segment_pending = TRUE;
+                pad->eos_pending = FALSE;
+                gst_omx_camera_sync_reset (&pad->sync);
+                memset (&pad->sync.stats, 0, sizeof (pad->sync.stats));
+            }
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+            g_mutex_lock (self->ready_lock);
+            self->playing = TRUE;
+            if (!omx_start (self))
+            {
+                g_mutex_unlock (self->ready_lock);
+                GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                        ("could not start capture"));
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            g_mutex_unlock (self->ready_lock);
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            g_mutex_lock (self->ready_lock);
+            if (self->ready)
+            {
+                /* unlock the loops and make sure streaming finishes */
+                for (i = 0; i < self->num_channels; i++)
+                {
+                    g_omx_port_pause (self->channels[i]->port);
+                    gst_pad_stop_task (GST_PAD (self->channels[i]));
+                }
+            }
+            g_mutex_unlock (self->ready_lock);
+            break;
+
+        default:
+            break;
+    }
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        goto leave;
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+            /* live source */
+            ret = GST_STATE_CHANGE_NO_PREROLL;
+            break;
+
+        case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+            self->playing = FALSE;
+            ret = GST_STATE_CHANGE_NO_PREROLL;
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            g_mutex_lock (self->ready_lock);
+            if (self->ready)
+            {
+                for (i = 0; i < self->num_channels; i++)
+                    g_omx_port_finish (self->channels[i]->port);
+
+                g_omx_core_stop (core);
+                g_omx_core_unload (core);
+                self->ready = FALSE;
+            }
+            g_mutex_unlock (self->ready_lock);
+            if (core->omx_state != OMX_StateLoaded &&
+                core->omx_state != OMX_StateInvalid)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_NULL:
+            g_omx_core_deinit (core);
+            break;
+
+        default:
+            break;
+    }
+
+leave:
+    GST_LOG_OBJECT (self, "end");
+
+    return ret;
+}
+
+/*
+ * GObject Methods:
+ */
+
+static void
+finalize (GObject *obj)
+{
+    GstOmxMcCamera *self;
+
+    self = GST_OMX_MCCAMERA (obj);
+
+    g_omx_core_free (self->gomx);
+
+    g_free (self->omx_role);
+    g_free (self->omx_component);
+    g_free (self->omx_library);
+
+    g_mutex_free (self->ready_lock);
+    g_mutex_free (self->stats_lock);
+
+    G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMcCamera *self;
+    const gchar *str;
+
+    self = GST_OMX_MCCAMERA (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_free (self->omx_role);
+            self->omx_role = g_value_dup_string (value);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_free (self->omx_component);
+            self->omx_component = g_value_dup_string (value);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_free (self->omx_library);
+            self->omx_library = g_value_dup_string (value);
+            break;
+        case ARG_INPUT_INTERFACE:
+            str = g_value_get_string (value);
+            if (!strcmp (str, "VIP1_PORTA"))
+                self->input_interface = OMX_VIDEO_CaptureHWPortVIP1_PORTA;
+            else if (!strcmp (str, "VIP1_PORTB"))
+                self->input_interface = OMX_VIDEO_CaptureHWPortVIP1_PORTB;
+            else if (!strcmp (str, "VIP2_PORTA"))
+                self->input_interface = OMX_VIDEO_CaptureHWPortVIP2_PORTA;
+            else if (!strcmp (str, "VIP2_PORTB"))
+                self->input_interface = OMX_VIDEO_CaptureHWPortVIP2_PORTB;
+            else
+                GST_WARNING_OBJECT (self, "%s unsupported", str);
+            break;
+        case ARG_CAP_MODE:
+            str = g_value_get_string (value);
+            if (!strcmp (str, "MC_LINE_MUX"))
+                self->cap_mode = OMX_VIDEO_CaptureModeMC_LINE_MUX;
+            else if (!strcmp (str, "MC_PEL_MUX"))
+                self->cap_mode = OMX_VIDEO_CaptureModeMC_PEL_MUX;
+            else if (!strcmp (str, "MC_LINE_MUX_SPLIT_LINE"))
+                self->cap_mode = OMX_VIDEO_CaptureModeMC_LINE_MUX_SPLIT_LINE;
+            else if (!strcmp (str, "SC_NON_MUX"))
+                self->cap_mode = OMX_VIDEO_CaptureModeSC_NON_MUX;
+            else
+                GST_WARNING_OBJECT (self, "%s unsupported", str);
+            break;
+        case ARG_SCAN_TYPE:
+            str = g_value_get_string (value);
+            if (!strcmp (str, "progressive"))
+                self->scan_type = OMX_VIDEO_CaptureScanTypeProgressive;
+            else if (!strcmp (str, "interlaced"))
+                self->scan_type = OMX_VIDEO_CaptureScanTypeInterlaced;
+            else
+                GST_WARNING_OBJECT (self, "%s unsupported", str);
+            break;
+        case ARG_VIF_MODE:
+            str = g_value_get_string (value);
+            if (!strcmp (str, "24BIT"))
+                self->vif_mode = OMX_VIDEO_CaptureVifMode_24BIT;
+            else if (!strcmp (str, "16BIT"))
+                self->vif_mode = OMX_VIDEO_CaptureVifMode_16BIT;
+            else
+                self->vif_mode = OMX_VIDEO_CaptureVifMode_08BIT;
+            break;
+        case ARG_NUM_OUTPUT_BUFFERS:
+            self->num_output_buffers = g_value_get_uint (value);
+            break;
+        case ARG_NUM_BUFFERS:
+            self->num_buffers = g_value_get_int (value);
+            break;
+        default:
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMcCamera *self;
+
+    self = GST_OMX_MCCAMERA (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_value_set_string (value, self->omx_role);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_value_set_string (value, self->omx_component);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_value_set_string (value, self->omx_library);
+            break;
+        case ARG_INPUT_INTERFACE:
+            if (self->input_interface == OMX_VIDEO_CaptureHWPortVIP1_PORTB)
+                g_value_set_string (value, "VIP1_PORTB");
+            else if (self->input_interface == OMX_VIDEO_CaptureHWPortVIP2_PORTA)
+                g_value_set_string (value, "VIP2_PORTA");
+            else if (self->input_interface == OMX_VIDEO_CaptureHWPortVIP2_PORTB)
+                g_value_set_string (value, "VIP2_PORTB");
+            else
+                g_value_set_string (value, "VIP1_PORTA");
+            break;
+        case ARG_CAP_MODE:
+            if (self->cap_mode == OMX_VIDEO_CaptureModeMC_PEL_MUX)
+                g_value_set_string (value, "MC_PEL_MUX");
+            else if (self->cap_mode == OMX_VIDEO_CaptureModeMC_LINE_MUX_SPLIT_LINE)
+                g_value_set_string (value, "MC_LINE_MUX_SPLIT_LINE");
+            else if (self->cap_mode == OMX_VIDEO_CaptureModeSC_NON_MUX)
+                g_value_set_string (value, "SC_NON_MUX");
+            else
+                g_value_set_string (value, "MC_LINE_MUX");
+            break;
+        case ARG_SCAN_TYPE:
+            if (self->scan_type == OMX_VIDEO_CaptureScanTypeInterlaced)
+                g_value_set_string (value, "interlaced");
+            else
+                g_value_set_string (value, "progressive");
+            break;
+        case ARG_VIF_MODE:
+            if (self->vif_mode == OMX_VIDEO_CaptureVifMode_24BIT)
+                g_value_set_string (value, "24BIT");
+            else if (self->vif_mode == OMX_VIDEO_CaptureVifMode_16BIT)
+                g_value_set_string (value, "16BIT");
+            else
+                g_value_set_string (value, "08BIT");
+            break;
+        case ARG_NUM_OUTPUT_BUFFERS:
+            g_value_set_uint (value, self->num_output_buffers);
+            break;
+        case ARG_NUM_BUFFERS:
+            g_value_set_int (value, self->num_buffers);
+            break;
+        default:
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+/*
+ * Initialization:
+ */
+
+static void
+type_base_init (gpointer g_class)
+{
+    GstElementClass *element_class;
+
+    element_class = GST_ELEMENT_CLASS (g_class);
+
+    {
+        GstElementDetails details;
+
+        details.longname = "Video OMX Multi-channel Camera Source";
+        details.klass = "Source/Video";
+        details.description = "Captures the multiplexed channels of a VIP port from one OMX Camera Component";
+        details.author = "RidgeRun";
+
+        gst_element_class_set_details (element_class, &details);
+    }
+
+    gst_element_class_add_pad_template (element_class,
+        gst_static_pad_template_get (&src_template));
+}
+
+static void
+type_class_init (gpointer g_class,
+                 gpointer class_data)
+{
+    GObjectClass *gobject_class;
+    GstElementClass *gstelement_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+    gstelement_class = GST_ELEMENT_CLASS (g_class);
+
+    gobject_class->finalize = finalize;
+    gstelement_class->change_state = change_state;
+    gstelement_class->send_event = GST_DEBUG_FUNCPTR (send_event);
+    gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR (request_new_pad);
+    gstelement_class->release_pad = GST_DEBUG_FUNCPTR (release_pad);
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_ROLE,
+                                         g_param_spec_string ("component-role", "Component role",
+                                                              "Role of the OpenMAX IL component",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_NAME,
+                                         g_param_spec_string ("component-name", "Component name",
+                                                              "Name of the OpenMAX IL component to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_LIBRARY_NAME,
+                                         g_param_spec_string ("library-name", "Library name",
+                                                              "Name of the OpenMAX IL implementation library to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_INPUT_INTERFACE,
+                                         g_param_spec_string ("input-interface", "Video input interface",
+                                                              "The video input interface the channels are multiplexed on"
+                                                              "\n\t\t\t VIP1_PORTA "
+                                                              "\n\t\t\t VIP1_PORTB "
+                                                              "\n\t\t\t VIP2_PORTA "
+                                                              "\n\t\t\t VIP2_PORTB ", "VIP1_PORTA", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_CAP_MODE,
+                                         g_param_spec_string ("capture-mode", "Multiplex mode",
+                                                              "How the channels are multiplexed (see below)"
+                                                              "\n\t\t\t MC_LINE_MUX "
+                                                              "\n\t\t\t MC_PEL_MUX "
+                                                              "\n\t\t\t MC_LINE_MUX_SPLIT_LINE "
+                                                              "\n\t\t\t SC_NON_MUX ", "MC_LINE_MUX", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_SCAN_TYPE,
+                                         g_param_spec_string ("scan-type", "Video scan mode",
+                                                              "Video scan mode (see below)"
+                                                              "\n\t\t\t progressive "
+                                                              "\n\t\t\t interlaced ", "progressive", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_VIF_MODE,
+                                         g_param_spec_string ("vif-mode", "Bit width of capture",
+                                                              "Video capture size (8, 16, 24 bits) (see below)"
+                                                              "\n\t\t\t 08BIT "
+                                                              "\n\t\t\t 16BIT "
+                                                              "\n\t\t\t 24BIT ", "08BIT", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_NUM_OUTPUT_BUFFERS,
+                                         g_param_spec_uint ("output-buffers", "Output buffers",
+                                                            "OMX buffers shared by all channels, split evenly between "
+                                                            "them (0 = 4 per channel)",
+                                                            0, 256, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_NUM_BUFFERS,
+                                         g_param_spec_int ("num-buffers", "num-buffers",
+                                                           "Number of buffers to output on each channel before sending EOS (-1 = unlimited)",
+                                                           -1, G_MAXINT, -1, G_PARAM_READWRITE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
+    }
+}
+
+static void
+type_instance_init (GTypeInstance *instance,
+                    gpointer g_class)
+{
+    GstOmxMcCamera *self;
+
+    self = GST_OMX_MCCAMERA (instance);
+
+    GST_LOG_OBJECT (self, "begin");
+
+    self->gomx = g_omx_core_new (self, g_class);
+    self->gomx->use_timestamps = TRUE;
+    self->ready_lock = g_mutex_new ();
+    self->stats_lock = g_mutex_new ();
+
+    self->input_interface = OMX_VIDEO_CaptureHWPortVIP1_PORTA;
+    self->cap_mode = OMX_VIDEO_CaptureModeMC_LINE_MUX;
+    self->scan_type = OMX_VIDEO_CaptureScanTypeProgressive;
+    self->vif_mode = OMX_VIDEO_CaptureVifMode_08BIT;
+    self->num_buffers = -1;
+
+    GST_OBJECT_FLAG_SET (self, GST_ELEMENT_IS_SOURCE);
+
+    GST_LOG_OBJECT (self, "end");
+}
+
+static void
+omx_interface_init (GstImplementsInterfaceClass *klass)
+{
+}
+
+static gboolean
+interface_supported (GstImplementsInterface *iface,
+                     GType type)
+{
+    g_assert (type == GST_TYPE_OMX);
+    return TRUE;
+}
+
+static void
+interface_init (GstImplementsInterfaceClass *klass)
+{
+    klass->supported = interface_supported;
+}
+
+static void
+init_interfaces (GType type)
+{
+    GInterfaceInfo *iface_info;
+    GInterfaceInfo *omx_info;
+
+    iface_info = g_new0 (GInterfaceInfo, 1);
+    iface_info->interface_init = (GInterfaceInitFunc) interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_IMPLEMENTS_INTERFACE, iface_info);
+    g_free (iface_info);
+
+    omx_info = g_new0 (GInterfaceInfo, 1);
+    omx_info->interface_init = (GInterfaceInitFunc) omx_interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_OMX, omx_info);
+    g_free (omx_info);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_MCCAMERA_H
+#define GSTOMX_MCCAMERA_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+#define GST_OMX_MCCAMERA(obj) ((GstOmxMcCamera *) (obj))
+#define GST_OMX_MCCAMERA_TYPE (gst_omx_mccamera_get_type ())
+#define GST_OMX_MCCAMERA_CLASS(obj) ((GstOmxMcCameraClass *) (obj))
+
+#define GST_TYPE_OMX_MCCAMERA_PAD (gst_omx_mccamera_pad_get_type ())
+#define GST_OMX_MCCAMERA_PAD(obj) \
+        (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_OMX_MCCAMERA_PAD, GstOmxMcCameraPad))
+
+typedef struct GstOmxMcCamera GstOmxMcCamera;
+typedef struct GstOmxMcCameraClass GstOmxMcCameraClass;
+typedef struct GstOmxMcCameraPad GstOmxMcCameraPad;
+typedef struct GstOmxMcCameraPadClass GstOmxMcCameraPadClass;
+
+#include "gstomx_util.h"
+#include "gstomx_camera.h"
+
+/* One VFCC handle captures up to this many multiplexed channels */
+#define MCCAMERA_MAX_CHANNELS 16
+
+/* A src_%02d pad, fed by the output port of the same index. */
+struct GstOmxMcCameraPad
+{
+    GstPad pad;
+
+    guint index;
+    GOmxPort *port;
+
+    GstVideoFormat format;
+    gint width, height, stride;
+    gint fps_n, fps_d;
+    guint skip_frames;
+
+    guint64 pushed;
+    gboolean segment_pending;
+    gboolean eos_pending;
+    GstOmxCameraSync sync;
+};
+
+struct GstOmxMcCameraPadClass
+{
+    GstPadClass parent_class;
+};
+
+struct GstOmxMcCamera
+{
+    GstElement element;
+
+    GstOmxMcCameraPad *channels[MCCAMERA_MAX_CHANNELS];
+    guint num_channels;
+
+    GOmxCore *gomx;
+
+    char *omx_role;
+    char *omx_component;
+    char *omx_library;
+
+    gint input_interface;
+    gint cap_mode;
+    gint scan_type;
+    gint vif_mode;
+
+    guint num_output_buffers;   /**< shared by all channels, 0 for default */
+    gint num_buffers;           /**< per channel before EOS, -1 for unlimited */
+
+    gboolean ready;
+    gboolean playing;
+    GMutex *ready_lock;
+    GMutex *stats_lock;
+};
+
+struct GstOmxMcCameraClass
+{
+    GstElementClass parent_class;
+};
+
+GType gst_omx_mccamera_get_type (void);
+GType gst_omx_mccamera_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* GSTOMX_MCCAMERA_H */
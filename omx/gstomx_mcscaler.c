@@ -0,0 +1,1281 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Multi-channel scaler: every sink_%02d/src_%02d pad pair is one channel of
+ * a single OMX.TI.VPSSM3.VFPC.INDTXSCWB handle, instead of one handle per
+ * stream as with omx_scaler.  Channel buffers are collected per tick and
+ * submitted back to back, so the component sees the whole set at once.
+ */
+
+#include "gstomx_mcscaler.h"
+#include "gstomx.h"
+#include "gstomx_interface.h"
+#include "gstomx_buffertransport.h"
+#include <gst/video/video.h>
+
+#include <stdlib.h> /* for atoi */
+#include <string.h> /* for strlen */
+
+enum
+{
+    ARG_0,
+    ARG_COMPONENT_ROLE,
+    ARG_COMPONENT_NAME,
+    ARG_LIBRARY_NAME,
+    ARG_USE_TIMESTAMPS,
+    ARG_NUM_INPUT_BUFFERS,
+    ARG_NUM_OUTPUT_BUFFERS,
+    ARG_FRAMES,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
+};
+
+#define DEFAULT_NUM_INPUT_BUFFERS 4
+#define DEFAULT_NUM_OUTPUT_BUFFERS 4
+
+static void init_interfaces (GType type);
+GSTOMX_BOILERPLATE_FULL (GstOmxMcScaler, gst_omx_mcscaler, GstElement, GST_TYPE_ELEMENT, init_interfaces);
+
+static GstStaticPadTemplate sink_template =
+        GST_STATIC_PAD_TEMPLATE ("sink_%02d",
+                GST_PAD_SINK,
+                GST_PAD_REQUEST,
+                GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV_STRIDED (
+                        "{NV12}", "[ 0, max ]"))
+        );
+
+static GstStaticPadTemplate src_template =
+        GST_STATIC_PAD_TEMPLATE ("src_%02d",
+                GST_PAD_SRC,
+                GST_PAD_SOMETIMES,
+                GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ( "{YUY2}" ))
+        );
+
+static gint
+gstomx_calculate_stride (int width, GstVideoFormat format)
+{
+    switch (format)
+    {
+        case GST_VIDEO_FORMAT_NV12:
+            return width;
+        case GST_VIDEO_FORMAT_YUY2:
+            return width * 2;
+        default:
+            GST_ERROR ("unsupported color format");
+    }
+    return -1;
+}
+
+static GstIterator *
+iterate_internal_links (GstPad *pad)
+{
+    GstOmxMcScalerChannel *channel;
+    GstPad *peer;
+
+    channel = gst_pad_get_element_private (pad);
+    peer = (pad == channel->sinkpad) ? channel->srcpad : channel->sinkpad;
+
+    return gst_iterator_new_single (GST_TYPE_PAD, peer,
+            (GstCopyFunction) gst_object_ref, (GFreeFunc) gst_object_unref);
+}
+
+static gboolean
+sink_setcaps (GstPad *pad,
+              GstCaps *caps)
+{
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+    GstStructure *structure;
+    GstVideoFormat format;
+    const GValue *framerate;
+
+    self = GST_OMX_MCSCALER (GST_PAD_PARENT (pad));
+    channel = gst_pad_get_element_private (pad);
+
+    GST_INFO_OBJECT (self, "setcaps (sink_%02d): %" GST_PTR_FORMAT, channel->index, caps);
+
+    g_return_val_if_fail (caps, FALSE);
+    g_return_val_if_fail (gst_caps_is_fixed (caps), FALSE);
+
+    structure = gst_caps_get_structure (caps, 0);
+
+    if (!gst_video_format_parse_caps_strided (caps,
+            &format, &channel->in_width, &channel->in_height, &channel->in_stride))
+    {
+        GST_WARNING_OBJECT (self, "width and/or height is not set in caps");
+        return FALSE;
+    }
+
+    if (!channel->in_stride)
+    {
+        channel->in_stride = gstomx_calculate_stride (channel->in_width, format);
+    }
+
+    framerate = gst_structure_get_value (structure, "framerate");
+    if (framerate)
+    {
+        channel->framerate_num = gst_value_get_fraction_numerator (framerate);
+        channel->framerate_denom = gst_value_get_fraction_denominator (framerate);
+
+        if (channel->framerate_num)
+            channel->duration = gst_util_uint64_scale_int (GST_SECOND,
+                    channel->framerate_denom, channel->framerate_num);
+    }
+
+    return gst_pad_set_caps (pad, caps);
+}
+
+static gboolean
+src_setcaps (GstPad *pad,
+             GstCaps *caps)
+{
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+    GstVideoFormat format;
+
+    self = GST_OMX_MCSCALER (GST_PAD_PARENT (pad));
+    channel = gst_pad_get_element_private (pad);
+
+    GST_INFO_OBJECT (self, "setcaps (src_%02d): %" GST_PTR_FORMAT, channel->index, caps);
+
+    g_return_val_if_fail (caps, FALSE);
+    g_return_val_if_fail (gst_caps_is_fixed (caps), FALSE);
+
+    if (!gst_video_format_parse_caps_strided (caps,
+            &format, &channel->out_width, &channel->out_height, &channel->out_stride))
+    {
+        GST_WARNING_OBJECT (self, "width and/or height is not set in caps");
+        return FALSE;
+    }
+
+    if (!channel->out_stride)
+    {
+        channel->out_stride = gstomx_calculate_stride (channel->out_width, format);
+    }
+
+    /* save the src caps later needed by omx transport buffer */
+    if (channel->out_port->caps)
+        gst_caps_unref (channel->out_port->caps);
+
+    channel->out_port->caps = gst_caps_copy (caps);
+
+    return TRUE;
+}
+
+static GstCaps *
+create_src_caps (GstOmxMcScalerChannel *channel)
+{
+    GstCaps *caps;
+    GstStructure *struc;
+    gint width = 0;
+    gint height = 0;
+
+    caps = gst_pad_peer_get_caps (channel->srcpad);
+
+    if (caps && !gst_caps_is_empty (caps))
+    {
+        GstStructure *s;
+
+        s = gst_caps_get_structure (caps, 0);
+        gst_structure_get_int (s, "width", &width);
+        gst_structure_get_int (s, "height", &height);
+    }
+
+    if (caps)
+        gst_caps_unref (caps);
+
+    /* Set default values */
+    if (!width && !height)
+    {
+        width = channel->in_width;
+        height = channel->in_height;
+    }
+    else if (!height)
+    {
+        height = width * channel->in_height / channel->in_width;
+    }
+    else if (!width)
+    {
+        width = height * channel->in_width / channel->in_height;
+    }
+
+    /* Workaround: Make width multiple of 16, otherwise, scaler crashes */
+    width = (width + 15) & 0xFFFFFFF0;
+
+    caps = gst_caps_new_empty ();
+    struc = gst_structure_new (("video/x-raw-yuv"),
+            "width",  G_TYPE_INT, width,
+            "height", G_TYPE_INT, height,
+            "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC ('Y', 'U', 'Y', '2'),
+            NULL);
+
+    if (channel->framerate_denom)
+    {
+        gst_structure_set (struc,
+                "framerate", GST_TYPE_FRACTION, channel->framerate_num,
+                channel->framerate_denom, NULL);
+    }
+
+    gst_caps_append_structure (caps, struc);
+
+    return caps;
+}
+
+/* Shares the upstream OMX buffers when the channel is fed by another OMX
+ * element, the same way the single channel filters do.
+ */
+static void
+setup_input_buffer (GstOmxMcScaler *self,
+                    GstOmxMcScalerChannel *channel,
+                    GstBuffer *buf)
+{
+    GOmxPort *in_port = channel->in_port;
+
+    if (buf && GST_IS_OMXBUFFERTRANSPORT (buf))
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE param;
+        GOmxPort *port;
+        gint i;
+
+        port = GST_GET_OMXPORT (buf);
+
+        if (!port->always_copy)
+        {
+            /* configure input buffer size to match with upstream buffer */
+            G_OMX_PORT_GET_DEFINITION (in_port, &param);
+            param.nBufferSize = GST_BUFFER_SIZE (buf);
+            param.nBufferCountActual = port->num_buffers;
+            G_OMX_PORT_SET_DEFINITION (in_port, &param);
+
+            in_port->share_buffer_info = g_new0 (OmxBufferInfo, 1);
+            in_port->share_buffer_info->pBuffer = g_new0 (OMX_U8 *, port->num_buffers);
+            for (i = 0; i < port->num_buffers; i++)
+            {
+                in_port->share_buffer_info->pBuffer[i] = port->buffers[i]->pBuffer;
+            }
+
+            /* disable omx_allocate alloc flag, so that we can fall back to shared method */
+            in_port->omx_allocate = FALSE;
+            in_port->always_copy = FALSE;
+            return;
+        }
+    }
+
+    /* ask openmax to allocate input buffer */
+    in_port->omx_allocate = TRUE;
+    in_port->always_copy = TRUE;
+}
+
+static gboolean
+channel_setup (GstOmxMcScaler *self,
+               GstOmxMcScalerChannel *channel)
+{
+    GOmxCore *gomx;
+    OMX_ERRORTYPE err;
+    OMX_PARAM_PORTDEFINITIONTYPE paramPort;
+    OMX_PARAM_BUFFER_MEMORYTYPE memTypeCfg;
+    OMX_CONFIG_VIDCHANNEL_RESOLUTION chResolution;
+    OMX_CONFIG_ALG_ENABLE algEnable;
+
+    gomx = self->gomx;
+
+    /* set the output cap */
+    {
+        GstCaps *caps = create_src_caps (channel);
+        gst_pad_set_caps (channel->srcpad, caps);
+        gst_caps_unref (caps);
+    }
+
+    if (!channel->out_width || !channel->out_height)
+    {
+        GST_ERROR_OBJECT (self, "src_%02d not negotiated", channel->index);
+        return FALSE;
+    }
+
+    /* Setting Memory type at input and output port to Raw Memory */
+    _G_OMX_INIT_PARAM (&memTypeCfg);
+    memTypeCfg.nPortIndex = channel->in_port->port_index;
+    memTypeCfg.eBufMemoryType = OMX_BUFFER_MEMORY_DEFAULT;
+    err = OMX_SetParameter (gomx->omx_handle, OMX_TI_IndexParamBuffMemType, &memTypeCfg);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    _G_OMX_INIT_PARAM (&memTypeCfg);
+    memTypeCfg.nPortIndex = channel->out_port->port_index;
+    memTypeCfg.eBufMemoryType = OMX_BUFFER_MEMORY_DEFAULT;
+    err = OMX_SetParameter (gomx->omx_handle, OMX_TI_IndexParamBuffMemType, &memTypeCfg);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    /* Input port configuration. */
+    G_OMX_PORT_GET_DEFINITION (channel->in_port, &paramPort);
+    paramPort.format.video.nFrameWidth = channel->in_width;
+    paramPort.format.video.nFrameHeight = channel->in_height;
+    paramPort.format.video.nStride = channel->in_stride;
+    paramPort.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    paramPort.format.video.eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
+    if (channel->in_port->always_copy)
+    {
+        paramPort.nBufferSize = channel->in_stride * channel->in_height * 3 / 2;
+        paramPort.nBufferCountActual = self->num_input_buffers;
+    }
+    paramPort.nBufferAlignment = 0;
+    paramPort.bBuffersContiguous = 0;
+    G_OMX_PORT_SET_DEFINITION (channel->in_port, &paramPort);
+    g_omx_port_setup (channel->in_port, &paramPort);
+
+    /* Output port configuration. */
+    G_OMX_PORT_GET_DEFINITION (channel->out_port, &paramPort);
+    paramPort.format.video.nFrameWidth = channel->out_width;
+    paramPort.format.video.nFrameHeight = channel->out_height;
+    paramPort.format.video.nStride = channel->out_stride;
+    paramPort.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    paramPort.format.video.eColorFormat = OMX_COLOR_FormatYCbYCr;
+    paramPort.nBufferSize = channel->out_stride * channel->out_height;
+    paramPort.nBufferCountActual = self->num_output_buffers;
+    paramPort.nBufferAlignment = 0;
+    paramPort.bBuffersContiguous = 0;
+    G_OMX_PORT_SET_DEFINITION (channel->out_port, &paramPort);
+    g_omx_port_setup (channel->out_port, &paramPort);
+
+    /* Set input channel resolution */
+    _G_OMX_INIT_PARAM (&chResolution);
+    chResolution.Frm0Width = channel->in_width;
+    chResolution.Frm0Height = channel->in_height;
+    chResolution.Frm0Pitch = channel->in_stride;
+    chResolution.Frm1Width = 0;
+    chResolution.Frm1Height = 0;
+    chResolution.Frm1Pitch = 0;
+    chResolution.FrmStartX = 0;
+    chResolution.FrmStartY = 0;
+    chResolution.FrmCropWidth = 0;
+    chResolution.FrmCropHeight = 0;
+    chResolution.eDir = OMX_DirInput;
+    chResolution.nChId = channel->index;
+    err = OMX_SetConfig (gomx->omx_handle, OMX_TI_IndexConfigVidChResolution, &chResolution);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    /* Set output channel resolution */
+    _G_OMX_INIT_PARAM (&chResolution);
+    chResolution.Frm0Width = channel->out_width;
+    chResolution.Frm0Height = channel->out_height;
+    chResolution.Frm0Pitch = channel->out_stride;
+    chResolution.Frm1Width = 0;
+    chResolution.Frm1Height = 0;
+    chResolution.Frm1Pitch = 0;
+    chResolution.FrmStartX = 0;
+    chResolution.FrmStartY = 0;
+    chResolution.FrmCropWidth = 0;
+    chResolution.FrmCropHeight = 0;
+    chResolution.eDir = OMX_DirOutput;
+    chResolution.nChId = channel->index;
+    err = OMX_SetConfig (gomx->omx_handle, OMX_TI_IndexConfigVidChResolution, &chResolution);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    _G_OMX_INIT_PARAM (&algEnable);
+    algEnable.nPortIndex = 0;
+    algEnable.nChId = channel->index;
+    algEnable.bAlgBypass = OMX_FALSE;
+    err = OMX_SetConfig (gomx->omx_handle, (OMX_INDEXTYPE) OMX_TI_IndexConfigAlgEnable, &algEnable);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+omx_setup (GstOmxMcScaler *self)
+{
+    GOmxCore *gomx;
+    OMX_ERRORTYPE err;
+    OMX_PARAM_VFPC_NUMCHANNELPERHANDLE numChannels;
+    guint i;
+
+    gomx = self->gomx;
+
+    GST_INFO_OBJECT (self, "begin: %u channels", self->num_channels);
+
+    /* the component numbers its channels 0..N-1 */
+    for (i = 0; i < self->num_channels; i++)
+    {
+        if (!self->channels[i])
+        {
+            GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                    ("channels must be numbered from sink_00 without gaps"));
+            return FALSE;
+        }
+    }
+
+    _G_OMX_INIT_PARAM (&numChannels);
+    numChannels.nNumChannelsPerHandle = self->num_channels;
+    err = OMX_SetParameter (gomx->omx_handle,
+        (OMX_INDEXTYPE) OMX_TI_IndexParamVFPCNumChPerHandle, &numChannels);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    for (i = 0; i < self->num_channels; i++)
+    {
+        GstOmxMcScalerChannel *channel = self->channels[i];
+
+        if (!channel_setup (self, channel))
+            return FALSE;
+
+        channel->in_port->enabled = TRUE;
+        channel->out_port->enabled = TRUE;
+        g_omx_port_resume (channel->in_port);
+        g_omx_port_resume (channel->out_port);
+
+        OMX_SendCommand (gomx->omx_handle, OMX_CommandPortEnable,
+                channel->in_port->port_index, NULL);
+        g_sem_down (gomx->port_sem);
+
+        OMX_SendCommand (gomx->omx_handle, OMX_CommandPortEnable,
+                channel->out_port->port_index, NULL);
+        g_sem_down (gomx->port_sem);
+    }
+
+    GST_INFO_OBJECT (self, "end");
+
+    return TRUE;
+}
+
+static void
+output_loop (gpointer data)
+{
+    GstPad *pad;
+    GOmxCore *gomx;
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+    GstFlowReturn ret = GST_FLOW_OK;
+    gpointer obj;
+
+    pad = data;
+    self = GST_OMX_MCSCALER (gst_pad_get_parent (pad));
+    channel = gst_pad_get_element_private (pad);
+    gomx = self->gomx;
+
+    g_omx_threads_enter_task (gomx->threads, pad, GST_PAD_NAME (pad));
+
+    obj = g_omx_port_recv (channel->out_port);
+
+    if (G_UNLIKELY (!obj))
+    {
+        GST_INFO_OBJECT (self, "src_%02d: null buffer: leaving", channel->index);
+        ret = GST_FLOW_WRONG_STATE;
+    }
+    else if (G_LIKELY (GST_IS_BUFFER (obj)))
+    {
+        GstBuffer *buf = GST_BUFFER (obj);
+
+        GST_BUFFER_DURATION (buf) = channel->duration;
+        PRINT_BUFFER (self, buf);
+
+        ret = gst_pad_push (pad, buf);
+        GST_LOG_OBJECT (self, "src_%02d: ret=%s", channel->index, gst_flow_get_name (ret));
+
+        /* an unlinked stream must not stall the other channels */
+        if (ret == GST_FLOW_NOT_LINKED)
+            ret = GST_FLOW_OK;
+    }
+    else if (GST_IS_EVENT (obj))
+    {
+        GST_DEBUG_OBJECT (self, "src_%02d: got eos", channel->index);
+        gst_pad_push_event (pad, obj);
+        ret = GST_FLOW_UNEXPECTED;
+    }
+
+    channel->last_pad_push_return = ret;
+
+    if (gomx->omx_error != OMX_ErrorNone)
+    {
+        GST_DEBUG_OBJECT (self, "omx_error=%s", g_omx_error_to_str (gomx->omx_error));
+        ret = GST_FLOW_ERROR;
+    }
+
+    if (ret != GST_FLOW_OK)
+    {
+        GST_INFO_OBJECT (self, "src_%02d: pause task, reason: %s",
+                         channel->index, gst_flow_get_name (ret));
+        gst_pad_pause_task (pad);
+    }
+
+    gst_object_unref (self);
+}
+
+static gboolean
+omx_start (GstOmxMcScaler *self,
+           GstCollectPads *pads)
+{
+    GOmxCore *gomx = self->gomx;
+    GSList *item;
+    guint i;
+
+    for (item = pads->data; item != NULL; item = item->next)
+    {
+        GstCollectData *collectdata = item->data;
+        GstBuffer *buf;
+
+        buf = gst_collect_pads_peek (pads, collectdata);
+        setup_input_buffer (self, gst_pad_get_element_private (collectdata->pad), buf);
+        if (buf)
+            gst_buffer_unref (buf);
+    }
+
+    if (!omx_setup (self))
+        return FALSE;
+
+    g_omx_core_prepare (gomx);
+
+    if (gomx->omx_state != OMX_StateIdle)
+        return FALSE;
+
+    self->ready = TRUE;
+
+    for (i = 0; i < self->num_channels; i++)
+    {
+        GstPad *srcpad = self->channels[i]->srcpad;
+
+        gst_pad_start_task (srcpad, output_loop, srcpad);
+    }
+
+    g_omx_core_start (gomx);
+
+    return gomx->omx_state == OMX_StateExecuting;
+}
+
+/* One tick: every channel that is not at EOS has a buffer queued, and all
+ * of them are handed to the component before waiting on any output.
+ */
+static GstFlowReturn
+collected (GstCollectPads *pads,
+           GstOmxMcScaler *self)
+{
+    GOmxCore *gomx = self->gomx;
+    GstFlowReturn ret = GST_FLOW_UNEXPECTED;
+    GSList *item;
+    guint submitted = 0;
+
+    g_mutex_lock (self->ready_lock);
+    if (G_UNLIKELY (gomx->omx_state == OMX_StateLoaded))
+    {
+        if (!omx_start (self, pads))
+        {
+            g_mutex_unlock (self->ready_lock);
+            goto out_flushing;
+        }
+    }
+    g_mutex_unlock (self->ready_lock);
+
+    for (item = pads->data; item != NULL; item = item->next)
+    {
+        GstCollectData *collectdata = item->data;
+        GstOmxMcScalerChannel *channel;
+        GstBuffer *buf;
+
+        channel = gst_pad_get_element_private (collectdata->pad);
+        buf = gst_collect_pads_pop (pads, collectdata);
+
+        if (!buf)
+        {
+            if (!channel->eos)
+            {
+                GstEvent *event = gst_event_new_eos ();
+
+                /* the EOS flag comes back on the channel's output port */
+                channel->eos = TRUE;
+                if (g_omx_port_send (channel->in_port, event) < 0)
+                    gst_pad_push_event (channel->srcpad, gst_event_ref (event));
+                gst_event_unref (event);
+            }
+            continue;
+        }
+
+        if (channel->last_pad_push_return != GST_FLOW_OK)
+        {
+            /* keep feeding the others; a flushing stream comes back */
+            if (channel->last_pad_push_return < GST_FLOW_UNEXPECTED)
+                ret = channel->last_pad_push_return;
+            else if (ret == GST_FLOW_UNEXPECTED)
+                ret = GST_FLOW_OK;
+            gst_buffer_unref (buf);
+            continue;
+        }
+
+        while (TRUE)
+        {
+            gint sent;
+
+            sent = g_omx_port_send (channel->in_port, buf);
+            if (G_UNLIKELY (sent < 0))
+            {
+                gst_buffer_unref (buf);
+                break;
+            }
+            else if (sent < GST_BUFFER_SIZE (buf))
+            {
+                GstBuffer *subbuf = gst_buffer_create_sub (buf, sent,
+                        GST_BUFFER_SIZE (buf) - sent);
+                gst_buffer_unref (buf);
+                buf = subbuf;
+            }
+            else
+            {
+                gst_buffer_unref (buf);
+                submitted++;
+                break;
+            }
+        }
+
+        if (ret == GST_FLOW_UNEXPECTED)
+            ret = GST_FLOW_OK;
+    }
+
+    self->frames += submitted;
+
+    if (gomx->omx_error != OMX_ErrorNone)
+        goto out_flushing;
+
+    return ret;
+
+    /* special conditions */
+out_flushing:
+    {
+        const gchar *error_msg = NULL;
+
+        if (gomx->omx_error)
+        {
+            error_msg = "Error from OpenMAX component";
+        }
+        else if (gomx->omx_state != OMX_StateExecuting &&
+                 gomx->omx_state != OMX_StatePause)
+        {
+            error_msg = "OpenMAX component in wrong state";
+        }
+
+        if (error_msg)
+        {
+            GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL), (error_msg));
+        }
+
+        return GST_FLOW_ERROR;
+    }
+}
+
+/* Sees the events before GstCollectPads, which keeps EOS and
+ * NEWSEGMENT to itself and forwards the rest over the internal link.
+ */
+static gboolean
+pad_event (GstPad *pad,
+           GstEvent *event)
+{
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+    GstEventType type;
+    gboolean ret;
+
+    self = GST_OMX_MCSCALER (GST_OBJECT_PARENT (pad));
+    channel = gst_pad_get_element_private (pad);
+    type = GST_EVENT_TYPE (event);
+
+    GST_INFO_OBJECT (self, "sink_%02d: event=%s", channel->index, GST_EVENT_TYPE_NAME (event));
+
+    switch (type)
+    {
+        case GST_EVENT_NEWSEGMENT:
+            gst_pad_push_event (channel->srcpad, gst_event_ref (event));
+            break;
+
+        case GST_EVENT_FLUSH_START:
+            channel->last_pad_push_return = GST_FLOW_WRONG_STATE;
+            if (self->ready)
+            {
+                g_omx_port_pause (channel->in_port);
+                g_omx_port_pause (channel->out_port);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    ret = channel->collect_event (pad, event);
+
+    switch (type)
+    {
+        case GST_EVENT_FLUSH_START:
+            gst_pad_pause_task (channel->srcpad);
+            break;
+
+        case GST_EVENT_FLUSH_STOP:
+            channel->eos = FALSE;
+            channel->last_pad_push_return = GST_FLOW_OK;
+            if (self->ready)
+            {
+                g_omx_port_flush (channel->in_port);
+                g_omx_port_flush (channel->out_port);
+                g_omx_port_resume (channel->in_port);
+                g_omx_port_resume (channel->out_port);
+                gst_pad_start_task (channel->srcpad, output_loop, channel->srcpad);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return ret;
+}
+
+static gboolean
+activate_push (GstPad *pad,
+               gboolean active)
+{
+    gboolean result = TRUE;
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+
+    self = GST_OMX_MCSCALER (gst_pad_get_parent (pad));
+    channel = gst_pad_get_element_private (pad);
+
+    if (active)
+    {
+        GST_DEBUG_OBJECT (self, "src_%02d: activate", channel->index);
+        channel->last_pad_push_return = GST_FLOW_OK;
+
+        if (self->ready)
+        {
+            g_omx_port_resume (channel->in_port);
+            g_omx_port_resume (channel->out_port);
+            result = gst_pad_start_task (pad, output_loop, pad);
+        }
+    }
+    else
+    {
+        GST_DEBUG_OBJECT (self, "src_%02d: deactivate", channel->index);
+
+        /* unlock loops */
+        if (self->ready)
+        {
+            g_omx_port_pause (channel->in_port);
+            g_omx_port_pause (channel->out_port);
+        }
+
+        /* make sure streaming finishes */
+        result = gst_pad_stop_task (pad);
+    }
+
+    gst_object_unref (self);
+
+    return result;
+}
+
+static GstPad *
+request_new_pad (GstElement *element,
+                 GstPadTemplate *templ,
+                 const gchar *req_name)
+{
+    GstOmxMcScaler *self;
+    GstElementClass *klass;
+    GstOmxMcScalerChannel *channel;
+    GstCollectData *collectdata;
+    gchar *name;
+    gint index = -1;
+
+    self = GST_OMX_MCSCALER (element);
+    klass = GST_ELEMENT_GET_CLASS (element);
+
+    if (templ != gst_element_class_get_pad_template (klass, "sink_%02d"))
+    {
+        g_warning ("gstomx_mcscaler: this is not our template!");
+        return NULL;
+    }
+
+    g_mutex_lock (self->ready_lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "channels can't be added while scaling");
+        return NULL;
+    }
+
+    if (req_name && strlen (req_name) > 5 && g_str_has_prefix (req_name, "sink_"))
+    {
+        /* parse serial number from requested padname */
+        index = atoi (&req_name[5]);
+    }
+    else
+    {
+        /* no name given when requesting the pad, use the first free channel */
+        for (index = 0; index < MCSCALER_MAX_CHANNELS; index++)
+            if (!self->channels[index])
+                break;
+    }
+
+    if (index < 0 || index >= MCSCALER_MAX_CHANNELS || self->channels[index])
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "no channel available for %s", req_name);
+        return NULL;
+    }
+
+    channel = g_new0 (GstOmxMcScalerChannel, 1);
+    channel->index = index;
+    channel->duration = GST_CLOCK_TIME_NONE;
+    channel->last_pad_push_return = GST_FLOW_OK;
+
+    name = g_strdup_printf ("in_%02d", index);
+    channel->in_port = g_omx_core_get_port (self->gomx, name,
+            OMX_VFPC_INPUT_PORT_START_INDEX + index);
+    g_free (name);
+    name = g_strdup_printf ("out_%02d", index);
+    channel->out_port = g_omx_core_get_port (self->gomx, name,
+            OMX_VFPC_OUTPUT_PORT_START_INDEX + index);
+    g_free (name);
+
+    channel->in_port->omx_allocate = TRUE;
+    channel->in_port->share_buffer = FALSE;
+    channel->in_port->enabled = TRUE;
+    channel->out_port->omx_allocate = TRUE;
+    channel->out_port->share_buffer = FALSE;
+    channel->out_port->always_copy = FALSE;
+    channel->out_port->enabled = TRUE;
+
+    name = g_strdup_printf ("sink_%02d", index);
+    channel->sinkpad = gst_pad_new_from_template (templ, name);
+    g_free (name);
+    gst_pad_set_element_private (channel->sinkpad, channel);
+    gst_pad_set_setcaps_function (channel->sinkpad, GST_DEBUG_FUNCPTR (sink_setcaps));
+    gst_pad_set_iterate_internal_links_function (channel->sinkpad,
+            GST_DEBUG_FUNCPTR (iterate_internal_links));
+
+    collectdata = gst_collect_pads_add_pad (self->collectpads, channel->sinkpad,
+            sizeof (GstCollectData));
+    channel->collect_event = GST_PAD_EVENTFUNC (channel->sinkpad);
+    gst_pad_set_event_function (channel->sinkpad, GST_DEBUG_FUNCPTR (pad_event));
+
+    name = g_strdup_printf ("src_%02d", index);
+    channel->srcpad = gst_pad_new_from_template (
+            gst_element_class_get_pad_template (klass, "src_%02d"), name);
+    g_free (name);
+    gst_pad_set_element_private (channel->srcpad, channel);
+    gst_pad_set_setcaps_function (channel->srcpad, GST_DEBUG_FUNCPTR (src_setcaps));
+    gst_pad_set_activatepush_function (channel->srcpad, activate_push);
+    gst_pad_set_iterate_internal_links_function (channel->srcpad,
+            GST_DEBUG_FUNCPTR (iterate_internal_links));
+    gst_pad_use_fixed_caps (channel->srcpad);
+
+    self->channels[index] = channel;
+    self->num_channels = MAX (self->num_channels, index + 1);
+
+    g_mutex_unlock (self->ready_lock);
+
+    GST_INFO_OBJECT (self, "added channel %d", index);
+
+    if (GST_STATE (element) > GST_STATE_READY)
+        gst_pad_set_active (channel->srcpad, TRUE);
+    gst_element_add_pad (element, channel->srcpad);
+    gst_element_add_pad (element, channel->sinkpad);
+
+    return channel->sinkpad;
+}
+
+static void
+release_pad (GstElement *element,
+             GstPad *pad)
+{
+    GstOmxMcScaler *self;
+    GstOmxMcScalerChannel *channel;
+    guint i;
+
+    self = GST_OMX_MCSCALER (element);
+    channel = gst_pad_get_element_private (pad);
+
+    g_mutex_lock (self->ready_lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->ready_lock);
+        GST_WARNING_OBJECT (self, "channels can't be removed while scaling");
+        return;
+    }
+
+    /* the ports stay in the core, disabled ones are not prepared */
+    channel->in_port->enabled = FALSE;
+    channel->out_port->enabled = FALSE;
+
+    self->channels[channel->index] = NULL;
+    self->num_channels = 0;
+    for (i = 0; i < MCSCALER_MAX_CHANNELS; i++)
+        if (self->channels[i])
+            self->num_channels = i + 1;
+
+    gst_collect_pads_remove_pad (self->collectpads, channel->sinkpad);
+
+    g_mutex_unlock (self->ready_lock);
+
+    gst_element_remove_pad (element, channel->srcpad);
+    gst_element_remove_pad (element, channel->sinkpad);
+
+    g_free (channel);
+}
+
+static GstStateChangeReturn
+change_state (GstElement *element,
+              GstStateChange transition)
+{
+    GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+    GstOmxMcScaler *self;
+    GOmxCore *core;
+    guint i;
+
+    self = GST_OMX_MCSCALER (element);
+    core = self->gomx;
+
+    GST_INFO_OBJECT (self, "begin: changing state %s -> %s",
+                     gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
+                     gst_element_state_get_name (GST_STATE_TRANSITION_NEXT (transition)));
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_NULL_TO_READY:
+            g_omx_core_init (core);
+            if (core->omx_state != OMX_StateLoaded)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+            self->frames = 0;
+            for (i = 0; i < MCSCALER_MAX_CHANNELS; i++)
+                if (self->channels[i])
+                    self->channels[i]->eos = FALSE;
+            gst_collect_pads_start (self->collectpads);
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            gst_collect_pads_stop (self->collectpads);
+            break;
+
+        default:
+            break;
+    }
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        goto leave;
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            g_mutex_lock (self->ready_lock);
+            if (self->ready)
+            {
+                /* unlock */
+                for (i = 0; i < self->num_channels; i++)
+                {
+                    g_omx_port_finish (self->channels[i]->in_port);
+                    g_omx_port_finish (self->channels[i]->out_port);
+                }
+
+                g_omx_core_stop (core);
+                g_omx_core_unload (core);
+                self->ready = FALSE;
+            }
+            g_mutex_unlock (self->ready_lock);
+            if (core->omx_state != OMX_StateLoaded &&
+                core->omx_state != OMX_StateInvalid)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_NULL:
+            g_omx_core_deinit (core);
+            break;
+
+        default:
+            break;
+    }
+
+leave:
+    GST_LOG_OBJECT (self, "end");
+
+    return ret;
+}
+
+static void
+finalize (GObject *obj)
+{
+    GstOmxMcScaler *self;
+    guint i;
+
+    self = GST_OMX_MCSCALER (obj);
+
+    for (i = 0; i < MCSCALER_MAX_CHANNELS; i++)
+        g_free (self->channels[i]);
+
+    gst_object_unref (self->collectpads);
+
+    g_omx_core_free (self->gomx);
+
+    g_free (self->omx_role);
+    g_free (self->omx_component);
+    g_free (self->omx_library);
+
+    g_mutex_free (self->ready_lock);
+
+    G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMcScaler *self;
+
+    self = GST_OMX_MCSCALER (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_free (self->omx_role);
+            self->omx_role = g_value_dup_string (value);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_free (self->omx_component);
+            self->omx_component = g_value_dup_string (value);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_free (self->omx_library);
+            self->omx_library = g_value_dup_string (value);
+            break;
+        case ARG_USE_TIMESTAMPS:
+            self->gomx->use_timestamps = g_value_get_boolean (value);
+            break;
+        case ARG_NUM_INPUT_BUFFERS:
+            self->num_input_buffers = g_value_get_uint (value);
+            break;
+        case ARG_NUM_OUTPUT_BUFFERS:
+            self->num_output_buffers = g_value_get_uint (value);
+            break;
+        default:
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMcScaler *self;
+
+    self = GST_OMX_MCSCALER (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_value_set_string (value, self->omx_role);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_value_set_string (value, self->omx_component);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_value_set_string (value, self->omx_library);
+            break;
+        case ARG_USE_TIMESTAMPS:
+            g_value_set_boolean (value, self->gomx->use_timestamps);
+            break;
+        case ARG_NUM_INPUT_BUFFERS:
+            g_value_set_uint (value, self->num_input_buffers);
+            break;
+        case ARG_NUM_OUTPUT_BUFFERS:
+            g_value_set_uint (value, self->num_output_buffers);
+            break;
+        case ARG_FRAMES:
+            g_value_set_uint64 (value, self->frames);
+            break;
+        default:
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+type_base_init (gpointer g_class)
+{
+    GstElementClass *element_class;
+
+    element_class = GST_ELEMENT_CLASS (g_class);
+
+    {
+        GstElementDetails details;
+
+        details.longname = "OpenMAX IL for OMX.TI.VPSSM3.VFPC.INDTXSCWB component";
+        details.klass = "Filter";
+        details.description = "Scale several video streams on the channels of one VPSS Scaler";
+        details.author = "RidgeRun";
+
+        gst_element_class_set_details (element_class, &details);
+    }
+
+    gst_element_class_add_pad_template (element_class,
+        gst_static_pad_template_get (&sink_template));
+
+    gst_element_class_add_pad_template (element_class,
+        gst_static_pad_template_get (&src_template));
+}
+
+static void
+type_class_init (gpointer g_class,
+                 gpointer class_data)
+{
+    GObjectClass *gobject_class;
+    GstElementClass *gstelement_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+    gstelement_class = GST_ELEMENT_CLASS (g_class);
+
+    gobject_class->finalize = finalize;
+    gstelement_class->change_state = change_state;
+    gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR (request_new_pad);
+    gstelement_class->release_pad = GST_DEBUG_FUNCPTR (release_pad);
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_ROLE,
+                                         g_param_spec_string ("component-role", "Component role",
+                                                              "Role of the OpenMAX IL component",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_NAME,
+                                         g_param_spec_string ("component-name", "Component name",
+                                                              "Name of the OpenMAX IL component to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_LIBRARY_NAME,
+                                         g_param_spec_string ("library-name", "Library name",
+                                                              "Name of the OpenMAX IL implementation library to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_USE_TIMESTAMPS,
+                                         g_param_spec_boolean ("use-timestamps", "Use timestamps",
+                                                               "Whether or not to use timestamps",
+                                                               TRUE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_NUM_INPUT_BUFFERS,
+                                         g_param_spec_uint ("input-buffers", "Input buffers",
+                                                            "The number of OMX input buffers per channel",
+                                                            1, 10, DEFAULT_NUM_INPUT_BUFFERS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_NUM_OUTPUT_BUFFERS,
+                                         g_param_spec_uint ("output-buffers", "Output buffers",
+                                                            "The number of OMX output buffers per channel",
+                                                            1, 10, DEFAULT_NUM_OUTPUT_BUFFERS, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAMES,
+                                         g_param_spec_uint64 ("frames", "Frames",
+                                                              "Number of frames submitted over all channels",
+                                                              0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
+    }
+}
+
+static void
+type_instance_init (GTypeInstance *instance,
+                    gpointer g_class)
+{
+    GstOmxMcScaler *self;
+
+    self = GST_OMX_MCSCALER (instance);
+
+    GST_LOG_OBJECT (self, "begin");
+
+    self->gomx = g_omx_core_new (self, g_class);
+    self->ready_lock = g_mutex_new ();
+    self->num_input_buffers = DEFAULT_NUM_INPUT_BUFFERS;
+    self->num_output_buffers = DEFAULT_NUM_OUTPUT_BUFFERS;
+
+    self->collectpads = gst_collect_pads_new ();
+    gst_collect_pads_set_function (self->collectpads,
+            (GstCollectPadsFunction) collected, self);
+
+    GST_LOG_OBJECT (self, "end");
+}
+
+static void
+omx_interface_init (GstImplementsInterfaceClass *klass)
+{
+}
+
+static gboolean
+interface_supported (GstImplementsInterface *iface,
+                     GType type)
+{
+    g_assert (type == GST_TYPE_OMX);
+    return TRUE;
+}
+
+static void
+interface_init (GstImplementsInterfaceClass *klass)
+{
+    klass->supported = interface_supported;
+}
+
+static void
+init_interfaces (GType type)
+{
+    GInterfaceInfo *iface_info;
+    GInterfaceInfo *omx_info;
+
+    iface_info = g_new0 (GInterfaceInfo, 1);
+    iface_info->interface_init = (GInterfaceInitFunc) interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_IMPLEMENTS_INTERFACE, iface_info);
+    g_free (iface_info);
+
+    omx_info = g_new0 (GInterfaceInfo, 1);
+    omx_info->interface_init = (GInterfaceInitFunc) omx_interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_OMX, omx_info);
+    g_free (omx_info);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_MCSCALER_H
+#define GSTOMX_MCSCALER_H
+
+#include <gst/gst.h>
+#include <gst/base/gstcollectpads.h>
+
+#include <OMX_TI_Index.h>
+#include <OMX_TI_Common.h>
+#include <omx_vfpc.h>
+
+G_BEGIN_DECLS
+
+#define GST_OMX_MCSCALER(obj) ((GstOmxMcScaler *) (obj))
+#define GST_OMX_MCSCALER_TYPE (gst_omx_mcscaler_get_type ())
+#define GST_OMX_MCSCALER_CLASS(obj) ((GstOmxMcScalerClass *) (obj))
+#define GST_IS_OMX_MCSCALER(obj) \
+        (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_OMX_MCSCALER_TYPE))
+
+typedef struct GstOmxMcScaler GstOmxMcScaler;
+typedef struct GstOmxMcScalerClass GstOmxMcScalerClass;
+typedef struct GstOmxMcScalerChannel GstOmxMcScalerChannel;
+
+#include "gstomx_util.h"
+
+/* One VFPC handle scales up to this many streams */
+#define MCSCALER_MAX_CHANNELS 16
+
+/* A sink_%02d/src_%02d pad pair, scaled on channel (and port pair) index
+ * of the shared component.
+ */
+struct GstOmxMcScalerChannel
+{
+    guint index;
+    GstPad *sinkpad;
+    GstPad *srcpad;
+    GOmxPort *in_port;
+    GOmxPort *out_port;
+
+    gint in_width, in_height, in_stride;
+    gint out_width, out_height, out_stride;
+    gint framerate_num, framerate_denom;
+    GstClockTime duration;
+
+    gboolean eos;
+    GstFlowReturn last_pad_push_return;
+    GstPadEventFunction collect_event;
+};
+
+struct GstOmxMcScaler
+{
+    GstElement element;
+
+    GstCollectPads *collectpads;
+    GstOmxMcScalerChannel *channels[MCSCALER_MAX_CHANNELS];
+    guint num_channels;
+
+    GOmxCore *gomx;
+
+    char *omx_role;
+    char *omx_component;
+    char *omx_library;
+    gboolean ready;
+    GMutex *ready_lock;
+
+    guint num_input_buffers;
+    guint num_output_buffers;
+
+    /** frames submitted over all channels */
+    guint64 frames;
+};
+
+struct GstOmxMcScalerClass
+{
+    GstElementClass parent_class;
+};
+
+GType gst_omx_mcscaler_get_type (void);
+
+G_END_DECLS
+
+#endif /* GSTOMX_MCSCALER_H */
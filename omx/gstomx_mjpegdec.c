@@ -24,6 +24,19 @@
 
 GSTOMX_BOILERPLATE (GstOmxMJPEGDec, gst_omx_mjpegdec, GstOmxBaseVideoDec, GST_OMX_BASE_VIDEODEC_TYPE);
 
+enum
+{
+    ARG_0,
+    ARG_PARALLELISM,
+};
+
+#define DEFAULT_PARALLELISM 1
+#define MAX_PARALLELISM 8
+
+static GstFlowReturn push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf);
+static GstFlowReturn pad_chain (GstPad *pad, GstBuffer *buf);
+static gboolean pad_event (GstPad *pad, GstEvent *event);
+
 static GstCaps *
 generate_sink_template (void)
 {
@@ -81,22 +94,314 @@ type_base_init (gpointer g_class)
     }
 }
 
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMJPEGDec *self;
+
+    self = GST_OMX_MJPEGDEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_PARALLELISM:
+            self->parallelism = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMJPEGDec *self;
+
+    self = GST_OMX_MJPEGDEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_PARALLELISM:
+            g_value_set_uint (value, self->parallelism);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+/*
+ * Reordering.
+ *
+ * JPEG frames don't depend on each other, so several can be in the
+ * decoder at once and come back in any order.  A decoded frame is held
+ * until no earlier frame is still in the decoder; a frame the decoder
+ * never returns holds things up for at most "parallelism" frames.
+ *
+ * Timestamps come back through OMX ticks, which drop whatever is below a
+ * tick, so they are matched at tick resolution.
+ */
+
+#define TICKS(timestamp) \
+    gst_util_uint64_scale_int ((timestamp), OMX_TICKS_PER_SECOND, GST_SECOND)
+
+static gint
+compare_timestamps (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    GstClockTime ta = GST_BUFFER_TIMESTAMP (a);
+    GstClockTime tb = GST_BUFFER_TIMESTAMP (b);
+
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void
+reorder_clear (GstOmxMJPEGDec *self)
+{
+    GstBuffer *buf;
+
+    while ((buf = g_queue_pop_head (self->held)))
+        gst_buffer_unref (buf);
+    g_array_set_size (self->pending, 0);
+}
+
+static void
+pending_add (GstOmxMJPEGDec *self, guint64 ticks)
+{
+    guint i;
+
+    for (i = self->pending->len; i > 0; i--)
+        if (g_array_index (self->pending, guint64, i - 1) <= ticks)
+            break;
+    g_array_insert_val (self->pending, i, ticks);
+}
+
+/* Drops the pending ticks up to ticks, just the one if exact */
+static void
+pending_remove (GstOmxMJPEGDec *self, guint64 ticks, gboolean exact)
+{
+    guint i;
+
+    for (i = 0; i < self->pending->len; i++)
+    {
+        guint64 pending = g_array_index (self->pending, guint64, i);
+
+        if (pending > ticks)
+            break;
+        if (exact && pending == ticks)
+        {
+            g_array_remove_index (self->pending, i);
+            return;
+        }
+    }
+
+    if (!exact)
+        g_array_remove_range (self->pending, 0, i);
+}
+
+static GstFlowReturn
+pad_chain (GstPad *pad, GstBuffer *buf)
+{
+    GstOmxMJPEGDec *self;
+    GstOmxBaseFilter *omx_base;
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buf);
+    GstFlowReturn ret;
+    guint frames_in;
+
+    self = GST_OMX_MJPEGDEC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    if (self->parallelism <= 1 || !GST_CLOCK_TIME_IS_VALID (timestamp))
+        return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_chain (pad, buf);
+
+    g_mutex_lock (self->reorder_lock);
+    if (G_UNLIKELY (omx_base->gomx->omx_state == OMX_StateLoaded))
+        reorder_clear (self);
+    pending_add (self, TICKS (timestamp));
+    g_mutex_unlock (self->reorder_lock);
+
+    g_mutex_lock (omx_base->num_buffers_mutex);
+    frames_in = omx_base->frames_in;
+    g_mutex_unlock (omx_base->num_buffers_mutex);
+
+    ret = GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_chain (pad, buf);
+
+    g_mutex_lock (omx_base->num_buffers_mutex);
+    frames_in = omx_base->frames_in - frames_in;
+    g_mutex_unlock (omx_base->num_buffers_mutex);
+
+    /* skipped by QoS or refused: it is not coming back */
+    if (!frames_in)
+    {
+        g_mutex_lock (self->reorder_lock);
+        pending_remove (self, TICKS (timestamp), TRUE);
+        g_mutex_unlock (self->reorder_lock);
+    }
+
+    return ret;
+}
+
+static GstFlowReturn
+push_buffer (GstOmxBaseFilter *omx_base, GstBuffer *buf)
+{
+    GstOmxMJPEGDec *self;
+    GQueue ready = G_QUEUE_INIT;
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    self = GST_OMX_MJPEGDEC (omx_base);
+
+    if (self->parallelism <= 1 || !GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+        return GST_OMX_BASE_FILTER_CLASS (parent_class)->push_buffer (omx_base, buf);
+
+    g_mutex_lock (self->reorder_lock);
+
+    pending_remove (self, TICKS (GST_BUFFER_TIMESTAMP (buf)), TRUE);
+    g_queue_insert_sorted (self->held, buf, compare_timestamps, NULL);
+
+    while (!g_queue_is_empty (self->held))
+    {
+        GstClockTime first;
+
+        first = GST_BUFFER_TIMESTAMP (g_queue_peek_head (self->held));
+
+        if (self->pending->len &&
+            g_array_index (self->pending, guint64, 0) < TICKS (first))
+        {
+            if (g_queue_get_length (self->held) <= self->parallelism)
+                break;
+
+            /* the earlier frames are not coming back */
+            GST_DEBUG_OBJECT (self, "giving up on frames before %" GST_TIME_FORMAT,
+                    GST_TIME_ARGS (first));
+            pending_remove (self, TICKS (first), FALSE);
+        }
+
+        g_queue_push_tail (&ready, g_queue_pop_head (self->held));
+    }
+
+    g_mutex_unlock (self->reorder_lock);
+
+    while ((buf = g_queue_pop_head (&ready)))
+    {
+        if (ret == GST_FLOW_OK)
+            ret = GST_OMX_BASE_FILTER_CLASS (parent_class)->push_buffer (omx_base, buf);
+        else
+            gst_buffer_unref (buf);
+    }
+
+    return ret;
+}
+
+/* At EOS nothing earlier is coming back any more: the held frames go out
+ * in order.
+ */
+static void
+drained (GstOmxBaseFilter *omx_base)
+{
+    GstOmxMJPEGDec *self;
+    GQueue ready = G_QUEUE_INIT;
+    GstBuffer *buf;
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    self = GST_OMX_MJPEGDEC (omx_base);
+
+    g_mutex_lock (self->reorder_lock);
+    while ((buf = g_queue_pop_head (self->held)))
+        g_queue_push_tail (&ready, buf);
+    g_array_set_size (self->pending, 0);
+    g_mutex_unlock (self->reorder_lock);
+
+    if (!g_queue_is_empty (&ready))
+        GST_DEBUG_OBJECT (self, "pushing %u held frames at EOS",
+                g_queue_get_length (&ready));
+
+    while ((buf = g_queue_pop_head (&ready)))
+    {
+        if (ret == GST_FLOW_OK)
+            ret = GST_OMX_BASE_FILTER_CLASS (parent_class)->push_buffer (omx_base, buf);
+        else
+            gst_buffer_unref (buf);
+    }
+}
+
+static gboolean
+pad_event (GstPad *pad, GstEvent *event)
+{
+    GstOmxMJPEGDec *self;
+
+    self = GST_OMX_MJPEGDEC (GST_OBJECT_PARENT (pad));
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+    {
+        g_mutex_lock (self->reorder_lock);
+        reorder_clear (self);
+        g_mutex_unlock (self->reorder_lock);
+    }
+
+    return GST_OMX_BASE_FILTER_CLASS (parent_class)->pad_event (pad, event);
+}
+
+static void
+finalize (GObject *obj)
+{
+    GstOmxMJPEGDec *self;
+
+    self = GST_OMX_MJPEGDEC (obj);
+
+    reorder_clear (self);
+    g_queue_free (self->held);
+    g_array_free (self->pending, TRUE);
+    g_mutex_free (self->reorder_lock);
+
+    G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
+    GObjectClass *gobject_class;
+    GstOmxBaseFilterClass *bclass;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+    bclass = GST_OMX_BASE_FILTER_CLASS (g_class);
+
+    gobject_class->finalize = finalize;
+    bclass->push_buffer = push_buffer;
+    bclass->pad_chain = pad_chain;
+    bclass->pad_event = pad_event;
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_PARALLELISM,
+                                         g_param_spec_uint ("parallelism", "Parallelism",
+                                                            "Frames decoded at once, output in timestamp order "
+                                                            "(set before the first buffer)",
+                                                            1, MAX_PARALLELISM, DEFAULT_PARALLELISM,
+                                                            G_PARAM_READWRITE));
+    }
 }
 
 static void
 initialize_port (GstOmxBaseFilter *omx_base)
 {
     GstOmxBaseVideoDec *self;
+    GstOmxMJPEGDec *mjpegdec;
     GOmxCore *gomx;
     OMX_PARAM_PORTDEFINITIONTYPE paramPort;
     gint width, height;
     GOmxPort *port;
 
     self = GST_OMX_BASE_VIDEODEC (omx_base);
+    mjpegdec = GST_OMX_MJPEGDEC (omx_base);
     gomx = (GOmxCore *) omx_base->gomx;
 
     GST_INFO_OBJECT (omx_base, "begin");
@@ -124,6 +429,9 @@ initialize_port (GstOmxBaseFilter *omx_base)
 
 	G_OMX_PORT_GET_DEFINITION (omx_base->in_port, &paramPort);
     //paramPort.nBufferCountActual = 8;
+    /* one more than in flight, so the next frame can be filled meanwhile */
+    paramPort.nBufferCountActual = MAX (paramPort.nBufferCountActual,
+            mjpegdec->parallelism + 1);
     paramPort.format.video.xFramerate = (60) << 16;
     G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &paramPort);
 #if 1
@@ -149,9 +457,18 @@ type_instance_init (GTypeInstance *instance,
                     gpointer g_class)
 {
     GstOmxBaseVideoDec *omx_base;
+    GstOmxMJPEGDec *self;
 
     omx_base = GST_OMX_BASE_VIDEODEC (instance);
+    self = GST_OMX_MJPEGDEC (instance);
 
     omx_base->compression_format = OMX_VIDEO_CodingMJPEG;
     omx_base->initialize_port = initialize_port;
+
+    self->parallelism = DEFAULT_PARALLELISM;
+    self->reorder_lock = g_mutex_new ();
+    self->pending = g_array_new (FALSE, FALSE, sizeof (guint64));
+    self->held = g_queue_new ();
+
+    GST_OMX_BASE_FILTER (instance)->drained = drained;
 }
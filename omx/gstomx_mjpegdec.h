@@ -37,6 +37,13 @@ typedef struct GstOmxMJPEGDecClass GstOmxMJPEGDecClass;
 struct GstOmxMJPEGDec
 {
     GstOmxBaseVideoDec omx_base;
+
+    guint parallelism;          /**< frames decoded at once */
+
+    /** frames come out in timestamp order, see push_buffer() */
+    GMutex *reorder_lock;
+    GArray *pending;            /**< sorted timestamps of frames in the decoder */
+    GQueue *held;               /**< decoded frames waiting for earlier ones */
 };
 
 struct GstOmxMJPEGDecClass
@@ -0,0 +1,1254 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Multi-window display: every sink_%02d pad is a window of one
+ * OMX.TI.VPSSM3.VFDC mosaic layout, fed on its own input port, so a video
+ * wall is put together by the display hardware instead of being composed
+ * into an intermediate frame by omx_videomixer first.  Buffers from other
+ * OMX elements are displayed in place.
+ */
+
+#include "gstomx_mosaicsink.h"
+#include "gstomx.h"
+#include "gstomx_interface.h"
+#include "gstomx_buffertransport.h"
+
+#include <OMX_TI_Index.h>
+#include <OMX_TI_Common.h>
+#include <omx_vfdc.h>
+
+#include <stdlib.h> /* for atoi */
+#include <string.h> /* for strcmp */
+
+enum
+{
+    ARG_0,
+    ARG_COMPONENT_ROLE,
+    ARG_COMPONENT_NAME,
+    ARG_LIBRARY_NAME,
+    ARG_DISPLAY_MODE,
+    ARG_DISPLAY_DEVICE,
+    ARG_SYNC,
+    ARG_NUM_INPUT_BUFFERS,
+};
+
+enum
+{
+    PAD_ARG_0,
+    PAD_ARG_LEFT,
+    PAD_ARG_TOP,
+    PAD_ARG_PRIORITY,
+};
+
+#define DEFAULT_INPUT_BUFFERS 4
+
+static void init_interfaces (GType type);
+GSTOMX_BOILERPLATE_FULL (GstOmxMosaicSink, gst_omx_mosaicsink, GstElement, GST_TYPE_ELEMENT, init_interfaces);
+
+G_DEFINE_TYPE (GstOmxMosaicSinkPad, gst_omx_mosaicsink_pad, GST_TYPE_PAD);
+
+static GstStaticPadTemplate sink_template =
+        GST_STATIC_PAD_TEMPLATE ("sink_%02d",
+                GST_PAD_SINK,
+                GST_PAD_REQUEST,
+                GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ("{ YUY2, NV12 }") ";"
+                                 GST_VIDEO_CAPS_YUV_STRIDED ("{ YUY2, NV12 }",
+                                         "[ 0, max ]"))
+        );
+
+static const struct
+{
+    const gchar *name;
+    gint mode;
+    gint width, height;
+} display_modes[] =
+{
+    { "OMX_DC_MODE_1080P_60", OMX_DC_MODE_1080P_60, 1920, 1080 },
+    { "OMX_DC_MODE_1080P_30", OMX_DC_MODE_1080P_30, 1920, 1080 },
+    { "OMX_DC_MODE_1080I_60", OMX_DC_MODE_1080I_60, 1920, 1080 },
+    { "OMX_DC_MODE_720P_60", OMX_DC_MODE_720P_60, 1280, 720 },
+    { "OMX_DC_MODE_PAL", OMX_DC_MODE_PAL, 720, 576 },
+    { "OMX_DC_MODE_NTSC", OMX_DC_MODE_NTSC, 720, 480 },
+    { NULL, 0, 0, 0 },
+};
+
+static void apply_layout (GstOmxMosaicSink *self);
+
+/*
+ * Pads:
+ */
+
+static void
+pad_set_property (GObject *obj,
+                  guint prop_id,
+                  const GValue *value,
+                  GParamSpec *pspec)
+{
+    GstOmxMosaicSinkPad *pad;
+    GstOmxMosaicSink *self;
+
+    pad = GST_OMX_MOSAICSINK_PAD (obj);
+    self = GST_OMX_MOSAICSINK (GST_PAD_PARENT (pad));
+
+    if (self)
+        g_mutex_lock (self->lock);
+
+    switch (prop_id)
+    {
+        case PAD_ARG_LEFT:
+            pad->left = g_value_get_int (value);
+            break;
+        case PAD_ARG_TOP:
+            pad->top = g_value_get_int (value);
+            break;
+        case PAD_ARG_PRIORITY:
+            pad->priority = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+
+    /* otherwise applied when the display starts */
+    if (self && self->ready && pad->active)
+        apply_layout (self);
+
+    if (self)
+        g_mutex_unlock (self->lock);
+}
+
+static void
+pad_get_property (GObject *obj,
+                  guint prop_id,
+                  GValue *value,
+                  GParamSpec *pspec)
+{
+    GstOmxMosaicSinkPad *pad;
+
+    pad = GST_OMX_MOSAICSINK_PAD (obj);
+
+    switch (prop_id)
+    {
+        case PAD_ARG_LEFT:
+            g_value_set_int (value, pad->left);
+            break;
+        case PAD_ARG_TOP:
+            g_value_set_int (value, pad->top);
+            break;
+        case PAD_ARG_PRIORITY:
+            g_value_set_uint (value, pad->priority);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_omx_mosaicsink_pad_class_init (GstOmxMosaicSinkPadClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = pad_set_property;
+    gobject_class->get_property = pad_get_property;
+
+    g_object_class_install_property (gobject_class, PAD_ARG_LEFT,
+                                     g_param_spec_int ("left", "Left",
+                                                       "Left edge of the window on the display (-1 = on a grid)",
+                                                       -1, G_MAXINT, -1, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PAD_ARG_TOP,
+                                     g_param_spec_int ("top", "Top",
+                                                       "Top edge of the window on the display (-1 = on a grid)",
+                                                       -1, G_MAXINT, -1, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PAD_ARG_PRIORITY,
+                                     g_param_spec_uint ("priority", "Priority",
+                                                        "Stacking priority of the window where it overlaps others",
+                                                        0, MOSAICSINK_MAX_WINDOWS - 1, 0, G_PARAM_READWRITE));
+}
+
+static void
+gst_omx_mosaicsink_pad_init (GstOmxMosaicSinkPad *pad)
+{
+    pad->format = GST_VIDEO_FORMAT_UNKNOWN;
+    pad->left = -1;
+    pad->top = -1;
+    gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+}
+
+static gboolean
+sink_setcaps (GstPad *gst_pad,
+              GstCaps *caps)
+{
+    GstOmxMosaicSink *self;
+    GstOmxMosaicSinkPad *pad;
+    GstVideoFormat format;
+    gint width, height, stride;
+    gboolean ret = TRUE;
+
+    self = GST_OMX_MOSAICSINK (GST_PAD_PARENT (gst_pad));
+    pad = GST_OMX_MOSAICSINK_PAD (gst_pad);
+
+    GST_INFO_OBJECT (self, "setcaps (sink_%02d): %" GST_PTR_FORMAT, pad->index, caps);
+
+    g_return_val_if_fail (gst_caps_get_size (caps) == 1, FALSE);
+
+    if (!gst_video_format_parse_caps_strided (caps, &format, &width, &height, &stride))
+    {
+        GST_WARNING_OBJECT (self, "width and/or height is not set in caps");
+        return FALSE;
+    }
+
+    if (!stride)
+        stride = (format == GST_VIDEO_FORMAT_YUY2) ? width * 2 : width;
+
+    g_mutex_lock (self->lock);
+
+    if (pad->configured &&
+        (format != pad->format || width != pad->width ||
+         height != pad->height || stride != pad->stride))
+    {
+        /* the port buffers were set up for the first geometry */
+        GST_WARNING_OBJECT (self, "sink_%02d: window format can't change while displaying",
+                            pad->index);
+        ret = FALSE;
+    }
+    else
+    {
+        pad->format = format;
+        pad->width = width;
+        pad->height = height;
+        pad->stride = stride;
+    }
+
+    g_mutex_unlock (self->lock);
+
+    return ret;
+}
+
+/*
+ * OpenMAX setup:
+ */
+
+/* Shares the upstream OMX buffers when the window is fed by another OMX
+ * element, the same way omx_videosink does.
+ */
+static void
+setup_input_buffer (GstOmxMosaicSink *self,
+                    GstOmxMosaicSinkPad *pad,
+                    GstBuffer *buf)
+{
+    GOmxPort *in_port = pad->port;
+
+    if (GST_IS_OMXBUFFERTRANSPORT (buf))
+    {
+        GOmxPort *port;
+        gint i;
+
+        port = GST_GET_OMXPORT (buf);
+
+        if (!port->always_copy)
+        {
+            in_port->num_buffers = port->num_buffers;
+            in_port->share_buffer_info = g_new0 (OmxBufferInfo, 1);
+            in_port->share_buffer_info->pBuffer = g_new0 (OMX_U8 *, port->num_buffers);
+            for (i = 0; i < port->num_buffers; i++)
+            {
+                in_port->share_buffer_info->pBuffer[i] = port->buffers[i]->pBuffer;
+            }
+
+            /* disable omx_allocate alloc flag, so that we can fall back to shared method */
+            in_port->omx_allocate = FALSE;
+            in_port->always_copy = FALSE;
+            in_port->share_buffer = FALSE;
+
+            GST_INFO_OBJECT (self, "sink_%02d: displaying %u upstream buffers in place",
+                             pad->index, port->num_buffers);
+            return;
+        }
+    }
+
+    /* ask openmax to allocate input buffer */
+    in_port->num_buffers = self->num_input_buffers;
+    in_port->omx_allocate = TRUE;
+    in_port->always_copy = TRUE;
+    in_port->share_buffer = FALSE;
+}
+
+static gboolean
+window_setup (GstOmxMosaicSink *self,
+              GstOmxMosaicSinkPad *pad,
+              guint size)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+    OMX_PARAM_BUFFER_MEMORYTYPE memTypeCfg;
+    OMX_ERRORTYPE err;
+
+    G_OMX_PORT_GET_DEFINITION (pad->port, &param);
+    param.format.video.nFrameWidth = pad->width;
+    param.format.video.nFrameHeight = pad->height;
+    param.format.video.nStride = pad->stride;
+    param.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    if (pad->format == GST_VIDEO_FORMAT_NV12)
+        param.format.video.eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
+    else
+        param.format.video.eColorFormat = OMX_COLOR_FormatYCbYCr;
+    param.nBufferSize = size;
+    param.nBufferCountActual = pad->port->num_buffers;
+    err = G_OMX_PORT_SET_DEFINITION (pad->port, &param);
+
+    if (err != OMX_ErrorNone)
+        return FALSE;
+
+    g_omx_port_setup (pad->port, &param);
+
+    /* set input memory to Raw */
+    _G_OMX_INIT_PARAM (&memTypeCfg);
+    memTypeCfg.nPortIndex = pad->port->port_index;
+    memTypeCfg.eBufMemoryType = OMX_BUFFER_MEMORY_DEFAULT;
+    G_OMX_PORT_SET_PARAM (pad->port, OMX_TI_IndexParamBuffMemType, &memTypeCfg);
+
+    return TRUE;
+}
+
+/* Windows with their own position keep it, the others are placed on a
+ * grid of equal cells, centered in theirs, in pad order.
+ */
+static void
+apply_layout (GstOmxMosaicSink *self)
+{
+    GOmxCore *gomx = self->gomx;
+    OMX_PARAM_VFDC_CREATEMOSAICLAYOUT mosaicLayout;
+    OMX_CONFIG_VFDC_MOSAICLAYOUT_PORT2WINMAP port2Winmap;
+    guint num_windows = 0, cols = 1, rows, cell_width, cell_height;
+    guint i, n;
+
+    for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+        if (self->windows[i] && self->windows[i]->active)
+            num_windows++;
+
+    if (!num_windows)
+        return;
+
+    while (cols * cols < num_windows)
+        cols++;
+    rows = (num_windows + cols - 1) / cols;
+    cell_width = self->max_width / cols;
+    cell_height = self->max_height / rows;
+
+    _G_OMX_INIT_PARAM (&mosaicLayout);
+    mosaicLayout.nPortIndex = 0;
+    mosaicLayout.nDisChannelNum = 0;
+    mosaicLayout.nNumWindows = num_windows;
+
+    _G_OMX_INIT_PARAM (&port2Winmap);
+    port2Winmap.nLayoutId = self->layout_id;
+    port2Winmap.numWindows = num_windows;
+
+    for (i = 0, n = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+    {
+        GstOmxMosaicSinkPad *pad = self->windows[i];
+        gint x, y;
+
+        if (!pad || !pad->active)
+            continue;
+
+        x = pad->left;
+        if (x < 0)
+            x = (n % cols) * cell_width + MAX ((gint) cell_width - pad->width, 0) / 2;
+        y = pad->top;
+        if (y < 0)
+            y = (n / cols) * cell_height + MAX ((gint) cell_height - pad->height, 0) / 2;
+
+        x = MIN (x, self->max_width - 2) & ~1;
+        y = MIN (y, self->max_height - 2) & ~1;
+
+        /* the display doesn't scale, windows past its edge are cropped */
+        mosaicLayout.sMosaicWinFmt[n].winStartX = x;
+        mosaicLayout.sMosaicWinFmt[n].winStartY = y;
+        mosaicLayout.sMosaicWinFmt[n].winWidth = MIN (pad->width, self->max_width - x);
+        mosaicLayout.sMosaicWinFmt[n].winHeight = MIN (pad->height, self->max_height - y);
+        if (pad->format == GST_VIDEO_FORMAT_NV12)
+        {
+            mosaicLayout.sMosaicWinFmt[n].dataFormat = VFDC_DF_YUV420SP_UV;
+            mosaicLayout.sMosaicWinFmt[n].bpp = VFDC_BPP_BITS12;
+            mosaicLayout.sMosaicWinFmt[n].pitch[VFDC_YUV_SP_Y_ADDR_IDX] = pad->stride;
+            mosaicLayout.sMosaicWinFmt[n].pitch[VFDC_YUV_SP_CBCR_ADDR_IDX] = pad->stride;
+        }
+        else
+        {
+            mosaicLayout.sMosaicWinFmt[n].dataFormat = VFDC_DF_YUV422I_YVYU;
+            mosaicLayout.sMosaicWinFmt[n].bpp = VFDC_BPP_BITS16;
+            mosaicLayout.sMosaicWinFmt[n].pitch[VFDC_YUV_INT_ADDR_IDX] = pad->stride;
+        }
+        mosaicLayout.sMosaicWinFmt[n].priority = pad->priority;
+
+        port2Winmap.omxPortList[n] = pad->port->port_index;
+
+        GST_INFO_OBJECT (self, "layout %u: sink_%02d at %dx%d, priority %u",
+                         self->layout_id, pad->index, x, y, pad->priority);
+        n++;
+    }
+
+    OMX_SetParameter (gomx->omx_handle, (OMX_INDEXTYPE) OMX_TI_IndexParamVFDCCreateMosaicLayout, &mosaicLayout);
+    OMX_SetConfig (gomx->omx_handle, (OMX_INDEXTYPE) OMX_TI_IndexConfigVFDCMosaicPort2WinMap, &port2Winmap);
+
+    /* the component numbers the layouts it creates, a running display
+     * switches to the one last mapped */
+    self->layout_id++;
+}
+
+static gboolean
+omx_setup (GstOmxMosaicSink *self)
+{
+    GOmxCore *gomx;
+    OMX_PARAM_VFDC_DRIVERINSTID driverId;
+    OMX_PARAM_VFDC_FIELD_MERGE_INFO fieldMergeInfo;
+    gint mode = OMX_DC_MODE_1080P_60;
+    guint i;
+
+    gomx = self->gomx;
+
+    self->max_width = 1920;
+    self->max_height = 1080;
+    for (i = 0; display_modes[i].name; i++)
+    {
+        if (!strcmp (self->display_mode, display_modes[i].name))
+        {
+            mode = display_modes[i].mode;
+            self->max_width = display_modes[i].width;
+            self->max_height = display_modes[i].height;
+            break;
+        }
+    }
+
+    /* set display driver mode */
+    _G_OMX_INIT_PARAM (&driverId);
+    if (!strcmp (self->display_device, "SD"))
+        driverId.nDrvInstID = OMX_VIDEO_DISPLAY_ID_SD0;
+    else
+        driverId.nDrvInstID = 0; /* on chip HDMI */
+    driverId.eDispVencMode = mode;
+    OMX_SetParameter (gomx->omx_handle, (OMX_INDEXTYPE) OMX_TI_IndexParamVFDCDriverInstId, &driverId);
+
+    for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+    {
+        GstOmxMosaicSinkPad *pad = self->windows[i];
+        guint size;
+
+        if (!pad || !pad->active)
+            continue;
+
+        size = gst_video_format_get_size_strided (pad->format,
+                pad->width, pad->height, pad->stride);
+
+        if (!window_setup (self, pad, size))
+        {
+            GST_ERROR_OBJECT (self, "sink_%02d: could not configure port", pad->index);
+            return FALSE;
+        }
+    }
+
+    self->layout_id = 0;
+    apply_layout (self);
+
+    _G_OMX_INIT_PARAM (&fieldMergeInfo);
+    fieldMergeInfo.fieldMergeMode = FALSE;
+    OMX_SetParameter (gomx->omx_handle, (OMX_INDEXTYPE) OMX_TI_IndexParamVFDCFieldMergeMode, &fieldMergeInfo);
+
+    for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+    {
+        GstOmxMosaicSinkPad *pad = self->windows[i];
+
+        if (!pad || !pad->active)
+            continue;
+
+        pad->port->enabled = TRUE;
+        g_omx_port_resume (pad->port);
+
+        OMX_SendCommand (gomx->omx_handle, OMX_CommandPortEnable,
+                pad->port->port_index, NULL);
+        g_sem_down (gomx->port_sem);
+    }
+
+    return TRUE;
+}
+
+/* Called with the lock held. */
+static gboolean
+omx_start (GstOmxMosaicSink *self)
+{
+    GOmxCore *gomx = self->gomx;
+
+    if (!omx_setup (self))
+        return FALSE;
+
+    g_omx_core_prepare (gomx);
+
+    if (gomx->omx_state != OMX_StateIdle)
+        return FALSE;
+
+    g_omx_core_start (gomx);
+
+    if (gomx->omx_state != OMX_StateExecuting)
+        return FALSE;
+
+    self->ready = TRUE;
+
+    return TRUE;
+}
+
+/* The display starts once every window has either its first buffer or
+ * ended without one.  Called with the lock held.
+ */
+static gboolean
+windows_configured (GstOmxMosaicSink *self)
+{
+    guint i;
+
+    for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+    {
+        GstOmxMosaicSinkPad *pad = self->windows[i];
+
+        if (pad && !pad->configured && !pad->eos)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+unschedule (GstOmxMosaicSinkPad *pad)
+{
+    if (pad->clock_id)
+        gst_clock_id_unschedule (pad->clock_id);
+}
+
+/*
+ * Streaming:
+ */
+
+/* Waits until the buffer is due on the pipeline clock.  Called with the
+ * lock held, which is released while waiting.
+ */
+static GstClockReturn
+wait_clock (GstOmxMosaicSink *self,
+            GstOmxMosaicSinkPad *pad,
+            GstBuffer *buf)
+{
+    GstClock *clock;
+    GstClockTime running_time;
+    GstClockReturn ret;
+
+    if (!self->sync || !GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+        return GST_CLOCK_OK;
+
+    running_time = gst_segment_to_running_time (&pad->segment, GST_FORMAT_TIME,
+            GST_BUFFER_TIMESTAMP (buf));
+    if (!GST_CLOCK_TIME_IS_VALID (running_time))
+        return GST_CLOCK_OK;
+
+    GST_OBJECT_LOCK (self);
+    clock = GST_ELEMENT_CLOCK (self);
+    if (clock)
+        pad->clock_id = gst_clock_new_single_shot_id (clock,
+                running_time + GST_ELEMENT_CAST (self)->base_time);
+    GST_OBJECT_UNLOCK (self);
+
+    if (!pad->clock_id)
+        return GST_CLOCK_OK;
+
+    g_mutex_unlock (self->lock);
+    ret = gst_clock_id_wait (pad->clock_id, NULL);
+    g_mutex_lock (self->lock);
+
+    gst_clock_id_unref (pad->clock_id);
+    pad->clock_id = NULL;
+
+    return ret;
+}
+
+static GstFlowReturn
+pad_chain (GstPad *gst_pad,
+           GstBuffer *buf)
+{
+    GstOmxMosaicSink *self;
+    GstOmxMosaicSinkPad *pad;
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    self = GST_OMX_MOSAICSINK (GST_OBJECT_PARENT (gst_pad));
+    pad = GST_OMX_MOSAICSINK_PAD (gst_pad);
+
+    g_mutex_lock (self->lock);
+
+    if (G_UNLIKELY (!pad->configured))
+    {
+        if (pad->format == GST_VIDEO_FORMAT_UNKNOWN)
+        {
+            g_mutex_unlock (self->lock);
+            gst_buffer_unref (buf);
+            return GST_FLOW_NOT_NEGOTIATED;
+        }
+
+        setup_input_buffer (self, pad, buf);
+        pad->configured = TRUE;
+        pad->active = TRUE;
+
+        if (windows_configured (self))
+        {
+            if (!omx_start (self))
+            {
+                g_mutex_unlock (self->lock);
+                gst_buffer_unref (buf);
+                GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                        ("could not start the display"));
+                return GST_FLOW_ERROR;
+            }
+            g_cond_broadcast (self->cond);
+        }
+    }
+
+    while (TRUE)
+    {
+        /* the display starts with the last window to get a buffer */
+        while (!pad->flushing && (!self->ready || !self->playing))
+            g_cond_wait (self->cond, self->lock);
+
+        if (pad->flushing)
+        {
+            ret = GST_FLOW_WRONG_STATE;
+            break;
+        }
+
+        /* unscheduled when pausing, wait to play again */
+        if (wait_clock (self, pad, buf) != GST_CLOCK_UNSCHEDULED)
+            break;
+    }
+
+    g_mutex_unlock (self->lock);
+
+    if (ret == GST_FLOW_OK)
+    {
+        PRINT_BUFFER (self, buf);
+
+        if (g_omx_port_send (pad->port, buf) < 0)
+            ret = GST_FLOW_WRONG_STATE;
+    }
+
+    gst_buffer_unref (buf);
+
+    return ret;
+}
+
+static gboolean
+pad_event (GstPad *gst_pad,
+           GstEvent *event)
+{
+    GstOmxMosaicSink *self;
+    GstOmxMosaicSinkPad *pad;
+    gboolean eos = FALSE, failed = FALSE;
+    guint i;
+
+    self = GST_OMX_MOSAICSINK (GST_OBJECT_PARENT (gst_pad));
+    pad = GST_OMX_MOSAICSINK_PAD (gst_pad);
+
+    GST_INFO_OBJECT (self, "sink_%02d: event=%s", pad->index, GST_EVENT_TYPE_NAME (event));
+
+    switch (GST_EVENT_TYPE (event))
+    {
+        case GST_EVENT_NEWSEGMENT:
+            {
+                gboolean update;
+                gdouble rate, applied_rate;
+                GstFormat format;
+                gint64 start, stop, position;
+
+                gst_event_parse_new_segment_full (event, &update, &rate,
+                        &applied_rate, &format, &start, &stop, &position);
+
+                g_mutex_lock (self->lock);
+                if (format == GST_FORMAT_TIME)
+                    gst_segment_set_newsegment_full (&pad->segment, update,
+                            rate, applied_rate, format, start, stop, position);
+                g_mutex_unlock (self->lock);
+                break;
+            }
+
+        case GST_EVENT_FLUSH_START:
+            g_mutex_lock (self->lock);
+            pad->flushing = TRUE;
+            unschedule (pad);
+            g_cond_broadcast (self->cond);
+            if (self->ready && pad->active)
+                g_omx_port_pause (pad->port);
+            g_mutex_unlock (self->lock);
+            break;
+
+        case GST_EVENT_FLUSH_STOP:
+            g_mutex_lock (self->lock);
+            pad->flushing = FALSE;
+            pad->eos = FALSE;
+            gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+            if (self->ready && pad->active)
+            {
+                g_omx_port_flush (pad->port);
+                g_omx_port_resume (pad->port);
+            }
+            g_mutex_unlock (self->lock);
+            break;
+
+        case GST_EVENT_EOS:
+            g_mutex_lock (self->lock);
+            pad->eos = TRUE;
+
+            /* a window that ended before its first buffer is left out */
+            if (!self->ready && !pad->configured && windows_configured (self))
+            {
+                for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+                    if (self->windows[i] && self->windows[i]->active)
+                        break;
+
+                if (i < MOSAICSINK_MAX_WINDOWS)
+                {
+                    failed = !omx_start (self);
+                    g_cond_broadcast (self->cond);
+                }
+            }
+
+            /* the last frame of every window stays on the display */
+            eos = TRUE;
+            for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+                if (self->windows[i] && !self->windows[i]->eos)
+                    eos = FALSE;
+            g_mutex_unlock (self->lock);
+
+            if (failed)
+            {
+                GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                        ("could not start the display"));
+            }
+            else if (eos)
+            {
+                GST_INFO_OBJECT (self, "all windows ended");
+                gst_element_post_message (GST_ELEMENT (self),
+                        gst_message_new_eos (GST_OBJECT (self)));
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    gst_event_unref (event);
+
+    return TRUE;
+}
+
+/*
+ * Element:
+ */
+
+static GstPad *
+request_new_pad (GstElement *element,
+                 GstPadTemplate *templ,
+                 const gchar *req_name)
+{
+    GstOmxMosaicSink *self;
+    GstOmxMosaicSinkPad *pad;
+    gchar *name;
+    gint index = -1;
+
+    self = GST_OMX_MOSAICSINK (element);
+
+    g_mutex_lock (self->lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->lock);
+        GST_WARNING_OBJECT (self, "windows can't be added while displaying");
+        return NULL;
+    }
+
+    if (req_name && strlen (req_name) > 5 && g_str_has_prefix (req_name, "sink_"))
+    {
+        /* parse serial number from requested padname */
+        index = atoi (&req_name[5]);
+    }
+    else
+    {
+        /* no name given when requesting the pad, use the first free window */
+        for (index = 0; index < MOSAICSINK_MAX_WINDOWS; index++)
+            if (!self->windows[index])
+                break;
+    }
+
+    if (index < 0 || index >= MOSAICSINK_MAX_WINDOWS || self->windows[index])
+    {
+        g_mutex_unlock (self->lock);
+        GST_WARNING_OBJECT (self, "no window available for %s", req_name);
+        return NULL;
+    }
+
+    name = g_strdup_printf ("sink_%02d", index);
+    pad = g_object_new (GST_TYPE_OMX_MOSAICSINK_PAD, "name", name,
+            "direction", GST_PAD_SINK, "template", templ, NULL);
+    g_free (name);
+
+    pad->index = index;
+
+    name = g_strdup_printf ("in_%02d", index);
+    pad->port = g_omx_core_get_port (self->gomx, name,
+            OMX_VFDC_INPUT_PORT_START_INDEX + index);
+    g_free (name);
+
+    /* enabled when its window is set up */
+    pad->port->enabled = FALSE;
+
+    gst_pad_set_setcaps_function (GST_PAD (pad), GST_DEBUG_FUNCPTR (sink_setcaps));
+    gst_pad_set_chain_function (GST_PAD (pad), GST_DEBUG_FUNCPTR (pad_chain));
+    gst_pad_set_event_function (GST_PAD (pad), GST_DEBUG_FUNCPTR (pad_event));
+
+    self->windows[index] = pad;
+
+    g_mutex_unlock (self->lock);
+
+    GST_INFO_OBJECT (self, "added window %d", index);
+
+    if (GST_STATE (element) > GST_STATE_READY)
+        gst_pad_set_active (GST_PAD (pad), TRUE);
+    gst_element_add_pad (element, GST_PAD (pad));
+
+    return GST_PAD (pad);
+}
+
+static void
+release_pad (GstElement *element,
+             GstPad *gst_pad)
+{
+    GstOmxMosaicSink *self;
+    GstOmxMosaicSinkPad *pad;
+
+    self = GST_OMX_MOSAICSINK (element);
+    pad = GST_OMX_MOSAICSINK_PAD (gst_pad);
+
+    g_mutex_lock (self->lock);
+
+    if (self->ready)
+    {
+        g_mutex_unlock (self->lock);
+        GST_WARNING_OBJECT (self, "windows can't be removed while displaying");
+        return;
+    }
+
+    /* the port stays in the core, disabled ones are not prepared */
+    pad->port->enabled = FALSE;
+    self->windows[pad->index] = NULL;
+
+    g_mutex_unlock (self->lock);
+
+    gst_element_remove_pad (element, gst_pad);
+}
+
+static GstStateChangeReturn
+change_state (GstElement *element,
+              GstStateChange transition)
+{
+    GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+    GstOmxMosaicSink *self;
+    GOmxCore *core;
+    guint i;
+
+    self = GST_OMX_MOSAICSINK (element);
+    core = self->gomx;
+
+    GST_INFO_OBJECT (self, "begin: changing state %s -> %s",
+                     gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
+                     gst_element_state_get_name (GST_STATE_TRANSITION_NEXT (transition)));
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_NULL_TO_READY:
+            g_omx_core_init (core);
+            if (core->omx_state != OMX_StateLoaded)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+            g_mutex_lock (self->lock);
+            for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+            {
+                GstOmxMosaicSinkPad *pad = self->windows[i];
+
+                if (!pad)
+                    continue;
+
+                pad->configured = FALSE;
+                pad->active = FALSE;
+                pad->flushing = FALSE;
+                pad->eos = FALSE;
+                gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+            }
+            g_mutex_unlock (self->lock);
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+            g_mutex_lock (self->lock);
+            self->playing = TRUE;
+            g_cond_broadcast (self->cond);
+            g_mutex_unlock (self->lock);
+            break;
+
+        case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+            g_mutex_lock (self->lock);
+            self->playing = FALSE;
+            for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+                if (self->windows[i])
+                    unschedule (self->windows[i]);
+            g_mutex_unlock (self->lock);
+            break;
+
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            /* unlock the chain functions */
+            g_mutex_lock (self->lock);
+            for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+            {
+                GstOmxMosaicSinkPad *pad = self->windows[i];
+
+                if (!pad)
+                    continue;
+
+                pad->flushing = TRUE;
+                unschedule (pad);
+                if (self->ready && pad->active)
+                    g_omx_port_pause (pad->port);
+            }
+            g_cond_broadcast (self->cond);
+            g_mutex_unlock (self->lock);
+            break;
+
+        default:
+            break;
+    }
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        goto leave;
+
+    switch (transition)
+    {
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            g_mutex_lock (self->lock);
+            if (self->ready)
+            {
+                for (i = 0; i < MOSAICSINK_MAX_WINDOWS; i++)
+                    if (self->windows[i] && self->windows[i]->active)
+                        g_omx_port_finish (self->windows[i]->port);
+
+                g_omx_core_stop (core);
+                g_omx_core_unload (core);
+                self->ready = FALSE;
+            }
+            g_mutex_unlock (self->lock);
+            if (core->omx_state != OMX_StateLoaded &&
+                core->omx_state != OMX_StateInvalid)
+            {
+                ret = GST_STATE_CHANGE_FAILURE;
+                goto leave;
+            }
+            break;
+
+        case GST_STATE_CHANGE_READY_TO_NULL:
+            g_omx_core_deinit (core);
+            break;
+
+        default:
+            break;
+    }
+
+leave:
+    GST_LOG_OBJECT (self, "end");
+
+    return ret;
+}
+
+/*
+ * GObject Methods:
+ */
+
+static void
+finalize (GObject *obj)
+{
+    GstOmxMosaicSink *self;
+
+    self = GST_OMX_MOSAICSINK (obj);
+
+    g_omx_core_free (self->gomx);
+
+    g_free (self->omx_role);
+    g_free (self->omx_component);
+    g_free (self->omx_library);
+    g_free (self->display_mode);
+    g_free (self->display_device);
+
+    g_mutex_free (self->lock);
+    g_cond_free (self->cond);
+
+    G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMosaicSink *self;
+
+    self = GST_OMX_MOSAICSINK (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_free (self->omx_role);
+            self->omx_role = g_value_dup_string (value);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_free (self->omx_component);
+            self->omx_component = g_value_dup_string (value);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_free (self->omx_library);
+            self->omx_library = g_value_dup_string (value);
+            break;
+        case ARG_DISPLAY_MODE:
+            g_free (self->display_mode);
+            self->display_mode = g_value_dup_string (value);
+            break;
+        case ARG_DISPLAY_DEVICE:
+            g_free (self->display_device);
+            self->display_device = g_value_dup_string (value);
+            break;
+        case ARG_SYNC:
+            self->sync = g_value_get_boolean (value);
+            break;
+        case ARG_NUM_INPUT_BUFFERS:
+            self->num_input_buffers = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxMosaicSink *self;
+
+    self = GST_OMX_MOSAICSINK (obj);
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_value_set_string (value, self->omx_role);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_value_set_string (value, self->omx_component);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_value_set_string (value, self->omx_library);
+            break;
+        case ARG_DISPLAY_MODE:
+            g_value_set_string (value, self->display_mode);
+            break;
+        case ARG_DISPLAY_DEVICE:
+            g_value_set_string (value, self->display_device);
+            break;
+        case ARG_SYNC:
+            g_value_set_boolean (value, self->sync);
+            break;
+        case ARG_NUM_INPUT_BUFFERS:
+            g_value_set_uint (value, self->num_input_buffers);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+/*
+ * Initialization:
+ */
+
+static void
+type_base_init (gpointer g_class)
+{
+    GstElementClass *element_class;
+
+    element_class = GST_ELEMENT_CLASS (g_class);
+
+    {
+        GstElementDetails details;
+
+        details.longname = "OpenMAX IL multi-window videosink element";
+        details.klass = "Video/Sink";
+        details.description = "Renders every input in its own window of the display mosaic";
+        details.author = "RidgeRun";
+
+        gst_element_class_set_details (element_class, &details);
+    }
+
+    gst_element_class_add_pad_template (element_class,
+        gst_static_pad_template_get (&sink_template));
+}
+
+static void
+type_class_init (gpointer g_class,
+                 gpointer class_data)
+{
+    GObjectClass *gobject_class;
+    GstElementClass *gstelement_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+    gstelement_class = GST_ELEMENT_CLASS (g_class);
+
+    gobject_class->finalize = finalize;
+    gstelement_class->change_state = change_state;
+    gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR (request_new_pad);
+    gstelement_class->release_pad = GST_DEBUG_FUNCPTR (release_pad);
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_ROLE,
+                                         g_param_spec_string ("component-role", "Component role",
+                                                              "Role of the OpenMAX IL component",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_COMPONENT_NAME,
+                                         g_param_spec_string ("component-name", "Component name",
+                                                              "Name of the OpenMAX IL component to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_LIBRARY_NAME,
+                                         g_param_spec_string ("library-name", "Library name",
+                                                              "Name of the OpenMAX IL implementation library to use",
+                                                              NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_DISPLAY_MODE,
+                                         g_param_spec_string ("display-mode", "Display mode",
+                                                              "Display driver configuration mode (see below)"
+                                                              "\n\t\t\t OMX_DC_MODE_NTSC "
+                                                              "\n\t\t\t OMX_DC_MODE_PAL "
+                                                              "\n\t\t\t OMX_DC_MODE_1080P_60 "
+                                                              "\n\t\t\t OMX_DC_MODE_720P_60 "
+                                                              "\n\t\t\t OMX_DC_MODE_1080I_60 "
+                                                              "\n\t\t\t OMX_DC_MODE_1080P_30",
+                                                              "OMX_DC_MODE_1080P_60", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_DISPLAY_DEVICE,
+                                         g_param_spec_string ("display-device", "Display Device",
+                                                              "Display device to be used -"
+                                                              "\n\t\t\t HDMI "
+                                                              "\n\t\t\t SD ", "HDMI", G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_SYNC,
+                                         g_param_spec_boolean ("sync", "Sync",
+                                                               "Show every buffer at its time on the pipeline clock",
+                                                               TRUE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_NUM_INPUT_BUFFERS,
+                                         g_param_spec_uint ("input-buffers", "Input buffers",
+                                                            "OMX buffers per window when its input has to be copied",
+                                                            2, 16, DEFAULT_INPUT_BUFFERS, G_PARAM_READWRITE));
+    }
+}
+
+static void
+type_instance_init (GTypeInstance *instance,
+                    gpointer g_class)
+{
+    GstOmxMosaicSink *self;
+
+    self = GST_OMX_MOSAICSINK (instance);
+
+    GST_LOG_OBJECT (self, "begin");
+
+    self->gomx = g_omx_core_new (self, g_class);
+    self->lock = g_mutex_new ();
+    self->cond = g_cond_new ();
+
+    self->display_mode = g_strdup ("OMX_DC_MODE_1080P_60");
+    self->display_device = g_strdup ("HDMI");
+    self->sync = TRUE;
+    self->num_input_buffers = DEFAULT_INPUT_BUFFERS;
+
+    GST_OBJECT_FLAG_SET (self, GST_ELEMENT_IS_SINK);
+
+    GST_LOG_OBJECT (self, "end");
+}
+
+static void
+omx_interface_init (GstImplementsInterfaceClass *klass)
+{
+}
+
+static gboolean
+interface_supported (GstImplementsInterface *iface,
+                     GType type)
+{
+    g_assert (type == GST_TYPE_OMX);
+    return TRUE;
+}
+
+static void
+interface_init (GstImplementsInterfaceClass *klass)
+{
+    klass->supported = interface_supported;
+}
+
+static void
+init_interfaces (GType type)
+{
+    GInterfaceInfo *iface_info;
+    GInterfaceInfo *omx_info;
+
+    iface_info = g_new0 (GInterfaceInfo, 1);
+    iface_info->interface_init = (GInterfaceInitFunc) interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_IMPLEMENTS_INTERFACE, iface_info);
+    g_free (iface_info);
+
+    omx_info = g_new0 (GInterfaceInfo, 1);
+    omx_info->interface_init = (GInterfaceInitFunc) omx_interface_init;
+
+    g_type_add_interface_static (type, GST_TYPE_OMX, omx_info);
+    g_free (omx_info);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_MOSAICSINK_H
+#define GSTOMX_MOSAICSINK_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+#define GST_OMX_MOSAICSINK(obj) ((GstOmxMosaicSink *) (obj))
+#define GST_OMX_MOSAICSINK_TYPE (gst_omx_mosaicsink_get_type ())
+#define GST_OMX_MOSAICSINK_CLASS(obj) ((GstOmxMosaicSinkClass *) (obj))
+
+#define GST_TYPE_OMX_MOSAICSINK_PAD (gst_omx_mosaicsink_pad_get_type ())
+#define GST_OMX_MOSAICSINK_PAD(obj) \
+        (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_OMX_MOSAICSINK_PAD, GstOmxMosaicSinkPad))
+
+typedef struct GstOmxMosaicSink GstOmxMosaicSink;
+typedef struct GstOmxMosaicSinkClass GstOmxMosaicSinkClass;
+typedef struct GstOmxMosaicSinkPad GstOmxMosaicSinkPad;
+typedef struct GstOmxMosaicSinkPadClass GstOmxMosaicSinkPadClass;
+
+#include "gstomx_util.h"
+
+/* One VFDC handle displays up to this many windows */
+#define MOSAICSINK_MAX_WINDOWS 16
+
+/* A sink_%02d pad, shown in a window of the mosaic layout and fed to the
+ * VFDC input port of the same index.
+ */
+struct GstOmxMosaicSinkPad
+{
+    GstPad pad;
+
+    guint index;
+    GOmxPort *port;
+
+    GstVideoFormat format;
+    gint width, height, stride;
+
+    gint left, top;             /**< -1 to place the window on the grid */
+    guint priority;
+
+    GstSegment segment;
+    GstClockID clock_id;
+
+    gboolean configured;        /**< first buffer seen, buffers set up */
+    gboolean active;            /**< has a window in the layout */
+    gboolean flushing;
+    gboolean eos;
+};
+
+struct GstOmxMosaicSinkPadClass
+{
+    GstPadClass parent_class;
+};
+
+struct GstOmxMosaicSink
+{
+    GstElement element;
+
+    GstOmxMosaicSinkPad *windows[MOSAICSINK_MAX_WINDOWS];
+
+    GOmxCore *gomx;
+
+    char *omx_role;
+    char *omx_component;
+    char *omx_library;
+
+    gchar *display_mode;
+    gchar *display_device;
+    gint max_width, max_height;
+
+    gboolean sync;
+    guint num_input_buffers;
+
+    guint layout_id;
+    gboolean ready;
+    gboolean playing;
+
+    /** protects the windows, layout and the streaming flags */
+    GMutex *lock;
+    GCond *cond;
+};
+
+struct GstOmxMosaicSinkClass
+{
+    GstElementClass parent_class;
+};
+
+GType gst_omx_mosaicsink_get_type (void);
+GType gst_omx_mosaicsink_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* GSTOMX_MOSAICSINK_H */
@@ -178,9 +178,9 @@ initialize_port (GstOmxBaseFilter *omx_base)
   /* number of buffers are set here */
   pInPortDef.nBufferCountActual = 4;
   pInPortDef.nBufferCountMin = 1;
-  /* buffer size by deafult is assumed as width * height for input bitstream
-     which would suffice most of the cases */
-  pInPortDef.nBufferSize = width * height;
+  /* buffer size is sized by the base class for one coded picture of the
+     stream (resolution, level and bitrate), see sink_setcaps */
+  pInPortDef.nBufferSize = self->input_buffer_size;
 
   pInPortDef.bEnabled = OMX_TRUE;
   pInPortDef.bPopulated = OMX_FALSE;
@@ -58,6 +58,20 @@ static void setup_shared_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffe
  * Port
  */
 
+void
+gst_omxportptr_unref (GstOmxPortPtr *self)
+{
+    if (!g_atomic_int_dec_and_test (&self->refcnt))
+        return;
+
+    /* the port and every buffer it handed out are gone */
+    gst_omxbuffertransport_free_idle (self);
+    g_mutex_free (self->busy_lock);
+    g_cond_free (self->busy_cond);
+    g_free (self->lent);
+    g_free (self);
+}
+
 GOmxPort *
 g_omx_port_new (GOmxCore *core, const gchar *name, guint index)
 {
@@ -77,6 +91,11 @@ g_omx_port_new (GOmxCore *core, const gchar *name, guint index)
     port->ignore_count = 0;
     port->n_offset = 0;
     port->vp6_hack = FALSE;
+    port->pack_buffer = NULL;
+    port->pack_timestamp = GST_CLOCK_TIME_NONE;
+    port->pack_count = 0;
+    port->pack_open = FALSE;
+    port->last_returned = GST_CLOCK_TIME_NONE;
 
 	port->portptr = gst_omxportptr_new(port);
 
@@ -222,11 +241,25 @@ g_omx_port_allocate_buffers (GOmxPort *port)
 
     DEBUG (port, "begin");
 
+    /* buffers of an earlier allocation still downstream keep the old
+     * pointer, which no longer refers to the port */
+    if (!port->portptr->port)
+    {
+        gst_omxportptr_unref (port->portptr);
+        port->portptr = gst_omxportptr_new (port);
+    }
+
     G_OMX_PORT_GET_DEFINITION (port, &param);
     size = param.nBufferSize;
 
     port->buffers = g_new0 (OMX_BUFFERHEADERTYPE *, port->num_buffers);
 
+    g_free (port->portptr->lent);
+    port->portptr->lent = g_new0 (gint, port->num_buffers);
+    port->portptr->num_lent = port->num_buffers;
+    port->portptr->omx_handle = port->core->omx_handle;
+    port->portptr->port_index = port->port_index;
+
     for (i = 0; i < port->num_buffers; i++)
     {
 
@@ -278,6 +311,16 @@ g_omx_port_allocate_buffers (GOmxPort *port)
         }
     }
 
+    /* see G_OMX_PORT_BUFFER_INDEX() */
+    if (port->type == GOMX_PORT_OUTPUT && !port->share_buffer)
+    {
+        for (i = 0; i < port->num_buffers; i++)
+            port->buffers[i]->pAppPrivate = GINT_TO_POINTER (i + 1);
+    }
+
+    /* one wrapper per buffer, so handing them downstream never allocates */
+    gst_omxbuffertransport_prealloc (port->portptr, port->num_buffers);
+
     DEBUG (port, "end");
 }
 
@@ -291,7 +334,8 @@ g_omx_port_free_buffers (GOmxPort *port)
 
     DEBUG (port, "begin");
 
-	gst_omxportptr_mutex_lock(port->portptr);
+    /* buffers still downstream stop resubmitting to the port */
+    gst_omxportptr_invalidate (port->portptr);
 
     for (i = 0; i < port->num_buffers; i++)
     {
@@ -307,7 +351,14 @@ g_omx_port_free_buffers (GOmxPort *port)
 		omx_buffer = port->buffers[i];
 		#endif
 
-        if (omx_buffer)
+        /* still downstream: whoever holds it frees it, see
+         * gst_omxbuffertransport_finalize() */
+        if (omx_buffer && gst_omxbuffertransport_orphan (port->portptr, i))
+        {
+            DEBUG (port, "%p held downstream, freed on release", omx_buffer);
+            port->buffers[i] = NULL;
+        }
+        else if (omx_buffer)
         {
 #if 0
             /** @todo how shall we free that buffer? */
@@ -326,8 +377,11 @@ g_omx_port_free_buffers (GOmxPort *port)
 
     g_free (port->buffers);
     port->buffers = NULL;
-	port->portptr->port = NULL;
-	gst_omxportptr_mutex_unlock(port->portptr);
+    port->outstanding = 0;
+    port->last_returned = GST_CLOCK_TIME_NONE;
+    port->pack_buffer = NULL;
+    port->pack_count = 0;
+    port->pack_open = FALSE;
 
     DEBUG (port, "end");
 }
@@ -371,7 +425,8 @@ void
 g_omx_port_push_buffer (GOmxPort *port,
                         OMX_BUFFERHEADERTYPE *omx_buffer)
 {
-    if (!port->always_copy && omx_buffer->pAppPrivate)
+    if (!port->always_copy && omx_buffer->pAppPrivate &&
+        G_OMX_PORT_BUFFER_INDEX (port, omx_buffer) < 0)
     {
 		/* Avoid a race condition of pAppPrivate getting set to null
 		   after the buffer is submitted back again */
@@ -409,20 +464,13 @@ request_buffer (GOmxPort *port)
 static void
 release_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
 {
-
-    OMX_ERRORTYPE eError = OMX_ErrorNone;
-
-
     switch (port->type)
     {
         case GOMX_PORT_INPUT:
             DEBUG (port, "ETB: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
                     omx_buffer, omx_buffer ? omx_buffer->pAppPrivate : 0, omx_buffer ? omx_buffer->pBuffer : 0);
             if(omx_buffer->nFilledLen != 0) {
-               eError = OMX_EmptyThisBuffer (port->core->omx_handle, omx_buffer);
-               if (eError != OMX_ErrorNone) {
-                  DEBUG (port, "Empty this buffer returned eError =%x",eError);
-               }
+               g_omx_port_submit (port, omx_buffer);
 	    }
             else{
                DEBUG (port, "filled length is zero put back into queue ");
@@ -432,17 +480,105 @@ release_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
         case GOMX_PORT_OUTPUT:
             DEBUG (port, "FTB: omx_buffer=%p, pAppPrivate=%p, pBuffer=%p",
                     omx_buffer, omx_buffer ? omx_buffer->pAppPrivate : 0, omx_buffer ? omx_buffer->pBuffer : 0);
-            eError = OMX_FillThisBuffer (port->core->omx_handle, omx_buffer);
-            if (eError != OMX_ErrorNone) {
-
-           }
+            g_omx_port_submit (port, omx_buffer);
             break;
          default:
             break;
     }
+}
+
+/**
+ * Hand a buffer to the component: EmptyThisBuffer on an input port,
+ * FillThisBuffer on an output port.
+ */
+void
+g_omx_port_submit (GOmxPort *port,
+                   OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    OMX_ERRORTYPE eError;
 
+    /* counted before the call, EBD/FBD may arrive before it returns */
+    g_atomic_int_inc (&port->outstanding);
 
+    if (port->type == GOMX_PORT_INPUT)
+        eError = OMX_EmptyThisBuffer (port->core->omx_handle, omx_buffer);
+    else
+        eError = OMX_FillThisBuffer (port->core->omx_handle, omx_buffer);
+
+    g_atomic_int_inc (&port->core->submit_calls);
 
+    if (eError != OMX_ErrorNone)
+    {
+        DEBUG (port, "%s returned eError =%x",
+                port->type == GOMX_PORT_INPUT ? "EmptyThisBuffer" : "FillThisBuffer",
+                eError);
+        g_omx_port_buffer_returned (port);
+    }
+    else
+    {
+        g_atomic_int_inc (&port->core->submitted);
+    }
+}
+
+/**
+ * Account for a buffer the component handed back with EBD/FBD.
+ */
+void
+g_omx_port_buffer_returned (GOmxPort *port)
+{
+    g_atomic_int_add (&port->outstanding, -1);
+
+    g_mutex_lock (port->mutex);
+    port->last_returned = gst_util_get_timestamp ();
+    g_cond_broadcast (port->cond);
+    g_mutex_unlock (port->mutex);
+}
+
+static gboolean
+wait_outstanding (GOmxPort *port, gint max, GTimeVal *end_time)
+{
+    gboolean ret;
+    gint outstanding;
+
+    g_mutex_lock (port->mutex);
+
+    while (TRUE)
+    {
+        outstanding = g_atomic_int_get (&port->outstanding);
+        ret = outstanding <= max;
+        if (ret || !g_cond_timed_wait (port->cond, port->mutex, end_time))
+            break;
+    }
+
+    g_mutex_unlock (port->mutex);
+
+    DEBUG (port, "outstanding=%d", outstanding);
+
+    return ret;
+}
+
+/**
+ * Wait until the component has returned every buffer submitted on this
+ * port, or until @end_time passes.
+ *
+ * Returns TRUE if nothing is left inside the component.
+ */
+gboolean
+g_omx_port_wait_returned (GOmxPort *port, GTimeVal *end_time)
+{
+    return wait_outstanding (port, 0, end_time);
+}
+
+/**
+ * Wait until the component holds at most @max buffers of this port, or
+ * until @end_time passes.
+ *
+ * Returns TRUE if no more than @max buffers are inside the component.
+ */
+gboolean
+g_omx_port_wait_outstanding (GOmxPort *port, gint max, GTimeVal *end_time)
+{
+    return wait_outstanding (port, max, end_time);
 }
 
 /* NOTE ABOUT BUFFER SHARING:
@@ -460,7 +596,8 @@ release_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
  *    pad_alloc()d, some care may need to be taken to ensure proper buffer
  *    alignment.
  * 2) shared_buffer is not enabled, in which case we respect the nOffset
- *    set by the component and pAppPrivate is NULL
+ *    set by the component and pAppPrivate holds the index of output
+ *    buffers (see G_OMX_PORT_BUFFER_INDEX())
  *
  */
 
@@ -482,7 +619,7 @@ setup_shared_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
     }
     else
     {
-        g_assert (omx_buffer->pBuffer && !omx_buffer->pAppPrivate);
+        g_assert (omx_buffer->pBuffer);
     }
 }
 
@@ -816,11 +953,63 @@ gint g_omx_port_send_interlaced_fields(GOmxPort *port, GstBuffer *buf, gint seco
 	// Timestamp for the second field comes from adding duration to the
 	// First field timestamp
 	second->nTimeStamp = (OMX_TICKS)-1;
+	/* back to back, first field first */
 	release_buffer (port, first);
 	release_buffer (port, second);
 	return ret;
 }
 
+/**
+ * Compute where the second field of an interlaced frame starts, relative to
+ * the start of @omx_buffer.  The port definition of @port must describe a
+ * single field (nFrameHeight is the field height); the upstream component
+ * places the second field after the padded first field.
+ */
+gint
+g_omx_port_get_second_field_offset (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+    gint top_rows, rows;
+
+    G_OMX_PORT_GET_DEFINITION (port, &param);
+
+    g_return_val_if_fail (param.format.video.nStride > 0, 0);
+
+    top_rows = omx_buffer->nOffset / param.format.video.nStride;
+    rows = top_rows + top_rows + ((param.format.video.nFrameHeight + 7) & ~7);
+
+    return rows * param.format.video.nStride;
+}
+
+/**
+ * Register the buffers of the upstream @peer port as the buffers of @port,
+ * twice each: once for the first field and once for the second field found
+ * @second_field_offset bytes later.  This lets both fields of one upstream
+ * frame be submitted with g_omx_port_send_interlaced_fields() without a
+ * copy.  The port definition of @port should already advertise
+ * 2 * peer->num_buffers buffers.
+ */
+void
+g_omx_port_share_fields (GOmxPort *port, GOmxPort *peer, gint second_field_offset)
+{
+    guint i;
+
+    port->share_buffer_info = g_new0 (OmxBufferInfo, 1);
+    port->share_buffer_info->num_buffers = peer->num_buffers * 2;
+    port->share_buffer_info->pBuffer = g_new0 (OMX_U8 *, peer->num_buffers * 2);
+
+    for (i = 0; i < peer->num_buffers; i++)
+    {
+        port->share_buffer_info->pBuffer[i << 1] = peer->buffers[i]->pBuffer;
+        port->share_buffer_info->pBuffer[(i << 1) + 1] =
+            peer->buffers[i]->pBuffer + second_field_offset;
+    }
+
+    /* disable omx_allocate alloc flag, so that we can fall back to shared method */
+    port->omx_allocate = FALSE;
+    port->always_copy = FALSE;
+}
+
 /**
  * Send a buffer/event to the OMX component.  This handles conversion of
  * GST buffer, codec-data, and EOS events to the equivalent OMX buffer.
@@ -930,6 +1119,183 @@ g_omx_port_send (GOmxPort *port, gpointer obj)
 	return -1;
 }
 
+/*
+ * Input packing: with always_copy input ports every GstBuffer costs an
+ * ETB/EBD round trip, however small.  Instead the fragments of one access
+ * unit (same timestamp, or no timestamp) are copied one after the other
+ * into the same OMX buffer, which is only submitted once the next access
+ * unit starts or g_omx_port_pack_flush() is called.  An access unit larger
+ * than one OMX buffer goes out in several, straight from the GstBuffer
+ * data, without sub-buffers.
+ */
+
+static void
+pack_submit (GOmxPort *port, gboolean end_of_frame)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer = port->pack_buffer;
+
+    port->pack_buffer = NULL;
+    port->pack_count = 0;
+    port->pack_open = FALSE;
+
+    if (end_of_frame)
+        omx_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+    DEBUG (port, "omx_buffer: size=%lu, len=%lu, flags=%lu, timestamp=%lld",
+            omx_buffer->nAllocLen, omx_buffer->nFilledLen, omx_buffer->nFlags,
+            omx_buffer->nTimeStamp);
+
+    release_buffer (port, omx_buffer);
+}
+
+/**
+ * Append @buf to the access unit being assembled on input @port.  @units,
+ * if given, is incremented for every buffer of complete access units
+ * submitted; with pack_units set, a buffer carries that many of them.
+ * A pack_continuous port ignores access units and submits each buffer as
+ * soon as it is full, counting it as pack_units units (one if unset).
+ *
+ * Returns number of bytes taken, or negative if error
+ */
+gint
+g_omx_port_pack (GOmxPort *port, GstBuffer *buf, guint *units)
+{
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buf);
+    const guint8 *data = GST_BUFFER_DATA (buf);
+    guint size = GST_BUFFER_SIZE (buf);
+
+    g_return_val_if_fail (port->type == GOMX_PORT_INPUT && port->always_copy, -1);
+
+    /* a new timestamp starts a new access unit */
+    if (!port->pack_continuous && port->pack_buffer && GST_CLOCK_TIME_IS_VALID (timestamp) &&
+        timestamp != port->pack_timestamp)
+    {
+        if (g_omx_port_pack_end_unit (port) && units)
+            (*units)++;
+    }
+
+    /* fragments without a timestamp belong to the current access unit; a
+     * buffer holding several keeps the timestamp of the first */
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+        port->pack_timestamp = timestamp;
+
+    while (size > 0)
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer = port->pack_buffer;
+        guint full, space, len;
+
+        if (!omx_buffer)
+        {
+            omx_buffer = request_buffer (port);
+            if (!omx_buffer)
+            {
+                DEBUG (port, "null buffer");
+                return -1;
+            }
+
+            if (omx_buffer->pAppPrivate)
+            {
+                gst_buffer_unref (omx_buffer->pAppPrivate);
+                omx_buffer->pAppPrivate = NULL;
+            }
+
+            omx_buffer->nFlags = 0;
+            omx_buffer->nOffset = 0;
+            omx_buffer->nFilledLen = 0;
+
+            if (port->core->use_timestamps)
+            {
+                if (GST_CLOCK_TIME_IS_VALID (port->pack_timestamp))
+                    omx_buffer->nTimeStamp = gst_util_uint64_scale_int (
+                            port->pack_timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
+                else
+                    omx_buffer->nTimeStamp = (OMX_TICKS)-1;
+            }
+
+            port->pack_buffer = omx_buffer;
+        }
+
+        full = omx_buffer->nAllocLen;
+        if (port->pack_size)
+            full = MIN (full, port->pack_size);
+
+        space = full - omx_buffer->nFilledLen;
+        len = MIN (size, space);
+
+        memcpy (omx_buffer->pBuffer + omx_buffer->nFilledLen, data, len);
+        omx_buffer->nFilledLen += len;
+        port->pack_open = TRUE;
+        data += len;
+        size -= len;
+
+        /* full: the access unit carries on in the next buffer */
+        if (omx_buffer->nFilledLen == full)
+        {
+            pack_submit (port, port->pack_continuous);
+            if (port->pack_continuous && units)
+                *units += MAX (port->pack_units, 1);
+        }
+    }
+
+    return GST_BUFFER_SIZE (buf);
+}
+
+/**
+ * Submit the access unit being assembled, if any.
+ *
+ * Returns TRUE if an access unit was submitted.
+ */
+gboolean
+g_omx_port_pack_flush (GOmxPort *port)
+{
+    if (!port->pack_buffer)
+        return FALSE;
+
+    pack_submit (port, TRUE);
+
+    return TRUE;
+}
+
+/**
+ * End the access unit being assembled; the buffer is submitted once it
+ * holds pack_units of them.  A unit that already ended, on a timestamp
+ * change, is not ended again.
+ *
+ * Returns TRUE if a buffer was submitted.
+ */
+gboolean
+g_omx_port_pack_end_unit (GOmxPort *port)
+{
+    if (!port->pack_buffer || !port->pack_open)
+        return FALSE;
+
+    port->pack_open = FALSE;
+
+    if (++port->pack_count < MAX (port->pack_units, 1))
+        return FALSE;
+
+    return g_omx_port_pack_flush (port);
+}
+
+/**
+ * Forget the access unit being assembled, after a flush.
+ */
+void
+g_omx_port_pack_reset (GOmxPort *port)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer = port->pack_buffer;
+
+    if (!omx_buffer)
+        return;
+
+    port->pack_buffer = NULL;
+    port->pack_timestamp = GST_CLOCK_TIME_NONE;
+    port->pack_count = 0;
+    port->pack_open = FALSE;
+    omx_buffer->nFilledLen = 0;
+    async_queue_push (port->queue, omx_buffer);
+}
+
 /**
  * Receive a buffer/event from OMX component.  This handles the conversion
  * of OMX buffer to GST buffer, codec-data, or EOS event.
@@ -946,6 +1312,7 @@ g_omx_port_recv (GOmxPort *port)
     while (!ret && port->enabled)
     {
         OMX_BUFFERHEADERTYPE *omx_buffer = request_buffer (port);
+        gboolean copied = FALSE;
 
         if (G_UNLIKELY (!omx_buffer))
         {
@@ -975,7 +1342,7 @@ g_omx_port_recv (GOmxPort *port)
         }
         else if (G_LIKELY (omx_buffer->nFilledLen > 0))
         {
-            GstBuffer *buf = omx_buffer->pAppPrivate;
+            GstBuffer *buf = port->share_buffer ? omx_buffer->pAppPrivate : NULL;
 
             /* I'm not really sure if it was intentional to block zero-copy of
              * the codec-data buffer.. this is how the original code worked,
@@ -986,7 +1353,11 @@ g_omx_port_recv (GOmxPort *port)
                 if (buf)
                     gst_buffer_unref (buf);
 
-                if (port->always_copy) {
+                /* a header lent now could be held past the port's
+                 * buffers going away */
+                copied = port->lend_copies;
+
+                if (port->always_copy || copied) {
                     buf = buffer_alloc (port, omx_buffer->nFilledLen);
                     memcpy (GST_BUFFER_DATA (buf), omx_buffer->pBuffer, omx_buffer->nFilledLen);
                 }
@@ -1024,7 +1395,7 @@ g_omx_port_recv (GOmxPort *port)
         }
         else
         {
-            GstBuffer *buf = omx_buffer->pAppPrivate;
+            GstBuffer *buf = port->share_buffer ? omx_buffer->pAppPrivate : NULL;
 
             if (buf)
             {
@@ -1080,7 +1451,7 @@ g_omx_port_recv (GOmxPort *port)
 #endif
         {
             setup_shared_buffer (port, omx_buffer);
-            if ((NULL == ret) || port->always_copy)
+            if ((NULL == ret) || port->always_copy || copied)
                 release_buffer (port, omx_buffer);
         }
     }
@@ -1173,6 +1544,31 @@ g_omx_port_enable (GOmxPort *port)
     DEBUG (port, "end");
 }
 
+/**
+ * Reallocate the buffers of a running port with @size bytes each, by
+ * cycling it through disable and enable.  Nothing may be sent to or
+ * received from the port meanwhile; the headers queued here are dropped.
+ */
+void
+g_omx_port_resize_buffers (GOmxPort *port, guint size)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+
+    DEBUG (port, "begin: size=%u", size);
+
+    g_omx_port_disable (port);
+    async_queue_flush (port->queue);
+
+    /* this is against the standard; nBufferSize is read-only. */
+    G_OMX_PORT_GET_DEFINITION (port, &param);
+    param.nBufferSize = size;
+    G_OMX_PORT_SET_DEFINITION (port, &param);
+
+    g_omx_port_enable (port);
+
+    DEBUG (port, "end");
+}
+
 void
 g_omx_port_disable (GOmxPort *port)
 {
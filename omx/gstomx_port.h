@@ -30,46 +30,74 @@
 
 G_BEGIN_DECLS
 
+/* Reference to a port held by the buffers it hands downstream, which may
+ * outlive the port's buffers or the port itself. The hot path takes no
+ * lock: buffers releasing to the port enter/leave it, and
+ * g_omx_port_free_buffers() invalidates it and waits for them; only the
+ * last one leaving an invalidated pointer takes busy_lock to wake it up.
+ * The lent states change with atomic operations only.
+ */
 typedef struct {
     GOmxPort *port;
 	gint refcnt;
-	GMutex *mutex;
+	gint busy;                  /**< buffers releasing to the port right now */
+	GMutex *busy_lock;
+	GCond *busy_cond;           /**< busy dropped to 0 after invalidation */
+	gpointer free_list;         /**< idle GstOmxBufferTransport wrappers */
+	gint num_wrappers;          /**< wrappers created for this port */
+	gint *lent;                 /**< GST_OMXPORTPTR_* of each header, by index */
+	guint num_lent;
+	OMX_HANDLETYPE omx_handle;  /**< frees the headers orphaned downstream */
+	guint port_index;
 } GstOmxPortPtr;
 
-static inline void gst_omxportptr_mutex_lock(GstOmxPortPtr *self) {
-	g_mutex_lock(self->mutex);
+/* Where each header of the port is. A header still lent when the port
+ * frees its buffers is orphaned: the port leaves it, and the buffer
+ * holding it frees it when finalized, so its memory outlives the port.
+ */
+enum {
+	GST_OMXPORTPTR_HOME,        /**< with the port or the component */
+	GST_OMXPORTPTR_LENT,        /**< in a buffer transport downstream */
+	GST_OMXPORTPTR_ORPHANED     /**< lent when the port freed its buffers */
+};
+
+static inline GOmxPort *gst_omxportptr_enter(GstOmxPortPtr *self) {
+	g_atomic_int_inc(&self->busy);
+	return (GOmxPort *) g_atomic_pointer_get((gpointer *) &self->port);
+}
+
+static inline void gst_omxportptr_leave(GstOmxPortPtr *self) {
+	if (g_atomic_int_dec_and_test(&self->busy) &&
+	    !g_atomic_pointer_get((gpointer *) &self->port)) {
+		g_mutex_lock(self->busy_lock);
+		g_cond_broadcast(self->busy_cond);
+		g_mutex_unlock(self->busy_lock);
+	}
 }
 
-static inline void gst_omxportptr_mutex_unlock(GstOmxPortPtr *self) {
-	g_mutex_unlock(self->mutex);
+/* after this no buffer releases to the port anymore */
+static inline void gst_omxportptr_invalidate(GstOmxPortPtr *self) {
+	g_atomic_pointer_set((gpointer *) &self->port, NULL);
+	g_mutex_lock(self->busy_lock);
+	while (g_atomic_int_get(&self->busy))
+		g_cond_wait(self->busy_cond, self->busy_lock);
+	g_mutex_unlock(self->busy_lock);
 }
 
 static inline GstOmxPortPtr *gst_omxportptr_ref(GstOmxPortPtr *self) {
-	g_mutex_lock(self->mutex);
-	self->refcnt++;
-	g_mutex_unlock(self->mutex);
+	g_atomic_int_inc(&self->refcnt);
 	return self;
 }
 
-static inline void gst_omxportptr_unref(GstOmxPortPtr *self) {
-	g_mutex_lock(self->mutex);
-	self->refcnt--;
-	if (0 == self->refcnt) {
-		g_mutex_unlock(self->mutex);
-		g_mutex_free(self->mutex);
-		g_free(self);
-		return;
-	}
-	g_mutex_unlock(self->mutex);
-}
+void gst_omxportptr_unref(GstOmxPortPtr *self);
 
 static inline GstOmxPortPtr* gst_omxportptr_new(GOmxPort *port) {
 	GstOmxPortPtr *p = g_new0(GstOmxPortPtr, 1);
 	if (p) {
 		p->refcnt = 1;
 		p->port = port;
-		p->mutex = g_mutex_new();
-		if (!p->mutex) { g_free(p); return NULL; }
+		p->busy_lock = g_mutex_new();
+		p->busy_cond = g_cond_new();
 	}
 	return p;
 }
@@ -129,6 +157,9 @@ struct GOmxPort
     /** varaible to indicate if we need to perform memcpy of incoming or outgoing gstreamer buffer into OMX buffer. */
     gboolean always_copy;
 
+    /** hand out copies instead of the headers, which are about to go */
+    gboolean lend_copies;
+
     /** variable to store caps for sinkpad */
     GstCaps *caps;
 
@@ -138,6 +169,20 @@ struct GOmxPort
 	GCond *cond;
 
 	GstOmxPortPtr *portptr;
+
+    /** buffers handed to the component with ETB/FTB and not yet returned */
+    gint outstanding;
+    /** gst_util_get_timestamp() of the last EBD/FBD, under mutex */
+    GstClockTime last_returned;
+
+    /** input packing, see g_omx_port_pack() */
+    OMX_BUFFERHEADERTYPE *pack_buffer;  /**< being filled, not yet submitted */
+    GstClockTime pack_timestamp;        /**< of the access unit in pack_buffer */
+    guint pack_units;                   /**< access units per buffer, 0 for one */
+    guint pack_count;                   /**< access units ended in pack_buffer */
+    gboolean pack_open;                 /**< data added since the last unit ended */
+    gboolean pack_continuous;           /**< cut only where a buffer fills up */
+    guint pack_size;                    /**< bytes that fill a buffer, 0 for nAllocLen */
 };
 
 /* Macros. */
@@ -168,11 +213,17 @@ struct GOmxPort
 #define G_OMX_PORT_SET_DEFINITION(port, param) \
         G_OMX_PORT_SET_PARAM (port, OMX_IndexParamPortDefinition, param)
 
-#define G_OMX_PORT_GET_NOTIFY_DEFINITION(port, param) \
-        G_OMX_PORT_GET_PARAM (port, OMX_TI_IndexParamCompPortNotifyType, param)
-
-#define G_OMX_PORT_SET_NOTIFY_DEFINITION(port, param) \
-        G_OMX_PORT_SET_PARAM (port, OMX_TI_IndexParamCompPortNotifyType, param)
+/* Output headers not shared with GstBuffers carry their index in the
+ * port, plus one, in pAppPrivate; -1 for the others. */
+#define G_OMX_PORT_BUFFER_INDEX(port, omx_buffer)                   \
+        (((port)->type == GOMX_PORT_OUTPUT && !(port)->share_buffer) ? \
+         GPOINTER_TO_INT ((omx_buffer)->pAppPrivate) - 1 : -1)
+
+#define G_OMX_PORT_GET_NOTIFY_DEFINITION(port, param) \
+        G_OMX_PORT_GET_PARAM (port, OMX_TI_IndexParamCompPortNotifyType, param)
+
+#define G_OMX_PORT_SET_NOTIFY_DEFINITION(port, param) \
+        G_OMX_PORT_SET_PARAM (port, OMX_TI_IndexParamCompPortNotifyType, param)
 
 
 
@@ -191,11 +242,22 @@ void g_omx_port_pause (GOmxPort *port);
 void g_omx_port_flush (GOmxPort *port);
 void g_omx_port_enable (GOmxPort *port);
 void g_omx_port_disable (GOmxPort *port);
+void g_omx_port_resize_buffers (GOmxPort *port, guint size);
 void g_omx_port_finish (GOmxPort *port);
 void g_omx_port_push_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
+void g_omx_port_buffer_returned (GOmxPort *port);
+void g_omx_port_submit (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
+gboolean g_omx_port_wait_returned (GOmxPort *port, GTimeVal *end_time);
+gboolean g_omx_port_wait_outstanding (GOmxPort *port, gint max, GTimeVal *end_time);
+gint g_omx_port_pack (GOmxPort *port, GstBuffer *buf, guint *units);
+gboolean g_omx_port_pack_flush (GOmxPort *port);
+gboolean g_omx_port_pack_end_unit (GOmxPort *port);
+void g_omx_port_pack_reset (GOmxPort *port);
 gint g_omx_port_send (GOmxPort *port, gpointer obj);
 gpointer g_omx_port_recv (GOmxPort *port);
 gint g_omx_port_send_interlaced_fields(GOmxPort *port, GstBuffer *buf, gint second_field_offset);
+gint g_omx_port_get_second_field_offset (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
+void g_omx_port_share_fields (GOmxPort *port, GOmxPort *peer, gint second_field_offset);
 
 /*
  * Some domain specific port related utility functions:
@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for sched_setaffinity() and CPU_SET() */
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "gstomx_thread.h"
+#include "gstomx.h"
+
+#undef GST_CAT_DEFAULT
+#define GST_CAT_DEFAULT gstomx_util_debug
+
+/* Settings of one thread role */
+typedef struct
+{
+    guint cpus;                 /**< CPU affinity mask, 0 for any CPU */
+    GOmxThreadPolicy policy;
+    gint priority;              /**< nice value for "other", RT priority otherwise */
+} GOmxThreadSettings;
+
+/* A thread that entered one of the roles, for the stats */
+typedef struct
+{
+    pid_t tid;
+    gchar *name;
+    GstClockTime last_time;     /**< wall clock at the last stats query */
+    GstClockTime last_cpu;      /**< CPU time at the last stats query */
+} GOmxThreadInfo;
+
+struct GOmxThreads
+{
+    gpointer object;
+
+    GMutex *lock;
+    GOmxThreadSettings settings[G_OMX_THREAD_N_ROLES];
+    /** changes with the settings; threads that applied this one skip */
+    gint cookie[G_OMX_THREAD_N_ROLES];
+    GList *threads;             /**< GOmxThreadInfo */
+};
+
+/* Per thread: the settings applied to it so far, by cookie. A callback
+ * thread serving several components has one entry for each of them.
+ * What the thread had before the first change is kept, to go back to.
+ */
+#define THREAD_STATE_COOKIES 8
+
+typedef struct
+{
+    pid_t tid;
+    gint cookies[THREAD_STATE_COOKIES];
+    guint next;
+
+    gboolean saved;             /**< the thread's own settings below are set */
+    gboolean saved_cpus;
+    cpu_set_t cpus;
+    gint policy;
+    struct sched_param param;
+    gint nice;
+} GOmxThreadState;
+
+static GStaticPrivate thread_state = G_STATIC_PRIVATE_INIT;
+static gint next_cookie = 1;
+
+static const gchar *role_names[G_OMX_THREAD_N_ROLES] = { "streaming", "callback" };
+
+enum
+{
+    PROP_STREAMING_CPUS,
+    PROP_STREAMING_POLICY,
+    PROP_STREAMING_PRIORITY,
+    PROP_CALLBACK_CPUS,
+    PROP_CALLBACK_POLICY,
+    PROP_CALLBACK_PRIORITY,
+    PROP_THREAD_STATS
+};
+
+GType
+g_omx_thread_policy_get_type (void)
+{
+    static GType type = 0;
+
+    if (!type)
+    {
+        static const GEnumValue vals[] =
+        {
+            {G_OMX_THREAD_POLICY_INHERIT, "Leave as created", "inherit"},
+            {G_OMX_THREAD_POLICY_OTHER,   "SCHED_OTHER",      "other"},
+            {G_OMX_THREAD_POLICY_FIFO,    "SCHED_FIFO",       "fifo"},
+            {G_OMX_THREAD_POLICY_RR,      "SCHED_RR",         "rr"},
+            {0, NULL, NULL}
+        };
+
+        type = g_enum_register_static ("GOmxThreadPolicy", vals);
+    }
+
+    return type;
+}
+
+GOmxThreads *
+g_omx_threads_new (gpointer object)
+{
+    GOmxThreads *threads;
+    gint i;
+
+    threads = g_new0 (GOmxThreads, 1);
+    threads->object = object;
+    threads->lock = g_mutex_new ();
+
+    for (i = 0; i < G_OMX_THREAD_N_ROLES; i++)
+    {
+        threads->settings[i].policy = G_OMX_THREAD_POLICY_INHERIT;
+        threads->cookie[i] = g_atomic_int_exchange_and_add (&next_cookie, 1);
+    }
+
+    return threads;
+}
+
+void
+g_omx_threads_free (GOmxThreads *threads)
+{
+    GList *l;
+
+    for (l = threads->threads; l; l = l->next)
+    {
+        GOmxThreadInfo *info = l->data;
+        g_free (info->name);
+        g_free (info);
+    }
+    g_list_free (threads->threads);
+
+    g_mutex_free (threads->lock);
+    g_free (threads);
+}
+
+/* Reads the CPU time a thread of this process has used and the CPU it
+ * last ran on.
+ */
+static gboolean
+thread_cpu_usage (pid_t tid,
+                  GstClockTime *cpu_time,
+                  gint *cpu)
+{
+    gchar *path, *contents, *p;
+    gchar **fields;
+    gboolean ret = FALSE;
+
+    path = g_strdup_printf ("/proc/self/task/%d/stat", (gint) tid);
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+    {
+        g_free (path);
+        return FALSE;
+    }
+    g_free (path);
+
+    /* the thread name may hold spaces; count fields from the state on */
+    p = strrchr (contents, ')');
+    if (p && p[1] == ' ')
+    {
+        fields = g_strsplit (p + 2, " ", -1);
+
+        /* state is field 3; utime 14, stime 15, processor 39 */
+        if (g_strv_length (fields) > 36)
+        {
+            guint64 ticks;
+
+            ticks = g_ascii_strtoull (fields[11], NULL, 10) +
+                g_ascii_strtoull (fields[12], NULL, 10);
+            *cpu_time = gst_util_uint64_scale (ticks, GST_SECOND,
+                    sysconf (_SC_CLK_TCK));
+            *cpu = atoi (fields[36]);
+            ret = TRUE;
+        }
+
+        g_strfreev (fields);
+    }
+
+    g_free (contents);
+
+    return ret;
+}
+
+static void
+thread_register (GOmxThreads *threads,
+                 GOmxThreadRole role,
+                 const gchar *name,
+                 pid_t tid)
+{
+    GOmxThreadInfo *info;
+    GList *l;
+    gint cpu;
+
+    for (l = threads->threads; l; l = l->next)
+    {
+        if (((GOmxThreadInfo *) l->data)->tid == tid)
+            return;
+    }
+
+    info = g_new0 (GOmxThreadInfo, 1);
+    info->tid = tid;
+    info->name = g_strdup_printf ("%s-%d", name ? name : role_names[role], (gint) tid);
+    info->last_time = gst_util_get_timestamp ();
+    if (!thread_cpu_usage (tid, &info->last_cpu, &cpu))
+        info->last_cpu = 0;
+
+    threads->threads = g_list_append (threads->threads, info);
+}
+
+static void
+thread_save (GOmxThreadState *state)
+{
+    if (state->saved)
+        return;
+
+    state->saved_cpus =
+        sched_getaffinity (0, sizeof (state->cpus), &state->cpus) == 0;
+    state->policy = sched_getscheduler (0);
+    if (state->policy < 0 || sched_getparam (0, &state->param) < 0)
+    {
+        state->policy = SCHED_OTHER;
+        state->param.sched_priority = 0;
+    }
+    errno = 0;
+    state->nice = getpriority (PRIO_PROCESS, state->tid);
+    if (errno)
+        state->nice = 0;
+
+    state->saved = TRUE;
+}
+
+/* Back to what the thread had before it was first changed */
+static void
+thread_restore (GOmxThreadState *state)
+{
+    if (!state->saved)
+        return;
+
+    if (state->saved_cpus)
+        sched_setaffinity (0, sizeof (state->cpus), &state->cpus);
+    sched_setscheduler (0, state->policy, &state->param);
+    setpriority (PRIO_PROCESS, state->tid, state->nice);
+}
+
+static void
+thread_apply (GOmxThreads *threads,
+              GOmxThreadRole role,
+              const GOmxThreadSettings *settings,
+              GOmxThreadState *state)
+{
+    struct sched_param param;
+    gint policy;
+    pid_t tid = state->tid;
+
+    /* settings apply to the thread as it was; "inherit" and any CPU keep
+     * that */
+    thread_restore (state);
+
+    if (!settings->cpus && settings->policy == G_OMX_THREAD_POLICY_INHERIT)
+    {
+        GST_INFO_OBJECT (threads->object, "%s thread %d: as created",
+                role_names[role], (gint) tid);
+        return;
+    }
+
+    thread_save (state);
+
+    if (settings->cpus)
+    {
+        cpu_set_t set;
+        guint i;
+
+        CPU_ZERO (&set);
+        for (i = 0; i < 32; i++)
+        {
+            if (settings->cpus & (1u << i))
+                CPU_SET (i, &set);
+        }
+
+        if (sched_setaffinity (0, sizeof (set), &set) < 0)
+            GST_WARNING_OBJECT (threads->object, "%s thread %d: could not set affinity 0x%x: %s",
+                    role_names[role], (gint) tid, settings->cpus, strerror (errno));
+    }
+
+    switch (settings->policy)
+    {
+        case G_OMX_THREAD_POLICY_OTHER:
+            param.sched_priority = 0;
+            if (sched_setscheduler (0, SCHED_OTHER, &param) < 0 ||
+                setpriority (PRIO_PROCESS, tid, CLAMP (settings->priority, -20, 19)) < 0)
+                GST_WARNING_OBJECT (threads->object, "%s thread %d: could not set nice %d: %s",
+                        role_names[role], (gint) tid, settings->priority, strerror (errno));
+            break;
+        case G_OMX_THREAD_POLICY_FIFO:
+        case G_OMX_THREAD_POLICY_RR:
+            policy = settings->policy == G_OMX_THREAD_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+            param.sched_priority = CLAMP (settings->priority,
+                    sched_get_priority_min (policy), sched_get_priority_max (policy));
+            if (sched_setscheduler (0, policy, &param) < 0)
+                GST_WARNING_OBJECT (threads->object, "%s thread %d: could not set RT priority %d: %s",
+                        role_names[role], (gint) tid, param.sched_priority, strerror (errno));
+            break;
+        default:
+            break;
+    }
+
+    GST_INFO_OBJECT (threads->object, "%s thread %d: cpus=0x%x policy=%d priority=%d",
+            role_names[role], (gint) tid, settings->cpus, settings->policy, settings->priority);
+}
+
+/* Returns TRUE if the settings were applied, FALSE if they already were */
+static gboolean
+threads_enter (GOmxThreads *threads,
+               GOmxThreadRole role,
+               const gchar *name)
+{
+    GOmxThreadState *state;
+    GOmxThreadSettings settings;
+    gint cookie;
+    guint i;
+
+    cookie = g_atomic_int_get (&threads->cookie[role]);
+
+    state = g_static_private_get (&thread_state);
+    if (G_UNLIKELY (!state))
+    {
+        state = g_new0 (GOmxThreadState, 1);
+        state->tid = syscall (SYS_gettid);
+        g_static_private_set (&thread_state, state, g_free);
+    }
+
+    for (i = 0; i < THREAD_STATE_COOKIES; i++)
+    {
+        if (state->cookies[i] == cookie)
+            return FALSE;
+    }
+
+    state->cookies[state->next++ % THREAD_STATE_COOKIES] = cookie;
+
+    g_mutex_lock (threads->lock);
+    thread_register (threads, role, name, state->tid);
+    settings = threads->settings[role];
+    g_mutex_unlock (threads->lock);
+
+    thread_apply (threads, role, &settings, state);
+
+    return TRUE;
+}
+
+/**
+ * Called by a thread each time it runs on behalf of the element. The
+ * first time, and after the settings of its role changed, the thread is
+ * registered for the stats and the settings are applied to it; all other
+ * calls only compare the cookie.
+ *
+ * A callback thread shared by several components keeps the settings of
+ * the last one that changed.
+ */
+void
+g_omx_threads_enter (GOmxThreads *threads,
+                     GOmxThreadRole role,
+                     const gchar *name)
+{
+    threads_enter (threads, role, name);
+}
+
+static void
+task_leave (GstTask *task,
+            GThread *thread,
+            gpointer user_data)
+{
+    GOmxThreadState *state = g_static_private_get (&thread_state);
+
+    if (!state)
+        return;
+
+    thread_restore (state);
+    /* whatever task the thread runs next applies its settings again */
+    memset (state->cookies, 0, sizeof (state->cookies));
+}
+
+static GstTaskThreadCallbacks task_callbacks = { NULL, task_leave };
+
+/**
+ * g_omx_threads_enter() for a streaming thread running the task of @pad.
+ * Task threads come from a pool and run other tasks afterwards, so the
+ * thread gets its own settings back when it leaves the task.
+ */
+void
+g_omx_threads_enter_task (GOmxThreads *threads,
+                          GstPad *pad,
+                          const gchar *name)
+{
+    GstTask *task;
+
+    if (!threads_enter (threads, G_OMX_THREAD_STREAMING, name))
+        return;
+
+    GST_OBJECT_LOCK (pad);
+    task = GST_PAD_TASK (pad);
+    if (task)
+        gst_object_ref (task);
+    GST_OBJECT_UNLOCK (pad);
+
+    if (task)
+    {
+        gst_task_set_thread_callbacks (task, &task_callbacks, NULL, NULL);
+        gst_object_unref (task);
+    }
+}
+
+/**
+ * Returns a new "omx-threads" structure with, for every thread that
+ * entered, its CPU time ("<name>-cpu-time", ns), its share of one CPU
+ * since the previous query ("<name>-cpu-load", percent) and the CPU it
+ * last ran on ("<name>-cpu"). Threads that have exited are dropped.
+ */
+GstStructure *
+g_omx_threads_get_stats (GOmxThreads *threads)
+{
+    GstStructure *s;
+    GList *l, *next;
+    GstClockTime now;
+
+    s = gst_structure_new ("omx-threads", NULL);
+    now = gst_util_get_timestamp ();
+
+    g_mutex_lock (threads->lock);
+    for (l = threads->threads; l; l = next)
+    {
+        GOmxThreadInfo *info = l->data;
+        GstClockTime cpu_time;
+        gdouble load = 0.0;
+        gchar *field;
+        gint cpu;
+
+        next = l->next;
+
+        if (!thread_cpu_usage (info->tid, &cpu_time, &cpu))
+        {
+            threads->threads = g_list_delete_link (threads->threads, l);
+            g_free (info->name);
+            g_free (info);
+            continue;
+        }
+
+        if (now > info->last_time && cpu_time >= info->last_cpu)
+            load = 100.0 * (cpu_time - info->last_cpu) / (now - info->last_time);
+        info->last_time = now;
+        info->last_cpu = cpu_time;
+
+        field = g_strdup_printf ("%s-cpu-time", info->name);
+        gst_structure_set (s, field, G_TYPE_UINT64, cpu_time, NULL);
+        g_free (field);
+        field = g_strdup_printf ("%s-cpu-load", info->name);
+        gst_structure_set (s, field, G_TYPE_DOUBLE, load, NULL);
+        g_free (field);
+        field = g_strdup_printf ("%s-cpu", info->name);
+        gst_structure_set (s, field, G_TYPE_INT, cpu, NULL);
+        g_free (field);
+    }
+    g_mutex_unlock (threads->lock);
+
+    return s;
+}
+
+/*
+ * Properties, installed by the elements that own streaming threads from
+ * first_prop_id on.
+ */
+
+void
+g_omx_threads_install_properties (GObjectClass *gobject_class,
+                                  guint first_prop_id)
+{
+    gint i;
+
+    for (i = 0; i < G_OMX_THREAD_N_ROLES; i++)
+    {
+        const gchar *role = role_names[i];
+        gchar *name, *nick, *blurb;
+        guint id = first_prop_id + i * 3;
+
+        name = g_strdup_printf ("%s-cpus", role);
+        nick = g_strdup_printf ("%s thread CPUs", role);
+        blurb = g_strdup_printf ("CPU affinity mask of the %s threads (0 = as created)", role);
+        g_object_class_install_property (gobject_class, id,
+                g_param_spec_uint (name, nick, blurb,
+                    0, G_MAXUINT, 0, G_PARAM_READWRITE));
+        g_free (name); g_free (nick); g_free (blurb);
+
+        name = g_strdup_printf ("%s-policy", role);
+        nick = g_strdup_printf ("%s thread policy", role);
+        blurb = g_strdup_printf ("Scheduling policy of the %s threads", role);
+        g_object_class_install_property (gobject_class, id + 1,
+                g_param_spec_enum (name, nick, blurb,
+                    G_OMX_TYPE_THREAD_POLICY, G_OMX_THREAD_POLICY_INHERIT,
+                    G_PARAM_READWRITE));
+        g_free (name); g_free (nick); g_free (blurb);
+
+        name = g_strdup_printf ("%s-priority", role);
+        nick = g_strdup_printf ("%s thread priority", role);
+        blurb = g_strdup_printf ("Priority of the %s threads: nice value for "
+                "policy \"other\", real-time priority for \"fifo\" and \"rr\"", role);
+        g_object_class_install_property (gobject_class, id + 2,
+                g_param_spec_int (name, nick, blurb,
+                    -20, 99, 0, G_PARAM_READWRITE));
+        g_free (name); g_free (nick); g_free (blurb);
+    }
+
+    g_object_class_install_property (gobject_class, first_prop_id + PROP_THREAD_STATS,
+            g_param_spec_boxed ("thread-stats", "Thread stats",
+                "CPU time, load and last CPU of every thread of the element",
+                GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+}
+
+gboolean
+g_omx_threads_set_property (GOmxThreads *threads,
+                            guint first_prop_id,
+                            guint prop_id,
+                            const GValue *value)
+{
+    GOmxThreadSettings *settings;
+    GOmxThreadRole role;
+    guint id;
+
+    if (prop_id < first_prop_id || prop_id >= first_prop_id + PROP_THREAD_STATS)
+        return FALSE;
+
+    id = prop_id - first_prop_id;
+    role = id / 3;
+
+    g_mutex_lock (threads->lock);
+    settings = &threads->settings[role];
+    switch (id % 3)
+    {
+        case 0:
+            settings->cpus = g_value_get_uint (value);
+            break;
+        case 1:
+            settings->policy = g_value_get_enum (value);
+            break;
+        case 2:
+            settings->priority = g_value_get_int (value);
+            break;
+    }
+    /* running threads pick the new settings up on their next entry */
+    threads->cookie[role] = g_atomic_int_exchange_and_add (&next_cookie, 1);
+    g_mutex_unlock (threads->lock);
+
+    return TRUE;
+}
+
+gboolean
+g_omx_threads_get_property (GOmxThreads *threads,
+                            guint first_prop_id,
+                            guint prop_id,
+                            GValue *value)
+{
+    GOmxThreadSettings *settings;
+    guint id;
+
+    if (prop_id < first_prop_id || prop_id >= first_prop_id + G_OMX_THREADS_N_PROPS)
+        return FALSE;
+
+    id = prop_id - first_prop_id;
+
+    if (id == PROP_THREAD_STATS)
+    {
+        g_value_take_boxed (value, g_omx_threads_get_stats (threads));
+        return TRUE;
+    }
+
+    g_mutex_lock (threads->lock);
+    settings = &threads->settings[id / 3];
+    switch (id % 3)
+    {
+        case 0:
+            g_value_set_uint (value, settings->cpus);
+            break;
+        case 1:
+            g_value_set_enum (value, settings->policy);
+            break;
+        case 2:
+            g_value_set_int (value, settings->priority);
+            break;
+    }
+    g_mutex_unlock (threads->lock);
+
+    return TRUE;
+}
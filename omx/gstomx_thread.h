@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_THREAD_H
+#define GSTOMX_THREAD_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Threads an element runs: the streaming threads it creates (output
+ * loops, source tasks, the videomixer input loop) and the threads the
+ * OMX core delivers its callbacks on.
+ */
+typedef enum
+{
+    G_OMX_THREAD_STREAMING,
+    G_OMX_THREAD_CALLBACK,
+    G_OMX_THREAD_N_ROLES
+} GOmxThreadRole;
+
+typedef enum
+{
+    G_OMX_THREAD_POLICY_INHERIT = -1,   /**< keep the thread as created */
+    G_OMX_THREAD_POLICY_OTHER = 0,
+    G_OMX_THREAD_POLICY_FIFO = 1,
+    G_OMX_THREAD_POLICY_RR = 2
+} GOmxThreadPolicy;
+
+#define G_OMX_TYPE_THREAD_POLICY (g_omx_thread_policy_get_type ())
+
+typedef struct GOmxThreads GOmxThreads;
+
+/* Number of properties g_omx_threads_install_properties() installs */
+#define G_OMX_THREADS_N_PROPS 7
+
+GType g_omx_thread_policy_get_type (void);
+
+GOmxThreads *g_omx_threads_new (gpointer object);
+void g_omx_threads_free (GOmxThreads *threads);
+void g_omx_threads_enter (GOmxThreads *threads, GOmxThreadRole role,
+        const gchar *name);
+void g_omx_threads_enter_task (GOmxThreads *threads, GstPad *pad,
+        const gchar *name);
+GstStructure *g_omx_threads_get_stats (GOmxThreads *threads);
+
+void g_omx_threads_install_properties (GObjectClass *gobject_class,
+        guint first_prop_id);
+gboolean g_omx_threads_set_property (GOmxThreads *threads,
+        guint first_prop_id, guint prop_id, const GValue *value);
+gboolean g_omx_threads_get_property (GOmxThreads *threads,
+        guint first_prop_id, guint prop_id, GValue *value);
+
+G_END_DECLS
+
+#endif /* GSTOMX_THREAD_H */
@@ -364,3 +364,53 @@ OMX_COLOR_FORMATTYPE g_omx_gstvformat_to_colorformat (GstVideoFormat videoformat
             return OMX_COLOR_FormatUnused;
     }
  }
+
+/*
+ * Size of an input/output bitstream buffer able to hold one coded picture.
+ *
+ * The bound starts from the uncompressed 4:2:0 picture (384 bytes per
+ * macroblock) divided by the minimum compression ratio: H.264 defines
+ * MinCR per level (4 for levels 3.1 to 4, 2 otherwise) and the other
+ * formats are held to the same 2:1, except JPEG which has no such bound
+ * and gets the whole raw picture.  When the stream bitrate and frame rate
+ * are known, a key frame is allowed eight times the average frame budget
+ * instead, if that is tighter, but never less than 16 KB.  A frame that
+ * still overflows grows the buffers while running.  @level is the
+ * level_idc (e.g. 31 for 3.1) or 0 when unknown; @ceiling, when non-zero,
+ * caps the result.
+ */
+guint
+g_omx_bitstream_buffer_size (OMX_VIDEO_CODINGTYPE coding, gint width, gint height,
+                             gint level, guint bitrate, gint fps_n, gint fps_d,
+                             guint ceiling)
+{
+    guint64 size;
+    guint mbs, min_cr = 2;
+
+    mbs = ((width + 15) / 16) * ((height + 15) / 16);
+
+    if (coding == OMX_VIDEO_CodingAVC && level >= 31 && level <= 40)
+        min_cr = 4;
+    else if (coding == OMX_VIDEO_CodingMJPEG)
+        min_cr = 1;
+
+    size = (guint64) mbs * 384 / min_cr;
+
+    if (bitrate && fps_n > 0 && fps_d > 0)
+    {
+        /* eight frames' worth of bytes is one frame's worth of bits */
+        guint64 burst = gst_util_uint64_scale (bitrate, fps_d, fps_n);
+
+        if (burst < size)
+            size = burst;
+    }
+
+    /* leave room for headers and SEI on tiny pictures */
+    size = MAX (size, 16 * 1024);
+
+    if (ceiling && size > ceiling)
+        size = ceiling;
+
+    /* round to whole pages, shared-region allocations are page based */
+    return (guint) ((size + 4095) & ~((guint64) 4095));
+}
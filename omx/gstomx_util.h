@@ -47,6 +47,7 @@ typedef struct GOmxSymbolTable GOmxSymbolTable;
 
 #include "gstomx_core.h"
 #include "gstomx_port.h"
+#include "gstomx_thread.h"
 
 
 /* Structures. */
@@ -82,6 +83,9 @@ const char * g_omx_error_to_str (OMX_ERRORTYPE omx_error);
 OMX_COLOR_FORMATTYPE g_omx_fourcc_to_colorformat (guint32 fourcc);
 guint32 g_omx_colorformat_to_fourcc (OMX_COLOR_FORMATTYPE eColorFormat);
 OMX_COLOR_FORMATTYPE g_omx_gstvformat_to_colorformat (GstVideoFormat videoformat);
+guint g_omx_bitstream_buffer_size (OMX_VIDEO_CODINGTYPE coding, gint width, gint height,
+                                   gint level, guint bitrate, gint fps_n, gint fps_d,
+                                   guint ceiling);
 
 
 
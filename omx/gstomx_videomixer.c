@@ -35,7 +35,8 @@ enum
     ARG_NUM_OUTPUT_BUFFERS,
     ARG_PORT_INDEX,
 	ARG_FRAME_RATE,
-	ARG_SETTINGS_CHANGED
+	ARG_SETTINGS_CHANGED,
+    ARG_THREADS     /* first of the G_OMX_THREADS_N_PROPS thread properties */
 };
 
 enum
@@ -551,7 +552,8 @@ set_property (GObject *obj,
 			//printf("settings updated!!\n");
 		break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_set_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -596,7 +598,8 @@ get_property (GObject *obj,
             g_value_set_uint (value, self->port_index);
             break;
         default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            if (!g_omx_threads_get_property (self->gomx->threads, ARG_THREADS, prop_id, value))
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
@@ -695,6 +698,8 @@ type_class_init (gpointer g_class,
                                          g_param_spec_boolean ("settingsChanged", "settingsChanged",
                                                                "Indicate if the port settings have changed",
                                                                TRUE, G_PARAM_WRITABLE));
+
+        g_omx_threads_install_properties (gobject_class, ARG_THREADS);
     }
 
 	/* Register the pad class */
@@ -1084,6 +1089,8 @@ output_loop (gpointer data)
 
     bclass = GST_OMX_VIDEO_MIXER_GET_CLASS (self);
 
+    g_omx_threads_enter_task (gomx->threads, pad, "output");
+
     GST_LOG_OBJECT (self, "begin");
 
     if (!self->ready)
@@ -1464,6 +1471,8 @@ static void* vidmix_input_loop(void *arg) {
 	    /*gettimeofday(&tv, NULL);
 		beftime = (tv.tv_sec * 1000000 + tv.tv_usec);*/
 		g_sem_down(self->bufferSem);
+		/* picks up changes to the thread properties while mixing */
+		g_omx_threads_enter (gomx->threads, G_OMX_THREAD_STREAMING, "input");
 		/*gettimeofday(&tv, NULL);
 		afttime = (tv.tv_sec * 1000000 + tv.tv_usec);
 		printf("Wait:%lld\n",(afttime-beftime));*/
@@ -50,8 +50,16 @@ enum
     ARG_DISPLAY_MODE,
     ARG_ENABLE_COLORKEY,
     ARG_DISPLAY_DEVICE,
+    ARG_QUEUE_DEPTH,
+    ARG_LOW_LATENCY,
+    ARG_STATS,
 };
 
+#define DEFAULT_QUEUE_DEPTH 5
+
+/* the displayed and the next frame */
+#define LOW_LATENCY_QUEUE_DEPTH 2
+
 static GstCaps *
 generate_sink_template (void)
 {
@@ -226,6 +234,33 @@ get_display_mode_from_string (char *str, int *mode, int *maxWidth, int *maxHeigh
 #define LCD_V_BACK_PORCH  (23)
 #define LCD_V_SYNC_LENGTH (10)
 
+/* how long a frame stays on screen at least, the display latches a new
+ * one at every vsync of a progressive mode and every other of an
+ * interlaced one */
+static GstClockTime
+get_vsync_period (GstOmxVideoSink *sink)
+{
+    if (!strcmp (sink->display_device, "LCD"))
+    {
+        return gst_util_uint64_scale (GST_SECOND,
+                (LCD_WIDTH + LCD_H_FRONT_PORCH + LCD_H_BACK_PORCH + LCD_H_SYNC_LENGTH) *
+                (LCD_HEIGHT + LCD_V_FRONT_PORCH + LCD_V_BACK_PORCH + LCD_V_SYNC_LENGTH),
+                LCD_PIXEL_CLOCK * 1000);
+    }
+
+    if (!strcmp (sink->display_mode, "OMX_DC_MODE_1080P_30") ||
+        !strcmp (sink->display_mode, "OMX_DC_MODE_1080I_60"))
+        return GST_SECOND / 30;
+
+    if (!strcmp (sink->display_mode, "OMX_DC_MODE_PAL"))
+        return GST_SECOND / 25;
+
+    if (!strcmp (sink->display_mode, "OMX_DC_MODE_NTSC"))
+        return gst_util_uint64_scale (GST_SECOND, 1001, 30000);
+
+    return GST_SECOND / 60;
+}
+
 
 static void
 omx_setup (GstBaseSink *gst_sink, GstCaps *caps)
@@ -274,7 +309,7 @@ omx_setup (GstBaseSink *gst_sink, GstCaps *caps)
     param.format.video.nFrameWidth = width;
     param.format.video.nFrameHeight = height;
     param.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
-    param.nBufferCountActual = 5;
+    param.nBufferCountActual = sink->queue_depth;
 
     G_OMX_PORT_SET_DEFINITION (omx_base->in_port, &param);
     g_omx_port_setup (omx_base->in_port, &param);
@@ -282,6 +317,10 @@ omx_setup (GstBaseSink *gst_sink, GstCaps *caps)
     /* get the display mode set via property */
     get_display_mode_from_string (sink->display_mode, &mode, &maxWidth, &maxHeight);
 
+    GST_OBJECT_LOCK (sink);
+    sink->vsync_period = get_vsync_period (sink);
+    GST_OBJECT_UNLOCK (sink);
+
     /* set display driver mode */
     _G_OMX_INIT_PARAM (&driverId);
 	
@@ -412,6 +451,150 @@ setcaps (GstBaseSink *gst_sink,
     return TRUE;
 }
 
+static gboolean
+start (GstBaseSink *gst_sink)
+{
+    GstOmxVideoSink *self = GST_OMX_VIDEOSINK (gst_sink);
+
+    GST_OBJECT_LOCK (self);
+    self->last_show = GST_CLOCK_TIME_NONE;
+    self->latency = GST_CLOCK_TIME_NONE;
+    self->reported_latency = GST_CLOCK_TIME_NONE;
+    self->rendered = self->dropped = self->repeated = 0;
+    GST_OBJECT_UNLOCK (self);
+
+    return TRUE;
+}
+
+/* Holds a frame back while the display queue is full, and drops it when
+ * the vsync it would land on is past its end, that is when its successor
+ * is due on screen by then.  The display repeats the last frame at the
+ * vsyncs that get none.  Vsyncs are where the display hands frames back.
+ */
+static GstFlowReturn
+render (GstBaseSink *gst_sink,
+        GstBuffer *buf)
+{
+    GstOmxVideoSink *self;
+    GstOmxBaseSink *omx_base;
+    GOmxPort *port;
+    GstClock *clock;
+    GstClockTime now, vsync, show, deadline = GST_CLOCK_TIME_NONE;
+    GstClockTime period, latency;
+    GTimeVal end_time;
+    gboolean update_latency = FALSE;
+    gint depth, queued;
+
+    self = GST_OMX_VIDEOSINK (gst_sink);
+    omx_base = GST_OMX_BASE_SINK (gst_sink);
+    port = omx_base->in_port;
+
+    /* the first frame sets the component up */
+    if (G_UNLIKELY (omx_base->gomx->omx_state != OMX_StateExecuting))
+        return GST_BASE_SINK_CLASS (parent_class)->render (gst_sink, buf);
+
+    depth = self->low_latency ? LOW_LATENCY_QUEUE_DEPTH : self->queue_depth;
+
+    /* flushing returns the held frames, don't wait longer than that */
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, G_USEC_PER_SEC);
+    g_omx_port_wait_outstanding (port, depth - 1, &end_time);
+
+    now = gst_util_get_timestamp ();
+    queued = g_atomic_int_get (&port->outstanding);
+
+    g_mutex_lock (port->mutex);
+    vsync = port->last_returned;
+    g_mutex_unlock (port->mutex);
+
+    /* when the frame after this one is due, in our time base */
+    clock = gst_element_get_clock (GST_ELEMENT (self));
+    if (clock && gst_base_sink_get_sync (gst_sink) &&
+        GST_BUFFER_TIMESTAMP_IS_VALID (buf) && GST_BUFFER_DURATION_IS_VALID (buf))
+    {
+        GstClockTime end;
+
+        end = gst_segment_to_running_time (&gst_sink->segment, GST_FORMAT_TIME,
+                GST_BUFFER_TIMESTAMP (buf) + GST_BUFFER_DURATION (buf));
+
+        if (GST_CLOCK_TIME_IS_VALID (end))
+        {
+            GstClockTimeDiff due;
+
+            due = GST_CLOCK_DIFF (gst_clock_get_time (clock),
+                    end + gst_element_get_base_time (GST_ELEMENT (self)) +
+                    gst_base_sink_get_latency (gst_sink));
+            deadline = now + MAX (due, 0);
+        }
+    }
+    if (clock)
+        gst_object_unref (clock);
+
+    GST_OBJECT_LOCK (self);
+
+    period = self->vsync_period;
+    if (!GST_CLOCK_TIME_IS_VALID (vsync) || vsync > now)
+        vsync = now;
+
+    /* latched at the next vsync if the display holds only the current
+     * frame, one vsync later for every frame queued before it */
+    show = vsync + ((now - vsync) / period + 1) * period;
+    if (queued > 1)
+        show += (queued - 1) * period;
+
+    if (self->rendered && GST_CLOCK_TIME_IS_VALID (deadline) && show > deadline)
+    {
+        self->dropped++;
+        GST_OBJECT_UNLOCK (self);
+
+        GST_DEBUG_OBJECT (self, "dropping %" GST_TIME_FORMAT ", on screen %"
+                GST_TIME_FORMAT " late", GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buf)),
+                GST_TIME_ARGS (show - deadline));
+        return GST_FLOW_OK;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (self->last_show) && show > self->last_show)
+    {
+        guint64 vsyncs = (show - self->last_show + period / 2) / period;
+
+        if (vsyncs > 1)
+            self->repeated += vsyncs - 1;
+    }
+    self->last_show = show;
+
+    /* measured for the stats only: frames are submitted earlier by the
+     * render delay, which would feed back into it */
+    latency = show - now;
+    if (GST_CLOCK_TIME_IS_VALID (self->latency))
+        self->latency = (7 * self->latency + latency) / 8;
+    else
+        self->latency = latency;
+
+    /* reported: up to the next vsync, then one more for every frame the
+     * display may have queued ahead */
+    latency = depth * period;
+    if (latency != self->reported_latency)
+    {
+        self->reported_latency = latency;
+        update_latency = TRUE;
+    }
+
+    self->rendered++;
+
+    GST_OBJECT_UNLOCK (self);
+
+    /* submitted that much ahead, and part of LATENCY query answers */
+    if (update_latency)
+    {
+        GST_INFO_OBJECT (self, "display latency %" GST_TIME_FORMAT, GST_TIME_ARGS (latency));
+        gst_base_sink_set_render_delay (gst_sink, latency);
+        gst_element_post_message (GST_ELEMENT (self),
+                gst_message_new_latency (GST_OBJECT (self)));
+    }
+
+    return GST_BASE_SINK_CLASS (parent_class)->render (gst_sink, buf);
+}
+
 static void
 set_property (GObject *object,
               guint prop_id,
@@ -451,6 +634,12 @@ set_property (GObject *object,
             g_free (self->display_device);
             self->display_device = g_value_dup_string (value);
             break;
+        case ARG_QUEUE_DEPTH:
+            self->queue_depth = g_value_get_uint (value);
+            break;
+        case ARG_LOW_LATENCY:
+            self->low_latency = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
@@ -493,6 +682,30 @@ get_property (GObject *object,
 		case ARG_DISPLAY_DEVICE:
             g_value_set_string (value, self->display_device);
             break;
+        case ARG_QUEUE_DEPTH:
+            g_value_set_uint (value, self->queue_depth);
+            break;
+        case ARG_LOW_LATENCY:
+            g_value_set_boolean (value, self->low_latency);
+            break;
+        case ARG_STATS:
+            {
+                GstStructure *s;
+
+                GST_OBJECT_LOCK (self);
+                s = gst_structure_new ("omx-videosink-stats",
+                        "rendered", G_TYPE_UINT64, self->rendered,
+                        "dropped", G_TYPE_UINT64, self->dropped,
+                        "repeated", G_TYPE_UINT64, self->repeated,
+                        "display-latency", G_TYPE_UINT64,
+                        GST_CLOCK_TIME_IS_VALID (self->latency) ? self->latency : 0,
+                        "vsync-period", G_TYPE_UINT64, self->vsync_period,
+                        NULL);
+                GST_OBJECT_UNLOCK (self);
+
+                g_value_take_boxed (value, s);
+            }
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
@@ -510,6 +723,8 @@ type_class_init (gpointer g_class,
     gst_base_sink_class = GST_BASE_SINK_CLASS (g_class);
 
     gst_base_sink_class->set_caps = setcaps;
+    gst_base_sink_class->start = start;
+    gst_base_sink_class->render = render;
 
     gobject_class->set_property = set_property;
     gobject_class->get_property = get_property;
@@ -543,6 +758,20 @@ type_class_init (gpointer g_class,
             "\n\t\t\t HDMI "
             "\n\t\t\t LCD "
 	    "\n\t\t\t SD ", "HDMI",G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, ARG_QUEUE_DEPTH,
+                                     g_param_spec_uint ("queue-depth", "Queue depth",
+                                                        "Frames the display may hold, including the one on screen",
+                                                        2, 16, DEFAULT_QUEUE_DEPTH, G_PARAM_READWRITE));
+    g_object_class_install_property (gobject_class, ARG_LOW_LATENCY,
+                                     g_param_spec_boolean ("low-latency", "Low latency",
+                                                           "Queue only the next frame behind the one on screen",
+                                                           FALSE, G_PARAM_READWRITE));
+    g_object_class_install_property (gobject_class, ARG_STATS,
+                                     g_param_spec_boxed ("stats", "Statistics",
+                                                         "Frames rendered, dropped and repeated by the display, "
+                                                         "and the delay until they are on screen",
+                                                         GST_TYPE_STRUCTURE, G_PARAM_READABLE));
 }
 
 static void
@@ -559,5 +788,11 @@ type_instance_init (GTypeInstance *instance,
     g_object_set (self, "colorkey", TRUE, NULL);
     g_object_set (self, "display-mode", "OMX_DC_MODE_1080P_60", NULL);
 	g_object_set (self, "display-device", "HDMI", NULL);
+
+    self->queue_depth = DEFAULT_QUEUE_DEPTH;
+    self->vsync_period = GST_SECOND / 60;
+    self->last_show = GST_CLOCK_TIME_NONE;
+    self->latency = GST_CLOCK_TIME_NONE;
+    self->reported_latency = GST_CLOCK_TIME_NONE;
 }
 
@@ -48,6 +48,18 @@ struct GstOmxVideoSink
     gchar *display_mode;
     guint maxWidth, maxHeight;
 	gchar *display_device;
+
+    guint queue_depth;          /**< frames the display may hold */
+    gboolean low_latency;       /**< hold at most two frames */
+
+    /* presentation, under the object lock */
+    GstClockTime vsync_period;
+    GstClockTime last_show;     /**< when the last frame went on screen */
+    GstClockTime latency;       /**< average submit to screen delay */
+    GstClockTime reported_latency;  /**< queue_depth vsync periods */
+    guint64 rendered;
+    guint64 dropped;
+    guint64 repeated;
 };
 
 struct GstOmxVideoSinkClass
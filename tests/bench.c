@@ -0,0 +1,665 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Throughput and latency benchmark over the simulated OpenMAX IL core.
+ *
+ * Each topology runs to EOS and prints one JSON object per line:
+ *
+ *   {"topology": ..., "frames": ..., "seconds": ..., "fps": ...,
+ *    "cpu_user_s": ..., "cpu_system_s": ..., "voluntary_switches": ...,
+ *    "involuntary_switches": ..., "allocs_per_frame": ...,
+ *    "buffer_calls_per_frame": ...,
+ *    "elements": {"<name>": {"samples": ..., "p50_us": ..., "p90_us": ...,
+ *                            "p99_us": ..., "max_us": ...}, ...},
+ *    "result": "ok" | "<error>"}
+ *
+ * Element latency is the time from a buffer entering an element to the
+ * next buffer leaving its first source pad, matching buffers in order on
+ * every sink pad. Allocations are GLib allocations (G_SLICE is forced to
+ * always-malloc), counted from PLAYING to EOS and divided by the frames
+ * reaching the first sink pad of the element named "sink". Buffer calls
+ * are the EmptyThisBuffer and FillThisBuffer calls the simulator took
+ * over the same span, one IPC round trip each on the DM81xx; null when
+ * the OMX core in use doesn't count them.
+ *
+ * Usage: bench [frames] [topology...]
+ */
+
+#include <gst/gst.h>
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define MAX_PENDING 64
+#define TIMEOUT (120 * GST_SECOND)
+
+typedef struct BenchTopology BenchTopology;
+typedef struct BenchElement BenchElement;
+typedef struct BenchPad BenchPad;
+
+struct BenchTopology
+{
+    const gchar *name;
+    gchar *(*describe) (guint frames);
+};
+
+struct BenchPad
+{
+    BenchElement *element;
+    GstClockTime pending[MAX_PENDING];
+    guint head;
+    guint length;
+};
+
+struct BenchElement
+{
+    gchar *name;
+    GMutex *mutex;
+    GList *sink_pads;
+    GstClockTime *samples;
+    guint num_samples;
+    guint max_samples;
+};
+
+static volatile gint allocations;
+static volatile gint frames_done;
+
+/* omxsim_get_buffer_calls() from the simulated core, if that is the one
+ * the plugin loads */
+static guint (*get_buffer_calls) (void);
+
+/*
+ * Allocation counting.
+ */
+
+static gpointer
+count_malloc (gsize n_bytes)
+{
+    g_atomic_int_inc (&allocations);
+    return malloc (n_bytes);
+}
+
+static gpointer
+count_realloc (gpointer mem,
+               gsize n_bytes)
+{
+    if (!mem)
+        g_atomic_int_inc (&allocations);
+    return realloc (mem, n_bytes);
+}
+
+static GMemVTable count_vtable = { count_malloc, count_realloc, free, NULL, NULL, NULL };
+
+/*
+ * Topologies.
+ */
+
+static gchar *
+describe_decode (guint frames)
+{
+    return g_strdup_printf (
+            "fakesrc num-buffers=%u sizetype=2 sizemax=65536 filltype=1 ! "
+            "video/x-h264, width=(int)1920, height=(int)1080, framerate=(fraction)30/1 ! "
+            "omx_h264dec name=dec ! omx_scaler name=scale ! "
+            "video/x-raw-yuv, width=(int)1280, height=(int)720 ! "
+            "omx_videosink name=sink sync=false", frames);
+}
+
+/* decoded frames go downstream in GstOmxBufferTransport wrappers and
+ * come straight back, so allocations per frame are the wrapper cost */
+static gchar *
+describe_decode_only (guint frames)
+{
+    return g_strdup_printf (
+            "fakesrc num-buffers=%u sizetype=2 sizemax=65536 filltype=1 ! "
+            "video/x-h264, width=(int)1920, height=(int)1080, framerate=(fraction)30/1 ! "
+            "omx_h264dec name=dec ! fakesink name=sink sync=false", frames);
+}
+
+/* parsed ADTS frames, packed several to an input buffer by omx_aacdec */
+static gchar *
+describe_aac_decode (guint frames)
+{
+    return g_strdup_printf (
+            "fakesrc num-buffers=%u sizetype=2 sizemax=768 filltype=1 ! "
+            "audio/mpeg, mpegversion=(int)4, rate=(int)48000, channels=(int)2, "
+            "parsed=(boolean)true ! "
+            "omx_aacdec name=dec ! fakesink name=sink sync=false", frames);
+}
+
+static gchar *
+describe_camera (guint frames)
+{
+    return g_strdup_printf (
+            "omx_camera name=cam num-buffers=%u ! "
+            "video/x-raw-yuv-strided, format=(fourcc)NV12, width=(int)1920, "
+            "height=(int)1080, framerate=(fraction)60/1 ! "
+            "omx_mdeiscaler name=dei "
+            "dei.src_01 ! omx_h264enc name=enc ! fakesink name=sink sync=false "
+            "dei.src_00 ! fakesink sync=false", frames);
+}
+
+static gchar *
+describe_mixer (guint frames)
+{
+    GString *str;
+    guint i;
+
+    str = g_string_new ("omx_videomixer name=mix ! fakesink name=sink sync=false");
+
+    for (i = 0; i < 8; i++)
+    {
+        g_string_append_printf (str,
+                " videotestsrc num-buffers=%u pattern=black ! "
+                "video/x-raw-yuv, format=(fourcc)NV12, width=(int)640, "
+                "height=(int)360, framerate=(fraction)30/1 ! mix.sink_%02u",
+                frames, i);
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gchar *
+describe_mosaic (guint frames)
+{
+    return g_strdup_printf (
+            "omx_videomosaic name=mosaic ! fakesink name=sink sync=false "
+            "videotestsrc num-buffers=%u pattern=black ! "
+            "video/x-raw-yuv, format=(fourcc)YUY2, width=(int)1280, "
+            "height=(int)720, framerate=(fraction)30/1 ! mosaic.sink_00 "
+            "videotestsrc num-buffers=%u pattern=black ! "
+            "video/x-raw-yuv, format=(fourcc)YUY2, width=(int)640, "
+            "height=(int)480, framerate=(fraction)30/1 ! mosaic.sink_01",
+            frames, frames);
+}
+
+static gchar *
+describe_scalers (guint frames,
+                  gboolean shared)
+{
+    GString *str;
+    guint i;
+
+    str = g_string_new (shared ? "omx_mcscaler name=mcs" : "");
+
+    /* channel 0 feeds the sink that counts frames */
+    for (i = 0; i < 16; i++)
+    {
+        g_string_append_printf (str,
+                " videotestsrc num-buffers=%u pattern=black ! "
+                "video/x-raw-yuv, format=(fourcc)NV12, width=(int)640, "
+                "height=(int)360, framerate=(fraction)30/1 ! ", frames);
+
+        if (shared)
+            g_string_append_printf (str, "mcs.sink_%02u mcs.src_%02u ! ", i, i);
+        else
+            g_string_append (str, "omx_scaler ! ");
+
+        g_string_append_printf (str,
+                "video/x-raw-yuv, width=(int)320, height=(int)180 ! "
+                "fakesink %s sync=false", i == 0 ? "name=sink" : "");
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gchar *
+describe_scaler_per_stream (guint frames)
+{
+    return describe_scalers (frames, FALSE);
+}
+
+static gchar *
+describe_mcscaler (guint frames)
+{
+    return describe_scalers (frames, TRUE);
+}
+
+static gchar *
+describe_cameras (guint frames,
+                  gboolean shared)
+{
+    GString *str;
+    guint i;
+
+    str = g_string_new ("");
+    if (shared)
+        g_string_append_printf (str, "omx_mccamera name=cap num-buffers=%u", frames);
+
+    /* channel 0 feeds the sink that counts frames */
+    for (i = 0; i < 4; i++)
+    {
+        if (shared)
+            g_string_append_printf (str, " cap.src_%02u ! ", i);
+        else
+            g_string_append_printf (str, " omx_camera num-buffers=%u ! ", frames);
+
+        g_string_append_printf (str,
+                "video/x-raw-yuv-strided, format=(fourcc)NV12, width=(int)720, "
+                "height=(int)480, framerate=(fraction)60/1 ! "
+                "fakesink %s sync=false", i == 0 ? "name=sink" : "");
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gchar *
+describe_camera_per_channel (guint frames)
+{
+    return describe_cameras (frames, FALSE);
+}
+
+static gchar *
+describe_mccamera (guint frames)
+{
+    return describe_cameras (frames, TRUE);
+}
+
+static gchar *
+describe_walls (guint frames,
+                gboolean windows)
+{
+    GString *str;
+    guint i;
+
+    /* a 2x2 wall, composed in memory or by the display */
+    str = g_string_new (windows ? "omx_mosaicsink name=sink sync=false" :
+            "omx_videomixer name=mix ! omx_videosink name=sink sync=false");
+
+    for (i = 0; i < 4; i++)
+    {
+        g_string_append_printf (str,
+                " videotestsrc num-buffers=%u pattern=black ! "
+                "video/x-raw-yuv, format=(fourcc)%s, width=(int)960, "
+                "height=(int)540, framerate=(fraction)30/1 ! %s.sink_%02u",
+                frames, windows ? "YUY2" : "NV12", windows ? "sink" : "mix", i);
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gchar *
+describe_mixer_wall (guint frames)
+{
+    return describe_walls (frames, FALSE);
+}
+
+static gchar *
+describe_mosaicsink_wall (guint frames)
+{
+    return describe_walls (frames, TRUE);
+}
+
+static const BenchTopology topologies[] =
+{
+    { "decode-scale-sink", describe_decode },
+    { "decode-fakesink", describe_decode_only },
+    { "aac-decode", describe_aac_decode },
+    { "camera-dei-encode", describe_camera },
+    { "mixer-8", describe_mixer },
+    { "mosaic-2", describe_mosaic },
+    { "scaler-16", describe_scaler_per_stream },
+    { "mcscaler-16", describe_mcscaler },
+    { "camera-4", describe_camera_per_channel },
+    { "mccamera-4", describe_mccamera },
+    { "mixer-wall-4", describe_mixer_wall },
+    { "mosaicsink-4", describe_mosaicsink_wall },
+    { NULL, NULL },
+};
+
+/*
+ * Probes.
+ *
+ * These run in the streaming threads and must not allocate, or they
+ * would show up in the per-frame allocation count.
+ */
+
+static gboolean
+sink_probe (GstPad *pad,
+            GstBuffer *buffer,
+            gpointer user_data)
+{
+    BenchPad *bench_pad = user_data;
+    BenchElement *element = bench_pad->element;
+
+    g_mutex_lock (element->mutex);
+    if (bench_pad->length < MAX_PENDING)
+    {
+        bench_pad->pending[(bench_pad->head + bench_pad->length) % MAX_PENDING] =
+            gst_util_get_timestamp ();
+        bench_pad->length++;
+    }
+    g_mutex_unlock (element->mutex);
+
+    return TRUE;
+}
+
+static gboolean
+src_probe (GstPad *pad,
+           GstBuffer *buffer,
+           gpointer user_data)
+{
+    BenchElement *element = user_data;
+    GstClockTime oldest = GST_CLOCK_TIME_NONE;
+    GList *l;
+
+    g_mutex_lock (element->mutex);
+
+    for (l = element->sink_pads; l; l = l->next)
+    {
+        BenchPad *bench_pad = l->data;
+
+        if (bench_pad->length == 0)
+            continue;
+
+        oldest = MIN (oldest, bench_pad->pending[bench_pad->head]);
+        bench_pad->head = (bench_pad->head + 1) % MAX_PENDING;
+        bench_pad->length--;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (oldest) && element->num_samples < element->max_samples)
+        element->samples[element->num_samples++] = gst_util_get_timestamp () - oldest;
+
+    g_mutex_unlock (element->mutex);
+
+    return TRUE;
+}
+
+static gboolean
+count_probe (GstPad *pad,
+             GstBuffer *buffer,
+             gpointer user_data)
+{
+    g_atomic_int_inc (&frames_done);
+
+    return TRUE;
+}
+
+static BenchElement *
+bench_element_new (GstElement *gst_element,
+                   guint frames)
+{
+    BenchElement *element;
+    GstIterator *it;
+    gpointer item;
+    gboolean has_src = FALSE;
+
+    element = g_new0 (BenchElement, 1);
+    element->name = gst_element_get_name (gst_element);
+    element->mutex = g_mutex_new ();
+    element->max_samples = frames * 2;
+    element->samples = g_new0 (GstClockTime, element->max_samples);
+
+    it = gst_element_iterate_sink_pads (gst_element);
+    while (gst_iterator_next (it, &item) == GST_ITERATOR_OK)
+    {
+        BenchPad *bench_pad;
+
+        bench_pad = g_new0 (BenchPad, 1);
+        bench_pad->element = element;
+        element->sink_pads = g_list_append (element->sink_pads, bench_pad);
+        gst_pad_add_buffer_probe (GST_PAD (item), G_CALLBACK (sink_probe), bench_pad);
+
+        if (strcmp (element->name, "sink") == 0 && !element->sink_pads->next)
+            gst_pad_add_buffer_probe (GST_PAD (item), G_CALLBACK (count_probe), NULL);
+
+        gst_object_unref (item);
+    }
+    gst_iterator_free (it);
+
+    it = gst_element_iterate_src_pads (gst_element);
+    if (gst_iterator_next (it, &item) == GST_ITERATOR_OK)
+    {
+        gst_pad_add_buffer_probe (GST_PAD (item), G_CALLBACK (src_probe), element);
+        gst_object_unref (item);
+        has_src = TRUE;
+    }
+    gst_iterator_free (it);
+
+    /* only elements with both sides have a latency */
+    if (!has_src || !element->sink_pads)
+        element->max_samples = 0;
+
+    return element;
+}
+
+static void
+bench_element_free (BenchElement *element)
+{
+    g_list_foreach (element->sink_pads, (GFunc) g_free, NULL);
+    g_list_free (element->sink_pads);
+    g_mutex_free (element->mutex);
+    g_free (element->samples);
+    g_free (element->name);
+    g_free (element);
+}
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+    GstClockTime ta = *(const GstClockTime *) a;
+    GstClockTime tb = *(const GstClockTime *) b;
+
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static inline guint64
+percentile (BenchElement *element,
+            guint p)
+{
+    return element->samples[(element->num_samples - 1) * p / 100] / GST_USECOND;
+}
+
+/*
+ * Runner.
+ */
+
+static gdouble
+timeval_seconds (struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static gboolean
+run_topology (const BenchTopology *topology,
+              guint frames)
+{
+    GstElement *pipeline;
+    GstBus *bus;
+    GstMessage *msg;
+    GstIterator *it;
+    gpointer item;
+    GList *elements = NULL;
+    GList *l;
+    GError *error = NULL;
+    gchar *description;
+    gchar *result;
+    struct rusage start_usage, end_usage;
+    GstClockTime start, end;
+    gint start_allocations, end_allocations;
+    guint start_calls = 0, end_calls = 0;
+    gchar *calls_per_frame;
+    gdouble seconds;
+    guint done;
+    gboolean ok;
+
+    description = topology->describe (frames);
+    pipeline = gst_parse_launch (description, &error);
+    g_free (description);
+
+    if (!pipeline || error)
+    {
+        g_print ("{\"topology\": \"%s\", \"result\": \"%s\"}\n", topology->name,
+                 error ? error->message : "parse failed");
+        if (error)
+            g_error_free (error);
+        if (pipeline)
+            gst_object_unref (pipeline);
+        return FALSE;
+    }
+
+    it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+    while (gst_iterator_next (it, &item) == GST_ITERATOR_OK)
+    {
+        elements = g_list_append (elements, bench_element_new (item, frames));
+        gst_object_unref (item);
+    }
+    gst_iterator_free (it);
+
+    g_atomic_int_set (&frames_done, 0);
+
+    getrusage (RUSAGE_SELF, &start_usage);
+    start_allocations = g_atomic_int_get (&allocations);
+    if (get_buffer_calls)
+        start_calls = get_buffer_calls ();
+    start = gst_util_get_timestamp ();
+
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+    bus = gst_element_get_bus (pipeline);
+    msg = gst_bus_timed_pop_filtered (bus, TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    end = gst_util_get_timestamp ();
+    end_allocations = g_atomic_int_get (&allocations);
+    if (get_buffer_calls)
+        end_calls = get_buffer_calls ();
+    getrusage (RUSAGE_SELF, &end_usage);
+
+    if (!msg)
+    {
+        result = g_strdup ("timeout");
+    }
+    else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    {
+        gst_message_parse_error (msg, &error, NULL);
+        result = g_strescape (error->message, NULL);
+        g_error_free (error);
+    }
+    else
+    {
+        result = g_strdup ("ok");
+    }
+
+    if (msg)
+        gst_message_unref (msg);
+    gst_object_unref (bus);
+
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+
+    done = g_atomic_int_get (&frames_done);
+    seconds = (gdouble) (end - start) / GST_SECOND;
+
+    if (get_buffer_calls)
+        calls_per_frame = g_strdup_printf ("%.2f",
+                done ? (gdouble) (end_calls - start_calls) / done : 0.0);
+    else
+        calls_per_frame = g_strdup ("null");
+
+    g_print ("{\"topology\": \"%s\", \"frames\": %u, \"seconds\": %.3f, \"fps\": %.2f, "
+             "\"cpu_user_s\": %.3f, \"cpu_system_s\": %.3f, "
+             "\"voluntary_switches\": %ld, \"involuntary_switches\": %ld, "
+             "\"allocs_per_frame\": %.2f, \"buffer_calls_per_frame\": %s, "
+             "\"elements\": {",
+             topology->name, done, seconds, seconds > 0 ? done / seconds : 0.0,
+             timeval_seconds (&end_usage.ru_utime) - timeval_seconds (&start_usage.ru_utime),
+             timeval_seconds (&end_usage.ru_stime) - timeval_seconds (&start_usage.ru_stime),
+             end_usage.ru_nvcsw - start_usage.ru_nvcsw,
+             end_usage.ru_nivcsw - start_usage.ru_nivcsw,
+             done ? (gdouble) (end_allocations - start_allocations) / done : 0.0,
+             calls_per_frame);
+    g_free (calls_per_frame);
+
+    {
+        gboolean first = TRUE;
+
+        for (l = elements; l; l = l->next)
+        {
+            BenchElement *element = l->data;
+
+            if (element->num_samples == 0)
+                continue;
+
+            qsort (element->samples, element->num_samples, sizeof (GstClockTime),
+                   compare_times);
+
+            g_print ("%s\"%s\": {\"samples\": %u, \"p50_us\": %" G_GUINT64_FORMAT
+                     ", \"p90_us\": %" G_GUINT64_FORMAT ", \"p99_us\": %" G_GUINT64_FORMAT
+                     ", \"max_us\": %" G_GUINT64_FORMAT "}",
+                     first ? "" : ", ", element->name, element->num_samples,
+                     percentile (element, 50), percentile (element, 90),
+                     percentile (element, 99), percentile (element, 100));
+            first = FALSE;
+        }
+    }
+
+    g_print ("}, \"result\": \"%s\"}\n", result);
+
+    g_list_foreach (elements, (GFunc) bench_element_free, NULL);
+    g_list_free (elements);
+    gst_object_unref (pipeline);
+
+    ok = (strcmp (result, "ok") == 0);
+    g_free (result);
+
+    return ok;
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+    const BenchTopology *topology;
+    guint frames = 300;
+    gboolean ok = TRUE;
+    gint i;
+
+    /* before anything in GLib allocates */
+    setenv ("G_SLICE", "always-malloc", 1);
+    g_mem_set_vtable (&count_vtable);
+
+    gst_init (&argc, &argv);
+
+    /* the same library the plugin opens through LD_LIBRARY_PATH */
+    {
+        void *core = dlopen ("libOMX_Core.so", RTLD_NOW);
+
+        if (core)
+            get_buffer_calls = dlsym (core, "omxsim_get_buffer_calls");
+    }
+
+    if (argc > 1)
+        frames = MAX (atoi (argv[1]), 1);
+
+    for (topology = topologies; topology->name; topology++)
+    {
+        gboolean selected = (argc <= 2);
+
+        for (i = 2; i < argc; i++)
+            selected |= (strcmp (argv[i], topology->name) == 0);
+
+        if (selected)
+            ok &= run_topology (topology, frames);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Field-pair submission on top of the standalone OMX core: an upstream
+ * output port hands out frames as GstOmxBufferTransport buffers, and an
+ * input port registered with g_omx_port_share_fields() must send both
+ * fields of every frame straight from the upstream memory.
+ */
+
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+#include "gstomx_util.h"
+#include "gstomx_port.h"
+#include "gstomx_buffertransport.h"
+#include "omxsim.h"
+#include <OMX_TI_Common.h>
+
+GST_DEBUG_CATEGORY (gstomx_debug);
+GST_DEBUG_CATEGORY (gstomx_ppm);
+
+#define NUM_FRAMES 4
+#define WIDTH 720
+#define STRIDE 768
+#define FIELD_HEIGHT 243      /* not a multiple of 8 on purpose */
+#define FRAME_SIZE (STRIDE * 1024 * 3 / 2)
+
+/*
+ * A bare element carrying the properties GOmxCore expects from its owner.
+ */
+
+typedef struct
+{
+    GstElement element;
+    gchar *library_name;
+    gchar *component_name;
+    gchar *component_role;
+} FieldsTest;
+
+typedef struct
+{
+    GstElementClass parent_class;
+} FieldsTestClass;
+
+enum
+{
+    ARG_0,
+    ARG_COMPONENT_ROLE,
+    ARG_COMPONENT_NAME,
+    ARG_LIBRARY_NAME,
+};
+
+G_DEFINE_TYPE (FieldsTest, fields_test, GST_TYPE_ELEMENT);
+
+static void
+fields_test_set_property (GObject *obj, guint prop_id,
+                          const GValue *value, GParamSpec *pspec)
+{
+    FieldsTest *self = (FieldsTest *) obj;
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_free (self->component_role);
+            self->component_role = g_value_dup_string (value);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_free (self->component_name);
+            self->component_name = g_value_dup_string (value);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_free (self->library_name);
+            self->library_name = g_value_dup_string (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+fields_test_get_property (GObject *obj, guint prop_id,
+                          GValue *value, GParamSpec *pspec)
+{
+    FieldsTest *self = (FieldsTest *) obj;
+
+    switch (prop_id)
+    {
+        case ARG_COMPONENT_ROLE:
+            g_value_set_string (value, self->component_role);
+            break;
+        case ARG_COMPONENT_NAME:
+            g_value_set_string (value, self->component_name);
+            break;
+        case ARG_LIBRARY_NAME:
+            g_value_set_string (value, self->library_name);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+fields_test_class_init (FieldsTestClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = fields_test_set_property;
+    gobject_class->get_property = fields_test_get_property;
+
+    g_object_class_install_property (gobject_class, ARG_COMPONENT_ROLE,
+            g_param_spec_string ("component-role", "Component role",
+                                 "Role of the OpenMAX component",
+                                 NULL, G_PARAM_READWRITE));
+    g_object_class_install_property (gobject_class, ARG_COMPONENT_NAME,
+            g_param_spec_string ("component-name", "Component name",
+                                 "Name of the OpenMAX IL component to use",
+                                 NULL, G_PARAM_READWRITE));
+    g_object_class_install_property (gobject_class, ARG_LIBRARY_NAME,
+            g_param_spec_string ("library-name", "Library name",
+                                 "Name of the OpenMAX IL implementation library to use",
+                                 NULL, G_PARAM_READWRITE));
+}
+
+static void
+fields_test_init (FieldsTest *self)
+{
+}
+
+/*
+ * Fixture
+ */
+
+static GstElement *owner;
+static GOmxCore *core;
+static GOmxPort *out_port;
+static GOmxPort *in_port;
+
+static void
+setup_port (GOmxPort *port, guint count, guint size)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+
+    G_OMX_PORT_GET_DEFINITION (port, &param);
+    param.eDomain = OMX_PortDomainVideo;
+    param.nBufferCountActual = count;
+    param.nBufferSize = size;
+    param.format.video.nFrameWidth = WIDTH;
+    param.format.video.nFrameHeight = FIELD_HEIGHT;
+    param.format.video.nStride = STRIDE;
+    G_OMX_PORT_SET_DEFINITION (port, &param);
+
+    g_omx_port_setup (port, &param);
+}
+
+static void
+fields_setup (void)
+{
+    owner = g_object_new (fields_test_get_type (), NULL);
+    core = g_omx_core_new (owner, G_OBJECT_GET_CLASS (owner));
+
+    g_object_set (owner,
+                  "library-name", "libomxil-foo.so",
+                  "component-name", "OMX.foo.fields",
+                  NULL);
+
+    g_omx_core_init (core);
+    fail_unless (core->omx_state == OMX_StateLoaded);
+
+    /* upstream: a component output port with its own frame buffers */
+    out_port = g_omx_core_get_port (core, "out", 1);
+    setup_port (out_port, NUM_FRAMES, FRAME_SIZE);
+    out_port->omx_allocate = FALSE;
+    out_port->always_copy = TRUE;
+    out_port->share_buffer = FALSE;
+    g_omx_port_allocate_buffers (out_port);
+    fail_unless (out_port->buffers != NULL);
+
+    in_port = g_omx_core_get_port (core, "in", 0);
+    setup_port (in_port, NUM_FRAMES * 2, FRAME_SIZE);
+    fail_unless_equals_int (in_port->num_buffers, NUM_FRAMES * 2);
+}
+
+static void
+fields_teardown (void)
+{
+    g_omx_port_free_buffers (in_port);
+    g_omx_port_free_buffers (out_port);
+
+    g_omx_core_deinit (core);
+    g_omx_core_free (core);
+    gst_object_unref (owner);
+}
+
+static GstBuffer *
+frame_new (guint index, guint offset, OMX_U32 flags, GstClockTime timestamp)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer = out_port->buffers[index];
+    GstBuffer *buf;
+
+    omx_buffer->nOffset = offset;
+    omx_buffer->nFilledLen = FRAME_SIZE - offset;
+    omx_buffer->nFlags = flags;
+
+    buf = gst_omxbuffertransport_new (out_port, omx_buffer);
+    fail_unless (buf != NULL);
+    GST_BUFFER_TIMESTAMP (buf) = timestamp;
+
+    return buf;
+}
+
+/* pretend the component is done with both fields */
+static void
+empty_buffer_done (OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    g_omx_port_push_buffer (in_port, omx_buffer);
+}
+
+/*
+ * Tests
+ */
+
+GST_START_TEST (test_second_field_offset)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer = out_port->buffers[0];
+
+    omx_buffer->nOffset = 0;
+    fail_unless_equals_int (g_omx_port_get_second_field_offset (in_port, omx_buffer),
+                            248 * STRIDE);
+
+    /* two rows of top padding are repeated above the second field */
+    omx_buffer->nOffset = 2 * STRIDE + 32;
+    fail_unless_equals_int (g_omx_port_get_second_field_offset (in_port, omx_buffer),
+                            (2 + 2 + 248) * STRIDE);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_share_fields)
+{
+    gint offset;
+    guint i;
+
+    offset = g_omx_port_get_second_field_offset (in_port, out_port->buffers[0]);
+    g_omx_port_share_fields (in_port, out_port, offset);
+
+    fail_if (in_port->always_copy);
+    fail_if (in_port->omx_allocate);
+    fail_unless_equals_int (in_port->share_buffer_info->num_buffers, NUM_FRAMES * 2);
+
+    g_omx_port_allocate_buffers (in_port);
+
+    for (i = 0; i < NUM_FRAMES; i++)
+    {
+        OMX_U8 *frame = out_port->buffers[i]->pBuffer;
+
+        fail_unless (in_port->buffers[i << 1]->pBuffer == frame);
+        fail_unless (in_port->buffers[(i << 1) + 1]->pBuffer == frame + offset);
+    }
+}
+GST_END_TEST;
+
+static void
+send_helper (gboolean top_first)
+{
+    OMX_BUFFERHEADERTYPE *top, *bottom, *first, *second;
+    GstBuffer *buf;
+    gint offset;
+    gint sent;
+
+    offset = g_omx_port_get_second_field_offset (in_port, out_port->buffers[1]);
+    g_omx_port_share_fields (in_port, out_port, offset);
+    g_omx_port_allocate_buffers (in_port);
+
+    buf = frame_new (1, 0,
+            top_first ? OMX_TI_BUFFERFLAG_VIDEO_FRAME_TYPE_INTERLACE_TOP_FIRST : 0,
+            GST_SECOND);
+
+    sent = g_omx_port_send_interlaced_fields (in_port, buf, offset);
+    fail_unless_equals_int (sent, FRAME_SIZE);
+
+    top = in_port->buffers[2];
+    bottom = in_port->buffers[3];
+
+    /* both fields point into the upstream frame, nothing was copied */
+    fail_unless (top->pBuffer == GST_BUFFER_DATA (buf));
+    fail_unless (bottom->pBuffer == GST_BUFFER_DATA (buf) + offset);
+
+    fail_unless (top->nFlags & OMX_TI_BUFFERFLAG_VIDEO_FRAME_TYPE_INTERLACE);
+    fail_if (top->nFlags & OMX_TI_BUFFERFLAG_VIDEO_FRAME_TYPE_INTERLACE_BOTTOM);
+    fail_unless (bottom->nFlags & OMX_TI_BUFFERFLAG_VIDEO_FRAME_TYPE_INTERLACE_BOTTOM);
+
+    /* the frame timestamp goes on whichever field comes first */
+    first = top_first ? top : bottom;
+    second = top_first ? bottom : top;
+    fail_unless_equals_uint64 (first->nTimeStamp, OMX_TICKS_PER_SECOND);
+    fail_unless (second->nTimeStamp == (OMX_TICKS) -1);
+
+    /* each field keeps the frame alive until the component returns it */
+    fail_unless (top->pAppPrivate == buf);
+    fail_unless (bottom->pAppPrivate == buf);
+    ASSERT_BUFFER_REFCOUNT (buf, "buf", 3);
+
+    empty_buffer_done (top);
+    empty_buffer_done (bottom);
+    ASSERT_BUFFER_REFCOUNT (buf, "buf", 1);
+
+    gst_buffer_unref (buf);
+}
+
+GST_START_TEST (test_send_top_first)
+{
+    send_helper (TRUE);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_send_bottom_first)
+{
+    send_helper (FALSE);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_send_needs_shared_buffers)
+{
+    GstBuffer *buf;
+
+    /* a plain buffer can't be split into fields without a copy */
+    buf = gst_buffer_new_and_alloc (FRAME_SIZE);
+    fail_unless_equals_int (g_omx_port_send_interlaced_fields (in_port, buf, 0), -1);
+    gst_buffer_unref (buf);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_transport_recycled)
+{
+    GstBuffer *buf, *again;
+
+    /* allocating the port's buffers made one wrapper for each */
+    fail_unless_equals_int (out_port->portptr->num_wrappers, NUM_FRAMES);
+
+    buf = frame_new (0, 0, 0, GST_SECOND);
+    GST_BUFFER_DURATION (buf) = GST_SECOND / 30;
+    fail_unless_equals_int (out_port->portptr->refcnt, 2);
+    gst_buffer_unref (buf);
+    fail_unless_equals_int (out_port->portptr->refcnt, 1);
+
+    /* the released wrapper comes back, reset */
+    again = frame_new (1, 0, 0, 2 * GST_SECOND);
+    fail_unless (again == buf);
+    fail_unless (GST_BUFFER_DATA (again) == out_port->buffers[1]->pBuffer);
+    fail_unless (GST_BUFFER_DURATION (again) == GST_CLOCK_TIME_NONE);
+    ASSERT_BUFFER_REFCOUNT (again, "again", 1);
+    fail_unless_equals_int (out_port->portptr->num_wrappers, NUM_FRAMES);
+
+    gst_buffer_unref (again);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_transport_orphaned)
+{
+    GstOmxPortPtr *portptr = out_port->portptr;
+    OMX_BUFFERHEADERTYPE *omx_buffer = out_port->buffers[0];
+    GstBuffer *buf;
+
+    buf = frame_new (0, 0, 0, GST_SECOND);
+    fail_unless_equals_int (portptr->lent[0], GST_OMXPORTPTR_LENT);
+
+    /* the port lets go of the header still downstream, data and all */
+    gst_omxportptr_ref (portptr);
+    g_omx_port_free_buffers (out_port);
+    fail_unless_equals_int (portptr->lent[0], GST_OMXPORTPTR_ORPHANED);
+    fail_unless (GST_BUFFER_DATA (buf) == omx_buffer->pBuffer);
+    fail_unless (GST_OMXBUFFERTRANSPORT (buf)->omxbuffer == omx_buffer);
+
+    /* and the buffer frees it */
+    gst_buffer_unref (buf);
+    fail_unless_equals_int (portptr->lent[0], GST_OMXPORTPTR_HOME);
+    gst_omxportptr_unref (portptr);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_fields_submitted_together)
+{
+    GstBuffer *buf;
+    gint offset;
+    guint calls;
+    gint refused;
+
+    offset = g_omx_port_get_second_field_offset (in_port, out_port->buffers[1]);
+    g_omx_port_share_fields (in_port, out_port, offset);
+    g_omx_port_allocate_buffers (in_port);
+
+    /* both fields go out back to back; a loaded component refuses them
+     * and they come back right away */
+    buf = frame_new (1, 0, 0, GST_SECOND);
+    calls = omxsim_get_buffer_calls ();
+    refused = core->submit_calls - core->submitted;
+    g_omx_port_send_interlaced_fields (in_port, buf, offset);
+    fail_unless_equals_int (omxsim_get_buffer_calls () - calls, 2);
+    fail_unless_equals_int (core->submit_calls - core->submitted - refused, 2);
+    fail_unless_equals_int (in_port->outstanding, 0);
+
+    empty_buffer_done (in_port->buffers[2]);
+    empty_buffer_done (in_port->buffers[3]);
+    ASSERT_BUFFER_REFCOUNT (buf, "buf", 1);
+
+    gst_buffer_unref (buf);
+}
+GST_END_TEST;
+
+/*
+ * Input packing, on the same ports: the loaded component refuses every
+ * buffer, which leaves them in the headers for a look.
+ */
+
+#define PACK_FRAME 100
+
+static void
+pack_setup (void)
+{
+    guint i;
+
+    in_port->always_copy = TRUE;
+    in_port->omx_allocate = FALSE;
+    in_port->share_buffer = FALSE;
+    g_omx_port_allocate_buffers (in_port);
+
+    for (i = 0; i < in_port->num_buffers; i++)
+        g_omx_port_push_buffer (in_port, in_port->buffers[i]);
+}
+
+static GstBuffer *
+pack_frame_new (guint8 value, GstClockTime timestamp)
+{
+    GstBuffer *buf;
+
+    buf = gst_buffer_new_and_alloc (PACK_FRAME);
+    memset (GST_BUFFER_DATA (buf), value, PACK_FRAME);
+    GST_BUFFER_TIMESTAMP (buf) = timestamp;
+
+    return buf;
+}
+
+GST_START_TEST (test_pack_units)
+{
+    guint units = 0;
+    guint calls;
+    guint i;
+
+    pack_setup ();
+    in_port->pack_units = 4;
+
+    /* whole frames, each with its own timestamp, ended by the caller as
+     * well: every frame is one unit, not two */
+    calls = omxsim_get_buffer_calls ();
+    for (i = 0; i < 8; i++)
+    {
+        GstBuffer *buf = pack_frame_new (i, i * GST_SECOND);
+
+        fail_unless_equals_int (g_omx_port_pack (in_port, buf, &units), PACK_FRAME);
+        if (g_omx_port_pack_end_unit (in_port))
+            units++;
+        gst_buffer_unref (buf);
+    }
+
+    fail_unless_equals_int (units, 2);
+    fail_unless_equals_int (omxsim_get_buffer_calls () - calls, 2);
+    fail_unless (in_port->pack_buffer == NULL);
+
+    for (i = 0; i < 2; i++)
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer = in_port->buffers[i];
+
+        fail_unless_equals_int (omx_buffer->nFilledLen, 4 * PACK_FRAME);
+        fail_unless (omx_buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME);
+        fail_unless_equals_int (omx_buffer->pBuffer[0], i * 4);
+        fail_unless_equals_int (omx_buffer->pBuffer[4 * PACK_FRAME - 1], i * 4 + 3);
+        empty_buffer_done (omx_buffer);
+    }
+
+    /* ending it twice doesn't end the next unit early either */
+    fail_if (g_omx_port_pack_end_unit (in_port));
+}
+GST_END_TEST;
+
+GST_START_TEST (test_pack_continuous)
+{
+    guint units = 0;
+    guint calls;
+    guint i;
+
+    pack_setup ();
+    in_port->pack_continuous = TRUE;
+    in_port->pack_units = 3;
+    in_port->pack_size = 3 * PACK_FRAME;
+
+    /* cut where the buffer fills up, whatever the timestamps */
+    calls = omxsim_get_buffer_calls ();
+    for (i = 0; i < 7; i++)
+    {
+        GstBuffer *buf = pack_frame_new (i, i * GST_SECOND);
+
+        g_omx_port_pack (in_port, buf, &units);
+        gst_buffer_unref (buf);
+    }
+
+    fail_unless_equals_int (units, 6);
+    fail_unless_equals_int (omxsim_get_buffer_calls () - calls, 2);
+    fail_unless_equals_int (in_port->pack_buffer->nFilledLen, PACK_FRAME);
+
+    fail_unless (g_omx_port_pack_flush (in_port));
+    fail_unless_equals_int (omxsim_get_buffer_calls () - calls, 3);
+    fail_unless (in_port->buffers[2]->nFlags & OMX_BUFFERFLAG_ENDOFFRAME);
+
+    for (i = 0; i < 3; i++)
+        empty_buffer_done (in_port->buffers[i]);
+}
+GST_END_TEST;
+
+static Suite *
+fields_suite (void)
+{
+    Suite *s = suite_create ("fields");
+    TCase *tc_chain = tcase_create ("general");
+
+    g_omx_init ();
+    GST_DEBUG_CATEGORY_INIT (gstomx_debug, "omx", 0, "gst-openmax");
+    GST_DEBUG_CATEGORY_INIT (gstomx_util_debug, "omx_util", 0, "gst-openmax utility");
+    GST_DEBUG_CATEGORY_INIT (gstomx_ppm, "omx_ppm", 0, "gst-openmax performance");
+
+    tcase_add_checked_fixture (tc_chain, fields_setup, fields_teardown);
+    tcase_add_test (tc_chain, test_second_field_offset);
+    tcase_add_test (tc_chain, test_share_fields);
+    tcase_add_test (tc_chain, test_send_top_first);
+    tcase_add_test (tc_chain, test_send_bottom_first);
+    tcase_add_test (tc_chain, test_send_needs_shared_buffers);
+    tcase_add_test (tc_chain, test_transport_recycled);
+    tcase_add_test (tc_chain, test_transport_orphaned);
+    tcase_add_test (tc_chain, test_fields_submitted_together);
+    tcase_add_test (tc_chain, test_pack_units);
+    tcase_add_test (tc_chain, test_pack_continuous);
+    suite_add_tcase (s, tc_chain);
+
+    return s;
+}
+
+GST_CHECK_MAIN (fields);
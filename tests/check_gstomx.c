@@ -20,11 +20,60 @@
  */
 
 #include <gst/check/gstcheck.h>
+#include <dlfcn.h>
+#include <string.h>
 
 #define BUFFER_SIZE 0x1000
 #define BUFFER_COUNT 0x100
 #define FLUSH_AT 0x10
 
+#define TRICK_FRAMES 20
+#define TRICK_GOP 5
+#define TRICK_FRAME_DURATION (40 * GST_MSECOND)
+
+/* the simulated core copies every input into an output buffer, so the
+ * buffers coming out of the decoder are exactly the ones it was given */
+static const gchar *trick_config =
+    "[OMX.TI.DUCATI.VIDDEC]\n"
+    "copy=true\n"
+    "buffer-count=4\n"
+    "buffer-size=0x1000\n";
+
+#define CAMERA_FRAMES 30
+#define CAMERA_INTERVAL (10 * GST_MSECOND)
+
+/* a capture source stamping frames on its own clock every 10ms */
+static const gchar *camera_config =
+    "[OMX.TI.VPSSM3.VFCC]\n"
+    "domain=video\n"
+    "input-ports=0\n"
+    "output-ports=1\n"
+    "output-start=0\n"
+    "ports-enabled=false\n"
+    "buffer-count=4\n"
+    "buffer-size=0x2000\n"
+    "interval-us=10000\n";
+
+#define MJPEG_FRAMES 10
+#define MJPEG_PARALLELISM 2
+#define MJPEG_FRAME_DURATION (40 * GST_MSECOND)
+
+#define JPEG_FRAMES 32
+#define JPEG_QUALITY 90
+#define JPEG_STEP 2
+#define JPEG_WINDOW 8
+
+/* every JPEG comes out the size of the raw frame */
+static const gchar *jpegenc_config =
+    "[OMX.TI.DUCATI.VIDENC]\n"
+    "copy=true\n"
+    "buffer-count=4\n"
+    "buffer-size=0x2000\n";
+
+#define AAC_FRAMES 6
+#define AAC_JUNK 5
+#define AAC_CHUNK 37
+
 static gboolean
 bus_cb (GstBus *bus,
         GstMessage *msg,
@@ -61,6 +110,15 @@ GST_STATIC_PAD_TEMPLATE ("sink",
                          GST_PAD_ALWAYS,
                          GST_STATIC_CAPS_ANY);
 
+static GstStaticPadTemplate camerasinktemplate =
+GST_STATIC_PAD_TEMPLATE ("sink",
+                         GST_PAD_SINK,
+                         GST_PAD_ALWAYS,
+                         GST_STATIC_CAPS ("video/x-raw-yuv, "
+                                          "format=(fourcc)YUY2, "
+                                          "width=(int)64, height=(int)32, "
+                                          "framerate=(fraction)100/1"));
+
 static GstStaticPadTemplate srctemplate =
 GST_STATIC_PAD_TEMPLATE ("src",
                          GST_PAD_SRC,
@@ -71,6 +129,10 @@ GST_STATIC_PAD_TEMPLATE ("src",
 static GMutex *eos_mutex;
 static GCond *eos_cond;
 static gboolean eos_arrived;
+static GstPad *mysrcpad;
+static GstPad *mysinkpad;
+static void *sim_handle;
+static void (*sim_clear_config) (void);
 
 gboolean
 test_sink_event (GstPad * pad, GstEvent * event)
@@ -90,20 +152,56 @@ test_sink_event (GstPad * pad, GstEvent * event)
     return gst_pad_event_default (pad, event);
 }
 
-static void
-helper (gboolean flush)
+/* upstream of the element under test: a source that can seek */
+static gboolean
+test_src_event (GstPad * pad, GstEvent * event)
 {
-    GstElement *filter;
-    GstBus *bus;
-    GstPad *mysrcpad;
-    GstPad *mysinkpad;
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK)
+    {
+        gst_event_unref (event);
+        return TRUE;
+    }
 
-    /* init */
-    filter = gst_check_setup_element ("omx_dummy");
-    mysrcpad = gst_check_setup_src_pad (filter, &srctemplate, NULL);
-    mysinkpad = gst_check_setup_sink_pad (filter, &sinktemplate, NULL);
+    return gst_pad_event_default (pad, event);
+}
+
+/*
+ * Sets up element @name between the test pads, with a source pad only if
+ * it has a sink pad. With @config the simulated core runs that profile
+ * until teardown_element(), otherwise its default one.
+ */
+static GstElement *
+setup_element (const gchar *name, const gchar *config,
+               GstStaticPadTemplate *sink_template)
+{
+    GstElement *element;
+    GstPad *sinkpad;
+
+    if (config)
+    {
+        gboolean (*load_config) (const gchar *data, GError **error);
+
+        sim_handle = dlopen ("libOMX_Core.so", RTLD_LAZY);
+        fail_unless (sim_handle != NULL, "%s", dlerror ());
+        load_config = dlsym (sim_handle, "omxsim_load_config");
+        sim_clear_config = dlsym (sim_handle, "omxsim_clear_config");
+        fail_unless (load_config && sim_clear_config);
+        fail_unless (load_config (config, NULL));
+    }
+
+    element = gst_check_setup_element (name);
+
+    mysrcpad = NULL;
+    sinkpad = gst_element_get_static_pad (element, "sink");
+    if (sinkpad)
+    {
+        gst_object_unref (sinkpad);
+        mysrcpad = gst_check_setup_src_pad (element, &srctemplate, NULL);
+        gst_pad_set_event_function (mysrcpad, test_src_event);
+        gst_pad_set_active (mysrcpad, TRUE);
+    }
 
-    gst_pad_set_active (mysrcpad, TRUE);
+    mysinkpad = gst_check_setup_sink_pad (element, sink_template, NULL);
     gst_pad_set_active (mysinkpad, TRUE);
 
     /* need to know when we are eos */
@@ -114,6 +212,53 @@ helper (gboolean flush)
     eos_cond = g_cond_new ();
     eos_arrived = FALSE;
 
+    return element;
+}
+
+static void
+wait_for_eos (void)
+{
+    g_mutex_lock (eos_mutex);
+    while (!eos_arrived)
+        g_cond_wait (eos_cond, eos_mutex);
+    g_mutex_unlock (eos_mutex);
+}
+
+static void
+teardown_element (GstElement *element)
+{
+    gst_check_drop_buffers ();
+    gst_element_set_state (element, GST_STATE_NULL);
+
+    if (mysrcpad)
+    {
+        gst_pad_set_active (mysrcpad, FALSE);
+        gst_check_teardown_src_pad (element);
+    }
+    gst_pad_set_active (mysinkpad, FALSE);
+    gst_check_teardown_sink_pad (element);
+    gst_check_teardown_element (element);
+
+    g_mutex_free (eos_mutex);
+    g_cond_free (eos_cond);
+
+    if (sim_handle)
+    {
+        sim_clear_config ();
+        dlclose (sim_handle);
+        sim_handle = NULL;
+    }
+}
+
+static void
+helper (gboolean flush)
+{
+    GstElement *filter;
+    GstBus *bus;
+
+    /* init */
+    filter = setup_element ("omx_dummy", NULL, &sinktemplate);
+
     g_object_set (G_OBJECT (filter), "library-name", "libomxil-foo.so", NULL);
 
     /* start */
@@ -157,10 +302,7 @@ helper (gboolean flush)
 
     gst_pad_push_event (mysrcpad, gst_event_new_eos ());
     /* need to wait a bit to make sure src pad task digested all and sent eos */
-    g_mutex_lock (eos_mutex);
-    while (!eos_arrived)
-        g_cond_wait (eos_cond, eos_mutex);
-    g_mutex_unlock (eos_mutex);
+    wait_for_eos ();
 
     /* check the order of the buffers*/
     if (!flush)
@@ -180,19 +322,9 @@ helper (gboolean flush)
     gst_bus_set_flushing (bus, TRUE);
     gst_element_set_bus (filter, NULL);
     gst_object_unref (GST_OBJECT (bus));
-    gst_check_drop_buffers ();
 
     /* deinit */
-    gst_element_set_state (filter, GST_STATE_NULL);
-
-    gst_pad_set_active (mysrcpad, FALSE);
-    gst_pad_set_active (mysinkpad, FALSE);
-    gst_check_teardown_src_pad (filter);
-    gst_check_teardown_sink_pad (filter);
-    gst_check_teardown_element (filter);
-
-    g_mutex_free (eos_mutex);
-    g_cond_free (eos_cond);
+    teardown_element (filter);
 }
 
 GST_START_TEST (test_flush)
@@ -207,6 +339,382 @@ GST_START_TEST (test_basic)
 }
 GST_END_TEST
 
+GST_START_TEST (test_trick_mode)
+{
+    GstElement *dec;
+    GstCaps *caps;
+    GList *cur;
+    guint i;
+
+    dec = setup_element ("omx_h264dec", trick_config, &sinktemplate);
+
+    fail_unless_equals_int (gst_element_set_state (dec, GST_STATE_PLAYING),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    /* fast forward over keyframes only; the decoder keeps to it only if
+     * upstream takes the seek */
+    fail_unless (gst_pad_push_event (mysinkpad,
+            gst_event_new_seek (2.0, GST_FORMAT_TIME, GST_SEEK_FLAG_SKIP,
+                                GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, -1)));
+    gst_pad_push_event (mysrcpad,
+            gst_event_new_new_segment (FALSE, 2.0, GST_FORMAT_TIME, 0, -1, 0));
+
+    caps = gst_caps_new_simple ("video/x-h264",
+                                "width", G_TYPE_INT, 64,
+                                "height", G_TYPE_INT, 64,
+                                "framerate", GST_TYPE_FRACTION, 25, 1,
+                                NULL);
+
+    for (i = 0; i < TRICK_FRAMES; i++)
+    {
+        GstBuffer *inbuffer;
+
+        inbuffer = gst_buffer_new_and_alloc (0x100);
+        memset (GST_BUFFER_DATA (inbuffer), 0, 0x100);
+        GST_BUFFER_DATA (inbuffer)[0] = i;
+        GST_BUFFER_TIMESTAMP (inbuffer) = i * TRICK_FRAME_DURATION;
+        GST_BUFFER_DURATION (inbuffer) = TRICK_FRAME_DURATION;
+        if (i % TRICK_GOP)
+            GST_BUFFER_FLAG_SET (inbuffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        gst_buffer_set_caps (inbuffer, caps);
+
+        fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+    }
+
+    gst_caps_unref (caps);
+
+    gst_pad_push_event (mysrcpad, gst_event_new_eos ());
+    wait_for_eos ();
+
+    /* only keyframes went through the component, retimed to the rate */
+    for (cur = buffers, i = 0; cur; cur = g_list_next (cur), i++)
+    {
+        GstBuffer *buffer = cur->data;
+
+        fail_unless_equals_int (GST_BUFFER_DATA (buffer)[0], i * TRICK_GOP);
+        fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer),
+                                   i * TRICK_GOP * TRICK_FRAME_DURATION / 2);
+    }
+    fail_unless_equals_int (i, TRICK_FRAMES / TRICK_GOP);
+
+    teardown_element (dec);
+}
+GST_END_TEST
+
+static void
+camera_helper (guint skip_frames)
+{
+    GstElement *cam;
+    GstClock *clock;
+    GstStructure *stats;
+    GstClockTime prev = GST_CLOCK_TIME_NONE;
+    GstClockTime first = GST_CLOCK_TIME_NONE;
+    guint64 frames;
+    GList *cur;
+    guint i;
+
+    cam = setup_element ("omx_camera", camera_config, &camerasinktemplate);
+
+    g_object_set (cam, "num-buffers", CAMERA_FRAMES, NULL);
+    g_object_set (cam, "skip-frames", skip_frames, NULL);
+
+    clock = gst_system_clock_obtain ();
+    gst_element_set_clock (cam, clock);
+    gst_element_set_base_time (cam, gst_clock_get_time (clock));
+    gst_object_unref (clock);
+
+    /* live source, no preroll */
+    fail_if (gst_element_set_state (cam, GST_STATE_PLAYING) ==
+             GST_STATE_CHANGE_FAILURE);
+
+    wait_for_eos ();
+
+    /* stamped with the capture time, not with the arrival time */
+    for (cur = buffers, i = 0; cur; cur = g_list_next (cur), i++)
+    {
+        GstClockTime timestamp = GST_BUFFER_TIMESTAMP (GST_BUFFER (cur->data));
+
+        fail_unless (GST_CLOCK_TIME_IS_VALID (timestamp));
+        /* the simulated capture doesn't skip, but the durations follow
+         * the rate the skip mask leaves */
+        fail_unless_equals_uint64 (GST_BUFFER_DURATION (GST_BUFFER (cur->data)),
+                                   (skip_frames + 1) * CAMERA_INTERVAL);
+        if (GST_CLOCK_TIME_IS_VALID (prev))
+            fail_unless (timestamp > prev);
+        else
+            first = timestamp;
+        prev = timestamp;
+    }
+    fail_unless_equals_int (i, CAMERA_FRAMES);
+    fail_unless (prev - first > (CAMERA_FRAMES - 1) * CAMERA_INTERVAL - 10 * GST_MSECOND);
+    fail_unless (prev - first < (CAMERA_FRAMES - 1) * CAMERA_INTERVAL + 10 * GST_MSECOND);
+
+    g_object_get (cam, "stats", &stats, NULL);
+    frames = g_value_get_uint64 (gst_structure_get_value (stats, "frames"));
+    fail_unless_equals_uint64 (frames, CAMERA_FRAMES);
+    gst_structure_free (stats);
+
+    teardown_element (cam);
+}
+
+/* An unframed AAC stream: some junk, then frames of growing length whose
+ * payload bytes are the frame number. */
+static GstBuffer *
+aac_stream_new (gboolean loas)
+{
+    GstBuffer *stream;
+    guint8 *data;
+    guint size = AAC_JUNK;
+    guint i;
+
+    for (i = 0; i < AAC_FRAMES; i++)
+        size += 20 + i * 7;
+
+    stream = gst_buffer_new_and_alloc (size);
+    data = GST_BUFFER_DATA (stream);
+    memset (data, 0, AAC_JUNK);
+    data += AAC_JUNK;
+
+    for (i = 0; i < AAC_FRAMES; i++)
+    {
+        guint len = 20 + i * 7;
+
+        memset (data, i, len);
+        if (loas)
+        {
+            /* AudioSyncStream: 11 bit sync, 13 bit payload length */
+            data[0] = 0x56;
+            data[1] = 0xe0 | ((len - 3) >> 8);
+            data[2] = (len - 3) & 0xff;
+        }
+        else
+        {
+            /* ADTS, no CRC: LC, 44.1 kHz, stereo */
+            data[0] = 0xff;
+            data[1] = 0xf1;
+            data[2] = (1 << 6) | (4 << 2);
+            data[3] = (2 << 6) | (len >> 11);
+            data[4] = (len >> 3) & 0xff;
+            data[5] = ((len & 0x07) << 5) | 0x1f;
+            data[6] = 0xfc;
+        }
+        data += len;
+    }
+
+    return stream;
+}
+
+static void
+aacdec_split_helper (gboolean loas)
+{
+    GstElement *dec;
+    GstCaps *caps;
+    GstBuffer *stream;
+    guint skipped;
+    guint offset;
+    GList *cur;
+    guint i;
+
+    dec = setup_element ("omx_aacdec", NULL, &sinktemplate);
+
+    /* the simulated foo core copies each input buffer to the output, so
+     * the decoder hands out the frames it split */
+    g_object_set (dec, "frames-per-buffer", 1, NULL);
+
+    fail_unless_equals_int (gst_element_set_state (dec, GST_STATE_PLAYING),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    caps = gst_caps_new_simple ("audio/mpeg",
+                                "mpegversion", G_TYPE_INT, 4,
+                                "rate", G_TYPE_INT, 44100,
+                                "channels", G_TYPE_INT, 2,
+                                NULL);
+
+    /* chunks that cut through headers and payload alike */
+    stream = aac_stream_new (loas);
+    for (offset = 0; offset < GST_BUFFER_SIZE (stream); offset += AAC_CHUNK)
+    {
+        GstBuffer *inbuffer;
+
+        inbuffer = gst_buffer_create_sub (stream, offset,
+                MIN (AAC_CHUNK, GST_BUFFER_SIZE (stream) - offset));
+        GST_BUFFER_TIMESTAMP (inbuffer) = offset ? GST_CLOCK_TIME_NONE : 0;
+        gst_buffer_set_caps (inbuffer, caps);
+
+        fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+    }
+
+    gst_caps_unref (caps);
+
+    gst_pad_push_event (mysrcpad, gst_event_new_eos ());
+    wait_for_eos ();
+
+    /* whole frames, in order, the last one too */
+    offset = AAC_JUNK;
+    for (cur = buffers, i = 0; cur; cur = g_list_next (cur), i++)
+    {
+        GstBuffer *buffer = cur->data;
+        guint len = 20 + i * 7;
+
+        fail_unless_equals_int (GST_BUFFER_SIZE (buffer), len);
+        fail_unless (memcmp (GST_BUFFER_DATA (buffer),
+                             GST_BUFFER_DATA (stream) + offset, len) == 0);
+        offset += len;
+    }
+    fail_unless_equals_int (i, AAC_FRAMES);
+
+    g_object_get (dec, "bytes-skipped", &skipped, NULL);
+    fail_unless_equals_int (skipped, AAC_JUNK);
+
+    gst_buffer_unref (stream);
+    teardown_element (dec);
+}
+
+GST_START_TEST (test_aacdec_split_adts)
+{
+    aacdec_split_helper (FALSE);
+}
+GST_END_TEST
+
+GST_START_TEST (test_aacdec_split_loas)
+{
+    aacdec_split_helper (TRUE);
+}
+GST_END_TEST
+
+GST_START_TEST (test_mjpegdec_eos_held)
+{
+    GstElement *dec;
+    GstCaps *caps;
+    GTimeVal end_time;
+    GList *cur;
+    guint i;
+
+    /* the same copying decoder as for trick modes */
+    dec = setup_element ("omx_mjpegdec", trick_config, &sinktemplate);
+
+    g_object_set (dec, "parallelism", MJPEG_PARALLELISM, NULL);
+
+    fail_unless_equals_int (gst_element_set_state (dec, GST_STATE_PLAYING),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    caps = gst_caps_new_simple ("image/jpeg",
+                                "width", G_TYPE_INT, 64,
+                                "height", G_TYPE_INT, 64,
+                                "framerate", GST_TYPE_FRACTION, 25, 1,
+                                NULL);
+
+    /* the half microsecond is lost in OMX ticks, so no frame comes back
+     * with the timestamp it went in with; each must still be matched, or
+     * the decoder holds the last ones until EOS */
+    for (i = 0; i < MJPEG_FRAMES; i++)
+    {
+        GstBuffer *inbuffer;
+
+        inbuffer = gst_buffer_new_and_alloc (0x100);
+        memset (GST_BUFFER_DATA (inbuffer), 0, 0x100);
+        GST_BUFFER_DATA (inbuffer)[0] = i;
+        GST_BUFFER_TIMESTAMP (inbuffer) = i * MJPEG_FRAME_DURATION + 500;
+        GST_BUFFER_DURATION (inbuffer) = MJPEG_FRAME_DURATION;
+        gst_buffer_set_caps (inbuffer, caps);
+
+        fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+    }
+
+    gst_caps_unref (caps);
+
+    /* every frame leaves without EOS pushing it out */
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, G_USEC_PER_SEC);
+    g_mutex_lock (check_mutex);
+    while (g_list_length (buffers) < MJPEG_FRAMES)
+    {
+        if (!g_cond_timed_wait (check_cond, check_mutex, &end_time))
+            break;
+    }
+    g_mutex_unlock (check_mutex);
+    fail_unless_equals_int (g_list_length (buffers), MJPEG_FRAMES);
+
+    gst_pad_push_event (mysrcpad, gst_event_new_eos ());
+    wait_for_eos ();
+
+    /* in order, on the tick */
+    for (cur = buffers, i = 0; cur; cur = g_list_next (cur), i++)
+    {
+        GstBuffer *buffer = cur->data;
+
+        fail_unless_equals_int (GST_BUFFER_DATA (buffer)[0], i);
+        fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer),
+                                   i * MJPEG_FRAME_DURATION);
+    }
+    fail_unless_equals_int (i, MJPEG_FRAMES);
+
+    teardown_element (dec);
+}
+GST_END_TEST
+
+GST_START_TEST (test_jpegenc_target_size)
+{
+    GstElement *enc;
+    GstCaps *caps;
+    guint quality;
+    guint i;
+
+    enc = setup_element ("omx_jpegenc", jpegenc_config, &sinktemplate);
+
+    /* no JPEG can get down to one byte: the quality only goes down */
+    g_object_set (enc, "quality", JPEG_QUALITY, "max-quality-step", JPEG_STEP,
+                  "target-frame-size", 1, NULL);
+
+    fail_unless_equals_int (gst_element_set_state (enc, GST_STATE_PLAYING),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    caps = gst_caps_new_simple ("video/x-raw-yuv",
+                                "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC ('N', 'V', '1', '2'),
+                                "width", G_TYPE_INT, 64,
+                                "height", G_TYPE_INT, 64,
+                                "framerate", GST_TYPE_FRACTION, 30, 1,
+                                NULL);
+
+    for (i = 0; i < JPEG_FRAMES; i++)
+    {
+        GstBuffer *inbuffer;
+
+        inbuffer = gst_buffer_new_and_alloc (64 * 64 * 3 / 2);
+        memset (GST_BUFFER_DATA (inbuffer), i, GST_BUFFER_SIZE (inbuffer));
+        GST_BUFFER_TIMESTAMP (inbuffer) = i * GST_SECOND / 30;
+        gst_buffer_set_caps (inbuffer, caps);
+
+        fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+    }
+
+    gst_caps_unref (caps);
+
+    gst_pad_push_event (mysrcpad, gst_event_new_eos ());
+    wait_for_eos ();
+
+    /* one step per averaging window at most, rather than one per frame */
+    g_object_get (enc, "quality", &quality, NULL);
+    fail_unless (quality < JPEG_QUALITY);
+    fail_unless (quality >= JPEG_QUALITY - JPEG_STEP * JPEG_FRAMES / JPEG_WINDOW);
+
+    teardown_element (enc);
+}
+GST_END_TEST
+
+GST_START_TEST (test_camera_timestamps)
+{
+    camera_helper (0);
+}
+GST_END_TEST
+
+GST_START_TEST (test_camera_skip_durations)
+{
+    /* every other frame: 15 out of 30 */
+    camera_helper (1);
+}
+GST_END_TEST
+
 static Suite *
 gstomx_suite (void)
 {
@@ -216,6 +724,13 @@ gstomx_suite (void)
     tcase_set_timeout (tc_chain, 10);
     tcase_add_test (tc_chain, test_basic);
     tcase_add_test (tc_chain, test_flush);
+    tcase_add_test (tc_chain, test_trick_mode);
+    tcase_add_test (tc_chain, test_camera_timestamps);
+    tcase_add_test (tc_chain, test_camera_skip_durations);
+    tcase_add_test (tc_chain, test_aacdec_split_adts);
+    tcase_add_test (tc_chain, test_aacdec_split_loas);
+    tcase_add_test (tc_chain, test_jpegenc_target_size);
+    tcase_add_test (tc_chain, test_mjpegdec_eos_held);
     suite_add_tcase (s, tc_chain);
 
     return s;
@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <dlfcn.h>
+#include <string.h>
 
 static const char *lib_name;
 static void *dl_handle;
@@ -35,6 +36,8 @@ static OMX_ERRORTYPE (*get_handle) (OMX_HANDLETYPE *handle,
                                     OMX_PTR data,
                                     OMX_CALLBACKTYPE *callbacks);
 static OMX_ERRORTYPE (*free_handle) (OMX_HANDLETYPE handle);
+static gboolean (*load_config) (const gchar *data, GError **error);
+static void (*clear_config) (void);
 
 typedef struct CustomData CustomData;
 
@@ -44,6 +47,8 @@ struct CustomData
     OMX_STATETYPE omx_state;
     GCond *omx_state_condition;
     GMutex *omx_state_mutex;
+    GAsyncQueue *events;
+    GAsyncQueue *done;
 };
 
 static CustomData *
@@ -53,6 +58,8 @@ custom_data_new (void)
     custom_data = g_new0 (CustomData, 1);
     custom_data->omx_state_condition = g_cond_new ();
     custom_data->omx_state_mutex = g_mutex_new ();
+    custom_data->events = g_async_queue_new ();
+    custom_data->done = g_async_queue_new ();
     return custom_data;
 }
 
@@ -60,6 +67,8 @@ static void
 custom_data_free (CustomData *custom_data)
 {
     g_mutex_free (custom_data->omx_state_mutex);
+    g_async_queue_unref (custom_data->events);
+    g_async_queue_unref (custom_data->done);
     g_cond_free (custom_data->omx_state_condition);
     g_free (custom_data);
 }
@@ -125,6 +134,10 @@ EventHandler (OMX_HANDLETYPE omx_handle,
                 }
                 break;
             }
+        case OMX_EventPortSettingsChanged:
+        case OMX_EventError:
+            g_async_queue_push (core->events, GUINT_TO_POINTER (data_1));
+            break;
         default:
             break;
     }
@@ -132,7 +145,70 @@ EventHandler (OMX_HANDLETYPE omx_handle,
     return OMX_ErrorNone;
 }
 
-static OMX_CALLBACKTYPE callbacks = { EventHandler, NULL, NULL };
+static OMX_ERRORTYPE
+BufferDone (OMX_HANDLETYPE omx_handle,
+            OMX_PTR app_data,
+            OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    CustomData *core;
+
+    core = app_data;
+    g_async_queue_push (core->done, omx_buffer);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_CALLBACKTYPE callbacks = { EventHandler, BufferDone, BufferDone };
+
+/* Brings a simulated component up with its own buffers on two ports. */
+static CustomData *
+sim_start (const gchar *config,
+           OMX_U32 in_index,
+           OMX_U32 out_index,
+           OMX_BUFFERHEADERTYPE **in,
+           OMX_BUFFERHEADERTYPE **out)
+{
+    CustomData *custom_data;
+
+    fail_unless (load_config (config, NULL));
+    fail_if (init () != OMX_ErrorNone);
+
+    custom_data = custom_data_new ();
+    fail_if (get_handle (&custom_data->omx_handle, "OMX.check.sim",
+                         custom_data, &callbacks) != OMX_ErrorNone);
+
+    change_state (custom_data, OMX_StateIdle);
+    fail_if (OMX_AllocateBuffer (custom_data->omx_handle, in, in_index, NULL, 64) != OMX_ErrorNone);
+    fail_if (OMX_AllocateBuffer (custom_data->omx_handle, out, out_index, NULL, 64) != OMX_ErrorNone);
+    wait_for_state (custom_data, OMX_StateIdle);
+
+    change_state (custom_data, OMX_StateExecuting);
+    wait_for_state (custom_data, OMX_StateExecuting);
+
+    return custom_data;
+}
+
+static void
+sim_stop (CustomData *custom_data,
+          OMX_U32 in_index,
+          OMX_U32 out_index,
+          OMX_BUFFERHEADERTYPE *in,
+          OMX_BUFFERHEADERTYPE *out)
+{
+    change_state (custom_data, OMX_StateIdle);
+    wait_for_state (custom_data, OMX_StateIdle);
+
+    change_state (custom_data, OMX_StateLoaded);
+    OMX_FreeBuffer (custom_data->omx_handle, in_index, in);
+    OMX_FreeBuffer (custom_data->omx_handle, out_index, out);
+    wait_for_state (custom_data, OMX_StateLoaded);
+
+    fail_if (free_handle (custom_data->omx_handle) != OMX_ErrorNone);
+    fail_if (deinit () != OMX_ErrorNone);
+    clear_config ();
+
+    custom_data_free (custom_data);
+}
 
 START_TEST (test_basic)
 {
@@ -201,6 +277,98 @@ START_TEST (test_idle)
 }
 END_TEST
 
+START_TEST (test_sim_latency)
+{
+    CustomData *custom_data;
+    OMX_BUFFERHEADERTYPE *in, *out;
+    GTimer *timer;
+
+    custom_data = sim_start ("[OMX.check.sim]\n"
+                             "latency-us=20000\n"
+                             "wait-populated=true\n",
+                             0, 1, &in, &out);
+
+    memcpy (in->pBuffer, "simulated", 10);
+    in->nFilledLen = 10;
+    in->nTimeStamp = 1234;
+
+    timer = g_timer_new ();
+    fail_if (OMX_FillThisBuffer (custom_data->omx_handle, out) != OMX_ErrorNone);
+    fail_if (OMX_EmptyThisBuffer (custom_data->omx_handle, in) != OMX_ErrorNone);
+
+    /* the output comes first, then the consumed input */
+    fail_unless (g_async_queue_pop (custom_data->done) == out);
+    fail_unless (g_timer_elapsed (timer, NULL) >= 0.02);
+    fail_unless (g_async_queue_pop (custom_data->done) == in);
+    g_timer_destroy (timer);
+
+    fail_unless (out->nFilledLen == 10);
+    fail_unless (out->nTimeStamp == 1234);
+    fail_unless (strcmp ((gchar *) out->pBuffer, "simulated") == 0);
+
+    sim_stop (custom_data, 0, 1, in, out);
+}
+END_TEST
+
+START_TEST (test_sim_ports)
+{
+    CustomData *custom_data;
+    OMX_BUFFERHEADERTYPE *in, *out;
+    OMX_PARAM_PORTDEFINITIONTYPE param;
+
+    /* a VFPC-like layout with outputs from index 16 */
+    custom_data = sim_start ("[OMX.check.sim]\n"
+                             "input-ports=2\n"
+                             "output-ports=2\n"
+                             "output-start=16\n"
+                             "buffer-count=1\n",
+                             1, 17, &in, &out);
+
+    memset (&param, 0, sizeof (param));
+    param.nSize = sizeof (param);
+    param.nPortIndex = 17;
+    fail_if (OMX_GetParameter (custom_data->omx_handle, OMX_IndexParamPortDefinition, &param) != OMX_ErrorNone);
+    fail_unless (param.eDir == OMX_DirOutput);
+
+    param.nPortIndex = 2;
+    fail_unless (OMX_GetParameter (custom_data->omx_handle, OMX_IndexParamPortDefinition, &param) == OMX_ErrorBadPortIndex);
+
+    /* input 1 feeds output 17 */
+    in->nFilledLen = 1;
+    fail_if (OMX_FillThisBuffer (custom_data->omx_handle, out) != OMX_ErrorNone);
+    fail_if (OMX_EmptyThisBuffer (custom_data->omx_handle, in) != OMX_ErrorNone);
+    fail_unless (g_async_queue_pop (custom_data->done) == out);
+    fail_unless (g_async_queue_pop (custom_data->done) == in);
+
+    sim_stop (custom_data, 1, 17, in, out);
+}
+END_TEST
+
+START_TEST (test_sim_events)
+{
+    CustomData *custom_data;
+    OMX_BUFFERHEADERTYPE *in, *out;
+
+    custom_data = sim_start ("[OMX.check.sim]\n"
+                             "port-settings-changed-at=0\n"
+                             "error-at=1\n"
+                             "error-code=0x8000100b\n",
+                             0, 1, &in, &out);
+
+    fail_unless (GPOINTER_TO_UINT (g_async_queue_pop (custom_data->events)) == 1);
+
+    in->nFilledLen = 1;
+    fail_if (OMX_FillThisBuffer (custom_data->omx_handle, out) != OMX_ErrorNone);
+    fail_if (OMX_EmptyThisBuffer (custom_data->omx_handle, in) != OMX_ErrorNone);
+    g_async_queue_pop (custom_data->done);
+    g_async_queue_pop (custom_data->done);
+
+    fail_unless (GPOINTER_TO_UINT (g_async_queue_pop (custom_data->events)) == 0x8000100b);
+
+    sim_stop (custom_data, 0, 1, in, out);
+}
+END_TEST
+
 static Suite *
 util_suite (void)
 {
@@ -223,11 +391,16 @@ util_suite (void)
         deinit = dlsym (dl_handle, "OMX_Deinit");
         get_handle = dlsym (dl_handle, "OMX_GetHandle");
         free_handle = dlsym (dl_handle, "OMX_FreeHandle");
+        load_config = dlsym (dl_handle, "omxsim_load_config");
+        clear_config = dlsym (dl_handle, "omxsim_clear_config");
     }
 
     tcase_add_test (tc_chain, test_basic);
     tcase_add_test (tc_chain, test_handle);
     tcase_add_test (tc_chain, test_idle);
+    tcase_add_test (tc_chain, test_sim_latency);
+    tcase_add_test (tc_chain, test_sim_ports);
+    tcase_add_test (tc_chain, test_sim_events);
     suite_add_tcase (s, tc_chain);
 
     return s;
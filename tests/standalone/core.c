@@ -19,53 +19,1083 @@
  *
  */
 
+/* OpenMAX IL component simulator.
+ *
+ * Every component gets a profile (see omxsim.h) describing its ports, how
+ * long a frame takes to process and which events to inject. Commands are
+ * completed asynchronously from a command thread, the way the DM81xx
+ * components answer over IPC, and a processing thread moves buffers
+ * between ports:
+ *
+ *  - filter: each input port feeds one output port (input n to output
+ *    n % outputs), or every output port when fanout is set. With batch
+ *    set a frame takes one buffer from every ready input, the way a VFPC
+ *    handle processes all of its channels per tick.
+ *  - mosaic: one buffer from every enabled input is composed into
+ *    output 0.
+ *  - no inputs: a source producing a frame every interval-us.
+ *  - no outputs: a sink releasing each input after latency-us.
+ */
+
 #include <OMX_Core.h>
 #include <OMX_Component.h>
 
-#include <glib.h>
+#include <glib.h>
+
+#include <stdlib.h> /* For calloc, free, strtoul */
+#include <string.h> /* For memcpy */
+
+#include "async_queue.h"
+#include "omxsim.h"
+
+#define MAX_PORTS 32
+
+typedef struct SimProfile SimProfile;
+typedef struct SimCommand SimCommand;
+typedef struct SimBuffer SimBuffer;
+typedef struct SimJob SimJob;
+typedef struct CompPrivate CompPrivate;
+typedef struct CompPrivatePort CompPrivatePort;
+
+struct SimProfile
+{
+    gboolean mosaic;
+    gboolean fanout;
+    gboolean batch;
+    gboolean copy;
+    guint num_inputs;
+    guint input_start;
+    guint num_outputs;
+    guint output_start;
+    guint buffer_count;
+    guint buffer_size;
+    OMX_PORTDOMAINTYPE domain;
+    gboolean ports_enabled;
+    gboolean wait_populated;
+    gulong latency;
+    gulong jitter;
+    gulong interval;
+    gint settings_changed_at;
+    guint settings_width;
+    guint settings_height;
+    gint error_at;
+    OMX_ERRORTYPE error;
+    gboolean fail_get_handle;
+};
+
+struct SimCommand
+{
+    OMX_COMMANDTYPE command;
+    OMX_U32 param;
+    OMX_PTR data;
+};
+
+struct SimBuffer
+{
+    OMX_BUFFERHEADERTYPE header;
+    gboolean allocated;
+};
+
+struct SimJob
+{
+    OMX_BUFFERHEADERTYPE *in[MAX_PORTS];
+    CompPrivatePort *in_ports[MAX_PORTS];
+    guint num_in;
+    OMX_BUFFERHEADERTYPE *out[MAX_PORTS];
+    CompPrivatePort *out_ports[MAX_PORTS];
+    guint num_out;
+};
+
+struct CompPrivate
+{
+    OMX_STATETYPE state;
+    OMX_CALLBACKTYPE *callbacks;
+    OMX_PTR app_data;
+    SimProfile profile;
+    CompPrivatePort *ports;
+    guint num_ports;
+    GHashTable *settings;
+    gboolean done;
+    gboolean busy;
+    gboolean flushing;
+    gboolean settings_sent;
+    gboolean error_sent;
+    guint frames;
+    guint next_input;
+    GTimer *timer;
+    GMutex *mutex;
+    GCond *condition;
+    AsyncQueue *commands;
+    GThread *command_thread;
+    GThread *process_thread;
+};
+
+struct CompPrivatePort
+{
+    OMX_PARAM_PORTDEFINITIONTYPE port_def;
+    GQueue *queue;
+    guint num_buffers;
+    OMX_U32 alloc_size;     /* smallest buffer handed over */
+    gboolean reconfigure;
+};
+
+static GKeyFile *config;
+static GStaticMutex config_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *extensions;
+static gboolean config_checked;
+static gint buffer_calls;
+
+static gpointer command_thread (gpointer cb_data);
+static gpointer process_thread (gpointer cb_data);
+
+/*
+ * Configuration.
+ */
+
+gboolean
+omxsim_load_config (const gchar *data,
+                    GError **error)
+{
+    GKeyFile *key_file;
+
+    key_file = g_key_file_new ();
+    if (!g_key_file_load_from_data (key_file, data, strlen (data),
+                                    G_KEY_FILE_NONE, error))
+    {
+        g_key_file_free (key_file);
+        return FALSE;
+    }
+
+    g_static_mutex_lock (&config_mutex);
+    if (config)
+        g_key_file_free (config);
+    config = key_file;
+    g_static_mutex_unlock (&config_mutex);
+
+    return TRUE;
+}
+
+gboolean
+omxsim_load_config_file (const gchar *filename,
+                         GError **error)
+{
+    gchar *data;
+    gboolean ret;
+
+    if (!g_file_get_contents (filename, &data, NULL, error))
+        return FALSE;
+
+    ret = omxsim_load_config (data, error);
+    g_free (data);
+
+    return ret;
+}
+
+void
+omxsim_clear_config (void)
+{
+    g_static_mutex_lock (&config_mutex);
+    if (config)
+        g_key_file_free (config);
+    config = NULL;
+    g_static_mutex_unlock (&config_mutex);
+}
+
+guint
+omxsim_get_buffer_calls (void)
+{
+    return g_atomic_int_get (&buffer_calls);
+}
+
+static gboolean
+get_key (const gchar *group,
+         const gchar *key,
+         gulong *value)
+{
+    gchar *str;
+
+    str = g_key_file_get_value (config, group, key, NULL);
+    if (!str)
+        return FALSE;
+
+    /* numbers may be given in hex, error codes usually are */
+    *value = strtoul (str, NULL, 0);
+    g_free (str);
+
+    return TRUE;
+}
+
+static void
+get_bool (const gchar *group,
+          const gchar *key,
+          gboolean *value)
+{
+    GError *error = NULL;
+    gboolean tmp;
+
+    tmp = g_key_file_get_boolean (config, group, key, &error);
+    if (error)
+    {
+        g_error_free (error);
+        return;
+    }
+
+    *value = tmp;
+}
+
+static void
+get_uint (const gchar *group,
+          const gchar *key,
+          guint *value)
+{
+    gulong tmp;
+
+    if (get_key (group, key, &tmp))
+        *value = tmp;
+}
+
+static void
+get_int (const gchar *group,
+         const gchar *key,
+         gint *value)
+{
+    gulong tmp;
+
+    if (get_key (group, key, &tmp))
+        *value = (gint) tmp;
+}
+
+static void
+profile_apply (SimProfile *profile,
+               const gchar *group)
+{
+    gchar *str;
+    gulong tmp;
+
+    if (!g_key_file_has_group (config, group))
+        return;
+
+    str = g_key_file_get_string (config, group, "mode", NULL);
+    if (str)
+    {
+        profile->mosaic = (strcmp (str, "mosaic") == 0);
+        g_free (str);
+    }
+
+    str = g_key_file_get_string (config, group, "domain", NULL);
+    if (str)
+    {
+        if (strcmp (str, "video") == 0)
+            profile->domain = OMX_PortDomainVideo;
+        else if (strcmp (str, "image") == 0)
+            profile->domain = OMX_PortDomainImage;
+        else if (strcmp (str, "other") == 0)
+            profile->domain = OMX_PortDomainOther;
+        else
+            profile->domain = OMX_PortDomainAudio;
+        g_free (str);
+    }
+
+    get_bool (group, "fanout", &profile->fanout);
+    get_bool (group, "batch", &profile->batch);
+    get_bool (group, "copy", &profile->copy);
+    get_uint (group, "input-ports", &profile->num_inputs);
+    get_uint (group, "input-start", &profile->input_start);
+    get_uint (group, "output-ports", &profile->num_outputs);
+    get_uint (group, "output-start", &profile->output_start);
+    get_uint (group, "buffer-count", &profile->buffer_count);
+    get_uint (group, "buffer-size", &profile->buffer_size);
+    get_bool (group, "ports-enabled", &profile->ports_enabled);
+    get_bool (group, "wait-populated", &profile->wait_populated);
+    get_key (group, "latency-us", &profile->latency);
+    get_key (group, "jitter-us", &profile->jitter);
+    get_key (group, "interval-us", &profile->interval);
+    get_int (group, "port-settings-changed-at", &profile->settings_changed_at);
+    get_uint (group, "port-settings-width", &profile->settings_width);
+    get_uint (group, "port-settings-height", &profile->settings_height);
+    get_int (group, "error-at", &profile->error_at);
+    if (get_key (group, "error-code", &tmp))
+        profile->error = (OMX_ERRORTYPE) tmp;
+    get_bool (group, "fail-get-handle", &profile->fail_get_handle);
+}
+
+static void
+profile_init (SimProfile *profile,
+              const gchar *component_name)
+{
+    /* the historic foo component: one audio port each way, no delay */
+    memset (profile, 0, sizeof (SimProfile));
+    profile->copy = TRUE;
+    profile->num_inputs = 1;
+    profile->input_start = 0;
+    profile->num_outputs = 1;
+    profile->output_start = 1;
+    profile->buffer_count = 1;
+    profile->buffer_size = 0x1000;
+    profile->domain = OMX_PortDomainAudio;
+    profile->ports_enabled = TRUE;
+    profile->interval = 33333;
+    profile->settings_changed_at = -1;
+    profile->error_at = -1;
+    profile->error = OMX_ErrorHardware;
+
+    g_static_mutex_lock (&config_mutex);
+    if (config)
+    {
+        profile_apply (profile, "default");
+        if (component_name)
+            profile_apply (profile, component_name);
+    }
+    g_static_mutex_unlock (&config_mutex);
+
+    profile->num_inputs = MIN (profile->num_inputs, MAX_PORTS);
+    profile->num_outputs = MIN (profile->num_outputs, MAX_PORTS);
+}
+
+/*
+ * Core.
+ */
+
+/* Also reached from OMX_GetHandle(): a test may link this file and still
+ * have the plugin call OMX_Init() through the dlopen'ed copy. */
+static void
+sim_init (void)
+{
+    gboolean load;
+
+    if (!g_thread_supported ())
+    {
+        g_thread_init (NULL);
+    }
+
+    g_static_mutex_lock (&config_mutex);
+    if (!extensions)
+        extensions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    load = !config && !config_checked;
+    config_checked = TRUE;
+    g_static_mutex_unlock (&config_mutex);
+
+    if (load && g_getenv (OMXSIM_CONFIG_ENV))
+    {
+        GError *error = NULL;
+
+        if (!omxsim_load_config_file (g_getenv (OMXSIM_CONFIG_ENV), &error))
+        {
+            g_warning ("%s", error->message);
+            g_error_free (error);
+        }
+    }
+}
+
+OMX_ERRORTYPE
+OMX_Init (void)
+{
+    sim_init ();
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_Deinit (void)
+{
+    return OMX_ErrorNone;
+}
+
+/*
+ * Helpers.
+ */
+
+static CompPrivatePort *
+get_port (CompPrivate *private,
+          OMX_U32 index)
+{
+    guint i;
+
+    for (i = 0; i < private->num_ports; i++)
+    {
+        if (private->ports[i].port_def.nPortIndex == index)
+            return &private->ports[i];
+    }
+
+    return NULL;
+}
+
+static inline gboolean
+port_matches (CompPrivatePort *port,
+              OMX_U32 index)
+{
+    return index == OMX_ALL || port->port_def.nPortIndex == index;
+}
+
+static void
+send_event (OMX_COMPONENTTYPE *comp,
+            OMX_EVENTTYPE event,
+            OMX_U32 data_1,
+            OMX_U32 data_2,
+            OMX_PTR data)
+{
+    CompPrivate *private;
+
+    private = comp->pComponentPrivate;
+
+    if (private->callbacks && private->callbacks->EventHandler)
+    {
+        private->callbacks->EventHandler (comp, private->app_data,
+                                          event, data_1, data_2, data);
+    }
+}
+
+static void
+return_buffer (OMX_COMPONENTTYPE *comp,
+               CompPrivatePort *port,
+               OMX_BUFFERHEADERTYPE *buffer)
+{
+    CompPrivate *private;
+
+    private = comp->pComponentPrivate;
+
+    if (port->port_def.eDir == OMX_DirInput)
+        private->callbacks->EmptyBufferDone (comp, private->app_data, buffer);
+    else
+        private->callbacks->FillBufferDone (comp, private->app_data, buffer);
+}
+
+/* Hands back every buffer queued on the matching ports. Called with the
+ * mutex held; in-flight buffers are waited for first so that nothing is
+ * returned after the command completes. */
+static void
+flush_ports (OMX_COMPONENTTYPE *comp,
+             OMX_U32 index)
+{
+    CompPrivate *private;
+    GQueue *returned;
+    guint i;
+
+    private = comp->pComponentPrivate;
+
+    private->flushing = TRUE;
+    while (private->busy)
+        g_cond_wait (private->condition, private->mutex);
+
+    returned = g_queue_new ();
+
+    for (i = 0; i < private->num_ports; i++)
+    {
+        CompPrivatePort *port = &private->ports[i];
+        OMX_BUFFERHEADERTYPE *buffer;
+
+        if (!port_matches (port, index))
+            continue;
+
+        while ((buffer = g_queue_pop_tail (port->queue)))
+        {
+            if (port->port_def.eDir == OMX_DirOutput)
+                buffer->nFilledLen = 0;
+            g_queue_push_tail (returned, port);
+            g_queue_push_tail (returned, buffer);
+        }
+    }
+
+    g_mutex_unlock (private->mutex);
+
+    while (!g_queue_is_empty (returned))
+    {
+        CompPrivatePort *port = g_queue_pop_head (returned);
+        return_buffer (comp, port, g_queue_pop_head (returned));
+    }
+
+    g_mutex_lock (private->mutex);
+
+    g_queue_free (returned);
+    private->flushing = FALSE;
+    g_cond_broadcast (private->condition);
+}
+
+static gboolean
+ports_populated (CompPrivate *private,
+                 OMX_U32 index)
+{
+    guint i;
+
+    for (i = 0; i < private->num_ports; i++)
+    {
+        CompPrivatePort *port = &private->ports[i];
+
+        if (!port_matches (port, index) || !port->port_def.bEnabled)
+            continue;
+
+        if (port->num_buffers < port->port_def.nBufferCountActual)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+ports_empty (CompPrivate *private,
+             OMX_U32 index)
+{
+    guint i;
+
+    for (i = 0; i < private->num_ports; i++)
+    {
+        if (port_matches (&private->ports[i], index) &&
+            private->ports[i].num_buffers > 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Commands.
+ */
+
+static void
+set_state (OMX_COMPONENTTYPE *comp,
+           OMX_STATETYPE state)
+{
+    CompPrivate *private;
+
+    private = comp->pComponentPrivate;
+
+    g_mutex_lock (private->mutex);
+
+    if (state == private->state)
+    {
+        g_mutex_unlock (private->mutex);
+        send_event (comp, OMX_EventError, OMX_ErrorSameState, 0, NULL);
+        return;
+    }
+
+    if (private->profile.wait_populated)
+    {
+        if (private->state == OMX_StateLoaded && state == OMX_StateIdle)
+        {
+            while (!private->done && !ports_populated (private, OMX_ALL))
+                g_cond_wait (private->condition, private->mutex);
+        }
+        else if (private->state == OMX_StateIdle && state == OMX_StateLoaded)
+        {
+            while (!private->done && !ports_empty (private, OMX_ALL))
+                g_cond_wait (private->condition, private->mutex);
+        }
+    }
+
+    if (state == OMX_StateIdle &&
+        (private->state == OMX_StateExecuting || private->state == OMX_StatePause))
+    {
+        flush_ports (comp, OMX_ALL);
+    }
+
+    if (state == OMX_StateExecuting && private->state == OMX_StateIdle)
+    {
+        /* sources pace themselves from here */
+        g_timer_start (private->timer);
+        private->frames = 0;
+    }
+
+    private->state = state;
+    g_cond_broadcast (private->condition);
+
+    g_mutex_unlock (private->mutex);
+
+    send_event (comp, OMX_EventCmdComplete, OMX_CommandStateSet, state, NULL);
+}
+
+static void
+set_port_enabled (OMX_COMPONENTTYPE *comp,
+                  OMX_U32 index,
+                  gboolean enable)
+{
+    CompPrivate *private;
+    OMX_COMMANDTYPE command;
+    guint i;
+
+    private = comp->pComponentPrivate;
+    command = enable ? OMX_CommandPortEnable : OMX_CommandPortDisable;
+
+    for (i = 0; i < private->num_ports; i++)
+    {
+        CompPrivatePort *port = &private->ports[i];
+        OMX_U32 port_index = port->port_def.nPortIndex;
+
+        if (!port_matches (port, index))
+            continue;
+
+        g_mutex_lock (private->mutex);
+
+        if (enable)
+        {
+            port->port_def.bEnabled = OMX_TRUE;
+            if (private->profile.wait_populated && private->state != OMX_StateLoaded)
+            {
+                while (!private->done && !ports_populated (private, port_index))
+                    g_cond_wait (private->condition, private->mutex);
+            }
+        }
+        else
+        {
+            port->port_def.bEnabled = OMX_FALSE;
+            flush_ports (comp, port_index);
+            if (private->profile.wait_populated && private->state != OMX_StateLoaded)
+            {
+                while (!private->done && !ports_empty (private, port_index))
+                    g_cond_wait (private->condition, private->mutex);
+            }
+            port->reconfigure = FALSE;
+        }
+
+        g_cond_broadcast (private->condition);
+        g_mutex_unlock (private->mutex);
+
+        send_event (comp, OMX_EventCmdComplete, command, port_index, NULL);
+    }
+}
+
+static gpointer
+command_thread (gpointer cb_data)
+{
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    SimCommand *command;
+
+    comp = cb_data;
+    private = comp->pComponentPrivate;
+
+    while ((command = async_queue_pop (private->commands)))
+    {
+        switch (command->command)
+        {
+            case OMX_CommandStateSet:
+                set_state (comp, command->param);
+                break;
+            case OMX_CommandFlush:
+                {
+                    guint i;
+
+                    g_mutex_lock (private->mutex);
+                    flush_ports (comp, command->param);
+                    g_mutex_unlock (private->mutex);
+
+                    for (i = 0; i < private->num_ports; i++)
+                    {
+                        if (port_matches (&private->ports[i], command->param))
+                            send_event (comp, OMX_EventCmdComplete, OMX_CommandFlush,
+                                        private->ports[i].port_def.nPortIndex, NULL);
+                    }
+                    break;
+                }
+            case OMX_CommandPortDisable:
+                set_port_enabled (comp, command->param, FALSE);
+                break;
+            case OMX_CommandPortEnable:
+                set_port_enabled (comp, command->param, TRUE);
+                break;
+            default:
+                send_event (comp, OMX_EventCmdComplete, command->command,
+                            command->param, command->data);
+                break;
+        }
+
+        g_free (command);
+    }
+
+    return NULL;
+}
+
+/*
+ * Processing.
+ */
+
+static gboolean
+output_ready (CompPrivatePort *port)
+{
+    return port->port_def.bEnabled && !port->reconfigure &&
+           !g_queue_is_empty (port->queue);
+}
+
+static gboolean
+take_outputs (CompPrivate *private,
+              SimJob *job,
+              guint input)
+{
+    CompPrivatePort *outputs;
+    guint num_outputs;
+    guint i;
+
+    outputs = private->ports + private->profile.num_inputs;
+    num_outputs = private->profile.num_outputs;
+
+    if (num_outputs == 0)
+        return TRUE;
+
+    if (!private->profile.fanout)
+    {
+        CompPrivatePort *port = &outputs[input % num_outputs];
+
+        if (!output_ready (port))
+            return FALSE;
+
+        job->out_ports[job->num_out] = port;
+        job->out[job->num_out++] = g_queue_pop_tail (port->queue);
+        return TRUE;
+    }
+
+    for (i = 0; i < num_outputs; i++)
+    {
+        if (outputs[i].port_def.bEnabled && !output_ready (&outputs[i]))
+            return FALSE;
+    }
+
+    for (i = 0; i < num_outputs; i++)
+    {
+        if (!outputs[i].port_def.bEnabled)
+            continue;
+        job->out_ports[job->num_out] = &outputs[i];
+        job->out[job->num_out++] = g_queue_pop_tail (outputs[i].queue);
+    }
+
+    return job->num_out > 0;
+}
+
+/* Picks the buffers for the next frame, called with the mutex held. */
+static gboolean
+next_job (CompPrivate *private,
+          SimJob *job)
+{
+    SimProfile *profile;
+    guint i;
+
+    profile = &private->profile;
+    job->num_in = 0;
+    job->num_out = 0;
+
+    if (profile->num_inputs == 0)
+        return take_outputs (private, job, 0);
+
+    if (profile->mosaic)
+    {
+        for (i = 0; i < profile->num_inputs; i++)
+        {
+            CompPrivatePort *port = &private->ports[i];
+
+            if (port->port_def.bEnabled && g_queue_is_empty (port->queue))
+                return FALSE;
+        }
+
+        if (!take_outputs (private, job, 0))
+            return FALSE;
+
+        for (i = 0; i < profile->num_inputs; i++)
+        {
+            CompPrivatePort *port = &private->ports[i];
+
+            if (!port->port_def.bEnabled)
+                continue;
+            job->in_ports[job->num_in] = port;
+            job->in[job->num_in++] = g_queue_pop_tail (port->queue);
+        }
+
+        return TRUE;
+    }
+
+    for (i = 0; i < profile->num_inputs; i++)
+    {
+        guint input = (private->next_input + i) % profile->num_inputs;
+        CompPrivatePort *port = &private->ports[input];
+
+        if (!port->port_def.bEnabled || g_queue_is_empty (port->queue))
+            continue;
+
+        if (!take_outputs (private, job, input))
+            continue;
+
+        job->in_ports[job->num_in] = port;
+        job->in[job->num_in++] = g_queue_pop_tail (port->queue);
+        private->next_input = input + 1;
+
+        if (!profile->batch || profile->fanout)
+            return TRUE;
+    }
+
+    return job->num_in > 0;
+}
+
+/* Emits the configured one-shot events once the frame count is reached,
+ * called with the mutex held. */
+static void
+inject_events (OMX_COMPONENTTYPE *comp)
+{
+    CompPrivate *private;
+    SimProfile *profile;
+    guint i;
+
+    private = comp->pComponentPrivate;
+    profile = &private->profile;
+
+    if (!private->settings_sent && profile->settings_changed_at >= 0 &&
+        private->frames >= (guint) profile->settings_changed_at)
+    {
+        private->settings_sent = TRUE;
+
+        for (i = profile->num_inputs; i < private->num_ports; i++)
+        {
+            CompPrivatePort *port = &private->ports[i];
+            OMX_VIDEO_PORTDEFINITIONTYPE *video = &port->port_def.format.video;
+
+            /* a new geometry that doesn't fit the buffers holds the port
+             * until it is reconfigured */
+            if (profile->settings_width && profile->settings_height &&
+                (video->nFrameWidth != profile->settings_width ||
+                 video->nFrameHeight != profile->settings_height))
+            {
+                video->nFrameWidth = profile->settings_width;
+                video->nFrameHeight = profile->settings_height;
+                video->nStride = profile->settings_width;
+                video->nSliceHeight = profile->settings_height;
+                port->port_def.nBufferSize = profile->settings_width *
+                                             profile->settings_height * 3 / 2;
+                port->reconfigure = port->num_buffers == 0 ||
+                                    port->port_def.nBufferSize > port->alloc_size;
+            }
+
+            g_mutex_unlock (private->mutex);
+            send_event (comp, OMX_EventPortSettingsChanged,
+                        port->port_def.nPortIndex, 0, NULL);
+            g_mutex_lock (private->mutex);
+        }
+    }
+
+    if (!private->error_sent && profile->error_at >= 0 &&
+        private->frames >= (guint) profile->error_at)
+    {
+        private->error_sent = TRUE;
+
+        g_mutex_unlock (private->mutex);
+        send_event (comp, OMX_EventError, profile->error, 0, NULL);
+        g_mutex_lock (private->mutex);
+    }
+}
+
+/* Fills @num_out outputs from one input frame (NULL for sources). */
+static void
+process_frame (CompPrivate *private,
+               OMX_BUFFERHEADERTYPE *in,
+               OMX_BUFFERHEADERTYPE **outs,
+               CompPrivatePort **out_ports,
+               guint num_out)
+{
+    SimProfile *profile;
+    gulong size = 0;
+    guint i;
+
+    profile = &private->profile;
+
+    if (profile->copy && in && !profile->mosaic)
+        size = in->nFilledLen;
+
+    for (i = 0; i < num_out; i++)
+    {
+        OMX_BUFFERHEADERTYPE *out = outs[i];
+
+        out->nOffset = 0;
+
+        if (profile->copy && in)
+        {
+            out->nFilledLen = MIN (in->nFilledLen, out->nAllocLen);
+            memcpy (out->pBuffer, in->pBuffer + in->nOffset, out->nFilledLen);
+            size = MIN (size, out->nFilledLen);
+        }
+        else
+        {
+            out->nFilledLen = MIN (out_ports[i]->port_def.nBufferSize,
+                                   out->nAllocLen);
+        }
+
+        if (in)
+        {
+            out->nTimeStamp = in->nTimeStamp;
+            out->nFlags = in->nFlags;
+        }
+        else
+        {
+            out->nTimeStamp = (OMX_TICKS) private->frames * profile->interval;
+            out->nFlags = 0;
+        }
+    }
+
+    /* a filter copying into smaller buffers keeps the rest of the input */
+    if (in && size > 0 && size < in->nFilledLen && num_out > 0)
+    {
+        in->nOffset += size;
+        in->nFilledLen -= size;
+        for (i = 0; i < num_out; i++)
+            outs[i]->nFlags &= ~OMX_BUFFERFLAG_EOS;
+    }
+    else if (in)
+    {
+        in->nFilledLen = 0;
+    }
+}
+
+static void
+process_job (CompPrivate *private,
+             SimJob *job)
+{
+    SimProfile *profile;
+    guint i;
 
-#include <stdlib.h> /* For calloc, free */
-#include <string.h> /* For memcpy */
+    profile = &private->profile;
 
-#include "async_queue.h"
+    /* a batch pairs every input with the output taken for it */
+    if (profile->batch && !profile->fanout && !profile->mosaic)
+    {
+        for (i = 0; i < job->num_in; i++)
+            process_frame (private, job->in[i], &job->out[i], &job->out_ports[i],
+                           i < job->num_out ? 1 : 0);
+        return;
+    }
 
-static void *foo_thread (void *cb_data);
+    process_frame (private, job->num_in > 0 ? job->in[0] : NULL,
+                   job->out, job->out_ports, job->num_out);
 
-OMX_ERRORTYPE
-OMX_Init (void)
+    for (i = 1; i < job->num_in; i++)
+        job->in[i]->nFilledLen = 0;
+}
+
+static void
+wait_until (CompPrivate *private,
+            gulong usecs)
 {
-    if (!g_thread_supported ())
+    GTimeVal end;
+
+    g_get_current_time (&end);
+    g_time_val_add (&end, usecs);
+
+    while (!private->done && !private->flushing)
     {
-        g_thread_init (NULL);
+        if (!g_cond_timed_wait (private->condition, private->mutex, &end))
+            break;
     }
-
-    return OMX_ErrorNone;
 }
 
-OMX_ERRORTYPE
-OMX_Deinit (void)
+static gpointer
+process_thread (gpointer cb_data)
 {
-    return OMX_ErrorNone;
-}
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    SimProfile *profile;
+    SimJob job;
 
-typedef struct CompPrivate CompPrivate;
-typedef struct CompPrivatePort CompPrivatePort;
+    comp = cb_data;
+    private = comp->pComponentPrivate;
+    profile = &private->profile;
 
-struct CompPrivate
-{
-    OMX_STATETYPE state;
-    OMX_CALLBACKTYPE *callbacks;
-    OMX_PTR app_data;
-    CompPrivatePort *ports;
-    gboolean done;
-    GMutex *flush_mutex;
-};
+    g_mutex_lock (private->mutex);
 
-struct CompPrivatePort
-{
-    OMX_PARAM_PORTDEFINITIONTYPE port_def;
-    AsyncQueue *queue;
-};
+    while (!private->done)
+    {
+        gulong delay;
+        guint i;
+
+        if (private->state != OMX_StateExecuting || private->flushing)
+        {
+            g_cond_wait (private->condition, private->mutex);
+            continue;
+        }
+
+        inject_events (comp);
+
+        if (profile->num_inputs == 0)
+        {
+            gulong due, now;
+
+            due = (gulong) private->frames * profile->interval;
+            now = (gulong) (g_timer_elapsed (private->timer, NULL) * G_USEC_PER_SEC);
+            if (now < due)
+            {
+                wait_until (private, due - now);
+                continue;
+            }
+        }
+
+        if (!next_job (private, &job))
+        {
+            g_cond_wait (private->condition, private->mutex);
+            continue;
+        }
+
+        private->busy = TRUE;
+        g_mutex_unlock (private->mutex);
+
+        /* processing time of the hardware block */
+        delay = profile->latency;
+        if (profile->jitter > 0)
+        {
+            gint offset;
+
+            offset = g_random_int_range (-(gint) profile->jitter,
+                                         (gint) profile->jitter + 1);
+            delay = (offset < 0 && (gulong) -offset > delay) ? 0 : delay + offset;
+        }
+        if (profile->num_inputs > 0 && delay > 0)
+            g_usleep (delay);
+
+        process_job (private, &job);
+
+        for (i = 0; i < job.num_out; i++)
+        {
+            OMX_BUFFERHEADERTYPE *out = job.out[i];
+
+            if (out->nFlags & OMX_BUFFERFLAG_EOS)
+                send_event (comp, OMX_EventBufferFlag,
+                            job.out_ports[i]->port_def.nPortIndex, out->nFlags, NULL);
+            return_buffer (comp, job.out_ports[i], out);
+        }
+
+        if (job.num_out == 0 && job.num_in > 0 &&
+            (job.in[0]->nFlags & OMX_BUFFERFLAG_EOS))
+        {
+            send_event (comp, OMX_EventBufferFlag,
+                        job.in_ports[0]->port_def.nPortIndex, job.in[0]->nFlags, NULL);
+        }
+
+        g_mutex_lock (private->mutex);
+
+        for (i = 0; i < job.num_in; i++)
+        {
+            if (job.in[i]->nFilledLen > 0)
+            {
+                /* the rest goes first next time */
+                g_queue_push_tail (job.in_ports[i]->queue, job.in[i]);
+                job.in[i] = NULL;
+            }
+        }
+
+        g_mutex_unlock (private->mutex);
+
+        for (i = 0; i < job.num_in; i++)
+        {
+            if (job.in[i])
+                return_buffer (comp, job.in_ports[i], job.in[i]);
+        }
+
+        g_mutex_lock (private->mutex);
+
+        private->frames++;
+        private->busy = FALSE;
+        g_cond_broadcast (private->condition);
+    }
+
+    g_mutex_unlock (private->mutex);
+
+    return NULL;
+}
+
+/*
+ * Component.
+ */
 
 static OMX_ERRORTYPE
 comp_GetState (OMX_HANDLETYPE handle,
@@ -84,6 +1114,57 @@ comp_GetState (OMX_HANDLETYPE handle,
     return OMX_ErrorNone;
 }
 
+static OMX_ERRORTYPE
+comp_GetComponentVersion (OMX_HANDLETYPE handle,
+                          OMX_STRING name,
+                          OMX_VERSIONTYPE *component_version,
+                          OMX_VERSIONTYPE *spec_version,
+                          OMX_UUIDTYPE *uuid)
+{
+    g_strlcpy (name, "OMX.sim", OMX_MAX_STRINGNAME_SIZE);
+    component_version->nVersion = 1;
+    spec_version->s.nVersionMajor = 1;
+    spec_version->s.nVersionMinor = 1;
+    spec_version->s.nRevision = 0;
+    spec_version->s.nStep = 0;
+    memset (uuid, 0, sizeof (OMX_UUIDTYPE));
+
+    return OMX_ErrorNone;
+}
+
+/* Structures the simulator does not interpret read back whatever was last
+ * set with the same index, so configuration round-trips. */
+static void
+store_setting (CompPrivate *private,
+               OMX_INDEXTYPE index,
+               OMX_PTR param)
+{
+    OMX_U32 size;
+
+    size = *(OMX_U32 *) param;
+    if (size < sizeof (OMX_U32) || size > 0x10000)
+        size = sizeof (OMX_U32);
+
+    g_mutex_lock (private->mutex);
+    g_hash_table_insert (private->settings, GUINT_TO_POINTER (index),
+                         g_memdup (param, size));
+    g_mutex_unlock (private->mutex);
+}
+
+static void
+load_setting (CompPrivate *private,
+              OMX_INDEXTYPE index,
+              OMX_PTR param)
+{
+    OMX_U32 *stored;
+
+    g_mutex_lock (private->mutex);
+    stored = g_hash_table_lookup (private->settings, GUINT_TO_POINTER (index));
+    if (stored && stored[0] <= *(OMX_U32 *) param)
+        memcpy (param, stored, stored[0]);
+    g_mutex_unlock (private->mutex);
+}
+
 static OMX_ERRORTYPE
 comp_GetParameter (OMX_HANDLETYPE handle,
                    OMX_INDEXTYPE index,
@@ -102,11 +1183,22 @@ comp_GetParameter (OMX_HANDLETYPE handle,
         case OMX_IndexParamPortDefinition:
             {
                 OMX_PARAM_PORTDEFINITIONTYPE *port_def;
+                CompPrivatePort *port;
+
                 port_def = param;
-                memcpy (port_def, &private->ports[port_def->nPortIndex].port_def, port_def->nSize);
+                port = get_port (private, port_def->nPortIndex);
+                if (!port)
+                    return OMX_ErrorBadPortIndex;
+
+                g_mutex_lock (private->mutex);
+                port->port_def.bPopulated = port->port_def.bEnabled &&
+                    port->num_buffers >= port->port_def.nBufferCountActual;
+                memcpy (port_def, &port->port_def, port_def->nSize);
+                g_mutex_unlock (private->mutex);
                 break;
             }
         default:
+            load_setting (private, index, param);
             break;
     }
 
@@ -131,17 +1223,77 @@ comp_SetParameter (OMX_HANDLETYPE handle,
         case OMX_IndexParamPortDefinition:
             {
                 OMX_PARAM_PORTDEFINITIONTYPE *port_def;
+                CompPrivatePort *port;
+
                 port_def = param;
-                memcpy (&private->ports[port_def->nPortIndex].port_def, port_def, port_def->nSize);
+                port = get_port (private, port_def->nPortIndex);
+                if (!port)
+                    return OMX_ErrorBadPortIndex;
+
+                g_mutex_lock (private->mutex);
+                memcpy (&port->port_def, port_def, port_def->nSize);
+                port->port_def.nBufferCountActual = MAX (port->port_def.nBufferCountActual,
+                                                         port->port_def.nBufferCountMin);
+                g_mutex_unlock (private->mutex);
                 break;
             }
         default:
+            store_setting (private, index, param);
             break;
     }
 
     return OMX_ErrorNone;
 }
 
+static OMX_ERRORTYPE
+comp_GetConfig (OMX_HANDLETYPE handle,
+                OMX_INDEXTYPE index,
+                OMX_PTR config)
+{
+    OMX_COMPONENTTYPE *comp;
+
+    comp = handle;
+    load_setting (comp->pComponentPrivate, index, config);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+comp_SetConfig (OMX_HANDLETYPE handle,
+                OMX_INDEXTYPE index,
+                OMX_PTR config)
+{
+    OMX_COMPONENTTYPE *comp;
+
+    comp = handle;
+    store_setting (comp->pComponentPrivate, index, config);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+comp_GetExtensionIndex (OMX_HANDLETYPE handle,
+                        OMX_STRING name,
+                        OMX_INDEXTYPE *index)
+{
+    gpointer value;
+
+    /* every vendor extension exists, each name gets its own index */
+    g_static_mutex_lock (&config_mutex);
+    value = g_hash_table_lookup (extensions, name);
+    if (!value)
+    {
+        value = GUINT_TO_POINTER (OMX_IndexVendorStartUnused +
+                                  g_hash_table_size (extensions) + 1);
+        g_hash_table_insert (extensions, g_strdup (name), value);
+    }
+    g_static_mutex_unlock (&config_mutex);
+
+    *index = (OMX_INDEXTYPE) GPOINTER_TO_UINT (value);
+
+    return OMX_ErrorNone;
+}
+
 static OMX_ERRORTYPE
 comp_SendCommand (OMX_HANDLETYPE handle,
                   OMX_COMMANDTYPE command,
@@ -150,176 +1302,211 @@ comp_SendCommand (OMX_HANDLETYPE handle,
 {
     OMX_COMPONENTTYPE *comp;
     CompPrivate *private;
+    SimCommand *cmd;
 
     /* printf ("SendCommand\n"); */
 
     comp = handle;
     private = comp->pComponentPrivate;
 
-    switch (command)
+    if ((command == OMX_CommandFlush ||
+         command == OMX_CommandPortDisable ||
+         command == OMX_CommandPortEnable) &&
+        param_1 != OMX_ALL && !get_port (private, param_1))
     {
-        case OMX_CommandStateSet:
-            {
-                if (private->state == OMX_StateLoaded && param_1 == OMX_StateIdle)
-                {
-                    g_thread_create (foo_thread, comp, TRUE, NULL);
-                }
-                private->state = param_1;
-                private->callbacks->EventHandler (handle,
-                                                  private->app_data, OMX_EventCmdComplete,
-                                                  OMX_CommandStateSet, private->state, data);
-            }
-            break;
-        case  OMX_CommandFlush:
-            {
-                g_mutex_lock (private->flush_mutex);
-                {
-                    OMX_BUFFERHEADERTYPE *buffer;
-
-                    while (buffer = async_queue_pop_full (private->ports[0].queue, FALSE, TRUE))
-                    {
-                        private->callbacks->EmptyBufferDone (comp,
-                                                             private->app_data, buffer);
-                    }
+        return OMX_ErrorBadPortIndex;
+    }
 
-                    while (buffer = async_queue_pop_full (private->ports[1].queue, FALSE, TRUE))
-                    {
-                        private->callbacks->FillBufferDone (comp,
-                                                            private->app_data, buffer);
-                    }
-                }
-                g_mutex_unlock (private->flush_mutex);
+    cmd = g_new0 (SimCommand, 1);
+    cmd->command = command;
+    cmd->param = param_1;
+    cmd->data = data;
 
-                private->callbacks->EventHandler (handle,
-                                                  private->app_data, OMX_EventCmdComplete,
-                                                  OMX_CommandFlush, param_1, data);
-            }
-            break;
-        default:
-            /* printf ("command: %d\n", command); */
-            break;
-    }
+    async_queue_push (private->commands, cmd);
 
     return OMX_ErrorNone;
 }
 
 static OMX_ERRORTYPE
-comp_UseBuffer (OMX_HANDLETYPE handle,
-                OMX_BUFFERHEADERTYPE **buffer_header,
-                OMX_U32 index,
-                OMX_PTR data,
-                OMX_U32 size,
-                OMX_U8 *buffer)
+new_buffer (OMX_HANDLETYPE handle,
+            OMX_BUFFERHEADERTYPE **buffer_header,
+            OMX_U32 index,
+            OMX_PTR data,
+            OMX_U32 size,
+            OMX_U8 *buffer)
 {
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    CompPrivatePort *port;
+    SimBuffer *sim_buffer;
     OMX_BUFFERHEADERTYPE *new;
 
-    new = calloc (1, sizeof (OMX_BUFFERHEADERTYPE));
+    comp = handle;
+    private = comp->pComponentPrivate;
+
+    port = get_port (private, index);
+    if (!port)
+        return OMX_ErrorBadPortIndex;
+
+    sim_buffer = calloc (1, sizeof (SimBuffer));
+    new = &sim_buffer->header;
     new->nSize = sizeof (OMX_BUFFERHEADERTYPE);
     new->nVersion.nVersion = 1;
-    new->pBuffer = buffer;
+    new->pAppPrivate = data;
     new->nAllocLen = size;
 
-    switch (index)
+    if (buffer)
     {
-        case 0: new->nInputPortIndex = 0; break;
-        case 1: new->nOutputPortIndex = 1; break;
-        default: break;
+        new->pBuffer = buffer;
     }
+    else
+    {
+        new->pBuffer = calloc (1, size);
+        sim_buffer->allocated = TRUE;
+    }
+
+    if (port->port_def.eDir == OMX_DirInput)
+        new->nInputPortIndex = index;
+    else
+        new->nOutputPortIndex = index;
+
+    g_mutex_lock (private->mutex);
+    if (port->num_buffers == 0 || size < port->alloc_size)
+        port->alloc_size = size;
+    port->num_buffers++;
+    g_cond_broadcast (private->condition);
+    g_mutex_unlock (private->mutex);
 
     *buffer_header = new;
 
     return OMX_ErrorNone;
 }
 
+static OMX_ERRORTYPE
+comp_UseBuffer (OMX_HANDLETYPE handle,
+                OMX_BUFFERHEADERTYPE **buffer_header,
+                OMX_U32 index,
+                OMX_PTR data,
+                OMX_U32 size,
+                OMX_U8 *buffer)
+{
+    return new_buffer (handle, buffer_header, index, data, size, buffer);
+}
+
+static OMX_ERRORTYPE
+comp_AllocateBuffer (OMX_HANDLETYPE handle,
+                     OMX_BUFFERHEADERTYPE **buffer_header,
+                     OMX_U32 index,
+                     OMX_PTR data,
+                     OMX_U32 size)
+{
+    return new_buffer (handle, buffer_header, index, data, size, NULL);
+}
+
 static OMX_ERRORTYPE
 comp_FreeBuffer (OMX_HANDLETYPE handle,
                  OMX_U32 index,
                  OMX_BUFFERHEADERTYPE *buffer_header)
 {
-    free (buffer_header);
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    CompPrivatePort *port;
+    SimBuffer *sim_buffer;
+
+    comp = handle;
+    private = comp->pComponentPrivate;
+
+    port = get_port (private, index);
+    if (!port)
+        return OMX_ErrorBadPortIndex;
+
+    g_mutex_lock (private->mutex);
+    if (port->num_buffers > 0)
+        port->num_buffers--;
+    g_cond_broadcast (private->condition);
+    g_mutex_unlock (private->mutex);
+
+    sim_buffer = (SimBuffer *) buffer_header;
+    if (sim_buffer->allocated)
+        free (buffer_header->pBuffer);
+    free (sim_buffer);
 
     return OMX_ErrorNone;
 }
 
-static gpointer
-foo_thread (gpointer cb_data)
+static OMX_ERRORTYPE
+queue_buffer (OMX_HANDLETYPE handle,
+              OMX_U32 index,
+              OMX_BUFFERHEADERTYPE *buffer_header)
 {
     OMX_COMPONENTTYPE *comp;
     CompPrivate *private;
+    CompPrivatePort *port;
 
-    comp = cb_data;
+    comp = handle;
     private = comp->pComponentPrivate;
 
-    while (!private->done)
-    {
-        OMX_BUFFERHEADERTYPE *in_buffer;
-        OMX_BUFFERHEADERTYPE *out_buffer;
-
-        in_buffer = async_queue_pop (private->ports[0].queue);
-        if (!in_buffer) continue;
-
-        out_buffer = async_queue_pop (private->ports[1].queue);
-        if (!out_buffer) continue;
+    port = get_port (private, index);
+    if (!port)
+        return OMX_ErrorBadPortIndex;
 
-        /* process buffers */
-        {
-            unsigned long size;
-            size = MIN (in_buffer->nFilledLen, out_buffer->nAllocLen);
-            memcpy (out_buffer->pBuffer, in_buffer->pBuffer, size);
-            out_buffer->nFilledLen = size;
-            in_buffer->nFilledLen -= size;
-            out_buffer->nTimeStamp = in_buffer->nTimeStamp;
-            out_buffer->nFlags = in_buffer->nFlags;
-        }
+    g_mutex_lock (private->mutex);
 
-        g_mutex_lock (private->flush_mutex);
+    if (private->state != OMX_StateExecuting && private->state != OMX_StatePause &&
+        private->state != OMX_StateIdle)
+    {
+        g_mutex_unlock (private->mutex);
+        return OMX_ErrorIncorrectStateOperation;
+    }
 
-        private->callbacks->FillBufferDone (comp,
-                                            private->app_data, out_buffer);
-        if (in_buffer->nFilledLen == 0)
-        {
-            private->callbacks->EmptyBufferDone (comp,
-                                                 private->app_data, in_buffer);
-        }
+    g_queue_push_head (port->queue, buffer_header);
+    g_cond_broadcast (private->condition);
 
-        g_mutex_unlock (private->flush_mutex);
-    }
+    g_mutex_unlock (private->mutex);
 
-    return NULL;
+    return OMX_ErrorNone;
 }
 
 static OMX_ERRORTYPE
 comp_EmptyThisBuffer (OMX_HANDLETYPE handle,
                       OMX_BUFFERHEADERTYPE *buffer_header)
 {
-    OMX_COMPONENTTYPE *comp;
-    CompPrivate *private;
-
     /* printf ("EmptyThisBuffer\n"); */
 
-    comp = handle;
-    private = comp->pComponentPrivate;
-
-    async_queue_push (private->ports[0].queue, buffer_header);
-
-    return OMX_ErrorNone;
+    g_atomic_int_inc (&buffer_calls);
+    return queue_buffer (handle, buffer_header->nInputPortIndex, buffer_header);
 }
 
 static OMX_ERRORTYPE
 comp_FillThisBuffer (OMX_HANDLETYPE handle,
                      OMX_BUFFERHEADERTYPE *buffer_header)
 {
-    OMX_COMPONENTTYPE *comp;
-    CompPrivate *private;
-
     /* printf ("FillThisBuffer\n"); */
 
-    comp = handle;
-    private = comp->pComponentPrivate;
-
-    async_queue_push (private->ports[1].queue, buffer_header);
+    g_atomic_int_inc (&buffer_calls);
+    return queue_buffer (handle, buffer_header->nOutputPortIndex, buffer_header);
+}
 
-    return OMX_ErrorNone;
+static void
+port_init (CompPrivatePort *port,
+           SimProfile *profile,
+           OMX_U32 index,
+           OMX_DIRTYPE dir)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE *port_def;
+
+    port->queue = g_queue_new ();
+
+    port_def = &port->port_def;
+    port_def->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
+    port_def->nVersion.nVersion = 1;
+    port_def->nPortIndex = index;
+    port_def->eDir = dir;
+    port_def->nBufferCountActual = profile->buffer_count;
+    port_def->nBufferCountMin = profile->buffer_count;
+    port_def->nBufferSize = profile->buffer_size;
+    port_def->bEnabled = profile->ports_enabled;
+    port_def->eDomain = profile->domain;
 }
 
 OMX_ERRORTYPE
@@ -329,64 +1516,66 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
                OMX_CALLBACKTYPE *callbacks)
 {
     OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    guint i;
+
+    sim_init ();
+
+    private = calloc (1, sizeof (CompPrivate));
+    profile_init (&private->profile, component_name);
+
+    if (private->profile.fail_get_handle)
+    {
+        free (private);
+        return OMX_ErrorInsufficientResources;
+    }
 
     comp = calloc (1, sizeof (OMX_COMPONENTTYPE));
     comp->nSize = sizeof (OMX_COMPONENTTYPE);
     comp->nVersion.nVersion = 1;
 
+    comp->GetComponentVersion = comp_GetComponentVersion;
     comp->GetState = comp_GetState;
     comp->GetParameter = comp_GetParameter;
     comp->SetParameter = comp_SetParameter;
+    comp->GetConfig = comp_GetConfig;
+    comp->SetConfig = comp_SetConfig;
+    comp->GetExtensionIndex = comp_GetExtensionIndex;
     comp->SendCommand = comp_SendCommand;
     comp->UseBuffer = comp_UseBuffer;
+    comp->AllocateBuffer = comp_AllocateBuffer;
     comp->FreeBuffer = comp_FreeBuffer;
     comp->EmptyThisBuffer = comp_EmptyThisBuffer;
     comp->FillThisBuffer = comp_FillThisBuffer;
 
-    {
-        CompPrivate *private;
-
-        private = calloc (1, sizeof (CompPrivate));
-        private->state = OMX_StateLoaded;
-        private->callbacks = callbacks;
-        private->app_data = data;
-        private->ports = calloc (2, sizeof (CompPrivatePort));
-        private->flush_mutex = g_mutex_new ();
+    private->state = OMX_StateLoaded;
+    private->callbacks = callbacks;
+    private->app_data = data;
+    private->settings = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    private->timer = g_timer_new ();
+    private->mutex = g_mutex_new ();
+    private->condition = g_cond_new ();
+    private->commands = async_queue_new ();
 
-        private->ports[0].queue = async_queue_new ();
-        private->ports[1].queue = async_queue_new ();
+    private->num_ports = private->profile.num_inputs + private->profile.num_outputs;
+    private->ports = calloc (MAX (private->num_ports, 1), sizeof (CompPrivatePort));
 
-        {
-            OMX_PARAM_PORTDEFINITIONTYPE *port_def;
-
-            port_def = &private->ports[0].port_def;
-            port_def->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
-            port_def->nVersion.nVersion = 1;
-            port_def->nPortIndex = 0;
-            port_def->eDir = OMX_DirInput;
-            port_def->nBufferCountActual = 1;
-            port_def->nBufferCountMin = 1;
-            port_def->nBufferSize = 0x1000;
-            port_def->eDomain = OMX_PortDomainAudio;
+    for (i = 0; i < private->profile.num_inputs; i++)
+    {
+        port_init (&private->ports[i], &private->profile,
+                   private->profile.input_start + i, OMX_DirInput);
+    }
 
-        }
+    for (i = 0; i < private->profile.num_outputs; i++)
+    {
+        port_init (&private->ports[private->profile.num_inputs + i], &private->profile,
+                   private->profile.output_start + i, OMX_DirOutput);
+    }
 
-        {
-            OMX_PARAM_PORTDEFINITIONTYPE *port_def;
-
-            port_def = &private->ports[1].port_def;
-            port_def->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
-            port_def->nVersion.nVersion = 1;
-            port_def->nPortIndex = 1;
-            port_def->eDir = OMX_DirOutput;
-            port_def->nBufferCountActual = 1;
-            port_def->nBufferCountMin = 1;
-            port_def->nBufferSize = 0x1000;
-            port_def->eDomain = OMX_PortDomainAudio;
-        }
+    comp->pComponentPrivate = private;
 
-        comp->pComponentPrivate = private;
-    }
+    private->command_thread = g_thread_create (command_thread, comp, TRUE, NULL);
+    private->process_thread = g_thread_create (process_thread, comp, TRUE, NULL);
 
     *handle = comp;
 
@@ -396,6 +1585,34 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
 OMX_ERRORTYPE
 OMX_FreeHandle (OMX_HANDLETYPE handle)
 {
-    /** @todo Free private structure? */
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+    guint i;
+
+    comp = handle;
+    private = comp->pComponentPrivate;
+
+    g_mutex_lock (private->mutex);
+    private->done = TRUE;
+    g_cond_broadcast (private->condition);
+    g_mutex_unlock (private->mutex);
+
+    async_queue_disable (private->commands);
+
+    g_thread_join (private->command_thread);
+    g_thread_join (private->process_thread);
+
+    for (i = 0; i < private->num_ports; i++)
+        g_queue_free (private->ports[i].queue);
+
+    async_queue_free (private->commands);
+    g_cond_free (private->condition);
+    g_mutex_free (private->mutex);
+    g_timer_destroy (private->timer);
+    g_hash_table_destroy (private->settings);
+    free (private->ports);
+    free (private);
+    free (comp);
+
     return OMX_ErrorNone;
 }
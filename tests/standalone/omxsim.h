@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2011 RidgeRun
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef OMXSIM_H
+#define OMXSIM_H
+
+#include <glib.h>
+
+/* The simulator reads one key-file group per component name, falling back
+ * to the [default] group and then to the built-in single in/out profile.
+ * OMX_Init() loads the file named by OMXSIM_CONFIG_ENV when no
+ * configuration has been loaded yet; see dm81xx.conf for the keys.
+ */
+#define OMXSIM_CONFIG_ENV "OMXSIM_CONFIG"
+
+gboolean omxsim_load_config (const gchar *data, GError **error);
+gboolean omxsim_load_config_file (const gchar *filename, GError **error);
+void omxsim_clear_config (void);
+
+/* EmptyThisBuffer and FillThisBuffer calls made to all components so far. */
+guint omxsim_get_buffer_calls (void);
+
+#endif /* OMXSIM_H */